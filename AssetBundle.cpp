@@ -0,0 +1,124 @@
+#include "AssetBundle.h"
+#include "Log.h"
+#include <cstring>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(PQ_HAVE_LZ4)
+#include <lz4.h>
+#endif
+
+AssetBundle::~AssetBundle() { close(); }
+
+bool AssetBundle::open(const std::string& path) {
+    close();
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) { CloseHandle(file); return false; }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) { CloseHandle(file); return false; }
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) { CloseHandle(mapping); CloseHandle(file); return false; }
+    fileHandle = file;
+    mappingHandle = mapping;
+    data = static_cast<const uint8_t*>(view);
+    size = static_cast<size_t>(file_size.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) { ::close(fd); return false; }
+    void* view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (view == MAP_FAILED) return false;
+    data = static_cast<const uint8_t*>(view);
+    size = static_cast<size_t>(st.st_size);
+#endif
+
+    // ヘッダーと索引の検証
+    header = reinterpret_cast<const bundle::BundleHeader*>(data);
+    if (size < sizeof(bundle::BundleHeader) ||
+        std::memcmp(header->magic, bundle::MAGIC, sizeof(bundle::MAGIC)) != 0 ||
+        header->version != bundle::VERSION ||
+        sizeof(bundle::BundleHeader) + static_cast<uint64_t>(header->entry_count) * sizeof(bundle::BundleEntry) > size) {
+        PQ_LOG_ERROR(LogCategory::GAME, "Invalid asset bundle: " << path);
+        close();
+        return false;
+    }
+    entries = reinterpret_cast<const bundle::BundleEntry*>(data + sizeof(bundle::BundleHeader));
+    for (uint32_t i = 0; i < header->entry_count; ++i) {
+        const auto& e = entries[i];
+        // 非圧縮の画像は find() がマップ済みメモリを raw_size バイトとして渡すので、ファイル上のサイズも一致していること
+        if (e.offset > size || e.stored_size > size - e.offset ||
+            e.raw_size != static_cast<uint64_t>(e.width) * e.height * 4 ||
+            (e.compression == bundle::COMPRESSION_NONE && e.stored_size != e.raw_size)) {
+            PQ_LOG_ERROR(LogCategory::GAME, "Corrupted asset bundle entry in: " << path);
+            close();
+            return false;
+        }
+    }
+
+    PQ_LOG_INFO(LogCategory::GAME, "Asset bundle mapped: " << path << " (" << header->entry_count << " images, " << size / 1024 << " KB)");
+    return true;
+}
+
+void AssetBundle::close() {
+    if (!data) return;
+#if defined(_WIN32)
+    UnmapViewOfFile(data);
+    CloseHandle(static_cast<HANDLE>(mappingHandle));
+    CloseHandle(static_cast<HANDLE>(fileHandle));
+    mappingHandle = nullptr;
+    fileHandle = nullptr;
+#else
+    munmap(const_cast<uint8_t*>(data), size);
+#endif
+    data = nullptr;
+    size = 0;
+    header = nullptr;
+    entries = nullptr;
+}
+
+bool AssetBundle::find(const std::string& name, BundleImage& out, std::vector<uint8_t>& scratch) const {
+    if (!entries || name.size() >= bundle::NAME_SIZE) return false;
+
+    for (uint32_t i = 0; i < header->entry_count; ++i) {
+        const auto& e = entries[i];
+        if (std::strncmp(e.name, name.c_str(), bundle::NAME_SIZE) != 0) continue;
+
+        out.width = static_cast<int>(e.width);
+        out.height = static_cast<int>(e.height);
+        out.pitch = static_cast<int>(e.width) * 4;
+
+        if (e.compression == bundle::COMPRESSION_NONE) {
+            out.pixels = data + e.offset;
+            return true;
+        }
+#if defined(PQ_HAVE_LZ4)
+        if (e.compression == bundle::COMPRESSION_LZ4) {
+            scratch.resize(e.raw_size);
+            int n = LZ4_decompress_safe(reinterpret_cast<const char*>(data + e.offset), reinterpret_cast<char*>(scratch.data()),
+                                        static_cast<int>(e.stored_size), static_cast<int>(e.raw_size));
+            if (n != static_cast<int>(e.raw_size)) {
+                PQ_LOG_ERROR(LogCategory::GAME, "Failed to decompress bundle image: " << name);
+                return false;
+            }
+            out.pixels = scratch.data();
+            return true;
+        }
+#endif
+        PQ_LOG_ERROR(LogCategory::GAME, "Unsupported compression for bundle image: " << name);
+        return false;
+    }
+    return false;
+}
@@ -0,0 +1,85 @@
+// AssetBundle.h - Prompt Quest: デコード済み画像バンドル（メモリマップ読み込み）
+
+#ifndef ASSET_BUNDLE_H
+#define ASSET_BUNDLE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// バンドルファイルの構造（リトルエンディアン）
+//   BundleHeader
+//   BundleEntry × entry_count
+//   画像データ（各16バイト境界、乗算済みアルファのRGBA 8bit × 4、必要ならLZ4圧縮）
+namespace bundle {
+
+const char MAGIC[4] = {'P', 'Q', 'A', 'B'};
+const uint32_t VERSION = 1;
+const size_t NAME_SIZE = 96;
+const size_t DATA_ALIGN = 16;
+
+enum Compression : uint32_t { COMPRESSION_NONE = 0, COMPRESSION_LZ4 = 1 };
+
+struct BundleHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t reserved;
+};
+
+struct BundleEntry {
+    char name[NAME_SIZE];   // 元画像のパス（TextureCacheのキーと同じ）
+    uint32_t width;
+    uint32_t height;
+    uint32_t compression;
+    uint32_t reserved;
+    uint64_t offset;        // ファイル先頭からのオフセット
+    uint64_t stored_size;   // ファイル上のサイズ
+    uint64_t raw_size;      // 展開後のサイズ（width * height * 4）
+};
+
+static_assert(sizeof(BundleHeader) == 16, "BundleHeader layout");
+static_assert(sizeof(BundleEntry) == 136, "BundleEntry layout");
+
+} // namespace bundle
+
+// バンドル内の1枚。pixels は乗算済みアルファの RGBA（SDL_PIXELFORMAT_RGBA32）
+struct BundleImage {
+    int width = 0;
+    int height = 0;
+    int pitch = 0;
+    const uint8_t* pixels = nullptr;
+};
+
+class AssetBundle {
+public:
+    AssetBundle() = default;
+    ~AssetBundle();
+
+    AssetBundle(const AssetBundle&) = delete;
+    AssetBundle& operator=(const AssetBundle&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return data != nullptr; }
+
+    // 画像を取得する。非圧縮ならマップ済みメモリを直接指す。
+    // LZ4圧縮の場合は scratch に展開する（次の呼び出しまで有効）。
+    bool find(const std::string& name, BundleImage& out, std::vector<uint8_t>& scratch) const;
+
+    size_t entryCount() const { return entries ? header->entry_count : 0; }
+
+private:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    const bundle::BundleHeader* header = nullptr;
+    const bundle::BundleEntry* entries = nullptr;
+
+#if defined(_WIN32)
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
+
+#endif
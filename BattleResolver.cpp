@@ -0,0 +1,103 @@
+#include "BattleResolver.h"
+#include <algorithm>
+
+namespace {
+// 行動を魔法の攻撃として扱う語
+const std::vector<std::string> MAGIC_WORDS = {"魔法", "呪文", "詠唱", "唱え", "術"};
+}
+
+void WeaknessMatcher::build(const std::vector<std::string>& words) {
+    keywords.clear();
+    for (auto& bucket : byFirstByte) bucket.clear();
+
+    for (const auto& word : words) {
+        if (!word.empty()) keywords.push_back(word);
+    }
+    for (size_t i = 0; i < keywords.size(); ++i) {
+        byFirstByte[static_cast<unsigned char>(keywords[i][0])].push_back(static_cast<uint16_t>(i));
+    }
+    // 「火」と「火魔法」のように前方が重なる場合は長い方を優先する
+    for (auto& bucket : byFirstByte) {
+        std::sort(bucket.begin(), bucket.end(), [this](uint16_t a, uint16_t b) {
+            return keywords[a].size() > keywords[b].size();
+        });
+    }
+}
+
+std::string_view WeaknessMatcher::match(std::string_view text) const {
+    std::string_view best;
+    for (size_t pos = 0; pos < text.size(); ++pos) {
+        const auto& bucket = byFirstByte[static_cast<unsigned char>(text[pos])];
+        for (uint16_t index : bucket) {
+            const std::string& word = keywords[index];
+            if (word.size() <= best.size()) break;  // 以降はさらに短い
+            if (text.compare(pos, word.size(), word) == 0) {
+                best = word;
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+BattleResolver::BattleResolver() {
+    magicWords.build(MAGIC_WORDS);
+}
+
+void BattleResolver::begin(const Monster& enemy, uint64_t seed) {
+    matcher.build(enemy.weaknesses);
+    // splitmix64で初期状態を拡散（xorshiftは状態0を避ける必要がある）
+    uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    rngState = (z ^ (z >> 31)) | 1;
+}
+
+uint64_t BattleResolver::nextRandom() {
+    // xorshift64*: 標準ライブラリの分布と違い、処理系によらず同じ列になる
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return rngState * 0x2545F4914F6CDD1Dull;
+}
+
+int BattleResolver::randomPercent() {
+    return static_cast<int>((nextRandom() >> 32) % 100);
+}
+
+BattleOutcome BattleResolver::resolvePlayerAttack(const Stats& attacker, const Stats& defender, std::string_view action) {
+    BattleOutcome outcome;
+    std::string_view keyword = matcher.match(action);
+    outcome.weakness = !keyword.empty();
+    outcome.matched_keyword = std::string(keyword);
+    outcome.magic = !magicWords.match(action).empty();
+
+    // 命中率: 通常85%、弱点を狙った攻撃は90%
+    int hit_chance = outcome.weakness ? 90 : 85;
+    outcome.hit = randomPercent() < hit_chance;
+    if (!outcome.hit) {
+        outcome.effect_text = "攻撃は外れた...";
+        return outcome;
+    }
+
+    // 基本ダメージは baseDamage()、弱点なら1.5〜2倍、さらに±10%の揺らぎ
+    int damage = outcome.magic ? baseDamage(attacker.mat, defender.mdf) : baseDamage(attacker.atk, defender.def);
+    if (outcome.weakness) damage = damage * (150 + randomPercent() % 51) / 100;
+    damage = damage * (90 + randomPercent() % 21) / 100;
+    outcome.damage = std::max(1, damage);
+
+    if (outcome.weakness) {
+        outcome.effect_text = "「" + outcome.matched_keyword + "」が弱点を突いた！";
+    } else {
+        outcome.effect_text = "攻撃が命中した！";
+    }
+    return outcome;
+}
+
+int BattleResolver::resolveEnemyAttack(const Stats& attacker, const Stats& defender) {
+    return baseDamage(attacker.atk, defender.def);
+}
+
+int BattleResolver::baseDamage(int power, int defense) {
+    return std::max(1, power - defense / 2);
+}
@@ -0,0 +1,61 @@
+// BattleResolver.h - Prompt Quest: ステータスと弱点から戦闘結果を決定するルールベースの裁定
+
+#ifndef BATTLE_RESOLVER_H
+#define BATTLE_RESOLVER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <cstdint>
+#include "ContentDatabase.h"
+
+// プレイヤーの行動テキストから弱点キーワードを探す。
+// キーワードを先頭バイトで振り分けておき、行動テキストを1回走査するだけで最長一致を見つける。
+class WeaknessMatcher {
+public:
+    void build(const std::vector<std::string>& keywords);
+    // 一致したキーワードを返す（なければ空）
+    std::string_view match(std::string_view text) const;
+
+private:
+    std::vector<std::string> keywords;
+    std::array<std::vector<uint16_t>, 256> byFirstByte;  // 長い順に並べたキーワード番号
+};
+
+struct BattleOutcome {
+    bool hit = false;
+    int damage = 0;
+    bool weakness = false;
+    bool magic = false;           // 魔法の攻撃（魔力と魔法防御で計算した）
+    std::string matched_keyword;  // 突いた弱点（命中判定とは独立）
+    std::string effect_text;      // ナレーションが届くまでの仮テキスト
+};
+
+class BattleResolver {
+public:
+    // 同じシードと同じ入力列なら常に同じ結果になる
+    static const uint64_t DEFAULT_SEED = 1234;
+
+    BattleResolver();
+
+    // 戦闘開始時に呼ぶ。敵の弱点から照合表を作り、乱数を初期化する。
+    void begin(const Monster& enemy, uint64_t seed = DEFAULT_SEED);
+
+    // 行動に魔法の語（魔法・呪文など）があれば魔力−魔法防御、なければ攻撃力−防御力で計算する
+    BattleOutcome resolvePlayerAttack(const Stats& attacker, const Stats& defender, std::string_view action);
+    int resolveEnemyAttack(const Stats& attacker, const Stats& defender);
+
+    // 乱数と弱点を掛ける前のダメージ。防御は半分だけ効かせるので、同じくらいの値どうしでも削り合える（最低1）
+    static int baseDamage(int power, int defense);
+
+private:
+    uint64_t nextRandom();
+    int randomPercent();  // 0〜99
+
+    WeaknessMatcher matcher;
+    WeaknessMatcher magicWords;
+    uint64_t rngState = DEFAULT_SEED;
+};
+
+#endif
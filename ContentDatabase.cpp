@@ -0,0 +1,242 @@
+#include "ContentDatabase.h"
+#include "Log.h"
+#include <fstream>
+#include <cstdlib>
+
+namespace {
+
+uint64_t fnv1a(std::string_view s) {
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+std::string_view trim(std::string_view s) {
+    const char* ws = " \t\r\n";
+    size_t first = s.find_first_not_of(ws);
+    if (first == std::string_view::npos) return {};
+    size_t last = s.find_last_not_of(ws);
+    return s.substr(first, last - first + 1);
+}
+
+std::vector<std::string> splitList(std::string_view value) {
+    std::vector<std::string> out;
+    size_t start = 0;
+    while (start <= value.size()) {
+        size_t comma = value.find(',', start);
+        if (comma == std::string_view::npos) comma = value.size();
+        std::string_view part = trim(value.substr(start, comma - start));
+        if (!part.empty()) out.emplace_back(part);
+        start = comma + 1;
+    }
+    return out;
+}
+
+bool parseStats(std::string_view value, Stats& stats) {
+    std::vector<std::string> parts = splitList(value);
+    if (parts.size() != 7) return false;
+    int* fields[] = {&stats.hp, &stats.mp, &stats.atk, &stats.def, &stats.mat, &stats.mdf, &stats.spd};
+    for (size_t i = 0; i < parts.size(); ++i) {
+        char* end = nullptr;
+        long v = std::strtol(parts[i].c_str(), &end, 10);
+        if (*end != '\0') return false;
+        *fields[i] = static_cast<int>(v);
+    }
+    return true;
+}
+
+bool parseItemType(std::string_view value, ItemType& type) {
+    if (value == "WEAPON") type = ItemType::WEAPON;
+    else if (value == "ARMOR") type = ItemType::ARMOR;
+    else if (value == "USABLE") type = ItemType::USABLE;
+    else if (value == "KEY") type = ItemType::KEY;
+    else return false;
+    return true;
+}
+
+} // namespace
+
+void NameIndex::build(const std::vector<std::string_view>& names) {
+    keys = names;
+    size_t capacity = 8;
+    while (capacity < names.size() * 2) capacity <<= 1;  // 負荷率50%以下
+    slots.assign(capacity, Slot());
+    mask = capacity - 1;
+
+    for (ContentId id = 0; id < names.size(); ++id) {
+        uint64_t h = fnv1a(names[id]);
+        for (uint64_t i = h & mask;; i = (i + 1) & mask) {
+            if (slots[i].id == INVALID_CONTENT_ID) {
+                slots[i] = {h, id};
+                break;
+            }
+        }
+    }
+}
+
+ContentId NameIndex::find(std::string_view name) const {
+    if (slots.empty()) return INVALID_CONTENT_ID;
+    uint64_t h = fnv1a(name);
+    for (uint64_t i = h & mask;; i = (i + 1) & mask) {
+        const Slot& slot = slots[i];
+        if (slot.id == INVALID_CONTENT_ID) return INVALID_CONTENT_ID;
+        if (slot.hash == h && keys[slot.id] == name) return slot.id;
+    }
+}
+
+std::string_view ContentDatabase::normalizeName(std::string_view name) {
+    // 前後の空白（全角スペース含む）と括弧・引用符を取り除く
+    static const std::string_view strip[] = {" ", "\t", "\r", "\n", "\"", "　", "「", "」", "『", "』"};
+    bool changed = true;
+    while (changed && !name.empty()) {
+        changed = false;
+        for (std::string_view s : strip) {
+            if (name.size() >= s.size() && name.substr(0, s.size()) == s) { name.remove_prefix(s.size()); changed = true; }
+            if (name.size() >= s.size() && name.substr(name.size() - s.size()) == s) { name.remove_suffix(s.size()); changed = true; }
+        }
+    }
+    return name;
+}
+
+bool ContentDatabase::loadFromFile(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        PQ_LOG_ERROR(LogCategory::GAME, "Failed to open content file: " << path);
+        return false;
+    }
+
+    itemList.clear();
+    monsterList.clear();
+    areaList.clear();
+    loreList.clear();
+
+    enum class Section { NONE, ITEM, MONSTER, AREA, LORE } section = Section::NONE;
+    std::vector<std::vector<std::string>> areaMonsterNames;  // 全モンスター読み込み後に解決する
+    std::vector<std::vector<std::string>> areaItemNames;     // 全アイテム読み込み後に解決する
+
+    auto fail = [&](int line_no, const std::string& msg) {
+        PQ_LOG_ERROR(LogCategory::GAME, path << ":" << line_no << ": " << msg);
+        return false;
+    };
+
+    std::string raw;
+    int line_no = 0;
+    while (std::getline(in, raw)) {
+        line_no++;
+        std::string_view line = trim(raw);
+        if (line_no == 1 && line.substr(0, 3) == "\xEF\xBB\xBF") line = trim(line.substr(3));
+        if (line.empty() || line[0] == '#') continue;
+
+        if (line.front() == '[' && line.back() == ']') {
+            std::string_view name = line.substr(1, line.size() - 2);
+            if (name == "item") { section = Section::ITEM; itemList.emplace_back(); }
+            else if (name == "monster") { section = Section::MONSTER; monsterList.emplace_back(); }
+            else if (name == "area") { section = Section::AREA; areaList.emplace_back(); areaMonsterNames.emplace_back(); areaItemNames.emplace_back(); }
+            else if (name == "lore") { section = Section::LORE; loreList.emplace_back(); }
+            else return fail(line_no, "unknown section [" + std::string(name) + "]");
+            continue;
+        }
+
+        size_t eq = line.find('=');
+        if (eq == std::string_view::npos) return fail(line_no, "expected 'key = value'");
+        std::string_view key = trim(line.substr(0, eq));
+        std::string_view value = trim(line.substr(eq + 1));
+
+        switch (section) {
+            case Section::ITEM: {
+                Item& item = itemList.back();
+                if (key == "name") item.name = std::string(value);
+                else if (key == "type") { if (!parseItemType(value, item.type)) return fail(line_no, "invalid item type"); }
+                else if (key == "stats") { if (!parseStats(value, item.stats)) return fail(line_no, "stats needs 7 integers (hp,mp,atk,def,mat,mdf,spd)"); }
+                else return fail(line_no, "unknown item key '" + std::string(key) + "'");
+                break;
+            }
+            case Section::MONSTER: {
+                Monster& monster = monsterList.back();
+                if (key == "name") monster.name = std::string(value);
+                else if (key == "stats") { if (!parseStats(value, monster.stats)) return fail(line_no, "stats needs 7 integers (hp,mp,atk,def,mat,mdf,spd)"); }
+                else if (key == "weaknesses") monster.weaknesses = splitList(value);
+                else if (key == "description") monster.description = std::string(value);
+                else if (key == "texture") monster.texturePath = std::string(value);
+                else return fail(line_no, "unknown monster key '" + std::string(key) + "'");
+                break;
+            }
+            case Section::AREA: {
+                Area& area = areaList.back();
+                if (key == "name") area.name = std::string(value);
+                else if (key == "background") area.background = std::string(value);
+                else if (key == "monsters") areaMonsterNames.back() = splitList(value);
+                else if (key == "depart_items") areaItemNames.back() = splitList(value);
+                else if (key == "depart_scene") area.departScene = std::string(value);
+                else if (key == "stay_scene") area.stayScene = std::string(value);
+                else return fail(line_no, "unknown area key '" + std::string(key) + "'");
+                break;
+            }
+            case Section::LORE: {
+                LoreEntry& entry = loreList.back();
+                if (key == "name") entry.name = std::string(value);
+                else if (key == "text") entry.text = std::string(value);
+                else return fail(line_no, "unknown lore key '" + std::string(key) + "'");
+                break;
+            }
+            case Section::NONE:
+                return fail(line_no, "entry outside of a section");
+        }
+    }
+
+    auto buildIndex = [&](NameIndex& index, const auto& list, const char* kind) {
+        std::vector<std::string_view> names;
+        names.reserve(list.size());
+        for (const auto& entry : list) {
+            if (entry.name.empty()) {
+                PQ_LOG_ERROR(LogCategory::GAME, path << ": " << kind << " without a name");
+                return false;
+            }
+            names.push_back(entry.name);
+        }
+        index.build(names);
+        // 重複した名前は後から定義したものが引けなくなるので弾く
+        for (ContentId id = 0; id < names.size(); ++id) {
+            if (index.find(names[id]) != id) {
+                PQ_LOG_ERROR(LogCategory::GAME, path << ": duplicate " << kind << " name '" << names[id] << "'");
+                return false;
+            }
+        }
+        return true;
+    };
+    if (!buildIndex(itemIndex, itemList, "item")) return false;
+    if (!buildIndex(monsterIndex, monsterList, "monster")) return false;
+    if (!buildIndex(areaIndex, areaList, "area")) return false;
+    for (const LoreEntry& entry : loreList) {
+        if (entry.text.empty()) {
+            PQ_LOG_ERROR(LogCategory::GAME, path << ": lore '" << entry.name << "' without text");
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < areaList.size(); ++i) {
+        for (const auto& name : areaMonsterNames[i]) {
+            ContentId id = monsterIndex.find(name);
+            if (id == INVALID_CONTENT_ID) {
+                PQ_LOG_ERROR(LogCategory::GAME, path << ": area '" << areaList[i].name << "' refers to unknown monster '" << name << "'");
+                return false;
+            }
+            areaList[i].monsters.push_back(id);
+        }
+        for (const auto& name : areaItemNames[i]) {
+            ContentId id = itemIndex.find(name);
+            if (id == INVALID_CONTENT_ID) {
+                PQ_LOG_ERROR(LogCategory::GAME, path << ": area '" << areaList[i].name << "' refers to unknown item '" << name << "'");
+                return false;
+            }
+            areaList[i].departItems.push_back(id);
+        }
+    }
+
+    PQ_LOG_INFO(LogCategory::GAME, "Content loaded: " << itemList.size() << " items, " << monsterList.size() << " monsters, "
+                << areaList.size() << " areas, " << loreList.size() << " lore entries from " << path);
+    return true;
+}
@@ -0,0 +1,98 @@
+// ContentDatabase.h - Prompt Quest: データファイル駆動のアイテム・モンスター・エリア定義
+
+#ifndef CONTENT_DATABASE_H
+#define CONTENT_DATABASE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+struct Stats {
+    int hp = 0, mp = 0, atk = 0, def = 0, mat = 0, mdf = 0, spd = 0;
+};
+
+enum class ItemType { WEAPON, ARMOR, USABLE, KEY };
+struct Item {
+    std::string name;
+    ItemType type = ItemType::KEY;  // type の無い行は装備も使用もできない品として扱う
+    Stats stats;
+    bool is_equipped = false;
+};
+
+struct Monster {
+    std::string name;
+    Stats stats;
+    std::string texturePath;  // TextureCacheのキー
+    std::vector<std::string> weaknesses;  // 弱点属性リスト（火、氷など）
+    std::string description;
+};
+
+// コンテンツはすべて読み込み順の連番IDで参照する
+using ContentId = uint32_t;
+const ContentId INVALID_CONTENT_ID = 0xFFFFFFFFu;
+
+struct Area {
+    std::string name;
+    std::string background;              // 背景画像（TextureCacheのキー）
+    std::vector<ContentId> monsters;     // 出現するモンスター
+    std::vector<ContentId> departItems;  // このエリアから旅立つときに渡されるアイテム
+    std::string departScene;             // 旅立ちを決めたときの場面の説明（NPCのプロンプト用）
+    std::string stayScene;               // 会話を続けるときの場面の説明
+};
+
+// 世界設定の断片。NPC のプロンプトには発言に関係するものだけが入る（LlmManager::addLore）
+struct LoreEntry {
+    std::string name;
+    std::string text;
+};
+
+// 名前 → ID の開番地法ハッシュ表。ハッシュ値を並べて持ち、一致した時だけ文字列を比較する。
+class NameIndex {
+public:
+    void build(const std::vector<std::string_view>& names);
+    ContentId find(std::string_view name) const;
+
+private:
+    struct Slot {
+        uint64_t hash = 0;
+        ContentId id = INVALID_CONTENT_ID;
+    };
+    std::vector<Slot> slots;
+    std::vector<std::string_view> keys;  // ID順。ContentDatabase内の文字列を指す
+    uint64_t mask = 0;
+};
+
+class ContentDatabase {
+public:
+    // data/content.txt 形式のファイルを読み込む。失敗時はエラーを出力して false。
+    bool loadFromFile(const std::string& path);
+
+    const std::vector<Item>& items() const { return itemList; }
+    const std::vector<Monster>& monsters() const { return monsterList; }
+    const std::vector<Area>& areas() const { return areaList; }
+    const std::vector<LoreEntry>& lore() const { return loreList; }
+
+    const Item& item(ContentId id) const { return itemList[id]; }
+    const Monster& monster(ContentId id) const { return monsterList[id]; }
+    const Area& area(ContentId id) const { return areaList[id]; }
+
+    // LLMが出力した名前の解決用。前後の空白と「」を取り除いてから引く。
+    ContentId findItem(std::string_view name) const { return itemIndex.find(normalizeName(name)); }
+    ContentId findMonster(std::string_view name) const { return monsterIndex.find(normalizeName(name)); }
+    ContentId findArea(std::string_view name) const { return areaIndex.find(normalizeName(name)); }
+
+    static std::string_view normalizeName(std::string_view name);
+
+private:
+    std::vector<Item> itemList;
+    std::vector<Monster> monsterList;
+    std::vector<Area> areaList;
+    std::vector<LoreEntry> loreList;
+
+    NameIndex itemIndex;
+    NameIndex monsterIndex;
+    NameIndex areaIndex;
+};
+
+#endif
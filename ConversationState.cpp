@@ -0,0 +1,34 @@
+#include "ConversationState.h"
+
+void ConversationState::append(ChatTurn turn) {
+    turn.serial = nextSerial++;
+    push(std::move(turn));
+}
+
+void ConversationState::restore(ChatTurn turn) {
+    if (turn.serial >= nextSerial) nextSerial = turn.serial + 1;
+    push(std::move(turn));
+}
+
+void ConversationState::push(ChatTurn turn) {
+    using Ring = ConversationView::Ring;
+    const size_t capacity = ConversationView::CAPACITY;
+
+    // 推論中のリクエストがスナップショットを持っていれば写しを作り、誰も持っていなければその場で書き換える
+    if (!current.ring) {
+        current.ring = std::make_shared<Ring>();
+    } else if (current.ring.use_count() > 1) {
+        current.ring = std::make_shared<Ring>(*current.ring);
+    }
+
+    Ring& ring = *current.ring;
+    auto shared = std::make_shared<const ChatTurn>(std::move(turn));
+    if (ring.count < capacity) {
+        ring.slots[(ring.head + ring.count) % capacity] = std::move(shared);
+        ring.count++;
+    } else {
+        // 満杯なら最も古い発言を上書きする
+        ring.slots[ring.head] = std::move(shared);
+        ring.head = (ring.head + 1) % capacity;
+    }
+}
@@ -0,0 +1,72 @@
+// ConversationState.h - Prompt Quest: 長老との会話履歴（発言のリングバッファと読み取り専用スナップショット）
+
+#ifndef CONVERSATION_STATE_H
+#define CONVERSATION_STATE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+struct llama_vocab;
+
+enum class ChatRole : uint8_t {
+    USER,       // プレイヤー
+    ASSISTANT   // 長老
+};
+
+// 1つの発言。履歴に追加した後は変更しないので、複数のリクエストから同時に読んでよい。
+struct ChatTurn {
+    ChatRole role = ChatRole::USER;
+    std::string text;
+    // プロンプトに入れる形（ヘッダー・話者名込み）でのトークン数。追加前に LlmManager::measureTokens() が入れる。
+    int tokens = -1;
+    const llama_vocab* tokens_vocab = nullptr;  // 数えたときの語彙（別のモデルの役割では数え直す）
+    // 追加した順の通し番号（1から。clear() しても戻さない）。記憶の索引で、履歴に入っている発言を見分けるのに使う
+    uint64_t serial = 0;
+};
+
+// 会話のある時点のスナップショット。古い順に発言を読める。
+// コピーは参照カウントの増減だけで、発言の文字列は複製しない。
+class ConversationView {
+public:
+    static const size_t CAPACITY = 128;  // トークン予算に入り切らないほど古い発言は持たない
+
+    size_t size() const { return ring ? ring->count : 0; }
+    bool empty() const { return size() == 0; }
+    const ChatTurn& operator[](size_t i) const { return *ring->slots[(ring->head + i) % CAPACITY]; }
+    const ChatTurn& back() const { return (*this)[size() - 1]; }
+
+private:
+    friend class ConversationState;
+
+    struct Ring {
+        std::array<std::shared_ptr<const ChatTurn>, CAPACITY> slots;
+        size_t head = 0;   // 最も古い発言の位置
+        size_t count = 0;
+    };
+    std::shared_ptr<Ring> ring;  // 読み取りは const のみ。書き換えは ConversationState が自分しか持っていないときだけ
+};
+
+// 表示用のログとは別に、会話を役割付きの発言として持つ。
+// 配布済みのスナップショットがあるときは追加時にリングを写し直す（発言へのポインタだけを写す）ので、
+// スナップショットの中身は後から変わらない。
+class ConversationState {
+public:
+    void append(ChatTurn turn);
+    // turn.serial をそのまま使って追加する（別のプロセスで作った履歴を写すとき。以降の append はその続きの番号になる）
+    void restore(ChatTurn turn);
+    void clear() { current = ConversationView(); }
+
+    ConversationView snapshot() const { return current; }
+    size_t size() const { return current.size(); }
+
+private:
+    ConversationView current;
+    uint64_t nextSerial = 1;
+
+    void push(ChatTurn turn);
+};
+
+#endif
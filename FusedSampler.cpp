@@ -0,0 +1,154 @@
+#include "FusedSampler.h"
+#include <algorithm>
+#include <vector>
+#include <cmath>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+static_assert(sizeof(llama_token_data) == 3 * sizeof(float), "llama_token_data layout changed");
+
+struct FusedSamplerContext {
+    float temp;
+    int32_t top_k;
+    float top_p;
+    size_t min_keep;
+    std::vector<llama_token_data> heap;  // 上位k個の最小ヒープ（容量は作成時に確保）
+};
+
+// std::*_heap で先頭が最小になる比較
+bool heapCompare(const llama_token_data& a, const llama_token_data& b) {
+    return a.logit > b.logit;
+}
+
+inline void offer(std::vector<llama_token_data>& heap, size_t k, const llama_token_data& cand, float& threshold) {
+    if (heap.size() < k) {
+        heap.push_back(cand);
+        std::push_heap(heap.begin(), heap.end(), heapCompare);
+        if (heap.size() == k) threshold = heap.front().logit;
+    } else if (cand.logit > heap.front().logit) {
+        std::pop_heap(heap.begin(), heap.end(), heapCompare);
+        heap.back() = cand;
+        std::push_heap(heap.begin(), heap.end(), heapCompare);
+        threshold = heap.front().logit;
+    }
+}
+
+// 語彙全体から logit 上位 k 個を選ぶ。ヒープが埋まった後はしきい値を超えるものだけを拾うので、
+// ほとんどのブロックは比較1回で読み飛ばせる。logit は {id, logit, p} の配列に飛び飛びで
+// 並んでいるのでギャザーで読み込む。
+void selectTopK(const llama_token_data* data, size_t n, size_t k, std::vector<llama_token_data>& heap) {
+    heap.clear();
+    float threshold = -INFINITY;
+    size_t i = 0;
+
+#if defined(__AVX512F__)
+    const __m512i offsets = _mm512_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21, 24, 27, 30, 33, 36, 39, 42, 45);
+    for (; i + 16 <= n; i += 16) {
+        const float* base = &data[i].logit;
+        __m512 logits = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xFFFF, offsets, base, 4);
+        __mmask16 mask = _mm512_cmp_ps_mask(logits, _mm512_set1_ps(threshold), _CMP_GT_OQ);
+        while (mask) {
+            int lane = __builtin_ctz(mask);
+            mask &= mask - 1;
+            offer(heap, k, data[i + lane], threshold);
+        }
+    }
+#elif defined(__AVX2__)
+    const __m256i offsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+    for (; i + 8 <= n; i += 8) {
+        const float* base = &data[i].logit;
+        __m256 logits = _mm256_i32gather_ps(base, offsets, 4);
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(logits, _mm256_set1_ps(threshold), _CMP_GT_OQ));
+        while (mask) {
+            int lane = __builtin_ctz(mask);
+            mask &= mask - 1;
+            offer(heap, k, data[i + lane], threshold);
+        }
+    }
+#endif
+
+    for (; i < n; ++i) {
+        if (data[i].logit > threshold) offer(heap, k, data[i], threshold);
+    }
+
+    // 降順に並べる
+    std::sort_heap(heap.begin(), heap.end(), heapCompare);
+}
+
+const char* fusedName(const llama_sampler*) {
+    return "pq-fused";
+}
+
+void fusedApply(llama_sampler* smpl, llama_token_data_array* cur_p) {
+    auto* ctx = static_cast<FusedSamplerContext*>(smpl->ctx);
+    if (cur_p->size == 0) return;
+
+    // 温度0以下は標準の temp サンプラーと同じく最大値だけを残す
+    size_t k = ctx->temp <= 0.0f ? 1 : std::min(cur_p->size, static_cast<size_t>(ctx->top_k));
+    selectTopK(cur_p->data, cur_p->size, k, ctx->heap);
+
+    size_t m = ctx->heap.size();
+    if (m == 0) return;  // すべて -inf
+    float inv_temp = ctx->temp > 0.0f ? 1.0f / ctx->temp : 1.0f;
+    for (size_t i = 0; i < m; ++i) ctx->heap[i].logit *= inv_temp;
+
+    // ソフトマックス（生き残った候補だけ）
+    float max_logit = ctx->heap[0].logit;
+    float sum = 0.0f;
+    for (size_t i = 0; i < m; ++i) {
+        float p = std::exp(ctx->heap[i].logit - max_logit);
+        ctx->heap[i].p = p;
+        sum += p;
+    }
+    for (size_t i = 0; i < m; ++i) ctx->heap[i].p /= sum;
+
+    // top_p: 累積確率がしきい値に達したところで打ち切る（確率は再正規化しない）
+    size_t keep = m;
+    float cum = 0.0f;
+    for (size_t i = 0; i < m; ++i) {
+        cum += ctx->heap[i].p;
+        if (cum >= ctx->top_p && i + 1 >= ctx->min_keep) {
+            keep = i + 1;
+            break;
+        }
+    }
+
+    std::copy(ctx->heap.begin(), ctx->heap.begin() + keep, cur_p->data);
+    cur_p->size = keep;
+    cur_p->sorted = true;
+    cur_p->selected = -1;
+}
+
+llama_sampler* fusedClone(const llama_sampler* smpl) {
+    const auto* ctx = static_cast<const FusedSamplerContext*>(smpl->ctx);
+    return createFusedSampler(ctx->temp, ctx->top_k, ctx->top_p, ctx->min_keep);
+}
+
+void fusedFree(llama_sampler* smpl) {
+    delete static_cast<FusedSamplerContext*>(smpl->ctx);
+}
+
+const llama_sampler_i fusedInterface = {
+    /* .name   = */ fusedName,
+    /* .accept = */ nullptr,
+    /* .apply  = */ fusedApply,
+    /* .reset  = */ nullptr,
+    /* .clone  = */ fusedClone,
+    /* .free   = */ fusedFree,
+};
+
+} // namespace
+
+llama_sampler* createFusedSampler(float temp, int32_t top_k, float top_p, size_t min_keep) {
+    auto* ctx = new FusedSamplerContext();
+    ctx->temp = temp;
+    ctx->top_k = (top_k <= 0 || top_k > FUSED_SAMPLER_MAX_K) ? FUSED_SAMPLER_MAX_K : top_k;
+    ctx->top_p = top_p;
+    ctx->min_keep = min_keep;
+    ctx->heap.reserve(ctx->top_k);
+    return llama_sampler_init(&fusedInterface, ctx);
+}
@@ -0,0 +1,17 @@
+// FusedSampler.h - Prompt Quest: temp → top_k → top_p を1回の走査で行うサンプラー
+
+#ifndef FUSED_SAMPLER_H
+#define FUSED_SAMPLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include "llama.h"
+
+// llama_sampler_chain に登録できるサンプラーを作る。標準の temp・top_k・top_p を順に並べたチェーンと
+// 同じ候補と確率を残す（最後の抽選は含まない）。語彙全体は top_k の選別で1回だけ読み、
+// 温度・ソフトマックス・top_p は生き残った k 個に対してだけ計算する。
+// top_k は 1〜FUSED_SAMPLER_MAX_K（0以下や上限超えは上限に丸める）。
+const int32_t FUSED_SAMPLER_MAX_K = 256;
+llama_sampler* createFusedSampler(float temp, int32_t top_k, float top_p, size_t min_keep = 1);
+
+#endif
@@ -0,0 +1,719 @@
+﻿#include "Game.h"
+#include "Log.h"
+#include "Trace.h"
+#include <SDL_image.h>
+#include <stdexcept>
+#include <chrono>
+#include <algorithm>
+#include <ctime>
+#include <cstdlib>
+
+const int SCREEN_WIDTH = 1280;
+const int SCREEN_HEIGHT = 720;
+
+// デコード済み画像バンドル（tools/asset_packer で生成）
+const char* const ASSET_BUNDLE_FILE = "assets.pqab";
+
+// コンテンツ定義ファイル（進行に使うエリアは GameSession が探す）
+const char* const CONTENT_FILE = "data/content.txt";
+
+// 画像ファイル（TextureCacheのキー）
+const char* const TITLE_BG_IMAGE = "images/background/spring.jpg";
+const char* const VILLAGE_ELDER_IMAGE = "images/npcs/village_elder.jpg";
+
+// 描画時の最大の高さ（render_Field / render_Battle の拡大率と揃える）
+const float NPC_IMAGE_HEIGHT_RATIO = 0.75f;
+const float MONSTER_IMAGE_HEIGHT_RATIO = 0.6f;
+
+Game::Game(const std::map<std::string, LlmRoleConfig>& role_configs) : roleConfigs(role_configs) {}
+
+Game::~Game() { cleanup(); }
+
+bool Game::init() {
+    // PQ_SEED=<数> で生成と戦闘判定の乱数を、PQ_RECORD=<パス> でプレイの記録先を指定できる
+    const char* seed = std::getenv("PQ_SEED");
+    if (seed && *seed) session.options.seed = static_cast<uint32_t>(std::strtoul(seed, nullptr, 10));
+    const char* record_path = std::getenv("PQ_RECORD");
+    if (record_path && *record_path) recordPath = record_path;
+    // PQ_LLM_MOCK=<台本> でモデルを使わずに動かす（data/mock_llm.txt）
+    const char* mock_script = std::getenv("PQ_LLM_MOCK");
+    if (mock_script && *mock_script) mockScriptPath = mock_script;
+    // PQ_LLM_WORKER=<名前> で別プロセスの推論ワーカー（tools/inference_worker）を使う
+    const char* worker_name = std::getenv("PQ_LLM_WORKER");
+    if (worker_name && *worker_name) workerName = worker_name;
+
+    if (!initVideo(false)) return false;
+    if (!initContent()) return false;
+    if (!initLlm()) return false;
+
+    SDL_StartTextInput();
+    
+    return true;
+}
+
+bool Game::initLlm() {
+    std::map<std::string, LlmRoleConfig> full_role_configs;
+    for(const auto& pair : roleConfigs) {
+        LlmRoleConfig config = pair.second;
+        config.model_path = basePath + config.model_path;
+        if (!config.lora_path.empty()) config.lora_path = basePath + config.lora_path;
+        full_role_configs[pair.first] = config;
+    }
+
+    LlmManager* manager = nullptr;  // llama.cpp で推論するときだけ（モデル固有の設定用）
+    if (!llm && !mockScriptPath.empty()) {
+        // モデルを使わず、台本どおりの応答を遅延の分布に従って返す
+        auto mock = std::make_unique<MockBackend>();
+        if (!mock->loadScript(mockScriptPath)) return false;
+        llm = std::move(mock);
+        PQ_LOG_INFO(LogCategory::GAME, "using mock inference backend (" << mockScriptPath << ")");
+    }
+    if (!llm && !workerName.empty() && !recordedOutputs) {
+        // モデルを読み込んだまま動いているワーカーに頼む。つながらなければこのプロセスで読み込む
+        // ワーカーの役割の設定（モデル・LoRA・短いプロンプト・コンテキスト）がこちらと違えば断られる
+        std::map<std::string, std::string> summaries;
+        for (const auto& pair : full_role_configs) summaries[pair.first] = pair.second.summary();
+        auto remote = std::make_unique<RemoteBackend>();
+        if (remote->connect(workerName, summaries)) llm = std::move(remote);
+        else PQ_LOG_WARN(LogCategory::GAME, "falling back to in-process inference");
+    }
+    if (!llm) {
+        try {
+            auto created = std::make_unique<LlmManager>(full_role_configs, LlmThreadConfig::fromEnvironment());
+            manager = created.get();
+            llm = std::move(created);
+        } catch (const std::exception& e) {
+            PQ_LOG_ERROR(LogCategory::LLM, "Fatal LLM Error: " << e.what());
+            SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "LLM Load Error", e.what(), window);
+            return false;
+        }
+        manager->setModelBudget(modelBudgetBytes);
+        if (recordedOutputs) {
+            // 記録した結果で再生するので、モデルも埋め込みも使わない
+            manager->setRecordedOutputs(recordedOutputs);
+            useSemanticCache = false;
+        }
+    } else {
+        useSemanticCache = false;  // 埋め込みは llama.cpp のときだけ
+    }
+    session.setBackend(llm.get());
+    llm->setSeed(session.options.seed);
+    if (!recordPath.empty()) startRecording();
+    GameSession::addLore(content, *llm);
+    // 会話の役割はタイトル・導入の間に読み込んでおく
+    llm->prefetch("GM");
+    llm->prefetch("NPC");
+    if (manager && useSemanticCache && !manager->enableSemanticCache()) {
+        PQ_LOG_WARN(LogCategory::LLM, "Semantic cache disabled.");
+    }
+    return true;
+}
+
+void Game::startRecording() {
+    recorder = std::make_unique<SessionRecorder>();
+    if (!recorder->open(recordPath)) {
+        recorder.reset();
+        return;
+    }
+    // 再生するときに同じ条件で動かすための設定（モデルのパスは basePath からの相対）
+    const GameSessionOptions& options = session.options;
+    recorder->setting("seed", std::to_string(options.seed));
+    recorder->setting("semantic_cache", useSemanticCache ? "1" : "0");
+    recorder->setting("gm_classifier", options.gmClassifier ? "1" : "0");
+    recorder->setting("native_battle", options.nativeBattleResolver ? "1" : "0");
+    recorder->setting("battle_narration", options.battleNarration ? "1" : "0");
+    for (const auto& pair : roleConfigs) {
+        const LlmRoleConfig& config = pair.second;
+        const std::string prefix = "role." + pair.first + ".";
+        recorder->setting(prefix + "model", config.model_path);
+        recorder->setting(prefix + "lora", config.lora_path);
+        recorder->setting(prefix + "lora_scale", std::to_string(config.lora_scale));
+        recorder->setting(prefix + "compact_prompt", config.compact_prompt ? "1" : "0");
+        recorder->setting(prefix + "n_ctx", std::to_string(config.context.n_ctx));
+        recorder->setting(prefix + "kv_type_k", ggml_type_name(config.context.type_k));
+        recorder->setting(prefix + "kv_type_v", ggml_type_name(config.context.type_v));
+        recorder->setting(prefix + "flash_attn", config.context.flash_attn ? "1" : "0");
+        recorder->setting(prefix + "prefix_cache", std::to_string(config.context.prefix_cache_leaves));
+    }
+    llm->setRecorder(recorder.get());
+    session.setRecorder(recorder.get());
+    PQ_LOG_INFO(LogCategory::GAME, "recording session to " << recordPath << " (seed " << options.seed << ")");
+}
+
+bool Game::initVideo(bool headless) {
+    if (SDL_Init(SDL_INIT_VIDEO) < 0) { PQ_LOG_ERROR(LogCategory::GAME, "SDL_Init Error: " << SDL_GetError()); return false; }
+    if (!(IMG_Init(IMG_INIT_JPG) & IMG_INIT_JPG)) { PQ_LOG_ERROR(LogCategory::GAME, "IMG_Init Error: " << IMG_GetError()); return false; }
+    if (TTF_Init() == -1) { PQ_LOG_ERROR(LogCategory::GAME, "TTF_Init Error: " << TTF_GetError()); return false; }
+
+    // ヘッドレス時は非表示ウィンドウにソフトウェアレンダラーで描画する（ベンチマーク用）
+    Uint32 windowFlags = headless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN;
+    Uint32 rendererFlags = headless ? SDL_RENDERER_SOFTWARE : (SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+
+    window = SDL_CreateWindow("Prompt Quest", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH, SCREEN_HEIGHT, windowFlags);
+    if (!window) { PQ_LOG_ERROR(LogCategory::GAME, "SDL_CreateWindow Error: " << SDL_GetError()); return false; }
+    renderer = SDL_CreateRenderer(window, -1, rendererFlags);
+    if (!renderer) { PQ_LOG_ERROR(LogCategory::GAME, "SDL_CreateRenderer Error: " << SDL_GetError()); return false; }
+    return true;
+}
+
+bool Game::initContent() {
+    // 呼び出し側（ベンチマーク等）で指定済みならそのまま使う
+    if (basePath.empty()) {
+        char* path = SDL_GetBasePath();
+        if (path) {
+            basePath = path;
+            SDL_free(path);
+            for (char& c : basePath) { if (c == '\\') c = '/'; }
+            size_t pos = basePath.find("build/");
+            if (pos!= std::string::npos) basePath = basePath.substr(0, pos);
+        } else {
+            basePath = "./";
+        }
+    }
+
+    if (!initializeDatabase()) { PQ_LOG_ERROR(LogCategory::GAME, "Failed to load content database."); return false; }
+
+    if (!loadResources()) { PQ_LOG_ERROR(LogCategory::GAME, "Failed to load resources."); return false; }
+    return true;
+}
+
+bool Game::initializeDatabase() {
+    if (!content.loadFromFile(basePath + CONTENT_FILE)) return false;
+    return session.init();
+}
+
+bool Game::loadResources() {
+    PQ_TRACE_SCOPE("asset", "loadResources");
+    std::string fontPath = basePath + "fonts/KH-Dot-Hibiya-24.ttf";
+    titleFont = TTF_OpenFont(fontPath.c_str(), 48);
+    uiFont = TTF_OpenFont(fontPath.c_str(), 24);
+    smallFont = TTF_OpenFont(fontPath.c_str(), 18);
+    if (!titleFont || !uiFont || !smallFont) { 
+        PQ_LOG_ERROR(LogCategory::GAME, "Failed to load font: " << TTF_GetError());
+        return false; 
+    }
+
+    textureCache = std::make_unique<TextureCache>(renderer, basePath, textureBudgetBytes);
+
+    // tools/asset_packer で作ったバンドルがあればJPEGのデコードを省く
+    if (assetBundle.open(basePath + ASSET_BUNDLE_FILE)) {
+        textureCache->setBundle(&assetBundle);
+    } else {
+        PQ_LOG_INFO(LogCategory::GAME, "Asset bundle not found, decoding images: " << basePath + ASSET_BUNDLE_FILE);
+    }
+
+    // 背景は画面全体に引き伸ばし、人物画像は高さ基準で描画されるので、そのサイズで保持する
+    auto background = [](const std::string& file) {
+        TextureDesc desc;
+        desc.file = file;
+        desc.target_w = SCREEN_WIDTH;
+        desc.target_h = SCREEN_HEIGHT;
+        return desc;
+    };
+    auto sprite = [](const std::string& file, float heightRatio) {
+        TextureDesc desc;
+        desc.file = file;
+        desc.target_h = static_cast<int>(SCREEN_HEIGHT * heightRatio);
+        desc.use_color_key = true;
+        desc.color_key = {255, 255, 255, 255};
+        return desc;
+    };
+
+    if (!textureCache->preload(background(TITLE_BG_IMAGE))) return false;
+    if (!textureCache->preload(sprite(VILLAGE_ELDER_IMAGE, NPC_IMAGE_HEIGHT_RATIO))) return false;
+
+    for (const auto& area : content.areas()) {
+        if (!textureCache->preload(background(area.background))) {
+            PQ_LOG_ERROR(LogCategory::GAME, "Failed to load background for area '" << area.name << "'");
+            return false;
+        }
+    }
+    for (const auto& monster : content.monsters()) {
+        if (!textureCache->preload(sprite(monster.texturePath, MONSTER_IMAGE_HEIGHT_RATIO))) {
+            PQ_LOG_ERROR(LogCategory::GAME, "Failed to load texture for monster '" << monster.name << "'");
+            return false;
+        }
+    }
+
+    PQ_LOG_INFO(LogCategory::GAME, "Textures resident: " << textureCache->residentCount()
+                << " (" << textureCache->usedBytes() / 1024 << " KB / budget " << textureCache->budget() / 1024 << " KB)");
+    return true;
+}
+
+void Game::run() {
+    while (!quit) {
+        PQ_TRACE_SCOPE("frame", "frame");
+        {
+            PQ_TRACE_SCOPE("frame", "handleEvents");
+            handleEvents();
+        }
+        {
+            PQ_TRACE_SCOPE("frame", "update");
+            update();
+        }
+        {
+            PQ_TRACE_SCOPE("frame", "render");
+            render();
+        }
+        PQ_TRACE_SCOPE("frame", "sleep");
+        SDL_Delay(16);
+    }
+}
+
+void Game::toggleTrace() {
+    if (!Trace::active()) {
+        Trace::start();
+        return;
+    }
+    // 何度取っても上書きしないよう、止めた時刻をファイル名に入れる
+    char name[64];
+    std::time_t now = std::time(nullptr);
+    std::strftime(name, sizeof(name), "logs/trace_%Y%m%d_%H%M%S.json", std::localtime(&now));
+    Trace::stop(name);
+}
+
+void Game::handleEvents() {
+    SDL_Event e;
+    while (SDL_PollEvent(&e) != 0) {
+        if (e.type == SDL_QUIT) quit = true;
+
+        if (e.type == SDL_MOUSEBUTTONDOWN) {
+            if (e.button.button == SDL_BUTTON_LEFT) {
+                int mouseX, mouseY;
+                SDL_GetMouseState(&mouseX, &mouseY);
+                
+                if (session.departureAvailable() && session.state() == GameState::CONVERSATION) {
+                    SDL_Rect buttonRect = { 50, SCREEN_HEIGHT - 250 - 50, 200, 40 };
+                    if (mouseX >= buttonRect.x && mouseX <= buttonRect.x + buttonRect.w &&
+                        mouseY >= buttonRect.y && mouseY <= buttonRect.y + buttonRect.h)
+                    {
+                        applyInput({SessionInputKind::DEPART});
+                        return;
+                    }
+                }
+
+                SDL_Rect itemPanelRect = { 50 + 900 + 20, SCREEN_HEIGHT - 250, SCREEN_WIDTH - (50 + 900 + 20) - 50, 220 };
+                if (mouseX >= itemPanelRect.x && mouseX <= itemPanelRect.x + itemPanelRect.w &&
+                    mouseY >= itemPanelRect.y && mouseY <= itemPanelRect.y + itemPanelRect.h)
+                {
+                    int itemTopY = itemPanelRect.y + 40;
+                    int itemHeight = 23;
+                    int clickedIndex = (mouseY - itemTopY) / itemHeight;
+                    applyInput({SessionInputKind::EQUIP, "", clickedIndex});
+                }
+            }
+        }
+
+        if ((session.state() == GameState::CONVERSATION || session.state() == GameState::BATTLE) && e.type == SDL_TEXTINPUT) {
+            inputText += e.text.text;
+        }
+
+        if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F12 && e.key.repeat == 0) {
+            toggleTrace();
+            continue;
+        }
+
+        if (e.type == SDL_KEYDOWN) {
+            Uint32 currentTime = SDL_GetTicks();
+            if ((session.state() == GameState::CONVERSATION || session.state() == GameState::BATTLE) && e.key.keysym.sym == SDLK_BACKSPACE && !inputText.empty()) {
+                inputText.pop_back();
+                lastKeypressTime = currentTime - (keypressDelay - 100);
+                continue;
+            }
+            if (currentTime < lastKeypressTime + keypressDelay) continue;
+
+            switch (session.state()) {
+                case GameState::TITLE:
+                    if (e.key.keysym.sym == SDLK_RETURN) {
+                        applyInput({SessionInputKind::START});
+                        lastKeypressTime = currentTime;
+                    }
+                    break;
+                case GameState::STORY:
+                    break;
+                case GameState::CONVERSATION:
+                case GameState::BATTLE:
+                    if (e.key.keysym.sym == SDLK_RETURN && !inputText.empty()) {
+                        SessionInput input = {SessionInputKind::TEXT, inputText};
+                        inputText = "";
+                        applyInput(input);
+                        lastKeypressTime = currentTime;
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+bool Game::applyInput(const SessionInput& input) {
+    return session.applyInput(input, SDL_GetTicks());
+}
+
+void Game::update() {
+    // 推論待ちでない間は推論スレッドを眠らせ、ポーリングで描画スレッドのコアを取らないようにする
+    if (llm) llm->setThreadsIdle(!session.llmBusy());
+
+    session.update(SDL_GetTicks());
+
+    // 森へ出発したときと、倒れてタイトルに戻ったときは、森の背景とモンスターをフェードを待たずに消す
+    const GameState state = session.state();
+    if (state != shownState && (state == GameState::TRANSITION_TO_FOREST || state == GameState::TITLE)) {
+        forestBgAlpha = 0;
+        monsterAlpha = 0;
+    }
+    shownState = state;
+
+    if (session.npcVisible()) {
+        if (npcImageAlpha < 255) {
+            int tempAlpha = npcImageAlpha + fadeSpeed;
+            npcImageAlpha = std::min(255, tempAlpha);
+        }
+    } else {
+        if (npcImageAlpha > 0) {
+            int tempAlpha = npcImageAlpha - fadeSpeed;
+            npcImageAlpha = std::max(0, tempAlpha);
+        }
+    }
+
+    // 森の背景フェード処理
+    if (session.forestVisible()) {
+        if (forestBgAlpha < 255) {
+            int tempAlpha = forestBgAlpha + fadeSpeed;
+            forestBgAlpha = std::min(255, tempAlpha);
+        }
+    } else {
+        if (forestBgAlpha > 0) {
+            int tempAlpha = forestBgAlpha - fadeSpeed;
+            forestBgAlpha = std::max(0, tempAlpha);
+        }
+    }
+
+    // モンスター画像フェード処理
+    if (session.monsterVisible()) {
+        if (monsterAlpha < 255) {
+            int tempAlpha = monsterAlpha + fadeSpeed;
+            monsterAlpha = std::min(255, tempAlpha);
+        }
+    } else {
+        if (monsterAlpha > 0) {
+            int tempAlpha = monsterAlpha - fadeSpeed;
+            monsterAlpha = std::max(0, tempAlpha);
+        }
+    }
+}
+
+void Game::render() {
+    textureCache->beginFrame();
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderClear(renderer);
+    const GameState state = session.state();
+    if (state == GameState::TITLE) {
+        render_Title();
+    } else if (state == GameState::BATTLE || state == GameState::PROCESSING_BATTLE) {
+        render_Battle();
+    } else {
+        render_Field();
+    }
+    SDL_RenderPresent(renderer);
+}
+
+void Game::render_Title() {
+    SDL_RenderCopy(renderer, textureCache->get(TITLE_BG_IMAGE), NULL, NULL);
+    
+    SDL_Color titleColor = { 255, 215, 0, 255 };  // ゴールド色
+    SDL_Color subtitleColor = { 200, 200, 255, 255 };  // ライトブルー
+    SDL_Color instructionColor = { 255, 255, 255, 255 };  // 白色
+    
+    TexturePtr titleTex = renderText("Prompt Quest", titleFont, titleColor);
+    int w, h;
+    SDL_QueryTexture(titleTex.get(), NULL, NULL, &w, &h);
+    SDL_Rect dst = {(SCREEN_WIDTH - w)/2, 80, w, h};
+    SDL_RenderCopy(renderer, titleTex.get(), NULL, &dst);
+    
+    TexturePtr subtitleTex = renderText("～ Words Shape Your Adventure ～", uiFont, subtitleColor);
+    SDL_QueryTexture(subtitleTex.get(), NULL, NULL, &w, &h);
+    dst = {(SCREEN_WIDTH - w)/2, 140, w, h};
+    SDL_RenderCopy(renderer, subtitleTex.get(), NULL, &dst);
+    
+    TexturePtr msgTex = renderText("Press ENTER to Start", uiFont, instructionColor);
+    SDL_QueryTexture(msgTex.get(), NULL, NULL, &w, &h);
+    dst = {(SCREEN_WIDTH - w)/2, 600, w, h};
+    SDL_RenderCopy(renderer, msgTex.get(), NULL, &dst);
+}
+
+void Game::render_Field() {
+    SDL_Texture* villageBgTexture = textureCache->get(content.area(session.villageArea()).background);
+    if (session.state() == GameState::TRANSITION_TO_FOREST && session.forestVisible() && forestBgAlpha > 0) {
+        // 森の背景を半透明で表示
+        SDL_Texture* forestBgTexture = textureCache->get(content.area(session.forestArea()).background);
+        setTextureAlpha(forestBgTexture, forestBgAlpha);
+        SDL_RenderCopy(renderer, forestBgTexture, NULL, NULL);
+        
+        // 村の背景を徐々に薄くする
+        int villageAlpha = 255 - forestBgAlpha;
+        setTextureAlpha(villageBgTexture, villageAlpha);
+        SDL_RenderCopy(renderer, villageBgTexture, NULL, NULL);
+    } else {
+        // 通常時は村の背景
+        setTextureAlpha(villageBgTexture, 255);
+        SDL_RenderCopy(renderer, villageBgTexture, NULL, NULL);
+    }
+
+    SDL_Texture* villageElderTexture = (npcImageAlpha > 0) ? textureCache->get(VILLAGE_ELDER_IMAGE) : nullptr;
+    if (villageElderTexture) {
+        setTextureAlpha(villageElderTexture, npcImageAlpha);
+        
+        int w, h;
+        SDL_QueryTexture(villageElderTexture, NULL, NULL, &w, &h);
+        float scale = (SCREEN_HEIGHT * NPC_IMAGE_HEIGHT_RATIO) / h;
+        int disp_w = static_cast<int>(w * scale);
+        int disp_h = static_cast<int>(h * scale);
+
+        SDL_Rect dstRect = { SCREEN_WIDTH - disp_w - 60, (SCREEN_HEIGHT - disp_h) / 2, disp_w, disp_h };
+        SDL_RenderCopy(renderer, villageElderTexture, NULL, &dstRect);
+    }
+
+    renderUI();
+    renderStatusPanel();
+}
+
+void Game::render_Battle() {
+    SDL_Texture* forestBgTexture = textureCache->get(content.area(session.forestArea()).background);
+    setTextureAlpha(forestBgTexture, 255);
+    SDL_RenderCopy(renderer, forestBgTexture, NULL, NULL);
+
+    const Monster* enemy = session.enemy();
+    if (enemy && session.monsterVisible() && monsterAlpha > 0) {
+        SDL_Texture* monsterTexture = textureCache->get(enemy->texturePath);
+        if (monsterTexture) {
+            setTextureAlpha(monsterTexture, monsterAlpha);
+            
+            int w, h;
+            SDL_QueryTexture(monsterTexture, NULL, NULL, &w, &h);
+            float scale = (SCREEN_HEIGHT * MONSTER_IMAGE_HEIGHT_RATIO) / h;
+            int disp_w = static_cast<int>(w * scale);
+            int disp_h = static_cast<int>(h * scale);
+            SDL_Rect dstRect = { (SCREEN_WIDTH - disp_w) / 2, (SCREEN_HEIGHT - disp_h) / 2 - 50, disp_w, disp_h };
+            SDL_RenderCopy(renderer, monsterTexture, NULL, &dstRect);
+        } else {
+            PQ_LOG_ERROR(LogCategory::GAME, "Error: Enemy texture is null.");
+        }
+    } else if (enemy) {
+        PQ_LOG_DEBUG(LogCategory::GAME, "Monster alpha is 0.");
+    } else {
+        PQ_LOG_ERROR(LogCategory::GAME, "Error: enemy is null.");
+    }
+
+    renderUI();
+    renderStatusPanel();
+    renderEnemyStatusPanel();
+}
+
+
+void Game::renderUI() {
+    SDL_Rect mainPanelRect = { 50, SCREEN_HEIGHT - 250, 900, 220 };
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 192);
+    SDL_RenderFillRect(renderer, &mainPanelRect);
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderDrawRect(renderer, &mainPanelRect);
+
+    if (session.departureAvailable()) {
+        SDL_Rect buttonRect = { mainPanelRect.x, mainPanelRect.y - 50, 200, 40 };
+        SDL_SetRenderDrawColor(renderer, 30, 80, 150, 220);
+        SDL_RenderFillRect(renderer, &buttonRect);
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        SDL_RenderDrawRect(renderer, &buttonRect);
+        TexturePtr btnText = renderText("静寂の森へ旅立つ", uiFont, {255, 255, 255, 255});
+        if (btnText) {
+            int w, h;
+            SDL_QueryTexture(btnText.get(), NULL, NULL, &w, &h);
+            SDL_Rect dst = { buttonRect.x + (buttonRect.w - w) / 2, buttonRect.y + (buttonRect.h - h) / 2, w, h };
+            SDL_RenderCopy(renderer, btnText.get(), NULL, &dst);
+        }
+    }
+
+    int logY = mainPanelRect.y + mainPanelRect.h - 50;
+    int logX = mainPanelRect.x + 10;
+    int logW = mainPanelRect.w - 20;
+    SDL_Color textColor = { 255, 255, 255, 255 };
+    
+    const std::vector<std::string>& conversationLog = session.log();
+    for (int i = conversationLog.size() - 1; i >= 0; --i) {
+        if (logY < mainPanelRect.y) break; 
+        SDL_Surface* surface = TTF_RenderUTF8_Blended_Wrapped(uiFont, conversationLog[i].c_str(), textColor, logW);
+        if(surface) {
+            logY -= surface->h;
+            SDL_Rect dst = {logX, logY, surface->w, surface->h};
+            if (dst.y < mainPanelRect.y) { SDL_FreeSurface(surface); break; }
+            TexturePtr texture = createTextureFromSurface(renderer, surface);
+            SDL_RenderCopy(renderer, texture.get(), NULL, &dst);
+            logY -= 5;
+            SDL_FreeSurface(surface);
+        }
+    }
+
+    SDL_Rect inputRect = { mainPanelRect.x, mainPanelRect.y + mainPanelRect.h - 40, mainPanelRect.w, 40 };
+    SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
+    SDL_RenderFillRect(renderer, &inputRect);
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderDrawRect(renderer, &inputRect);
+
+    std::string displayText = "> ";
+    const GameState state = session.state();
+    if (state == GameState::PROCESSING_GM || state == GameState::PROCESSING_NPC || state == GameState::PROCESSING_BATTLE) {
+        displayText += "考えている...";
+    } else if (state == GameState::CONVERSATION || state == GameState::BATTLE) {
+        displayText += inputText;
+        if (SDL_GetTicks() / 500 % 2) displayText += "_";
+    }
+    
+    TexturePtr inputTex = renderText(displayText, uiFont, textColor);
+    if (inputTex) {
+        int w, h;
+        SDL_QueryTexture(inputTex.get(), NULL, NULL, &w, &h);
+        SDL_Rect dst = { inputRect.x + 10, inputRect.y + 5, w, h };
+        SDL_RenderCopy(renderer, inputTex.get(), NULL, &dst);
+    }
+    
+    SDL_Rect itemPanelRect = { mainPanelRect.x + mainPanelRect.w + 20, mainPanelRect.y, SCREEN_WIDTH - (mainPanelRect.x + mainPanelRect.w + 20) - 50, mainPanelRect.h };
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 192);
+    SDL_RenderFillRect(renderer, &itemPanelRect);
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderDrawRect(renderer, &itemPanelRect);
+    
+    TexturePtr itemTitle = renderText("もちもの", uiFont, textColor);
+    if(itemTitle) {
+        int w, h;
+        SDL_QueryTexture(itemTitle.get(), NULL, NULL, &w, &h);
+        SDL_Rect dst = {itemPanelRect.x + 10, itemPanelRect.y + 10, w, h};
+        SDL_RenderCopy(renderer, itemTitle.get(), NULL, &dst);
+    }
+
+    int itemY = itemPanelRect.y + 40;
+    for(const auto& item : session.inventory()) {
+        std::string itemText = item.name;
+        TexturePtr itemTex = renderText(itemText, smallFont, textColor);
+        if(itemTex) {
+            int w, h;
+            SDL_QueryTexture(itemTex.get(), NULL, NULL, &w, &h);
+            SDL_Rect dst = {itemPanelRect.x + 20, itemY, w, h};
+            SDL_RenderCopy(renderer, itemTex.get(), NULL, &dst);
+
+            if (item.is_equipped) {
+                SDL_Color equippedColor = {255, 220, 0, 255};
+                TexturePtr equippedMark = renderText("E", smallFont, equippedColor);
+                if (equippedMark) {
+                    int markW, markH;
+                    SDL_QueryTexture(equippedMark.get(), NULL, NULL, &markW, &markH);
+                    SDL_Rect markDst = {itemPanelRect.x + itemPanelRect.w - markW - 10, itemY, markW, markH};
+                    SDL_RenderCopy(renderer, equippedMark.get(), NULL, &markDst);
+                }
+            }
+            itemY += h + 5;
+        }
+    }
+}
+
+void Game::renderStatusPanel() {
+    SDL_Rect statusPanelRect = { SCREEN_WIDTH - 250, 20, 230, 200 };
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 192);
+    SDL_RenderFillRect(renderer, &statusPanelRect);
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderDrawRect(renderer, &statusPanelRect);
+
+    SDL_Color textColor = { 255, 255, 255, 255 };
+    int currentY = statusPanelRect.y + 10;
+    
+    auto renderStat = [&](const std::string& name, int value) {
+        std::string text = name + " : " + std::to_string(value);
+        TexturePtr tex = renderText(text, smallFont, textColor);
+        if (tex) {
+            int w, h;
+            SDL_QueryTexture(tex.get(), NULL, NULL, &w, &h);
+            SDL_Rect dst = { statusPanelRect.x + 15, currentY, w, h };
+            SDL_RenderCopy(renderer, tex.get(), NULL, &dst);
+            currentY += h + 5;
+        }
+    };
+
+    const Stats& playerCurrentStats = session.playerStats();
+    renderStat("HP", playerCurrentStats.hp);
+    renderStat("MP", playerCurrentStats.mp);
+    renderStat("ATK", playerCurrentStats.atk);
+    renderStat("DEF", playerCurrentStats.def);
+    renderStat("MAT", playerCurrentStats.mat);
+    renderStat("MDF", playerCurrentStats.mdf);
+    renderStat("SPD", playerCurrentStats.spd);
+}
+
+void Game::renderEnemyStatusPanel() {
+    const Monster* enemy = session.enemy();
+    if (!enemy) return;
+
+    SDL_Rect panelRect = { 20, 20, 230, 80 };
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 150, 0, 0, 192);
+    SDL_RenderFillRect(renderer, &panelRect);
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderDrawRect(renderer, &panelRect);
+
+    SDL_Color textColor = { 255, 255, 255, 255 };
+    int currentY = panelRect.y + 10;
+
+    TexturePtr nameTex = renderText(enemy->name, uiFont, textColor);
+    if (nameTex) {
+        int w, h;
+        SDL_QueryTexture(nameTex.get(), NULL, NULL, &w, &h);
+        SDL_Rect dst = { panelRect.x + 15, currentY, w, h };
+        SDL_RenderCopy(renderer, nameTex.get(), NULL, &dst);
+        currentY += h + 8;
+    }
+
+    std::string hpText = "HP : " + std::to_string(session.enemyStats().hp);
+    TexturePtr hpTex = renderText(hpText, smallFont, textColor);
+    if (hpTex) {
+        int w, h;
+        SDL_QueryTexture(hpTex.get(), NULL, NULL, &w, &h);
+        SDL_Rect dst = { panelRect.x + 15, currentY, w, h };
+        SDL_RenderCopy(renderer, hpTex.get(), NULL, &dst);
+    }
+}
+
+
+TexturePtr Game::renderText(const std::string &text, TTF_Font* font, SDL_Color color) {
+    if (text.empty()) return nullptr;
+    SDL_Surface* surface = TTF_RenderUTF8_Blended(font, text.c_str(), color);
+    if (!surface) return nullptr;
+    TexturePtr texture = createTextureFromSurface(renderer, surface);
+    SDL_FreeSurface(surface);
+    return texture;
+}
+
+void Game::cleanup() {
+    if (llm) llm->cancelPending();  // 生成中のものは待たずに切り上げさせる
+    session.waitPending();
+    llm.reset();
+    recorder.reset();  // 推論が終わってから閉じる
+    textureCache.reset();
+    assetBundle.close();
+    SDL_StopTextInput();
+    if(titleFont) TTF_CloseFont(titleFont);
+    if(uiFont) TTF_CloseFont(uiFont);
+    if(smallFont) TTF_CloseFont(smallFont);
+    if (renderer) SDL_DestroyRenderer(renderer);
+    if (window) SDL_DestroyWindow(window);
+    TTF_Quit();
+    IMG_Quit();
+    SDL_Quit();
+}
+
+void Game::resetGame() {
+    session.reset();
+    // 倒れたときと同じく、森の背景とモンスターはフェードを待たずに消す
+    forestBgAlpha = 0;
+    monsterAlpha = 0;
+}
@@ -0,0 +1,114 @@
+// Game.h - Prompt Quest: Core game engine implementation
+
+#ifndef GAME_H
+#define GAME_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <map>
+#include <cstdint>
+#include "LlmManager.h"
+#include "MockBackend.h"
+#include "RemoteBackend.h"
+#include "TextureCache.h"
+#include "AssetBundle.h"
+#include "ContentDatabase.h"
+#include "GameSession.h"
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+class Game {
+public:
+    Game(const std::map<std::string, LlmRoleConfig>& role_configs);
+    ~Game();
+
+    bool init();
+    void run();
+
+private:
+    using GameState = GameSession::State;
+
+    SDL_Window* window = nullptr;
+    SDL_Renderer* renderer = nullptr;
+    TTF_Font* titleFont = nullptr;
+    TTF_Font* uiFont = nullptr;
+    TTF_Font* smallFont = nullptr;
+
+    bool quit = false;
+    
+    std::string basePath;
+    std::map<std::string, LlmRoleConfig> roleConfigs;
+
+    // 画像はキャッシュ経由で取得する（描画サイズへ縮小、予算超過時はLRUで追い出し）
+    AssetBundle assetBundle;
+    std::unique_ptr<TextureCache> textureCache;
+    size_t textureBudgetBytes = 32 * 1024 * 1024;
+
+    std::string inputText = "";
+
+    // アイテム・モンスター・エリアは data/content.txt から読み込む
+    ContentDatabase content;
+    // ゲームの進行（会話・戦闘・もちもの）。生成と戦闘判定の乱数シード（PQ_SEED）は session.options.seed
+    GameSession session{content};
+    GameState shownState = GameState::TITLE;  // 前回の update() で見た状態（場面の切り替わりを知るため）
+
+    // プレイの記録（PQ_RECORD）。推論より後に解放する
+    std::string recordPath;
+    std::unique_ptr<SessionRecorder> recorder;
+    RecordedOutputs* recordedOutputs = nullptr;  // 再生時だけ（bench/replay_bench.cpp）
+
+    // 推論（既定は llama.cpp の LlmManager、PQ_LLM_MOCK や負荷試験では MockBackend、PQ_LLM_WORKER では RemoteBackend）
+    std::unique_ptr<InferenceBackend> llm;
+    std::string mockScriptPath;
+    std::string workerName;  // PQ_LLM_WORKER（tools/inference_worker に推論を頼む）
+    // モデルの重みとコンテキストに使うメモリの上限。役割ごとに別のモデルを指定した場合は、超えた分を古い順に解放する
+    size_t modelBudgetBytes = size_t(10) * 1024 * 1024 * 1024;
+    bool useSemanticCache = true;  // 意味の近い入力にはGM・戦闘の過去の応答を再利用する
+
+    Uint32 lastKeypressTime = 0;
+    const Uint32 keypressDelay = 250; 
+
+    // 画像フェード表示制御
+    bool isNpcImageVisible = false;
+    bool isForestBgVisible = false;
+    bool isMonsterVisible = false;
+    Uint8 npcImageAlpha = 0;
+    Uint8 forestBgAlpha = 0;
+    Uint8 monsterAlpha = 0;
+    
+    const int fadeSpeed = 8;  // フェードイン・アウト速度
+    
+    friend class RenderBench;  // bench/render_bench.cpp から描画関数を直接計測する
+    friend class ReplayBench;  // bench/replay_bench.cpp から記録した入力でゲームを動かす
+    friend class LoopStress;   // bench/loop_stress.cpp から MockBackend でゲームループに負荷をかける
+
+    bool initVideo(bool headless);
+    bool initContent();
+    bool initLlm();
+    void startRecording();
+
+    void handleEvents();
+    // プレイヤーの操作を session に反映する（受け付けられない状態なら false）
+    bool applyInput(const SessionInput& input);
+    void update();
+    void render();
+    
+    void render_Title();
+    void render_Field();
+    void render_Battle();
+
+    bool loadResources();
+    void cleanup();
+    void renderUI();
+    void renderStatusPanel();
+    void renderEnemyStatusPanel();
+    TexturePtr renderText(const std::string &text, TTF_Font* font, SDL_Color color);
+
+    bool initializeDatabase();
+    void resetGame();  // ゲーム状態をタイトル画面に戻す
+    void toggleTrace();  // F12: トレースの記録開始／logs/ への書き出し
+};
+
+#endif
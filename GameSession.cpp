@@ -0,0 +1,525 @@
+#include "GameSession.h"
+#include "Log.h"
+#include <algorithm>
+#include <iostream>
+
+// 進行に使うエリア名（背景・出現モンスターはファイル側で定義）
+const char* const VILLAGE_AREA = "始まりの村";
+const char* const FOREST_AREA = "静寂の森";
+
+GameSession::GameSession(const ContentDatabase& content) : content(content) {
+    introStory = {
+        "かつて、世界は万物の調和を司る「調和のクリスタル」の恩恵を受け、平和と繁栄を謳歌していた。",
+        "しかし、ある日、どこからともなく現れた謎の災厄「静寂」が世界を覆い始める。",
+        "物語は、世界の片隅にある「始まりの村」から始まる...",
+    };
+    transitionStory = {
+        "長老の言葉を胸に、あなたは村の門をくぐった。",
+        "一歩外に出ると、空気は重く、色彩は褪せている。これが「静寂」の影響か...",
+        "村のすぐそばに広がる「静寂の森」。不気味な静けさの中、あなたは意を決して足を踏み入れた。",
+        "...",
+        "森の奥、ひときわ大きな木の前で、異様な気配があなたを捉える！"
+    };
+}
+
+GameSession::~GameSession() { waitPending(); }
+
+bool GameSession::init() {
+    villageAreaId = content.findArea(VILLAGE_AREA);
+    forestAreaId = content.findArea(FOREST_AREA);
+    if (villageAreaId == INVALID_CONTENT_ID || forestAreaId == INVALID_CONTENT_ID) {
+        std::cerr << "Content file must define areas '" << VILLAGE_AREA << "' and '" << FOREST_AREA << "'" << std::endl;
+        return false;
+    }
+    if (content.area(forestAreaId).monsters.empty()) {
+        std::cerr << "Area '" << FOREST_AREA << "' has no monsters" << std::endl;
+        return false;
+    }
+
+    playerBaseStats = {50, 20, 10, 8, 18, 8, 7};
+    recalculateStats();
+    return true;
+}
+
+void GameSession::addLore(const ContentDatabase& content, InferenceBackend& llm) {
+    for (const LoreEntry& entry : content.lore()) llm.addLore(entry.text);
+    for (const Monster& monster : content.monsters()) {
+        if (!monster.description.empty()) llm.addLore(monster.name + ": " + monster.description);
+    }
+}
+
+const char* GameSession::stateName(State state) {
+    switch (state) {
+        case State::TITLE: return "TITLE";
+        case State::STORY: return "STORY";
+        case State::CONVERSATION: return "CONVERSATION";
+        case State::PROCESSING_GM: return "PROCESSING_GM";
+        case State::PROCESSING_NPC: return "PROCESSING_NPC";
+        case State::TRANSITION_TO_FOREST: return "TRANSITION_TO_FOREST";
+        case State::BATTLE: return "BATTLE";
+        case State::PROCESSING_BATTLE: return "PROCESSING_BATTLE";
+    }
+    return "?";
+}
+
+void GameSession::recordPhase(const char* name, std::chrono::steady_clock::time_point started) {
+    if (!recorder) return;
+    recorder->phase(name, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count());
+}
+
+bool GameSession::applyInput(const SessionInput& input, uint32_t now_ms) {
+    const State state = currentState;
+    switch (input.kind) {
+        case SessionInputKind::START:
+            if (currentState != State::TITLE) return false;
+            currentState = State::STORY;
+            pushToLog(introStory[currentStoryIndex]);
+            lastStoryTime = now_ms;
+            break;
+        case SessionInputKind::TEXT:
+            if (input.text.empty()) return false;
+            if (currentState == State::CONVERSATION) {
+                pushToLog("> " + input.text);
+                pushChat(ChatRole::USER, input.text);
+                currentState = State::PROCESSING_GM;
+            } else if (currentState == State::BATTLE) {
+                pushToLog("> " + input.text);
+                currentState = State::PROCESSING_BATTLE;
+            } else {
+                return false;
+            }
+            break;
+        case SessionInputKind::DEPART:
+            // 判定は会話の途中で先に届くので、長老の台詞が出終わるまでは押せない
+            if (!showDepartureButton || currentState != State::CONVERSATION) return false;
+            currentState = State::TRANSITION_TO_FOREST;
+            showDepartureButton = false;
+            isNpcImageVisible = false;
+            isForestBgVisible = false;
+            isMonsterVisible = false;
+
+            if (llm) llm->rememberEvent("勇者は長老に見送られ、静寂の森へ旅立った。");
+            conversationLog.clear();
+            conversation.clear();
+            pushToLog(transitionStory[0]);
+            lastTransitionTime = now_ms;
+            break;
+        case SessionInputKind::EQUIP:
+            if (input.item < 0 || input.item >= static_cast<int>(playerInventory.size())) return false;
+            onInventoryClick(input.item);
+            break;
+    }
+    if (recorder) recorder->input(stateName(state), input);
+    return true;
+}
+
+void GameSession::update(uint32_t now_ms) {
+    if (currentState == State::STORY) {
+        if (now_ms >= lastStoryTime + options.storyLineMs) {
+            currentStoryIndex++;
+            if (currentStoryIndex < introStory.size()) {
+                pushToLog(introStory[currentStoryIndex]);
+                lastStoryTime = now_ms;
+            } else {
+                currentState = State::CONVERSATION;
+                isNpcImageVisible = true;
+                pushToLog("長老: あなたか...。よく来てくれた。話したいことがある。");
+                pushChat(ChatRole::ASSISTANT, "あなたか...。よく来てくれた。話したいことがある。");
+            }
+        }
+        return;
+    }
+
+    if (currentState == State::TRANSITION_TO_FOREST) {
+        if (now_ms >= lastTransitionTime + options.storyLineMs) {
+            currentTransitionIndex++;
+            if (currentTransitionIndex < transitionStory.size()) {
+                pushToLog(transitionStory[currentTransitionIndex]);
+                lastTransitionTime = now_ms;
+
+                if (currentTransitionIndex == 1) {
+                    // "一歩外に出ると..." の時点で森の背景を表示開始
+                    isForestBgVisible = true;
+                } else if (currentTransitionIndex == 2) {
+                    // "村のすぐそばに広がる「静寂の森」..." の時点でNPC画像を非表示
+                    isNpcImageVisible = false;
+                }
+            } else {
+                currentState = State::BATTLE;
+                currentEnemyTemplate = &content.monster(content.area(forestAreaId).monsters.front());
+                currentEnemyStats = currentEnemyTemplate->stats;
+                battleResolver.begin(*currentEnemyTemplate, options.seed);
+                conversationLog.clear();
+                pushToLog(currentEnemyTemplate->name + " が現れた！");
+                pushToLog("コマンドを入力して戦おう");
+
+                // モンスター画像を表示開始
+                isMonsterVisible = true;
+            }
+        }
+        return;
+    }
+
+    // GM応答
+    if (currentState == State::PROCESSING_GM && !gm_future.valid()) {
+        auto decision = std::make_shared<std::promise<GmResponse>>();
+        gm_decision_future = decision->get_future();
+        GmDecisionCallback on_decision = [decision](const GmResponse& res) {
+            decision->set_value(res);
+            return true;  // scene_context はNPCの台詞に使うので最後まで生成する
+        };
+        auto generate = options.gmClassifier ? &InferenceBackend::generateGmDecision : &InferenceBackend::generateGmResponse;
+        gmStarted = std::chrono::steady_clock::now();
+        gm_future = std::async(std::launch::async, generate, llm, conversation.snapshot(), on_decision);
+    }
+
+    // GMの判定（action・items）は scene_context より先に届くので、その時点で反映する
+    if (gm_decision_future.valid() && gm_decision_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        try {
+            GmResponse decision = gm_decision_future.get();
+            if (decision.action == "DEPART") {
+                showDepartureButton = true;
+                llm->prefetch("BATTLE");  // 出発ボタンが押される前に戦闘用のモデルを用意する
+            }
+        } catch (const std::exception& e) {
+            PQ_LOG_ERROR(LogCategory::GM, "GM decision exception: " << e.what());
+        }
+        gm_decision_future = {};
+    }
+
+    // GM応答の完了チェック
+    if (currentState == State::PROCESSING_GM && gm_future.valid()) {
+        if (gm_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            try {
+                gm_response_buffer = gm_future.get();
+                recordPhase("GM", gmStarted);
+                // 判定に無い装備と場面の説明（候補の比較では action しか決まらない）は村の定義から補う
+                const Area& village = content.area(villageAreaId);
+                if (gm_response_buffer.scene_context.empty()) {
+                    gm_response_buffer.scene_context = gm_response_buffer.action == "DEPART" ? village.departScene : village.stayScene;
+                }
+                if (gm_response_buffer.action == "DEPART" && gm_response_buffer.items.empty()) {
+                    for (ContentId id : village.departItems) gm_response_buffer.items.push_back(content.item(id).name);
+                }
+                gm_future = {};
+                if (gm_response_buffer.action == "DEPART") {
+                    showDepartureButton = true;
+                    llm->prefetch("BATTLE");
+                }
+                currentState = State::PROCESSING_NPC;
+            } catch (const std::exception& e) {
+                PQ_LOG_ERROR(LogCategory::GM, "GM thread exception: " << e.what());
+                pushToLog("長老: （考えがまとまらぬ...）");
+                currentState = State::CONVERSATION;
+                gm_future = {};
+            }
+        }
+    }
+
+    if (currentState == State::PROCESSING_NPC && !npc_future.valid()) {
+        npcStarted = std::chrono::steady_clock::now();
+        npc_future = std::async(std::launch::async, &InferenceBackend::generateNpcDialogue, llm, conversation.snapshot(), gm_response_buffer.scene_context);
+    }
+
+    if (currentState == State::PROCESSING_NPC && npc_future.valid()) {
+        if (npc_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            try {
+                std::string dialogue = npc_future.get();
+                recordPhase("NPC", npcStarted);
+                if (!dialogue.empty()) {
+                    pushToLog("長老: " + dialogue);
+                    pushChat(ChatRole::ASSISTANT, dialogue);
+                }
+                if (gm_response_buffer.action == "DEPART" && !departureItemsGranted) {
+                    departureItemsGranted = true;
+                    for (const auto& item_name : gm_response_buffer.items) {
+                        ContentId item_id = content.findItem(item_name);
+                        if (item_id != INVALID_CONTENT_ID) {
+                            playerInventory.push_back(content.item(item_id));
+                            pushToLog("（" + playerInventory.back().name + " を手に入れた！）");
+                        }
+                    }
+                }
+            } catch (const std::exception& e) {
+                PQ_LOG_ERROR(LogCategory::NPC, "NPC thread exception: " << e.what());
+                pushToLog("長老: （...むずかしいことを言うのう）");
+            }
+            currentState = State::CONVERSATION;
+            npc_future = {};
+        }
+    }
+
+    // 戦闘応答
+    if (currentState == State::PROCESSING_BATTLE && !battle_future.valid()) {
+        std::string last_action = lastPlayerAction();
+
+        if (options.nativeBattleResolver) {
+            // 判定はその場で確定させ、LLMには結果に合わせた描写だけを非同期で頼む
+            BattleOutcome outcome = battleResolver.resolvePlayerAttack(playerCurrentStats, currentEnemyStats, last_action);
+            // 描写は1件ずつ（取り消すと同じ生成を待つ他の応答まで止まる）。前の描写の生成中に入った攻撃の描写は頼まない
+            if (options.battleNarration && llm && narration_future.valid()) {
+                PQ_LOG_INFO(LogCategory::BATTLE, "narration skipped: the previous attack's narration is still generating");
+            } else if (options.battleNarration && llm) {
+                std::string summary = !outcome.hit ? "攻撃は外れた"
+                    : outcome.weakness ? "弱点「" + outcome.matched_keyword + "」を突いて大きなダメージを与えた"
+                    : "攻撃が命中した";
+                narrationStarted = std::chrono::steady_clock::now();
+                narrationSerial = battleSerial;
+                narration_future = std::async(std::launch::async, &InferenceBackend::generateBattleNarration, llm,
+                    last_action, enemyInfoText(), summary);
+            }
+            BattleResponse res;
+            res.hit = outcome.hit;
+            res.damage = outcome.damage;
+            res.effect_text = outcome.effect_text;
+            applyBattleResult(res);
+        } else {
+            auto stats_to_string = [](const Stats& s) {
+                return "HP:" + std::to_string(s.hp) + ", ATK:" + std::to_string(s.atk) + ", DEF:" + std::to_string(s.def) +
+                       ", MAT:" + std::to_string(s.mat) + ", MDF:" + std::to_string(s.mdf);
+            };
+            auto decision = std::make_shared<std::promise<BattleResponse>>();
+            battle_decision_future = decision->get_future();
+            BattleDecisionCallback on_decision = [decision](const BattleResponse& res) {
+                decision->set_value(res);
+                return true;
+            };
+            battleStarted = std::chrono::steady_clock::now();
+            battleRequestSerial = battleSerial;
+            battle_future = std::async(std::launch::async, &InferenceBackend::generateBattleResponse, llm,
+                stats_to_string(playerCurrentStats), stats_to_string(currentEnemyStats), last_action, enemyInfoText(), on_decision);
+        }
+    }
+
+    // LLM裁定の hit・damage が揃ったら、effect_text を待たずにダメージを反映する
+    if (battle_decision_future.valid() && battle_decision_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        try {
+            BattleResponse res = battle_decision_future.get();
+            if (battleRequestSerial == battleSerial) {
+                res.effect_text.clear();
+                battleDecisionApplied = true;
+                applyBattleResult(res);
+            }
+        } catch (const std::exception& e) {
+            PQ_LOG_ERROR(LogCategory::BATTLE, "battle decision exception: " << e.what());
+        }
+        battle_decision_future = {};
+    }
+
+    // 戦闘応答の完了チェック（LLM裁定時）。判定を反映済みなら説明文だけを表示する
+    if (battle_future.valid() && battle_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        BattleResponse res;
+        try {
+            res = battle_future.get();
+            recordPhase("BATTLE", battleStarted);
+        } catch (const std::exception& e) {
+            PQ_LOG_ERROR(LogCategory::BATTLE, "battle thread exception: " << e.what());
+            res = BattleResponse();
+            res.effect_text = battleDecisionApplied ? "" : "（しかし何も起こらなかった...）";
+        }
+        battle_future = {};
+        if (battleRequestSerial != battleSerial) {
+            // 判定で決着した（倒した・倒れた）か、リセットした後に届いた。説明文も判定も捨てる
+            battleDecisionApplied = false;
+        } else if (battleDecisionApplied) {
+            battleDecisionApplied = false;
+            if (!res.effect_text.empty()) pushToLog(res.effect_text);
+        } else {
+            applyBattleResult(res);
+        }
+    }
+
+    // 戦闘描写の到着
+    if (narration_future.valid() && narration_future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        try {
+            std::string narration = narration_future.get();
+            recordPhase("NARRATION", narrationStarted);
+            // 決着した戦闘の描写は、次の入力の後に流れてしまうので捨てる
+            if (!narration.empty() && narrationSerial == battleSerial) pushToLog(narration);
+        } catch (const std::exception& e) {
+            PQ_LOG_ERROR(LogCategory::BATTLE, "narration thread exception: " << e.what());
+        }
+        narration_future = {};
+    }
+}
+
+bool GameSession::llmBusy() const {
+    switch (currentState) {
+        case State::PROCESSING_GM:
+        case State::PROCESSING_NPC:
+        case State::PROCESSING_BATTLE:
+            return true;
+        default:
+            // 戦闘の描写は BATTLE に戻った後も生成が続く
+            return gm_future.valid() || npc_future.valid() || battle_future.valid() || narration_future.valid();
+    }
+}
+
+bool GameSession::inFlight() const {
+    auto pending = [](const auto& future) {
+        return future.valid() && future.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+    };
+    return pending(gm_future) || pending(npc_future) || pending(battle_future) || pending(narration_future);
+}
+
+void GameSession::waitPending() {
+    if (gm_future.valid()) gm_future.wait();
+    if (npc_future.valid()) npc_future.wait();
+    if (battle_future.valid()) battle_future.wait();
+    if (narration_future.valid()) narration_future.wait();
+}
+
+std::string GameSession::lastPlayerAction() const {
+    for (auto it = conversationLog.rbegin(); it != conversationLog.rend(); ++it) {
+        if (it->rfind("> ", 0) == 0) return it->substr(2);
+    }
+    return "";
+}
+
+std::string GameSession::enemyInfoText() const {
+    // 敵の弱点情報を含む詳細情報を作成
+    std::string enemy_info = currentEnemyTemplate->description + " 弱点: ";
+    for (size_t i = 0; i < currentEnemyTemplate->weaknesses.size(); ++i) {
+        enemy_info += currentEnemyTemplate->weaknesses[i];
+        if (i < currentEnemyTemplate->weaknesses.size() - 1) {
+            enemy_info += "、";
+        }
+    }
+    return enemy_info;
+}
+
+void GameSession::applyBattleResult(const BattleResponse& res) {
+    if (!res.effect_text.empty()) pushToLog(res.effect_text);
+    if (res.hit) {
+        currentEnemyStats.hp -= res.damage;
+        pushToLog(currentEnemyTemplate->name + "に" + std::to_string(res.damage) + "のダメージ！");
+        if (currentEnemyStats.hp <= 0) {
+            currentEnemyStats.hp = 0;
+            pushToLog(currentEnemyTemplate->name + "を倒した！");
+            currentState = State::CONVERSATION;
+            battleSerial++;
+            if (llm) {
+                std::string action = lastPlayerAction();
+                llm->rememberEvent("勇者は" + currentEnemyTemplate->name + "を倒した" +
+                                          (action.empty() ? std::string("。") : "（決め手: " + action + "）。"));
+                llm->prefetch("GM");
+                llm->prefetch("NPC");
+            }
+        }
+    }
+
+    if (currentEnemyStats.hp > 0) {
+         pushToLog(currentEnemyTemplate->name + "の攻撃！");
+         int damage_to_player = battleResolver.resolveEnemyAttack(currentEnemyStats, playerCurrentStats);
+         playerCurrentStats.hp -= damage_to_player;
+         pushToLog("プレイヤーは" + std::to_string(damage_to_player) + "のダメージを受けた！");
+         if(playerCurrentStats.hp <= 0) {
+            playerCurrentStats.hp = 0;
+            pushToLog("あなたは倒れてしまった...");
+            reset();
+         } else {
+            currentState = State::BATTLE;
+         }
+    }
+}
+
+void GameSession::pushToLog(const std::string& text) {
+    conversationLog.push_back(text);
+    pushedLines++;
+    if (conversationLog.size() > 20) {
+        conversationLog.erase(conversationLog.begin());
+    }
+}
+
+void GameSession::pushChat(ChatRole role, std::string text) {
+    ChatTurn turn;
+    turn.role = role;
+    turn.text = std::move(text);
+    // トークン数は追加前に一度だけ数え、以降のリクエストでは保持した値を使う
+    if (llm) llm->measureTokens("GM", turn);
+    conversation.append(std::move(turn));
+    // 履歴から押し出された後も、関係のある発言は NPC のプロンプトに引き戻せるよう索引にも入れる
+    if (llm) llm->rememberTurn(conversation.snapshot().back());
+}
+
+void GameSession::onInventoryClick(int item_index) {
+    if (item_index < 0 || item_index >= playerInventory.size()) return;
+
+    Item& clickedItem = playerInventory[item_index];
+
+    if (clickedItem.type == ItemType::WEAPON) {
+        if (clickedItem.is_equipped) {
+            clickedItem.is_equipped = false;
+            equippedWeapon = -1;
+        } else {
+            if (equippedWeapon >= 0) {
+                playerInventory[equippedWeapon].is_equipped = false;
+            }
+            clickedItem.is_equipped = true;
+            equippedWeapon = item_index;
+        }
+    } else if (clickedItem.type == ItemType::ARMOR) {
+        if (clickedItem.is_equipped) {
+            clickedItem.is_equipped = false;
+            equippedArmor = -1;
+        } else {
+            if (equippedArmor >= 0) {
+                playerInventory[equippedArmor].is_equipped = false;
+            }
+            clickedItem.is_equipped = true;
+            equippedArmor = item_index;
+        }
+    }
+
+    recalculateStats();
+}
+
+void GameSession::recalculateStats() {
+    playerCurrentStats = playerBaseStats;
+
+    auto addStats = [&](const Stats& itemStats) {
+        playerCurrentStats.hp += itemStats.hp;
+        playerCurrentStats.mp += itemStats.mp;
+        playerCurrentStats.atk += itemStats.atk;
+        playerCurrentStats.def += itemStats.def;
+        playerCurrentStats.mat += itemStats.mat;
+        playerCurrentStats.mdf += itemStats.mdf;
+        playerCurrentStats.spd += itemStats.spd;
+    };
+
+    if (equippedWeapon >= 0) {
+        addStats(playerInventory[equippedWeapon].stats);
+    }
+    if (equippedArmor >= 0) {
+        addStats(playerInventory[equippedArmor].stats);
+    }
+}
+
+void GameSession::reset() {
+    currentState = State::TITLE;
+    conversationLog.clear();
+    conversation.clear();
+    // 生成中の戦闘応答・描写は届いても捨て、届いていない判定は次の戦闘に持ち越さない
+    battleSerial++;
+    battleDecisionApplied = false;
+    battle_decision_future = {};
+    if (llm) {
+        llm->cancelPending();  // 倒れた後に届く戦闘の説明文と描写は捨てるので、生成を打ち切る
+        llm->forgetEpisodes();
+    }
+    equippedWeapon = -1;
+    equippedArmor = -1;
+    departureItemsGranted = false;
+    playerInventory.clear();
+
+    recalculateStats(); // ステータスを初期値に戻す
+
+    isNpcImageVisible = false;
+    showDepartureButton = false;
+
+    isForestBgVisible = false;
+    isMonsterVisible = false;
+
+    currentStoryIndex = 0;
+    currentTransitionIndex = 0;
+}
@@ -0,0 +1,146 @@
+// GameSession.h - Prompt Quest: 画面に依存しないゲームの進行（会話・GMの判定・戦闘・もちものとステータス）
+//
+// Game（SDL の画面を持つ1人用）と tools/game_server（画面を持たずに複数のプレイヤーを受け持つ）の両方が使う。
+// 時刻は呼び出し側がミリ秒で渡す。推論と記録は借りるだけなので、持ち主はこのセッションより後に解放する。
+
+#ifndef GAME_SESSION_H
+#define GAME_SESSION_H
+
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <string>
+#include <vector>
+#include "BattleResolver.h"
+#include "ContentDatabase.h"
+#include "ConversationState.h"
+#include "InferenceBackend.h"
+#include "SessionRecorder.h"
+
+struct GameSessionOptions {
+    // 戦闘判定の乱数シード（PQ_SEED）。記録したセッションは同じシードで再生する
+    uint32_t seed = BattleResolver::DEFAULT_SEED;
+    uint32_t storyLineMs = 2500;  // 導入と森への移動で1行を表示しておく時間
+    // 戦闘の判定はBattleResolverで即座に行い、LLMは描写の一文だけを後から届ける。
+    // false にすると従来どおりLLMがダメージと命中を決める。
+    bool nativeBattleResolver = true;
+    bool battleNarration = true;
+    bool gmClassifier = true;  // GMの判定をJSON生成ではなく候補の対数確率比較で行う
+};
+
+class GameSession {
+public:
+    enum class State { TITLE, STORY, CONVERSATION, PROCESSING_GM, PROCESSING_NPC, TRANSITION_TO_FOREST, BATTLE, PROCESSING_BATTLE };
+
+    // content は読み込む前に渡してよい（init() より前には使わない）
+    explicit GameSession(const ContentDatabase& content);
+    ~GameSession();
+
+    GameSession(const GameSession&) = delete;
+    GameSession& operator=(const GameSession&) = delete;
+
+    GameSessionOptions options;
+
+    // content を読み込んだ後に呼ぶ。進行に使うエリアが無ければエラーを出力して false
+    bool init();
+    void setBackend(InferenceBackend* llm) { this->llm = llm; }
+    void setRecorder(SessionRecorder* recorder) { this->recorder = recorder; }
+    // 世界設定の断片とモンスターの説明を、長老が必要なときに引ける記憶として llm に入れる（推論ごとに1度）
+    static void addLore(const ContentDatabase& content, InferenceBackend& llm);
+
+    // プレイヤーの操作を反映する（受け付けられない状態なら false）。記録中なら書き出す
+    bool applyInput(const SessionInput& input, uint32_t now_ms);
+    // 導入・移動の行送りと、届いた推論の結果を反映する。入力の有無にかかわらず毎フレーム呼ぶ
+    void update(uint32_t now_ms);
+    void reset();  // タイトル画面に戻す
+    // 生成中のものが終わるのを待って結果を捨てる（推論を解放する前に呼ぶ。打ち切るのは呼び出し側）
+    void waitPending();
+
+    State state() const { return currentState; }
+    static const char* stateName(State state);
+    bool llmBusy() const;      // 推論の結果を待っているか
+    bool inFlight() const;     // 届いていない推論の結果があるか（llmBusy と違い、届いて未反映のものは含めない）
+    bool acceptsInput() const { return currentState == State::TITLE || currentState == State::CONVERSATION || currentState == State::BATTLE; }
+
+    // 画面に出す内容
+    const std::vector<std::string>& log() const { return conversationLog; }
+    uint64_t logCount() const { return pushedLines; }  // これまでに足した行の数（古い行を消しても減らない）
+    const std::vector<Item>& inventory() const { return playerInventory; }
+    const Stats& playerStats() const { return playerCurrentStats; }
+    const Monster* enemy() const { return currentEnemyTemplate; }
+    const Stats& enemyStats() const { return currentEnemyStats; }
+    bool departureAvailable() const { return showDepartureButton; }
+    bool npcVisible() const { return isNpcImageVisible; }
+    bool forestVisible() const { return isForestBgVisible; }
+    bool monsterVisible() const { return isMonsterVisible; }
+    ContentId villageArea() const { return villageAreaId; }
+    ContentId forestArea() const { return forestAreaId; }
+
+private:
+    friend class RenderBench;  // bench/render_bench.cpp から描画する場面を直接組み立てる
+
+    const ContentDatabase& content;
+    ContentId villageAreaId = INVALID_CONTENT_ID;
+    ContentId forestAreaId = INVALID_CONTENT_ID;
+    InferenceBackend* llm = nullptr;
+    SessionRecorder* recorder = nullptr;
+
+    State currentState = State::TITLE;
+    std::vector<std::string> conversationLog;
+    uint64_t pushedLines = 0;
+    std::vector<Item> playerInventory;
+
+    Stats playerBaseStats;
+    Stats playerCurrentStats;
+    // 装備中のもちものの playerInventory での位置（-1 は無し）。もちものが増えると配列は移動するのでポインタは持たない
+    int equippedWeapon = -1;
+    int equippedArmor = -1;
+    bool departureItemsGranted = false;  // 出発の装備はGMが何度 DEPART と答えても1度だけ渡す
+
+    const Monster* currentEnemyTemplate = nullptr;
+    Stats currentEnemyStats;
+    BattleResolver battleResolver;
+
+    std::vector<std::string> introStory;
+    std::vector<std::string> transitionStory;
+    int currentStoryIndex = 0;
+    int currentTransitionIndex = 0;
+    uint32_t lastStoryTime = 0;
+    uint32_t lastTransitionTime = 0;
+    bool showDepartureButton = false;
+
+    // 場面に出ているもの（画面側はこれに合わせてフェードする）
+    bool isNpcImageVisible = false;
+    bool isForestBgVisible = false;
+    bool isMonsterVisible = false;
+
+    // 非同期処理用
+    std::future<GmResponse> gm_future;
+    std::future<std::string> npc_future;
+    std::future<BattleResponse> battle_future;
+    std::future<std::string> narration_future;
+    // 判定フィールドだけの途中結果。説明文の生成が終わる前に届く。
+    std::future<GmResponse> gm_decision_future;
+    std::future<BattleResponse> battle_decision_future;
+    bool battleDecisionApplied = false;  // LLM裁定の判定を適用済みで、effect_text の到着待ち
+    // 戦闘が決着するかリセットするたびに進める。応答・描写は頼んだときの値と違えば、決着済みの戦闘のものとして捨てる
+    uint32_t battleSerial = 0;
+    uint32_t battleRequestSerial = 0;
+    uint32_t narrationSerial = 0;
+    GmResponse gm_response_buffer;
+    // 長老との会話の履歴（表示用ログとは別）。リクエストにはスナップショットを渡す
+    ConversationState conversation;
+    // セッション記録用に、各非同期処理を始めた時刻
+    std::chrono::steady_clock::time_point gmStarted, npcStarted, battleStarted, narrationStarted;
+
+    void recordPhase(const char* name, std::chrono::steady_clock::time_point started);
+    void pushToLog(const std::string& text);
+    void pushChat(ChatRole role, std::string text);
+    std::string lastPlayerAction() const;
+    std::string enemyInfoText() const;
+    void applyBattleResult(const BattleResponse& res);
+    void onInventoryClick(int item_index);
+    void recalculateStats();
+};
+
+#endif
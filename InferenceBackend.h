@@ -0,0 +1,72 @@
+// InferenceBackend.h - Prompt Quest: ゲームが使う推論の窓口（llama.cpp の LlmManager と、テスト用の MockBackend）
+
+#ifndef INFERENCE_BACKEND_H
+#define INFERENCE_BACKEND_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "ConversationState.h"
+
+class SessionRecorder;
+
+struct GmResponse {
+    std::string scene_context;
+    std::string action = "CONTINUE";
+    std::vector<std::string> items;
+};
+
+struct BattleResponse {
+    int damage = 0;
+    bool hit = false;
+    std::string effect_text;
+};
+
+// ゲームが判定に使うフィールド（GMは action・items、戦闘は hit・damage）が揃った時点で呼ばれる。
+// 説明文（scene_context / effect_text）はまだ空のことがある。false を返すと説明文を待たずに生成を打ち切る。
+using GmDecisionCallback = std::function<bool(const GmResponse&)>;
+using BattleDecisionCallback = std::function<bool(const BattleResponse&)>;
+
+// generate* はゲームの非同期処理（std::async）から同時に呼ばれる。それ以外もどのスレッドから呼んでもよい。
+// 推論に関係しない呼び出し（先読みや記憶など）は既定では何もしない。
+class InferenceBackend {
+public:
+    virtual ~InferenceBackend() = default;
+
+    // on_decision には判定フィールドが揃った時点の途中結果が1度だけ渡される（戻り値は最終結果）
+    virtual GmResponse generateGmResponse(const ConversationView& history, const GmDecisionCallback& on_decision = nullptr) = 0;
+    // action（CONTINUE/DEPART）だけを決める軽い判定。items・scene_context が空なら呼び出し側がコンテンツから補う
+    virtual GmResponse generateGmDecision(const ConversationView& history, const GmDecisionCallback& on_decision = nullptr) = 0;
+    virtual std::string generateNpcDialogue(const ConversationView& history, const std::string& scene_context) = 0;
+    virtual BattleResponse generateBattleResponse(const std::string& player_stats, const std::string& enemy_stats, const std::string& player_action,
+                                                  const std::string& enemy_info = "", const BattleDecisionCallback& on_decision = nullptr) = 0;
+    // 判定済みの戦闘結果に添える一文
+    virtual std::string generateBattleNarration(const std::string& player_action, const std::string& enemy_info, const std::string& outcome) = 0;
+
+    // 呼び出し済みの generate* をすべて早めに切り上げさせる（待っているものも含む）。
+    // 切り上げた呼び出しはそこまでの結果（空のこともある）を返す。以降の呼び出しは普通に動く
+    virtual void cancelPending() = 0;
+
+    // 生成の乱数シード。役割ごとの呼び出しの順が同じなら同じ結果になる
+    virtual void setSeed(uint32_t seed) = 0;
+    // 問い合わせを recorder に書き出す。nullptr で止める
+    virtual void setRecorder(SessionRecorder* recorder) {}
+
+    // 役割の準備を裏で始めておく（次の状態で使う役割のヒント）
+    virtual void prefetch(const std::string& role) {}
+    // ゲームが入力待ちの間は true（推論スレッドを眠らせてよい）
+    virtual void setThreadsIdle(bool idle) {}
+    // 発言のトークン数を数えて turn に入れる（履歴に追加する前に呼ぶ）
+    virtual void measureTokens(const std::string& role, ChatTurn& turn) {}
+
+    // 長老のプロンプトに関係のある部分だけを引いて入れる記憶
+    virtual void addLore(const std::string& text) {}
+    virtual void rememberTurn(const ChatTurn& turn) {}
+    virtual void rememberEvent(const std::string& text) {}
+    virtual void forgetEpisodes() {}
+
+    virtual void printMetrics() const {}
+};
+
+#endif
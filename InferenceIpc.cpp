@@ -0,0 +1,354 @@
+#include "InferenceIpc.h"
+#include "Log.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <new>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace ipc {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+int remainingMs(Clock::time_point deadline) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+    return left > 0 ? static_cast<int>(left) : 0;
+}
+
+#if defined(__linux__)
+std::string shmName(const std::string& name) { return "/pq_worker_" + name; }
+#endif
+
+} // namespace
+
+// ---- futex ----
+
+#if defined(__linux__)
+
+void wait(std::atomic<uint32_t>& word, uint32_t expected, int timeout_ms) {
+    if (timeout_ms <= 0) return;
+    struct timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = static_cast<long>(timeout_ms % 1000) * 1000000L;
+    // 共有メモリ上の語なので FUTEX_PRIVATE_FLAG は付けない。値が変わっていれば（EAGAIN）すぐ戻る
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+}
+
+void wake(std::atomic<uint32_t>& word) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+int32_t currentPid() { return static_cast<int32_t>(getpid()); }
+
+bool processAlive(int32_t pid) {
+    if (pid <= 0) return false;
+    return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+#else
+
+void wait(std::atomic<uint32_t>&, uint32_t, int) {}
+void wake(std::atomic<uint32_t>&) {}
+int32_t currentPid() { return 0; }
+bool processAlive(int32_t) { return false; }
+
+#endif
+
+// ---- Ring ----
+
+void Ring::copyIn(uint64_t pos, const void* src, size_t n) {
+    size_t offset = static_cast<size_t>(pos % RING_BYTES);
+    size_t first = std::min(n, RING_BYTES - offset);
+    std::memcpy(data + offset, src, first);
+    if (first < n) std::memcpy(data, static_cast<const char*>(src) + first, n - first);
+}
+
+void Ring::copyOut(uint64_t pos, void* dst, size_t n) const {
+    size_t offset = static_cast<size_t>(pos % RING_BYTES);
+    size_t first = std::min(n, RING_BYTES - offset);
+    std::memcpy(dst, data + offset, first);
+    if (first < n) std::memcpy(static_cast<char*>(dst) + first, data, n - first);
+}
+
+bool Ring::write(std::string_view message, int timeout_ms) {
+    const uint64_t needed = sizeof(uint32_t) + message.size();
+    if (needed > RING_BYTES) return false;
+
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    uint64_t head = header.head.load(std::memory_order_relaxed);  // 進めるのは自分だけ
+    for (;;) {
+        // consumed を先に読む: tail を読んだ後に読まれても値が変わって futex はすぐ戻る
+        uint32_t seen = header.consumed.load(std::memory_order_acquire);
+        uint64_t tail = header.tail.load(std::memory_order_acquire);
+        if (RING_BYTES - (head - tail) >= needed) break;
+        int left = remainingMs(deadline);
+        if (left == 0) return false;
+        wait(header.consumed, seen, left);
+    }
+
+    uint32_t length = static_cast<uint32_t>(message.size());
+    copyIn(head, &length, sizeof(length));
+    copyIn(head + sizeof(length), message.data(), message.size());
+    header.head.store(head + needed, std::memory_order_release);
+    header.written.fetch_add(1, std::memory_order_release);
+    wake(header.written);
+    return true;
+}
+
+bool Ring::read(std::string& message, int timeout_ms) {
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    uint64_t tail = header.tail.load(std::memory_order_relaxed);  // 進めるのは自分だけ
+    uint64_t head;
+    for (;;) {
+        uint32_t seen = header.written.load(std::memory_order_acquire);
+        head = header.head.load(std::memory_order_acquire);
+        if (head != tail) break;
+        int left = remainingMs(deadline);
+        if (left == 0) return false;
+        wait(header.written, seen, left);
+    }
+
+    uint32_t length = 0;
+    copyOut(tail, &length, sizeof(length));
+    if (sizeof(length) + static_cast<uint64_t>(length) > head - tail) {
+        // 書く側が壊れている。読める分を捨てて続ける
+        PQ_LOG_ERROR(LogCategory::LLM, "corrupted message in inference ring (" << length << " bytes)");
+        header.tail.store(head, std::memory_order_release);
+        return false;
+    }
+    message.resize(length);
+    copyOut(tail + sizeof(length), message.data(), length);
+    header.tail.store(tail + sizeof(length) + length, std::memory_order_release);
+    header.consumed.fetch_add(1, std::memory_order_release);
+    wake(header.consumed);
+    return true;
+}
+
+void Ring::reset() {
+    header.head.store(0, std::memory_order_relaxed);
+    header.tail.store(0, std::memory_order_relaxed);
+    header.written.store(0, std::memory_order_relaxed);
+    header.consumed.store(0, std::memory_order_release);
+}
+
+// ---- SharedMemory ----
+
+SharedMemory::~SharedMemory() { close(); }
+
+#if defined(__linux__)
+
+bool SharedMemory::create(const std::string& name) {
+    close();
+    const std::string path = shmName(name);
+    shm_unlink(path.c_str());  // 前回異常終了したワーカーの残り
+    int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        PQ_LOG_ERROR(LogCategory::LLM, "Failed to create shared memory " << path << ": " << std::strerror(errno));
+        return false;
+    }
+    if (ftruncate(fd, sizeof(SharedRegion)) != 0) {
+        PQ_LOG_ERROR(LogCategory::LLM, "Failed to size shared memory " << path << ": " << std::strerror(errno));
+        ::close(fd);
+        shm_unlink(path.c_str());
+        return false;
+    }
+    void* view = mmap(nullptr, sizeof(SharedRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (view == MAP_FAILED) {
+        PQ_LOG_ERROR(LogCategory::LLM, "Failed to map shared memory " << path << ": " << std::strerror(errno));
+        shm_unlink(path.c_str());
+        return false;
+    }
+
+    // ftruncate で0埋めされているので、atomic はすべて0（FREE・空のリング）から始まる
+    mapped = static_cast<SharedRegion*>(view);
+    ownedName = path;
+    mapped->version = VERSION;
+    mapped->workerPid.store(currentPid(), std::memory_order_relaxed);
+    mapped->magic.store(MAGIC, std::memory_order_release);
+    return true;
+}
+
+bool SharedMemory::open(const std::string& name) {
+    close();
+    const std::string path = shmName(name);
+    int fd = shm_open(path.c_str(), O_RDWR, 0);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) != sizeof(SharedRegion)) {
+        ::close(fd);
+        return false;
+    }
+    void* view = mmap(nullptr, sizeof(SharedRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (view == MAP_FAILED) return false;
+
+    auto* region = static_cast<SharedRegion*>(view);
+    if (region->magic.load(std::memory_order_acquire) != MAGIC || region->version != VERSION) {
+        munmap(view, sizeof(SharedRegion));
+        return false;
+    }
+    mapped = region;
+    return true;
+}
+
+void SharedMemory::close() {
+    if (mapped) {
+        if (!ownedName.empty()) mapped->magic.store(0, std::memory_order_release);
+        munmap(mapped, sizeof(SharedRegion));
+        mapped = nullptr;
+    }
+    if (!ownedName.empty()) {
+        shm_unlink(ownedName.c_str());
+        ownedName.clear();
+    }
+}
+
+#else
+
+bool SharedMemory::create(const std::string& name) {
+    PQ_LOG_ERROR(LogCategory::LLM, "The inference worker is only supported on Linux");
+    return false;
+}
+
+bool SharedMemory::open(const std::string& name) { return false; }
+
+void SharedMemory::close() {}
+
+#endif
+
+// ---- メッセージ ----
+
+MessageWriter::MessageWriter(MessageType type, uint64_t id) {
+    u8(static_cast<uint8_t>(type));
+    u64(id);
+}
+
+MessageWriter& MessageWriter::u8(uint8_t v) {
+    buffer.push_back(static_cast<char>(v));
+    return *this;
+}
+
+MessageWriter& MessageWriter::u32(uint32_t v) {
+    buffer.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    return *this;
+}
+
+MessageWriter& MessageWriter::u64(uint64_t v) {
+    buffer.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    return *this;
+}
+
+MessageWriter& MessageWriter::str(std::string_view v) {
+    u32(static_cast<uint32_t>(v.size()));
+    buffer.append(v.data(), v.size());
+    return *this;
+}
+
+MessageReader::MessageReader(std::string_view data) : rest(data) {
+    messageType = static_cast<MessageType>(u8());
+    requestId = u64();
+}
+
+bool MessageReader::take(void* out, size_t n) {
+    if (!valid || rest.size() < n) {
+        valid = false;
+        std::memset(out, 0, n);
+        return false;
+    }
+    std::memcpy(out, rest.data(), n);
+    rest.remove_prefix(n);
+    return true;
+}
+
+uint8_t MessageReader::u8() {
+    uint8_t v;
+    take(&v, sizeof(v));
+    return v;
+}
+
+uint32_t MessageReader::u32() {
+    uint32_t v;
+    take(&v, sizeof(v));
+    return v;
+}
+
+uint64_t MessageReader::u64() {
+    uint64_t v;
+    take(&v, sizeof(v));
+    return v;
+}
+
+std::string MessageReader::str() {
+    uint32_t length = u32();
+    if (!valid || rest.size() < length) {
+        valid = false;
+        return std::string();
+    }
+    std::string v(rest.substr(0, length));
+    rest.remove_prefix(length);
+    return v;
+}
+
+void writeHistory(MessageWriter& out, const ConversationView& history) {
+    out.u32(static_cast<uint32_t>(history.size()));
+    for (size_t i = 0; i < history.size(); ++i) {
+        const ChatTurn& turn = history[i];
+        out.u8(static_cast<uint8_t>(turn.role)).u64(turn.serial).str(turn.text);
+    }
+}
+
+bool readHistory(MessageReader& in, ConversationState& out) {
+    uint32_t count = in.u32();
+    if (count > ConversationView::CAPACITY) return false;
+    for (uint32_t i = 0; i < count && in.ok(); ++i) {
+        ChatTurn turn;
+        turn.role = in.u8() == static_cast<uint8_t>(ChatRole::ASSISTANT) ? ChatRole::ASSISTANT : ChatRole::USER;
+        turn.serial = in.u64();
+        turn.text = in.str();
+        out.restore(std::move(turn));
+    }
+    return in.ok();
+}
+
+void writeGm(MessageWriter& out, const GmResponse& res) {
+    out.str(res.action).str(res.scene_context).u32(static_cast<uint32_t>(res.items.size()));
+    for (const auto& item : res.items) out.str(item);
+}
+
+GmResponse readGm(MessageReader& in) {
+    GmResponse res;
+    res.action = in.str();
+    res.scene_context = in.str();
+    uint32_t count = in.u32();
+    for (uint32_t i = 0; i < count && in.ok(); ++i) res.items.push_back(in.str());
+    return res;
+}
+
+void writeBattle(MessageWriter& out, const BattleResponse& res) {
+    out.u8(res.hit ? 1 : 0).u32(static_cast<uint32_t>(res.damage)).str(res.effect_text);
+}
+
+BattleResponse readBattle(MessageReader& in) {
+    BattleResponse res;
+    res.hit = in.u8() != 0;
+    res.damage = static_cast<int>(in.u32());
+    res.effect_text = in.str();
+    return res;
+}
+
+} // namespace ipc
@@ -0,0 +1,178 @@
+// InferenceIpc.h - Prompt Quest: ゲームと推論ワーカー（tools/inference_worker.cpp）の間の共有メモリ
+//
+// ワーカーが名前付きの共有メモリを作り、ゲームは接続するたびに空いているクライアント枠を1つ取る。
+// 枠ごとに要求（ゲーム→ワーカー）と応答（ワーカー→ゲーム）の2本のリングを持ち、メッセージは
+// [長さ u32][本体] の形でリングへ直接書く（ソケットもカーネルのバッファも通らない）。
+// 待つ側は futex で眠り、書いた側・読んだ側が起こす。Linux のみ対応（他の環境では create/open が失敗する）。
+
+#ifndef INFERENCE_IPC_H
+#define INFERENCE_IPC_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "InferenceBackend.h"
+
+namespace ipc {
+
+const uint32_t MAGIC = 0x57515150;  // "PQQW"
+const uint32_t VERSION = 2;
+const size_t MAX_CLIENTS = 8;
+const size_t RING_BYTES = 1 << 20;  // 1方向あたり。会話の履歴128発言でも十分に入る
+
+enum class SlotState : uint32_t {
+    FREE,       // 空き（ワーカーが空ける）
+    CLAIMING,   // ゲームがリングを初期化している（取った直後に pid を書く。途中で終了したゲームの枠はワーカーが空ける）
+    CONNECTED,
+    CLOSED      // ゲームが切断した（ワーカーが片付けて FREE に戻す）
+};
+
+enum class MessageType : uint8_t {
+    // ゲーム → ワーカー
+    GM_RESPONSE = 1,
+    GM_DECISION,
+    NPC_DIALOGUE,
+    BATTLE_RESPONSE,
+    BATTLE_NARRATION,
+    CANCEL,
+    SET_SEED,
+    PREFETCH,
+    THREADS_IDLE,
+    ADD_LORE,
+    REMEMBER_TURN,
+    REMEMBER_EVENT,
+    FORGET_EPISODES,
+    ROLE_CONFIGS,    // 接続直後に送る [数 u32]([役割][LlmRoleConfig::summary()])...。設定が違えば ERROR_RESULT で断られる
+    // ワーカー → ゲーム
+    GM_DECISION_READY = 64,  // on_decision に渡す途中結果
+    BATTLE_DECISION_READY,
+    GM_RESULT,
+    BATTLE_RESULT,
+    TEXT_RESULT,
+    ERROR_RESULT
+};
+
+// 共有メモリ上に置くのでアドレスに依存しない（ロックフリーの）atomic だけを使う
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+              "shared-memory rings need address-free atomics");
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be 32 bits");
+
+struct RingHeader {
+    alignas(64) std::atomic<uint64_t> head;     // 書き終えた総バイト数（書く側だけが進める）
+    alignas(64) std::atomic<uint64_t> tail;     // 読み終えた総バイト数（読む側だけが進める）
+    alignas(64) std::atomic<uint32_t> written;  // futex: 書くたびに増やす
+    alignas(64) std::atomic<uint32_t> consumed; // futex: 読むたびに増やす
+};
+
+struct ClientSlot {
+    std::atomic<uint32_t> state;       // SlotState
+    std::atomic<uint32_t> generation;  // 枠を空けるたびに増やす（前の接続あての応答を書かないため）
+    std::atomic<int32_t> pid;          // 枠を取ったゲームのプロセス（空きなら 0）
+    RingHeader requests;
+    RingHeader responses;
+    char requestData[RING_BYTES];
+    char responseData[RING_BYTES];
+};
+
+struct SharedRegion {
+    std::atomic<uint32_t> magic;     // 初期化が終わってから書く
+    uint32_t version;
+    std::atomic<int32_t> workerPid;
+    std::atomic<uint32_t> doorbell;  // futex: 要求を書くたびに増やす（ワーカーは全ての枠をここで待つ）
+    ClientSlot slots[MAX_CLIENTS];
+};
+
+// futex による待ちと起床（プロセス間）。待ちは word が expected のままなら最大 timeout_ms 眠る
+void wait(std::atomic<uint32_t>& word, uint32_t expected, int timeout_ms);
+void wake(std::atomic<uint32_t>& word);
+int32_t currentPid();
+bool processAlive(int32_t pid);
+
+// 1方向のリング。書く側・読む側はそれぞれ1つ（同じ側を複数のスレッドで使うときは呼び出し側で排他する）
+class Ring {
+public:
+    Ring(RingHeader& header, char* data) : header(header), data(data) {}
+
+    // 空きが出るまで最大 timeout_ms 待って書く。リングより大きいメッセージや時間切れは false
+    bool write(std::string_view message, int timeout_ms);
+    // 届くまで最大 timeout_ms 待って読む（0 なら待たない）。時間切れや壊れた長さは false
+    bool read(std::string& message, int timeout_ms);
+    // 空にする（接続を始めるときだけ。相手が使っていないこと）
+    void reset();
+
+private:
+    RingHeader& header;
+    char* data;
+
+    void copyIn(uint64_t pos, const void* src, size_t n);
+    void copyOut(uint64_t pos, void* dst, size_t n) const;
+};
+
+// 名前付きの共有メモリ（/dev/shm/pq_worker_<name>）
+class SharedMemory {
+public:
+    SharedMemory() = default;
+    ~SharedMemory();
+    SharedMemory(const SharedMemory&) = delete;
+    SharedMemory& operator=(const SharedMemory&) = delete;
+
+    // ワーカー: 作り直して初期化する（閉じるときに消す）。失敗時はエラーを出力して false
+    bool create(const std::string& name);
+    // ゲーム: 既存のものに接続する。失敗時は false（ワーカーが動いていないだけなので出力しない）
+    bool open(const std::string& name);
+    void close();
+
+    SharedRegion* region() const { return mapped; }
+
+private:
+    SharedRegion* mapped = nullptr;
+    std::string ownedName;  // create したときだけ
+};
+
+// メッセージ本体: [種類 u8][要求の番号 u64][フィールド...]。文字列は [長さ u32][バイト列]
+class MessageWriter {
+public:
+    MessageWriter(MessageType type, uint64_t id);
+    MessageWriter& u8(uint8_t v);
+    MessageWriter& u32(uint32_t v);
+    MessageWriter& u64(uint64_t v);
+    MessageWriter& str(std::string_view v);
+    const std::string& data() const { return buffer; }
+
+private:
+    std::string buffer;
+};
+
+class MessageReader {
+public:
+    explicit MessageReader(std::string_view data);
+    bool ok() const { return valid; }  // 途中で足りなくなったら false のまま
+    MessageType type() const { return messageType; }
+    uint64_t id() const { return requestId; }
+
+    uint8_t u8();
+    uint32_t u32();
+    uint64_t u64();
+    std::string str();
+
+private:
+    std::string_view rest;
+    bool valid = true;
+    MessageType messageType = MessageType::ERROR_RESULT;
+    uint64_t requestId = 0;
+    bool take(void* out, size_t n);
+};
+
+// 会話の履歴（通し番号ごと）と応答の読み書き
+void writeHistory(MessageWriter& out, const ConversationView& history);
+bool readHistory(MessageReader& in, ConversationState& out);
+void writeGm(MessageWriter& out, const GmResponse& res);
+GmResponse readGm(MessageReader& in);
+void writeBattle(MessageWriter& out, const BattleResponse& res);
+BattleResponse readBattle(MessageReader& in);
+
+} // namespace ipc
+
+#endif
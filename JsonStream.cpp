@@ -0,0 +1,280 @@
+#include "JsonStream.h"
+#include <cstdlib>
+
+namespace {
+
+bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool isNumberChar(char c) {
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+const unsigned REPLACEMENT_CHARACTER = 0xFFFD;
+
+} // namespace
+
+JsonStream::JsonStream(JsonHandler& h) : handler(h) {
+    containers.reserve(MAX_DEPTH);
+    buffer.reserve(256);
+}
+
+void JsonStream::reset() {
+    state = State::BEFORE_ROOT;
+    containers.clear();
+    buffer.clear();
+    stringIsKey = false;
+    unicodeValue = 0;
+    unicodeDigits = 0;
+    pendingHighSurrogate = 0;
+    literal = nullptr;
+    literalPos = 0;
+}
+
+void JsonStream::appendCodepoint(unsigned cp) {
+    if (cp < 0x80) {
+        buffer += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        buffer += static_cast<char>(0xC0 | (cp >> 6));
+        buffer += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        buffer += static_cast<char>(0xE0 | (cp >> 12));
+        buffer += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        buffer += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        buffer += static_cast<char>(0xF0 | (cp >> 18));
+        buffer += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        buffer += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        buffer += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+// 値の先頭文字を受け取り、対応する状態へ移る
+bool JsonStream::beginValue(char c) {
+    switch (c) {
+        case '{':
+            if (depth() >= MAX_DEPTH) return false;
+            handler.onBeginObject(depth());
+            containers.push_back('{');
+            state = State::KEY_OR_END;
+            return true;
+        case '[':
+            if (depth() >= MAX_DEPTH) return false;
+            handler.onBeginArray(depth());
+            containers.push_back('[');
+            state = State::VALUE_OR_END;
+            return true;
+        case '"':
+            buffer.clear();
+            stringIsKey = false;
+            state = State::STRING;
+            return true;
+        case 't': literal = "true"; break;
+        case 'f': literal = "false"; break;
+        case 'n': literal = "null"; break;
+        default:
+            if (c == '-' || (c >= '0' && c <= '9')) {
+                buffer.clear();
+                buffer += c;
+                state = State::NUMBER;
+                return true;
+            }
+            return false;
+    }
+    literalPos = 1;
+    state = State::LITERAL;
+    return true;
+}
+
+void JsonStream::endValue() {
+    state = containers.empty() ? State::DONE : State::AFTER_VALUE;
+}
+
+void JsonStream::finishString() {
+    if (pendingHighSurrogate) {
+        appendCodepoint(REPLACEMENT_CHARACTER);
+        pendingHighSurrogate = 0;
+    }
+    if (stringIsKey) {
+        handler.onKey(buffer, depth());
+        state = State::COLON;
+    } else {
+        handler.onString(buffer, depth());
+        endValue();
+    }
+}
+
+bool JsonStream::finishNumber() {
+    char* end = nullptr;
+    double value = std::strtod(buffer.c_str(), &end);
+    if (end != buffer.c_str() + buffer.size()) return false;
+    handler.onNumber(value, depth());
+    endValue();
+    return true;
+}
+
+bool JsonStream::feed(std::string_view chunk) {
+    size_t i = 0;
+    while (i < chunk.size()) {
+        if (state == State::DONE || state == State::ERROR) break;
+        char c = chunk[i];
+
+        switch (state) {
+            case State::BEFORE_ROOT:
+                // LLMの前置きを読み飛ばす
+                if (c == '{') beginValue(c);
+                break;
+
+            case State::VALUE:
+            case State::VALUE_OR_END:
+                if (isSpace(c)) break;
+                if (state == State::VALUE_OR_END && c == ']') {
+                    containers.pop_back();
+                    handler.onEndArray(depth());
+                    endValue();
+                    break;
+                }
+                if (!beginValue(c)) fail();
+                break;
+
+            case State::KEY:
+            case State::KEY_OR_END:
+                if (isSpace(c)) break;
+                if (state == State::KEY_OR_END && c == '}') {
+                    containers.pop_back();
+                    handler.onEndObject(depth());
+                    endValue();
+                    break;
+                }
+                if (c != '"') { fail(); break; }
+                buffer.clear();
+                stringIsKey = true;
+                state = State::STRING;
+                break;
+
+            case State::COLON:
+                if (isSpace(c)) break;
+                if (c == ':') state = State::VALUE;
+                else fail();
+                break;
+
+            case State::AFTER_VALUE:
+                if (isSpace(c)) break;
+                if (c == ',') {
+                    state = containers.back() == '{' ? State::KEY : State::VALUE;
+                } else if (c == '}' && containers.back() == '{') {
+                    containers.pop_back();
+                    handler.onEndObject(depth());
+                    endValue();
+                } else if (c == ']' && containers.back() == '[') {
+                    containers.pop_back();
+                    handler.onEndArray(depth());
+                    endValue();
+                } else {
+                    fail();
+                }
+                break;
+
+            case State::STRING:
+                if (c == '"') {
+                    finishString();
+                } else if (c == '\\') {
+                    state = State::STRING_ESCAPE;
+                } else {
+                    if (pendingHighSurrogate) {
+                        appendCodepoint(REPLACEMENT_CHARACTER);
+                        pendingHighSurrogate = 0;
+                    }
+                    // 生の改行などの制御文字もLLM出力では許容する
+                    buffer += c;
+                }
+                break;
+
+            case State::STRING_ESCAPE:
+                if (c == 'u') {
+                    unicodeValue = 0;
+                    unicodeDigits = 0;
+                    state = State::STRING_UNICODE;
+                    break;
+                }
+                if (pendingHighSurrogate) {
+                    appendCodepoint(REPLACEMENT_CHARACTER);
+                    pendingHighSurrogate = 0;
+                }
+                switch (c) {
+                    case '"': buffer += '"'; break;
+                    case '\\': buffer += '\\'; break;
+                    case '/': buffer += '/'; break;
+                    case 'b': buffer += '\b'; break;
+                    case 'f': buffer += '\f'; break;
+                    case 'n': buffer += '\n'; break;
+                    case 'r': buffer += '\r'; break;
+                    case 't': buffer += '\t'; break;
+                    default: buffer += c; break;  // 未知のエスケープはそのまま残す
+                }
+                state = State::STRING;
+                break;
+
+            case State::STRING_UNICODE: {
+                int h = hexValue(c);
+                if (h < 0) { fail(); break; }
+                unicodeValue = (unicodeValue << 4) | static_cast<unsigned>(h);
+                if (++unicodeDigits < 4) break;
+
+                unsigned cp = unicodeValue;
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    if (pendingHighSurrogate) appendCodepoint(REPLACEMENT_CHARACTER);
+                    pendingHighSurrogate = cp;
+                } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                    if (pendingHighSurrogate) {
+                        appendCodepoint(0x10000 + ((pendingHighSurrogate - 0xD800) << 10) + (cp - 0xDC00));
+                        pendingHighSurrogate = 0;
+                    } else {
+                        appendCodepoint(REPLACEMENT_CHARACTER);
+                    }
+                } else {
+                    if (pendingHighSurrogate) {
+                        appendCodepoint(REPLACEMENT_CHARACTER);
+                        pendingHighSurrogate = 0;
+                    }
+                    appendCodepoint(cp);
+                }
+                state = State::STRING;
+                break;
+            }
+
+            case State::NUMBER:
+                if (isNumberChar(c)) {
+                    buffer += c;
+                    break;
+                }
+                // 数値の終わり。この文字は次の状態で処理し直す
+                if (!finishNumber()) fail();
+                continue;
+
+            case State::LITERAL:
+                if (c != literal[literalPos]) { fail(); break; }
+                if (literal[++literalPos] == '\0') {
+                    if (literal[0] == 'n') handler.onNull(depth());
+                    else handler.onBool(literal[0] == 't', depth());
+                    literal = nullptr;
+                    endValue();
+                }
+                break;
+
+            case State::DONE:
+            case State::ERROR:
+                break;
+        }
+        ++i;
+    }
+    return state == State::DONE;
+}
@@ -0,0 +1,66 @@
+// JsonStream.h - Prompt Quest: 生成中のトークン片を逐次受け取るSAX形式のJSONパーサー
+
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// パース結果を受け取る側。depth はその値を囲むコンテナの数（ルートオブジェクトの直下が1）。
+class JsonHandler {
+public:
+    virtual ~JsonHandler() = default;
+    virtual void onBeginObject(int depth) {}
+    virtual void onEndObject(int depth) {}
+    virtual void onBeginArray(int depth) {}
+    virtual void onEndArray(int depth) {}
+    virtual void onKey(std::string_view key, int depth) {}
+    virtual void onString(std::string_view value, int depth) {}
+    virtual void onNumber(double value, int depth) {}
+    virtual void onBool(bool value, int depth) {}
+    virtual void onNull(int depth) {}
+};
+
+// 文字列・数値・リテラルが断片の境目で切れていても続きから処理する。
+// 最初の '{' より前の文字（LLMの前置き）は読み飛ばし、ルートのオブジェクトが閉じた時点で完了する。
+class JsonStream {
+public:
+    static const int MAX_DEPTH = 32;
+
+    explicit JsonStream(JsonHandler& handler);
+
+    void reset();
+    // 断片を処理する。ルートが閉じたら true を返し、以降の入力は無視する。
+    bool feed(std::string_view chunk);
+
+    bool complete() const { return state == State::DONE; }
+    bool failed() const { return state == State::ERROR; }
+
+private:
+    enum class State {
+        BEFORE_ROOT, VALUE, VALUE_OR_END, KEY, KEY_OR_END, COLON, AFTER_VALUE,
+        STRING, STRING_ESCAPE, STRING_UNICODE, NUMBER, LITERAL, DONE, ERROR
+    };
+
+    bool beginValue(char c);
+    void endValue();
+    void finishString();
+    bool finishNumber();
+    void appendCodepoint(unsigned codepoint);
+    void fail() { state = State::ERROR; }
+    int depth() const { return static_cast<int>(containers.size()); }
+
+    JsonHandler& handler;
+    State state = State::BEFORE_ROOT;
+    std::vector<char> containers;  // '{' または '['
+    std::string buffer;            // 文字列・数値の途中経過
+    bool stringIsKey = false;
+    unsigned unicodeValue = 0;
+    int unicodeDigits = 0;
+    unsigned pendingHighSurrogate = 0;
+    const char* literal = nullptr;  // "true" / "false" / "null"
+    int literalPos = 0;
+};
+
+#endif
@@ -1,322 +1,1416 @@
 #include "LlmManager.h"
+#include "FusedSampler.h"
+#include "JsonStream.h"
+#include "Log.h"
+#include "Trace.h"
+#include "ggml-cpu.h"
 #include <stdexcept>
-#include <iostream>
 #include <vector>
 #include <sstream>
 #include <algorithm>
-#include <set>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <thread>
+#include <type_traits>
+#include <filesystem>
 
-LlmManager::LlmManager(const std::map<std::string, std::string>& model_paths) {
+namespace {
+
+// GMのプロンプトで履歴の後ろに付ける指示と応答ヘッダー
+const std::string GM_PROMPT_TAIL =
+    "<|start_header_id|>user<|end_header_id|>\n\n上記の会話を分析してください。<|eot_id|>"
+    "<|start_header_id|>assistant<|end_header_id|>\n\n";
+
+// セマンティックキャッシュで一致を求める語のグループ（SemanticCache::keywordSignature）。
+// 出発の意思・否定・問いかけのどれかが違えば、埋め込みが近くても過去のGMの判定は使わない。
+// 1文字のかなや2文字の英単語は別の語の一部（「必ず」の「ず」、"good" の "go"）に当たるので入れない
+const std::vector<std::vector<std::string>> GM_CACHE_KEYWORDS = {
+    {"出発", "旅立", "行く", "行き", "行こ", "行か", "向か", "森へ", "depart", "leave", "going", "set off", "set out"},
+    {"ない", "ません", "ずに", "やめ", "まだ", "無理", "嫌", "いや", "待って",
+     "not", "don't", "won't", "can't", "cannot", "never"},
+    {"?$", "？$", "か$", "かい$"},
+};
+// 戦闘は否定だけ（「火を使わずに斬る」と「火で斬る」を同じ判定にしない）
+const std::vector<std::vector<std::string>> BATTLE_CACHE_KEYWORDS = {
+    {"ない", "ません", "ずに", "やめ", "not", "don't", "won't", "never", "without"},
+};
+
+// 生成を止める特殊トークン（出力に現れたらそこまで）
+const std::string_view STOP_TOKENS[] = {"<|eot_id|>", "<|end_of_text|>", "[/GPT]", "</s>"};
+
+// トレースの区間名（書き出しまで生きている文字列である必要がある）
+const char* inferenceSpanName(const std::string& role) {
+    if (role == "GM") return "inference GM";
+    if (role == "NPC") return "inference NPC";
+    if (role == "BATTLE") return "inference BATTLE";
+    return "inference";
+}
+
+// ログ用に ["a", "b"] の形へ並べる
+std::string joinItems(const std::vector<std::string>& items) {
+    std::string out;
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (i > 0) out += ", ";
+        out += "\"" + items[i] + "\"";
+    }
+    return out;
+}
+
+// セッションの記録用に、キャッシュから再利用した応答を parseGmResponse / parseBattleResponse で読める形にする
+std::string jsonString(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default: out += c; break;
+        }
+    }
+    return out + "\"";
+}
+
+std::string toJson(const GmResponse& res) {
+    std::string items;
+    for (size_t i = 0; i < res.items.size(); ++i) items += (i ? ", " : "") + jsonString(res.items[i]);
+    return "{\"action\": " + jsonString(res.action) + ", \"items\": [" + items + "], \"scene_context\": " + jsonString(res.scene_context) + "}";
+}
+
+std::string toJson(const BattleResponse& res) {
+    return std::string("{\"hit\": ") + (res.hit ? "true" : "false") + ", \"damage\": " + std::to_string(res.damage) +
+           ", \"effect_text\": " + jsonString(res.effect_text) + "}";
+}
+
+// 範囲外や数字以外なら警告して target を変えない
+template <typename T>
+void intFromEnv(const char* name, long min_value, long max_value, T& target) {
+    const char* value = std::getenv(name);
+    if (!value || !*value) return;
+    char* end = nullptr;
+    long parsed = std::strtol(value, &end, 10);
+    if (*end != '\0' || parsed < min_value || parsed > max_value) {
+        PQ_LOG_WARN(LogCategory::LLM, "ignoring invalid " << name << "=\"" << value << "\"");
+        return;
+    }
+    target = static_cast<T>(parsed);
+}
+
+const ggml_type KV_CACHE_TYPES[] = {
+    GGML_TYPE_F16, GGML_TYPE_Q8_0, GGML_TYPE_Q5_1, GGML_TYPE_Q5_0, GGML_TYPE_Q4_1, GGML_TYPE_Q4_0,
+};
+
+} // namespace
+
+// GM応答 {"action": ..., "items": [...], "scene_context": ...} をパースしながら埋める
+GmResponseBuilder::GmResponseBuilder(GmResponse& out) : res(out) {
+    res = GmResponse();
+    res.scene_context.clear();
+    res.action.clear();
+}
+
+void GmResponseBuilder::onKey(std::string_view key, int depth) {
+    if (depth == 1) currentKey.assign(key);
+}
+
+void GmResponseBuilder::onString(std::string_view value, int depth) {
+    if (depth == 1) {
+        if (currentKey == "scene_context") res.scene_context.assign(value);
+        else if (currentKey == "action") res.action.assign(value);
+    } else if (depth == 2 && currentKey == "items") {
+        res.items.emplace_back(value);
+    }
+}
+
+void GmResponseBuilder::onEndArray(int depth) {
+    if (depth == 1 && currentKey == "items") itemsDone = true;
+}
+
+void GmResponseBuilder::finish() {
+    if (res.action.empty()) res.action = "CONTINUE";
+    if (res.scene_context.empty()) res.scene_context = "若者との会話を続けている。";
+}
+
+// 戦闘応答 {"hit": ..., "damage": ..., "effect_text": ...} をパースしながら埋める。
+// LLMは数値や真偽値を文字列で返すことがあるので、どちらも受け付ける。
+BattleResponseBuilder::BattleResponseBuilder(BattleResponse& out) : res(out) {
+    res = BattleResponse();
+}
+
+void BattleResponseBuilder::onKey(std::string_view key, int depth) {
+    if (depth == 1) currentKey.assign(key);
+}
+
+void BattleResponseBuilder::onString(std::string_view value, int depth) {
+    if (depth != 1) return;
+    if (currentKey == "effect_text") {
+        res.effect_text.assign(value);
+    } else if (currentKey == "hit") {
+        res.hit = (value == "true");
+        hasHit = true;
+    } else if (currentKey == "damage") {
+        res.damage = std::atoi(std::string(value).c_str());
+        hasDamage = true;
+    }
+}
+
+void BattleResponseBuilder::onNumber(double value, int depth) {
+    if (depth == 1 && currentKey == "damage") {
+        res.damage = static_cast<int>(value);
+        hasDamage = true;
+    }
+}
+
+void BattleResponseBuilder::onBool(bool value, int depth) {
+    if (depth == 1 && currentKey == "hit") {
+        res.hit = value;
+        hasHit = true;
+    }
+}
+
+void BattleResponseBuilder::finish() {
+    if (!res.effect_text.empty()) return;
+    res.effect_text = res.hit ? "攻撃が命中した！" : "攻撃は外れた...";
+}
+
+bool LlmThreadConfig::parseCpuList(const std::string& text, std::vector<int>& out) {
+    std::vector<int> cpus;
+    std::stringstream ss(text);
+    std::string part;
+    while (std::getline(ss, part, ',')) {
+        if (part.empty()) return false;
+        size_t dash = part.find('-');
+        std::string first_text = part.substr(0, dash);
+        std::string last_text = dash == std::string::npos ? first_text : part.substr(dash + 1);
+        auto is_number = [](const std::string& s) {
+            return !s.empty() && s.size() <= 4 && std::all_of(s.begin(), s.end(), [](char c) { return c >= '0' && c <= '9'; });
+        };
+        if (!is_number(first_text) || !is_number(last_text)) return false;
+        int first = std::stoi(first_text);
+        int last = std::stoi(last_text);
+        if (first > last || last >= GGML_MAX_N_THREADS) return false;
+        for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    }
+    if (cpus.empty()) return false;
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    out = std::move(cpus);
+    return true;
+}
+
+LlmThreadConfig LlmThreadConfig::fromEnvironment() {
+    LlmThreadConfig config;
+
+    // 既定ではCPU 0 を描画スレッド用に空け、残りのコアで推論する
+    int hardware = static_cast<int>(std::thread::hardware_concurrency());
+    if (hardware > 2) {
+        for (int cpu = 1; cpu < std::min(hardware, GGML_MAX_N_THREADS); ++cpu) config.decode_cpus.push_back(cpu);
+        config.prefill_cpus = config.decode_cpus;
+        config.decode_threads = std::min<int>(8, static_cast<int>(config.decode_cpus.size()));
+        config.prefill_threads = config.decode_threads;
+    } else if (hardware > 0) {
+        config.decode_threads = hardware;
+        config.prefill_threads = hardware;
+    }
+
+    auto cpus_from_env = [](const char* name, std::vector<int>& cpus, int& threads) {
+        const char* value = std::getenv(name);
+        if (!value || !*value) return;
+        if (!parseCpuList(value, cpus)) {
+            PQ_LOG_WARN(LogCategory::LLM, "ignoring invalid " << name << "=\"" << value << "\"");
+            return;
+        }
+        threads = static_cast<int>(cpus.size());
+    };
+    cpus_from_env("PQ_LLM_CPUS", config.decode_cpus, config.decode_threads);
+    cpus_from_env("PQ_LLM_CPUS", config.prefill_cpus, config.prefill_threads);
+    cpus_from_env("PQ_LLM_DECODE_CPUS", config.decode_cpus, config.decode_threads);
+    cpus_from_env("PQ_LLM_PREFILL_CPUS", config.prefill_cpus, config.prefill_threads);
+
+    intFromEnv("PQ_LLM_DECODE_THREADS", 1, GGML_MAX_N_THREADS, config.decode_threads);
+    intFromEnv("PQ_LLM_PREFILL_THREADS", 1, GGML_MAX_N_THREADS, config.prefill_threads);
+    intFromEnv("PQ_LLM_POLL", 0, 100, config.poll);
+    int strict = config.strict_cpu ? 1 : 0;
+    intFromEnv("PQ_LLM_STRICT_CPU", 0, 1, strict);
+    config.strict_cpu = strict != 0;
+    return config;
+}
+
+LlmContextConfig LlmContextConfig::fromEnvironment() {
+    LlmContextConfig config;
+    intFromEnv("PQ_LLM_CTX", 256, 131072, config.n_ctx);
+
+    auto type_from_env = [](const char* name, ggml_type& target) {
+        const char* value = std::getenv(name);
+        if (!value || !*value) return;
+        if (!parseCacheType(value, target)) PQ_LOG_WARN(LogCategory::LLM, "ignoring invalid " << name << "=\"" << value << "\"");
+    };
+    type_from_env("PQ_LLM_KV_TYPE", config.type_k);
+    type_from_env("PQ_LLM_KV_TYPE", config.type_v);
+    type_from_env("PQ_LLM_KV_TYPE_K", config.type_k);
+    type_from_env("PQ_LLM_KV_TYPE_V", config.type_v);
+
+    int flash_attn = config.flash_attn ? 1 : 0;
+    intFromEnv("PQ_LLM_FLASH_ATTN", 0, 1, flash_attn);
+    config.flash_attn = flash_attn != 0;
+    intFromEnv("PQ_LLM_PREFIX_CACHE", 0, 32, config.prefix_cache_leaves);
+    return config;
+}
+
+bool LlmContextConfig::parseCacheType(const std::string& text, ggml_type& out) {
+    for (ggml_type type : KV_CACHE_TYPES) {
+        if (text == ggml_type_name(type)) {
+            out = type;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t LlmContextConfig::kvCacheBytes(const llama_model* model) const {
+    // GQA では K と V の幅は head_dim * n_head_kv（Llama 3.1 8B なら 128 * 8）
+    const int64_t n_head = std::max(1, llama_model_n_head(model));
+    const int64_t n_embd_kv = llama_model_n_embd(model) / n_head * llama_model_n_head_kv(model);
+    const size_t per_token = ggml_row_size(type_k, n_embd_kv) + ggml_row_size(type_v, n_embd_kv);
+    return per_token * static_cast<size_t>(llama_model_n_layer(model)) * static_cast<size_t>(n_ctx);
+}
+
+std::string LlmRoleConfig::summary() const {
+    // ゲームとワーカーでは置き場所（basePath と --root）が違うので、パスは比べない
+    auto file_name = [](const std::string& path) { return std::filesystem::path(path).filename().string(); };
+    std::ostringstream ss;
+    ss << "model=" << file_name(model_path);
+    if (!lora_path.empty()) ss << " lora=" << file_name(lora_path) << "@" << lora_scale;
+    ss << " compact=" << (compact_prompt ? 1 : 0) << " ctx=" << context.n_ctx << " kv=" << ggml_type_name(context.type_k) << "/"
+       << ggml_type_name(context.type_v) << " flash_attn=" << (context.flash_attn ? 1 : 0);
+    return ss.str();
+}
+
+LlmManager::ThreadPoolLease::ThreadPoolLease(LlmManager& manager) : manager(manager) {
+    // 止めたプールは ggml が計算の開始時に自分で起こすが、状態を合わせるためにここで起こしておく
+    if (!manager.threadsPaused) return;
+    if (manager.decodePool) ggml_threadpool_resume(manager.decodePool);
+    if (manager.prefillPool) ggml_threadpool_resume(manager.prefillPool);
+    manager.threadsPaused = false;
+}
+
+void LlmManager::createThreadPools() {
+    auto make_pool = [&](int n_threads, const std::vector<int>& cpus) -> ggml_threadpool* {
+        ggml_threadpool_params params = ggml_threadpool_params_default(n_threads);
+        for (int cpu : cpus) {
+            if (cpu >= 0 && cpu < GGML_MAX_N_THREADS) params.cpumask[cpu] = true;
+        }
+        params.prio = threadConfig.prio;
+        params.poll = threadConfig.poll;
+        params.strict_cpu = threadConfig.strict_cpu && !cpus.empty();
+        return ggml_threadpool_new(&params);
+    };
+    decodePool = make_pool(threadConfig.decode_threads, threadConfig.decode_cpus);
+    prefillPool = make_pool(threadConfig.prefill_threads, threadConfig.prefill_cpus);
+    if (!decodePool || !prefillPool) {
+        // 作れなければ llama.cpp が計算ごとに作るスレッドで動かす
+        PQ_LOG_WARN(LogCategory::LLM, "failed to create ggml threadpools, falling back to implicit threads");
+        if (decodePool) ggml_threadpool_free(decodePool);
+        if (prefillPool) ggml_threadpool_free(prefillPool);
+        decodePool = nullptr;
+        prefillPool = nullptr;
+        return;
+    }
+    PQ_LOG_INFO(LogCategory::LLM, "threadpools: decode " << threadConfig.decode_threads << " threads, prefill "
+                << threadConfig.prefill_threads << " threads, poll " << threadConfig.poll
+                << (threadConfig.decode_cpus.empty() ? ", no affinity" : ", pinned to cpu list"));
+}
+
+void LlmManager::applyThreadIdle() {
+    bool idle = threadsIdleRequested.load();
+    if (idle == threadsPaused || !decodePool) return;
+    if (idle) {
+        ggml_threadpool_pause(decodePool);
+        ggml_threadpool_pause(prefillPool);
+    } else {
+        ggml_threadpool_resume(decodePool);
+        ggml_threadpool_resume(prefillPool);
+    }
+    threadsPaused = idle;
+}
+
+void LlmManager::setThreadsIdle(bool idle) {
+    threadsIdleRequested.store(idle);
+    // 推論中なら、その推論の ThreadPoolLease が抜けるときに反映する
+    std::unique_lock<std::mutex> lock(inferenceMutex, std::try_to_lock);
+    if (lock.owns_lock()) applyThreadIdle();
+}
+
+namespace {
+std::map<std::string, LlmRoleConfig> rolesFromPaths(const std::map<std::string, std::string>& model_paths) {
+    std::map<std::string, LlmRoleConfig> roles;
+    for (const auto& pair : model_paths) roles[pair.first].model_path = pair.second;
+    return roles;
+}
+}
+
+LlmManager::LlmManager(const std::map<std::string, std::string>& model_paths, const LlmThreadConfig& thread_config)
+    : LlmManager(rolesFromPaths(model_paths), thread_config) {}
+
+LlmManager::LlmManager(const std::map<std::string, LlmRoleConfig>& roles, const LlmThreadConfig& thread_config)
+    : threadConfig(thread_config) {
     llama_backend_init();
+    createThreadPools();
 
-    // モデルファイルパスでグループ化してインスタンスを共有
-    std::map<std::string, LlmInstance*> shared_instances_by_path;
-    
-    for (const auto& pair : model_paths) {
+    // 同じパスの役割は1つのモデルとコンテキストを共有する。重みは最初に使う役割が来たときに読む
+    modelPool = std::make_unique<ModelPool>(0, [this](const std::string& path, llama_model* model, size_t& context_bytes) {
+        return createContext(path, model, context_bytes);
+    });
+    modelPool->setEvictCallback([this](const std::string& path, llama_context* ctx) {
+        prefixCaches.erase(ctx);
+        releaseAdapters(path, ctx);
+        if (ctx == batchCtx) batchCtx = nullptr;  // スロットのKVも無くなる
+    });
+    for (const auto& pair : roles) {
         const std::string& role = pair.first;
-        const std::string& path = pair.second;
-
-        // 同じパスのモデルが既に読み込まれているかチェック
-        auto path_it = shared_instances_by_path.find(path);
-        if (path_it != shared_instances_by_path.end()) {
-            // 既存のインスタンスを共有
-            instances[role] = *(path_it->second);
-            std::cout << "Role '" << role << "' shares model instance from: " << path << std::endl;
-            continue;
+        const LlmRoleConfig& config = pair.second;
+        // ファイルの欠落はここで検出する（語彙だけを読むので重みの読み込みより速い）
+        if (!modelPool->add(config.model_path)) {
+            throw std::runtime_error("Error: failed to load model for role '" + role + "' from " + config.model_path);
+        }
+        if (!config.lora_path.empty() && !std::filesystem::exists(config.lora_path)) {
+            throw std::runtime_error("Error: LoRA adapter for role '" + role + "' not found: " + config.lora_path);
+        }
+        LlmContextConfig context = config.context;
+        if (ggml_is_quantized(context.type_v) && !context.flash_attn) {
+            PQ_LOG_WARN(LogCategory::LLM, "Role '" << role << "': quantized V cache requires flash attention, enabling it");
+            context.flash_attn = true;
+        }
+        auto [shared, inserted] = contextConfigs.emplace(config.model_path, context);
+        if (!inserted) {
+            LlmContextConfig& merged = shared->second;
+            if (merged.type_k != context.type_k || merged.type_v != context.type_v || merged.flash_attn != context.flash_attn) {
+                throw std::runtime_error("Error: role '" + role + "' shares " + config.model_path +
+                                         " with another role but uses different KV cache settings");
+            }
+            merged.n_ctx = std::max(merged.n_ctx, context.n_ctx);
+            merged.prefix_cache_leaves = std::max(merged.prefix_cache_leaves, context.prefix_cache_leaves);
+        }
+        roleConfigs[role] = config;
+        PQ_LOG_INFO(LogCategory::LLM, "Role '" << role << "' registered with model: " << config.model_path
+                    << (config.lora_path.empty() ? "" : ", LoRA: " + config.lora_path)
+                    << " (ctx " << context.n_ctx << ", KV " << ggml_type_name(context.type_k) << "/" << ggml_type_name(context.type_v)
+                    << (context.flash_attn ? ", flash attention" : "") << ")");
+    }
+}
+
+llama_context* LlmManager::createContext(const std::string& model_path, llama_model* model, size_t& context_bytes) {
+    const LlmContextConfig& context = contextConfigs.at(model_path);
+    auto cparams = llama_context_default_params();
+    // 連続バッチ処理のスロットはそれぞれ n_ctx まで伸びるので、その分のセルを足す
+    const int sequences = 1 + parallelSlots;
+    cparams.n_ctx = context.n_ctx * sequences;
+    cparams.n_batch = batchSize(); 
+    // classify() の候補を並列シーケンスで評価し、プロンプトの共通部分も別のシーケンスに残すため、
+    // KVセルは全シーケンスで共有する（シーケンス間のコピーはセルの共有で済む）。スロットはその後ろの番号
+    cparams.n_seq_max = MAX_CLASSIFY_CANDIDATES + context.prefix_cache_leaves + parallelSlots;
+    cparams.kv_unified = true;
+    
+    // スレッド数（プールを付けた場合はプール側の数で動く）
+    cparams.n_threads = threadConfig.decode_threads;
+    cparams.n_threads_batch = threadConfig.prefill_threads;
+
+    cparams.type_k = context.type_k;
+    cparams.type_v = context.type_v;
+    cparams.flash_attn = context.flash_attn;
+    cparams.offload_kqv = false;  
+    
+    llama_context* ctx = llama_init_from_model(model, cparams);
+    context_bytes = context.kvCacheBytes(model) * sequences;
+    // 1トークンずつの生成は decodePool、プロンプトのバッチは prefillPool で計算する
+    if (ctx && decodePool) llama_attach_threadpool(ctx, decodePool, prefillPool);
+    return ctx;
+}
+
+bool LlmManager::acquireRole(const std::string& role, LlmInstance& out, bool use_adapter) {
+    auto it = roleConfigs.find(role);
+    if (it == roleConfigs.end()) return false;
+    const LlmRoleConfig& config = it->second;
+    if (!modelPool->acquire(config.model_path, out.model, out.ctx)) return false;
+    if (!states.count(role)) createInferenceState(role, out.ctx, out.model);
+    const LlmContextConfig& context = contextConfigs.at(config.model_path);
+    if (context.prefix_cache_leaves > 0) {
+        std::unique_ptr<PrefixCache>& prefix = prefixCaches[out.ctx];
+        if (!prefix) {
+            // 木に使うセルは1シーケンス分まで（残りは連続バッチ処理のスロットの分）
+            prefix = std::make_unique<PrefixCache>(out.ctx, MAX_CLASSIFY_CANDIDATES, context.prefix_cache_leaves, context.n_ctx);
+        }
+        out.prefix = prefix.get();
+    }
+
+    // 同じコンテキストを共有する役割どうしでは、アダプターが変わるときだけ付け替える
+    AppliedAdapter wanted;
+    if (use_adapter && !config.lora_path.empty()) {
+        wanted.adapter = roleAdapter(config, out.model);
+        wanted.scale = wanted.adapter ? config.lora_scale : 0.0f;
+    }
+    AppliedAdapter& current = appliedAdapters[out.ctx];
+    if (current.adapter != wanted.adapter || current.scale != wanted.scale) {
+        llama_clear_adapter_lora(out.ctx);
+        if (wanted.adapter && llama_set_adapter_lora(out.ctx, wanted.adapter, wanted.scale) != 0) {
+            PQ_LOG_ERROR(LogCategory::LLM, "failed to apply LoRA for role '" << role << "'");
+            wanted = AppliedAdapter();
+        }
+        current = wanted;
+    }
+    return true;
+}
+
+llama_adapter_lora* LlmManager::roleAdapter(const LlmRoleConfig& config, llama_model* model) {
+    std::string key = config.model_path + '\n' + config.lora_path;
+    auto it = adapters.find(key);
+    if (it != adapters.end()) return it->second;
+
+    PQ_TRACE_SCOPE("llm", "loadAdapter");
+    llama_adapter_lora* adapter = llama_adapter_lora_init(model, config.lora_path.c_str());
+    if (adapter) {
+        PQ_LOG_INFO(LogCategory::LLM, "loaded LoRA " << config.lora_path);
+    } else {
+        PQ_LOG_ERROR(LogCategory::LLM, "failed to load LoRA " << config.lora_path << ", using the base model");
+    }
+    adapters[key] = adapter;
+    return adapter;
+}
+
+void LlmManager::releaseAdapters(const std::string& model_path, llama_context* ctx) {
+    appliedAdapters.erase(ctx);
+    std::string prefix = model_path + '\n';
+    for (auto it = adapters.begin(); it != adapters.end();) {
+        if (it->first.compare(0, prefix.size(), prefix) == 0) {
+            if (it->second) llama_adapter_lora_free(it->second);
+            it = adapters.erase(it);
+        } else {
+            ++it;
         }
+    }
+}
+
+bool LlmManager::compactPrompt(const std::string& role) const {
+    auto it = roleConfigs.find(role);
+    return it != roleConfigs.end() && it->second.compact_prompt && !it->second.lora_path.empty();
+}
 
-        // 新しいモデルインスタンスを作成
+const llama_vocab* LlmManager::roleVocab(const std::string& role) const {
+    auto it = roleConfigs.find(role);
+    return it == roleConfigs.end() ? nullptr : modelPool->vocab(it->second.model_path);
+}
+
+void LlmManager::prefetch(const std::string& role) {
+    if (recordedOutputs) return;  // 記録した結果で再生している間はモデルを使わない
+    auto it = roleConfigs.find(role);
+    if (it == roleConfigs.end() || modelPool->resident(it->second.model_path)) return;
+
+    std::lock_guard<std::mutex> lock(prefetchMutex);
+    prefetchJobs.erase(std::remove_if(prefetchJobs.begin(), prefetchJobs.end(), [](std::future<void>& job) {
+        return job.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }), prefetchJobs.end());
+    prefetchJobs.push_back(std::async(std::launch::async, [this, role]() {
+        // 読み込みで他のモデルを追い出すことがあるので、推論と同じ mutex の中で行う
+        std::lock_guard<std::mutex> inference_lock(inferenceMutex);
         LlmInstance instance;
-        auto mparams = llama_model_default_params();
-        mparams.use_mmap = false; 
-        mparams.use_mlock = false;
-        
-        instance.model = llama_model_load_from_file(path.c_str(), mparams);
-        if (instance.model == nullptr) {
-            throw std::runtime_error("Error: failed to load model for role '" + role + "' from " + path);
+        if (!acquireRole(role, instance)) PQ_LOG_WARN(LogCategory::LLM, "prefetch failed for role '" << role << "'");
+    }));
+}
+
+void LlmManager::setModelBudget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(inferenceMutex);
+    modelPool->setBudget(bytes);
+}
+
+ModelPoolMetrics LlmManager::modelMetrics() const {
+    return modelPool->metrics();
+}
+
+LlmManager::~LlmManager() {
+    if (batchThread.joinable()) {
+        // 受け付けたリクエストを終えてから止まる
+        {
+            std::lock_guard<std::mutex> lock(inferenceMutex);
+            batchStopping = true;
         }
+        batchWake.notify_all();
+        batchThread.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(prefetchMutex);
+        for (auto& job : prefetchJobs) job.wait();
+    }
+    printMetrics();
+    if (embedCtx) llama_free(embedCtx);
+    for (auto& pair : states) {
+        llama_sampler_free(pair.second.sampler);
+        llama_batch_free(pair.second.batch);
+        llama_batch_free(pair.second.genBatch);
+    }
+    for (BatchSlot& slot : batchSlots) {
+        if (slot.sampler) llama_sampler_free(slot.sampler);
+    }
+    if (parallelSlots > 0) llama_batch_free(batchBuffer);
 
-        auto cparams = llama_context_default_params();
-        cparams.n_ctx = 2048;  // コンテキストサイズ
-        cparams.n_batch = 256; 
-        
-        // スレッド数
-        cparams.n_threads = 8; 
-        cparams.n_threads_batch = 8;  
-    
-        cparams.flash_attn = false;
-        cparams.offload_kqv = false;  
+    prefixCaches.clear();
+    for (auto& pair : adapters) {
+        if (pair.second) llama_adapter_lora_free(pair.second);
+    }
+    modelPool.reset();  // アダプターはベースモデルより先に解放する
+    // スレッドプールはそれを使うコンテキストをすべて解放してから
+    if (decodePool) ggml_threadpool_free(decodePool);
+    if (prefillPool) ggml_threadpool_free(prefillPool);
+    llama_backend_free();
+}
+
+void LlmManager::createInferenceState(const std::string& role, llama_context* ctx, const llama_model* model) {
+    InferenceState& state = states[role];
+    state.sampler = createRoleSampler(role);
+
+    state.batchCapacity = static_cast<int32_t>(llama_n_batch(ctx));
+    state.batch = llama_batch_init(state.batchCapacity, 0, 1);
+    state.genBatch = llama_batch_init(1, 0, 1);
+
+    state.tokens.resize(llama_n_ctx(ctx));
+    state.candidates.resize(llama_vocab_n_tokens(llama_model_get_vocab(model)));
+    state.output.reserve(4096);
+}
+
+llama_sampler* LlmManager::createRoleSampler(const std::string& role) {
+    struct llama_sampler_chain_params sparams = llama_sampler_chain_default_params();
+    sparams.no_perf = true;
+    llama_sampler* sampler = llama_sampler_chain_init(sparams);
+    // temp → top_k → top_p を1回の走査で行う融合サンプラー（標準チェーンと同じ候補・確率になる）
+    if (role == "GM") {
+        // JSON生成用：より確定的
+        llama_sampler_chain_add(sampler, createFusedSampler(0.3f, 20, 0.85f));
+    } else {
+        // NPC会話用：自然な多様性
+        llama_sampler_chain_add(sampler, createFusedSampler(0.7f, 35, 0.9f));
+    }
+    return sampler;
+}
+
+bool LlmManager::decodePrompt(InferenceState& state, llama_context* ctx, const llama_token* tokens, int n_tokens, int first) {
+    llama_batch& batch = state.batch;
+    for (int processed = first; processed < n_tokens; processed += state.batchCapacity) {
+        int current = std::min(state.batchCapacity, n_tokens - processed);
+        PQ_TRACE_NAMED_SCOPE(chunk_span, "llm", "prefill");
+        PQ_TRACE_ARG(chunk_span, "tokens", current);
+        for (int i = 0; i < current; ++i) {
+            batch.token[i] = tokens[processed + i];
+            batch.pos[i] = processed + i;
+            batch.n_seq_id[i] = 1;
+            batch.seq_id[i][0] = 0;
+            // 最後のトークンでのみlogitsを有効化（生成に必要）
+            batch.logits[i] = (processed + i == n_tokens - 1);
+        }
+        batch.n_tokens = current;
+        if (llama_decode(ctx, batch) != 0) return false;
+    }
+    return true;
+}
+
+bool LlmManager::prefillShared(InferenceState& state, const LlmInstance& instance, const llama_token* tokens, int n_tokens, int reserve) {
+    llama_memory_t mem = llama_get_memory(instance.ctx);
+    for (int seq = 0; seq < MAX_CLASSIFY_CANDIDATES; ++seq) llama_memory_seq_rm(mem, seq, -1, -1);
+    if (!instance.prefix) return decodePrompt(state, instance.ctx, tokens, n_tokens);
+
+    const AppliedAdapter& adapter = appliedAdapters[instance.ctx];
+    const PrefixCache::Space space(adapter.adapter, adapter.scale);
+    const uint64_t evictions = instance.prefix->evictions();
+    int reused = 0;
+    {
+        PQ_TRACE_NAMED_SCOPE(fork_span, "llm", "prefix fork");
+        reused = instance.prefix->fork(space, tokens, n_tokens, 0, reserve);
+        PQ_TRACE_ARG(fork_span, "reused_tokens", reused);
+    }
+
+    bool ok = decodePrompt(state, instance.ctx, tokens, n_tokens, reused);
+    if (!ok && instance.prefix->cachedTokens() > 0) {
+        // 残したKVでセルが埋まって入らなかった場合は、すべて捨てて最初から計算し直す
+        PQ_LOG_WARN(LogCategory::LLM, "prefill failed with " << instance.prefix->cachedTokens() << " cached tokens, clearing prefix cache");
+        instance.prefix->clear();
+        llama_memory_seq_rm(mem, 0, -1, -1);
+        reused = 0;
+        ok = decodePrompt(state, instance.ctx, tokens, n_tokens);
+    }
+    if (ok) instance.prefix->insert(space, tokens, n_tokens, 0);
+
+    std::lock_guard<std::mutex> lock(metricsMutex);
+    prefixStats.lookups++;
+    if (reused > 0) prefixStats.hits++;
+    prefixStats.reused_tokens += static_cast<uint64_t>(reused);
+    prefixStats.prefilled_tokens += static_cast<uint64_t>(n_tokens - reused);
+    prefixStats.evictions += instance.prefix->evictions() - evictions;
+    return ok;
+}
+
+llama_token LlmManager::sampleToken(InferenceState& state, llama_context* ctx) {
+    return sampleLogits(state.sampler, state.candidates, state.rng, llama_get_logits_ith(ctx, -1));
+}
+
+llama_token LlmManager::sampleLogits(llama_sampler* sampler, std::vector<llama_token_data>& candidates, std::mt19937& rng, const float* logits) {
+    // llama_sampler_sample は毎回語彙サイズの配列を確保するので、候補配列は使い回す
+    const int n_vocab = static_cast<int>(candidates.size());
+    for (int i = 0; i < n_vocab; ++i) {
+        candidates[i] = {i, logits[i], 0.0f};
+    }
+    llama_token_data_array cur_p = {candidates.data(), candidates.size(), -1, false};
+    llama_sampler_apply(sampler, &cur_p);
+
+    // 最後の抽選はリクエストごとのシードで自前で行う（dist サンプラーは内部で確保が走る）
+    float max_logit = cur_p.data[0].logit;
+    for (size_t i = 1; i < cur_p.size; ++i) max_logit = std::max(max_logit, cur_p.data[i].logit);
+    float sum = 0.0f;
+    for (size_t i = 0; i < cur_p.size; ++i) {
+        cur_p.data[i].p = std::exp(cur_p.data[i].logit - max_logit);
+        sum += cur_p.data[i].p;
+    }
+    float r = static_cast<float>(rng() >> 8) * (1.0f / 16777216.0f) * sum;
+    size_t selected = cur_p.size - 1;
+    for (size_t i = 0; i < cur_p.size; ++i) {
+        r -= cur_p.data[i].p;
+        if (r <= 0.0f) { selected = i; break; }
+    }
+
+    llama_token token = cur_p.data[selected].id;
+    llama_sampler_accept(sampler, token);
+    return token;
+}
+
+bool LlmManager::appendToken(const llama_vocab* vocab, llama_token token, std::string& output, bool json_output,
+                             const TokenCallback* on_token, const std::string& role) {
+    if (llama_vocab_is_eog(vocab, token)) return false;
+
+    char piece[128];
+    int len = llama_token_to_piece(vocab, token, piece, sizeof(piece), 0, false);
+    if (len < 0) return false;
+    std::string_view piece_str(piece, len);
+
+    output.append(piece_str);
+    PQ_LOG_TRACE(Log::categoryForRole(role), "token " << token << " \"" << piece_str << "\"");
+
+    // 停止トークンのチェック（今回追加した部分にかかる範囲だけ探す）
+    for (std::string_view stop_token : STOP_TOKENS) {
+        size_t from = output.size() > piece_str.size() + stop_token.size() ? output.size() - piece_str.size() - stop_token.size() : 0;
+        if (output.find(stop_token.data(), from, stop_token.size()) != std::string::npos) return false;
+    }
+
+    if (on_token) {
+        PQ_TRACE_SCOPE("llm", "parse");
+        if (!(*on_token)(piece_str)) return false;
+    }
+
+    // 役割別の終了条件判定（JSONの終わりは呼び出し側の JsonStream が on_token で知らせる）
+    if (!json_output) {
+        // NPC会話の自然な終了
+        if ((piece_str.find("。") != std::string_view::npos || 
+             piece_str.find("！") != std::string_view::npos || 
+             piece_str.find("？") != std::string_view::npos) && 
+            output.length() > 20) {
+            return false;
+        }
+    }
+    return true;
+}
+
+LlmManager::PromptBudget LlmManager::promptBudget(const std::string& role, int n_ctx) {
+    PromptBudget budget = {512, 80};
+    if (role == "GM") budget = {640, 150};
+    else if (role == "NPC") budget = {768, 80};
+    else if (role == "BATTLE") budget = {0, 150};  // 戦闘は履歴を使わない
+    budget.history_tokens = static_cast<int>(static_cast<int64_t>(budget.history_tokens) * n_ctx / BASE_CONTEXT_SIZE);
+    return budget;
+}
+
+int LlmManager::contextSize(const std::string& role) const {
+    auto it = roleConfigs.find(role);
+    return it == roleConfigs.end() ? BASE_CONTEXT_SIZE : contextConfigs.at(it->second.model_path).n_ctx;
+}
+
+std::string LlmManager::formatTurn(ChatRole role, std::string_view text) {
+    std::string out = role == ChatRole::USER ? "<|start_header_id|>user<|end_header_id|>\n\nプレイヤー: "
+                                             : "<|start_header_id|>assistant<|end_header_id|>\n\n長老: ";
+    out.append(text);
+    out += "<|eot_id|>";
+    return out;
+}
+
+int LlmManager::tokenLength(const llama_vocab* vocab, const std::string& text) {
+    if (text.empty()) return 0;
+    // 出力先を渡さなければ、必要なトークン数が負の値で返る
+    int n = llama_tokenize(vocab, text.c_str(), (int)text.length(), nullptr, 0, false, true);
+    return n < 0 ? -n : n;
+}
+
+void LlmManager::measureTokens(const std::string& role, ChatTurn& turn) {
+    // 語彙は常駐しているので、重みが読み込まれていなくても数えられる
+    const llama_vocab* vocab = roleVocab(role);
+    if (!vocab) return;
+    // 発言は特殊トークンで区切られるので、連結しても個別に数えた合計と一致する
+    turn.tokens = tokenLength(vocab, formatTurn(turn.role, turn.text));
+    turn.tokens_vocab = vocab;
+}
+
+int LlmManager::turnTokens(const llama_vocab* vocab, const ChatTurn& turn) {
+    // 履歴に入った発言は共有されていて書き換えないので、語彙が違うときはその場で数えるだけにする
+    if (turn.tokens >= 0 && turn.tokens_vocab == vocab) return turn.tokens;
+    return tokenLength(vocab, formatTurn(turn.role, turn.text));
+}
+
+std::string LlmManager::packHistory(const std::string& role, const ConversationView& history, const std::string& fixed_prompt,
+                                    size_t* first_turn) {
+    if (first_turn) *first_turn = history.size();
+    const llama_vocab* vocab = roleVocab(role);
+    if (!vocab) return "";
+    const int n_ctx = contextSize(role);
+    PromptBudget budget = promptBudget(role, n_ctx);
+    int available = n_ctx - tokenLength(vocab, fixed_prompt) - budget.max_new_tokens - 1;
+    int limit = std::min(budget.history_tokens, available);
+
+    // 新しいメッセージから順に、予算に収まるところまで遡る
+    size_t first = history.size();
+    size_t overflow = history.size();  // 直近の発言だけで予算を超えた場合の位置
+    int used = 0;
+    for (size_t i = history.size(); i > 0; --i) {
+        int n = turnTokens(vocab, history[i - 1]);
+        if (used + n > limit) {
+            if (used == 0) overflow = i - 1;
+            break;
+        }
+        used += n;
+        first = i - 1;
+    }
+
+    std::string packed;
+    for (size_t i = first; i < history.size(); ++i) packed += formatTurn(history[i].role, history[i].text);
+    if (overflow == history.size()) {
+        if (first_turn) *first_turn = first;
+        return packed;
+    }
+
+    // 長すぎる発言は先頭から収まる長さに切り詰める（UTF-8の文字境界で切る）
+    const ChatTurn& turn = history[overflow];
+    std::string cut;
+    size_t len = turn.text.size() * std::max(0, limit) / std::max(1, turnTokens(vocab, turn));
+    while (true) {
+        while (len > 0 && (static_cast<unsigned char>(turn.text[len]) & 0xC0) == 0x80) --len;
+        cut = formatTurn(turn.role, turn.text.substr(0, len) + "…");
+        if (tokenLength(vocab, cut) <= limit) break;
+        if (len == 0) return "";
+        len = len * 9 / 10;
+    }
+    PQ_LOG_INFO(Log::categoryForRole(role), "latest message truncated to " << len << " of " << turn.text.size() << " bytes to fit the token budget");
+    if (first_turn) *first_turn = overflow;
+    return cut;
+}
+
+uint32_t LlmManager::requestSeed(const std::string& role) {
+    // 役割名のハッシュで系列を分ける（どの役割も1回目が baseSeed になると、同じプロンプトで同じ乱数列になる）
+    uint32_t salt = 2166136261u;
+    for (char c : role) {
+        salt ^= static_cast<uint8_t>(c);
+        salt *= 16777619u;
+    }
+    return baseSeed + salt + roleRequests[role]++;
+}
+
+std::string LlmManager::run_inference(const std::string& role, const std::string& prompt, bool plain_text, const TokenCallback& on_token,
+                                      const std::string& seed_key, bool* completed) {
+    PQ_TRACE_NAMED_SCOPE(inference_span, "llm", inferenceSpanName(role));
+    if (Trace::active()) Trace::setThreadName("llm " + role);
+    const auto start_time = std::chrono::steady_clock::now();
+    auto elapsed_ms = [&start_time]() {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+    };
+    const std::atomic<uint64_t>& cancel_source = cancelSource ? *cancelSource : cancelEpoch;
+    const uint64_t epoch = cancel_source.load();
+    auto cancelled = [&]() { return cancel_source.load(std::memory_order_relaxed) != epoch; };
+    std::unique_lock<std::mutex> lock(inferenceMutex, std::defer_lock);
+    {
+        // 他の役割の推論を待っている時間（スレッド間の競合）
+        PQ_TRACE_SCOPE("llm", "wait inferenceMutex");
+        lock.lock();
+    }
+
+    LlmExchange exchange;
+    exchange.role = role;
+    exchange.seed = requestSeed(seed_key.empty() ? role : seed_key);
+    exchange.wait_ms = elapsed_ms();
+    if (recorder || recordedOutputs) exchange.prompt = prompt;
+    // 後処理前の結果を記録してから返す（再生では同じ後処理をかけ直す）
+    auto finish = [&](std::string output) {
+        if (completed) *completed = !cancelled() && output.rfind("[ERROR", 0) != 0;
+        if (recorder) {
+            exchange.output = output;
+            exchange.total_ms = elapsed_ms();
+            recorder->exchange(exchange);
+        }
+        return output;
+    };
+
+    if (recordedOutputs) {
+        // 記録した結果を返す（時間は今回のもので記録し直す）
+        std::string output;
+        LlmExchange recorded;
+        if (recordedOutputs->take(role, LlmExchangeKind::GENERATE, prompt, recorded)) {
+            output = std::move(recorded.output);
+        } else {
+            PQ_LOG_WARN(Log::categoryForRole(role), "replay: no recorded output left for role '" << role << "'");
+        }
+        if (on_token) {
+            // 生成のときと同じく、停止トークンより前だけをパーサーに渡す
+            std::string_view piece(output);
+            for (std::string_view stop_token : STOP_TOKENS) {
+                piece = piece.substr(0, piece.find(stop_token));
+            }
+            if (!piece.empty()) on_token(piece);
+        }
+        return cleanupOutput(role, finish(std::move(output)));
+    }
+
+    if (cancelled()) {
+        PQ_LOG_DEBUG(Log::categoryForRole(role), "cancelled before inference");
+        return finish("");
+    }
+    if (parallelSlots > 0) {
+        // モデルの読み込みと計算は batchLoop() が他のリクエストとまとめて行う
+        return cleanupOutput(role, finish(runBatched(role, prompt, plain_text, on_token, cancel_source, epoch, exchange, lock, start_time)));
+    }
+
+    ThreadPoolLease pool_lease(*this);
+    // JSON を出す役割のアダプターは出力形式ごと学習しているので、地の文（戦闘の描写）はベースモデルで書く
+    bool json_role = role == "GM" || role == "BATTLE";
+    LlmInstance instance;
+    if (!acquireRole(role, instance, !(plain_text && json_role))) {
+        return finish("[ERROR: Model for role '" + role + "' unavailable]");
+    }
+    InferenceState& state = states.at(role);
+    exchange.load_ms = elapsed_ms() - exchange.wait_ms;
+
+    const auto* vocab = llama_model_get_vocab(instance.model);
+    int n_tokens = 0;
+    {
+        PQ_TRACE_SCOPE("llm", "tokenize");
+        n_tokens = llama_tokenize(vocab, prompt.c_str(), (int)prompt.length(), state.tokens.data(), (int)state.tokens.size(), false, true);
+    }
+    if (n_tokens < 0) return finish("[ERROR: Tokenization failed]");
+    const int n_ctx = static_cast<int>(llama_n_ctx(instance.ctx));
+    if (n_tokens >= n_ctx - 1) return finish("[ERROR: Prompt too long]");
+    exchange.prompt_tokens = n_tokens;
+
+    const LogCategory log_category = Log::categoryForRole(role);
+    PQ_LOG_DEBUG(log_category, "prompt (" << n_tokens << " tokens):\n" << prompt);
+
+    // 生成トークン数は役割ごとの予算。プロンプトが長くてもコンテキストの上限には届かせない
+    int max_tokens = std::min(promptBudget(role).max_new_tokens, n_ctx - 1 - n_tokens);
+
+    uint64_t reused_before = 0;
+    if (recorder) {
+        std::lock_guard<std::mutex> metrics_lock(metricsMutex);
+        reused_before = prefixStats.reused_tokens;
+    }
+    const double prefill_start = elapsed_ms();
+    if (!prefillShared(state, instance, state.tokens.data(), n_tokens, max_tokens)) {
+        return finish("[ERROR: llama_decode failed]");
+    }
+    exchange.prefill_ms = elapsed_ms() - prefill_start;
+    if (recorder) {
+        std::lock_guard<std::mutex> metrics_lock(metricsMutex);
+        exchange.reused_tokens = static_cast<int>(prefixStats.reused_tokens - reused_before);
+    }
+    // 生成中はプリフィル側のスレッドがポーリングで decodePool とコアを取り合わないよう眠らせる
+    // （次のプリフィルで ggml が自動的に起こす）
+    if (prefillPool) ggml_threadpool_pause(prefillPool);
+
+    // サンプラーはリクエストごとにリセットし、乱数はリクエストごとのシードで初期化
+    llama_sampler_reset(state.sampler);
+    state.rng.seed(exchange.seed);
+
+    std::string& result_str = state.output;
+    result_str.clear();
+    int n_cur = n_tokens;
+    llama_batch& gen_batch = state.genBatch;
+
+    bool json_output = !plain_text && json_role;
+
+    for (int i = 0; i < max_tokens; ++i) {
+        if (cancelled()) {
+            PQ_LOG_DEBUG(log_category, "cancelled after " << i << " tokens");
+            break;
+        }
+        llama_token new_token_id;
+        {
+            PQ_TRACE_SCOPE("llm", "sample");
+            new_token_id = sampleToken(state, instance.ctx);
+        }
+        if (i == 0) exchange.first_token_ms = elapsed_ms();
+        exchange.generated_tokens++;
+
+        if (!appendToken(vocab, new_token_id, result_str, json_output, on_token ? &on_token : nullptr, role)) break;
+
+        gen_batch.n_tokens = 1;
+        gen_batch.token[0] = new_token_id;
+        gen_batch.pos[0] = n_cur;
+        gen_batch.n_seq_id[0] = 1;
+        gen_batch.seq_id[0][0] = 0;
+        gen_batch.logits[0] = true;
         
-        instance.ctx = llama_init_from_model(instance.model, cparams);
-        if (instance.ctx == nullptr) {
-            llama_model_free(instance.model);
-            throw std::runtime_error("Error: failed to create context for role '" + role + "'");
+        // コンテキストサイズの上限近くで停止
+        if (n_cur >= n_ctx - 1) {
+            PQ_LOG_WARN(log_category, "context size limit reached, stopping generation");
+            break;
         }
         
-        instances[role] = instance;
-        shared_instances_by_path[path] = &instances[role];
-        std::cout << "New model instance for role '" << role << "' loaded from: " << path << std::endl;
+        PQ_TRACE_SCOPE("llm", "decode");
+        if (llama_decode(instance.ctx, gen_batch) != 0) {
+            PQ_LOG_WARN(log_category, "llama_decode failed, stopping generation");
+            break;
+        }
+        n_cur++;
     }
+    PQ_TRACE_ARG(inference_span, "generated_tokens", n_cur - n_tokens);
+
+    PQ_LOG_DEBUG(log_category, "raw output (" << n_cur - n_tokens << " tokens): \"" << result_str << "\"");
+    return cleanupOutput(role, finish(result_str));
 }
 
-LlmManager::~LlmManager() {
-    // 共有インスタンスの重複解放を防ぐために、ユニークポインタで管理
-    std::set<llama_context*> freed_contexts;
-    std::set<llama_model*> freed_models;
-    
-    for (auto& pair : instances) {
-        if (pair.second.ctx && freed_contexts.find(pair.second.ctx) == freed_contexts.end()) {
-            llama_free(pair.second.ctx);
-            freed_contexts.insert(pair.second.ctx);
+thread_local const std::atomic<uint64_t>* LlmManager::cancelSource = nullptr;
+
+LlmManager::CancelScope::CancelScope(const std::atomic<uint64_t>& source) : previous(cancelSource) {
+    cancelSource = &source;
+}
+
+LlmManager::CancelScope::~CancelScope() {
+    cancelSource = previous;
+}
+
+void LlmManager::setParallelSequences(int n, size_t kv_budget_bytes) {
+    std::lock_guard<std::mutex> lock(inferenceMutex);
+    if (n <= 1 || parallelSlots > 0) return;
+    // スロットの分のKVセルとシーケンスはコンテキストを作るときに確保する
+    if (modelPool->metrics().loads > 0) {
+        PQ_LOG_WARN(LogCategory::LLM, "setParallelSequences: a model is already loaded, keeping serial inference");
+        return;
+    }
+
+    // スロットはそれぞれ n_ctx まで伸びるので、1シーケンス分のKVが最も大きいモデルで数を決める
+    size_t per_sequence = 0;
+    for (const auto& pair : contextConfigs) {
+        if (const llama_model* info = modelPool->info(pair.first)) per_sequence = std::max(per_sequence, pair.second.kvCacheBytes(info));
+    }
+    int slots = std::min(n, static_cast<int>(MAX_PARALLEL_SEQUENCES));
+    if (kv_budget_bytes > 0 && per_sequence > 0) {
+        // 1本は直列の推論とプレフィックスキャッシュの分
+        const int fit = static_cast<int>(std::min<size_t>(kv_budget_bytes / per_sequence, MAX_PARALLEL_SEQUENCES + 1)) - 1;
+        if (fit < slots) {
+            PQ_LOG_WARN(LogCategory::LLM, "continuous batching: " << slots << " sequences need " << (per_sequence * (slots + 1) >> 20)
+                        << " MB of KV cache per model, over the budget of " << (kv_budget_bytes >> 20) << " MB");
+            slots = fit;
+        }
+    }
+    if (slots <= 1) {
+        PQ_LOG_WARN(LogCategory::LLM, "continuous batching: KV budget is too small, keeping serial inference");
+        return;
+    }
+
+    parallelSlots = slots;
+    batchSlots.resize(parallelSlots);
+    batchBuffer = llama_batch_init(batchSize(), 0, 1);
+    batchThread = std::thread(&LlmManager::batchLoop, this);
+    PQ_LOG_INFO(LogCategory::LLM, "continuous batching: " << parallelSlots << " sequences, " << batchSize() << " tokens per batch, "
+                << (per_sequence * (parallelSlots + 1) >> 20) << " MB of KV cache per model");
+}
+
+std::string LlmManager::batchGroupKey(const BatchRequest& request) const {
+    // 同じコンテキストでも、かけるアダプターが違うリクエストは1つのバッチにできない
+    const LlmRoleConfig& config = roleConfigs.at(request.role);
+    return config.model_path + '\n' + (request.use_adapter ? config.lora_path : std::string());
+}
+
+std::string LlmManager::runBatched(const std::string& role, const std::string& prompt, bool plain_text, const TokenCallback& on_token,
+                                   const std::atomic<uint64_t>& cancel_source, uint64_t epoch, LlmExchange& exchange,
+                                   std::unique_lock<std::mutex>& lock, std::chrono::steady_clock::time_point start_time) {
+    // 語彙はモデルの重みを読まなくても引ける
+    const llama_vocab* vocab = roleVocab(role);
+    if (!vocab) return "[ERROR: Model for role '" + role + "' unavailable]";
+
+    BatchRequest request;
+    {
+        PQ_TRACE_SCOPE("llm", "tokenize");
+        request.tokens.resize(prompt.size() + 16);
+        int n = llama_tokenize(vocab, prompt.c_str(), (int)prompt.length(), request.tokens.data(), (int)request.tokens.size(), false, true);
+        if (n <= 0) return "[ERROR: Tokenization failed]";
+        request.tokens.resize(n);
+    }
+    const int n_tokens = static_cast<int>(request.tokens.size());
+    const int n_ctx = contextSize(role);
+    if (n_tokens >= n_ctx - 1) return "[ERROR: Prompt too long]";
+    exchange.prompt_tokens = n_tokens;
+
+    const LogCategory log_category = Log::categoryForRole(role);
+    PQ_LOG_DEBUG(log_category, "prompt (" << n_tokens << " tokens):\n" << prompt);
+
+    // JSON を出す役割のアダプターは出力形式ごと学習しているので、地の文（戦闘の描写）はベースモデルで書く
+    const bool json_role = role == "GM" || role == "BATTLE";
+    request.role = role;
+    request.use_adapter = !(plain_text && json_role);
+    request.json_output = !plain_text && json_role;
+    if (on_token) {
+        request.queuePiece = [&request](std::string_view piece) {
+            request.pending.append(piece.data(), piece.size());
+            return !request.stopped;
+        };
+        request.on_token = &request.queuePiece;
+    }
+    request.n_ctx = n_ctx;
+    request.max_tokens = std::min(promptBudget(role).max_new_tokens, n_ctx - 1 - n_tokens);
+    request.seed = exchange.seed;
+    request.cancel_source = &cancel_source;
+    request.epoch = epoch;
+    request.exchange = &exchange;
+    request.start = start_time;
+
+    batchQueue.push_back(&request);
+    batchWake.notify_one();
+    std::string piece;
+    size_t delivered = 0;  // on_token に渡し終えた出力の長さ（打ち切った後に生成された分は結果に含めない）
+    for (;;) {
+        {
+            PQ_TRACE_SCOPE("llm", "wait batch");
+            batchDone.wait(lock, [&request]() { return request.done || !request.pending.empty(); });
         }
-        if (pair.second.model && freed_models.find(pair.second.model) == freed_models.end()) {
-            llama_model_free(pair.second.model);
-            freed_models.insert(pair.second.model);
+        if (request.pending.empty()) break;
+        piece.clear();
+        piece.swap(request.pending);
+        if (request.stopped) continue;  // 打ち切った後に生成された分は渡さない
+        delivered = request.output.size();
+        lock.unlock();
+        const bool more = on_token(piece);
+        lock.lock();
+        if (!more) {
+            request.stopped = true;
+            batchWake.notify_one();
         }
     }
-    llama_backend_free();
+    if (request.stopped) request.output.resize(delivered);
+    PQ_LOG_DEBUG(log_category, "raw output (" << request.generated << " tokens): \"" << request.output << "\"");
+    return std::move(request.output);
 }
 
-std::string LlmManager::run_inference(const std::string& role, const std::string& prompt) {
-    auto it = instances.find(role);
-    if (it == instances.end()) {
-        return "[ERROR: Role '" + role + "' not found]";
+void LlmManager::batchLoop() {
+    if (Trace::active()) Trace::setThreadName("llm batch");
+    auto busy = [this]() {
+        if (!batchQueue.empty()) return true;
+        for (const BatchSlot& slot : batchSlots) {
+            if (slot.request) return true;
+        }
+        return false;
+    };
+    std::unique_lock<std::mutex> lock(inferenceMutex);
+    for (;;) {
+        batchWake.wait(lock, [&]() { return batchStopping || busy(); });
+        if (!busy()) return;  // 止める指示が来て、残りのリクエストも無い
+        batchStep();
+        // ステップの間に classify() や新しいリクエストが mutex を取れるようにする
+        lock.unlock();
+        std::this_thread::yield();
+        lock.lock();
     }
-    LlmInstance& instance = it->second;
+}
 
-    const auto* vocab = llama_model_get_vocab(instance.model);
-    std::vector<llama_token> tokens_list(prompt.size() + 16);
-    int n_tokens = llama_tokenize(vocab, prompt.c_str(), (int)prompt.length(), tokens_list.data(), tokens_list.size(), false, true);
-    if (n_tokens < 0) return "[ERROR: Tokenization failed]";
-    tokens_list.resize(n_tokens);
+void LlmManager::releaseSlot(BatchSlot& slot, llama_memory_t mem) {
+    if (mem) llama_memory_seq_rm(mem, slot.seq, -1, -1);
+    slot.request->done = true;
+    slot.request = nullptr;
+    batchDone.notify_all();
+}
 
-    // プロンプト表示は主要なもののみ
-    if (role == "GM") {
-        std::cout << "\n=== GM PROMPT SENT ===\n";
-        std::cout << prompt << std::endl;
-        std::cout << "=== END GM PROMPT ===\n" << std::endl;
+void LlmManager::batchStep() {
+    auto elapsed_ms = [](std::chrono::steady_clock::time_point since) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+    };
+
+    // 打ち切られたものは順番を待たずに返す（生成中のものはそこまでの結果を返す）
+    bool woke = false;
+    for (auto it = batchQueue.begin(); it != batchQueue.end();) {
+        if (!(*it)->cancelled()) {
+            ++it;
+            continue;
+        }
+        (*it)->done = true;
+        it = batchQueue.erase(it);
+        woke = true;
+    }
+    if (woke) batchDone.notify_all();
+    const BatchRequest* leader = nullptr;
+    for (BatchSlot& slot : batchSlots) {
+        if (!slot.request) continue;
+        if (slot.request->cancelled() || slot.request->stopped) {
+            if (!slot.request->stopped) {
+                PQ_LOG_DEBUG(Log::categoryForRole(slot.request->role), "cancelled after " << slot.request->generated << " tokens");
+            }
+            releaseSlot(slot, batchCtx ? llama_get_memory(batchCtx) : nullptr);
+            continue;
+        }
+        if (!leader) leader = slot.request;
+    }
+    if (!leader) {
+        if (batchQueue.empty()) return;
+        // スロットが空いたら、待っている先頭のリクエストのモデルとアダプターに切り替える
+        leader = batchQueue.front();
+        batchGroup = batchGroupKey(*leader);
     }
 
-    llama_memory_clear(llama_get_memory(instance.ctx), false);
-    
-    // バッチサイズをより安全な値に設定
-    int safe_batch_size = std::min(n_tokens, 256);  // 512から256に削減
-    llama_batch batch = llama_batch_init(safe_batch_size, 0, 1);
-    
-    // バッチ処理を複数回に分割して実行
-    int processed_tokens = 0;
-    while (processed_tokens < n_tokens) {
-        int current_batch_size = std::min(safe_batch_size, n_tokens - processed_tokens);
-        
-        // バッチの各トークンを設定
-        for (int32_t i = 0; i < current_batch_size; ++i) {
-            batch.token[i] = tokens_list[processed_tokens + i];
-            batch.pos[i] = processed_tokens + i;
-            batch.n_seq_id[i] = 1;
-            batch.seq_id[i][0] = 0;
-            batch.logits[i] = false;
+    // classify() などがステップの間にアダプターを付け替えていることがあるので、毎回この組の設定に戻す
+    const auto acquire_start = std::chrono::steady_clock::now();
+    LlmInstance instance;
+    if (!acquireRole(leader->role, instance, leader->use_adapter)) {
+        PQ_LOG_ERROR(LogCategory::LLM, "batch: model for role '" << leader->role << "' unavailable");
+        for (BatchSlot& slot : batchSlots) {
+            if (!slot.request) continue;
+            slot.request->output = "[ERROR: Model for role '" + slot.request->role + "' unavailable]";
+            releaseSlot(slot, batchCtx ? llama_get_memory(batchCtx) : nullptr);
         }
-        batch.n_tokens = current_batch_size;
-        
-        // 最後のトークンでのみlogitsを有効化（生成に必要）
-        if (processed_tokens + current_batch_size >= n_tokens) {
-            batch.logits[current_batch_size - 1] = true;
+        for (auto it = batchQueue.begin(); it != batchQueue.end();) {
+            if (batchGroupKey(**it) != batchGroup) {
+                ++it;
+                continue;
+            }
+            (*it)->output = "[ERROR: Model for role '" + (*it)->role + "' unavailable]";
+            (*it)->done = true;
+            it = batchQueue.erase(it);
         }
-
-        if (llama_decode(instance.ctx, batch) != 0) {
-            llama_batch_free(batch);
-            return "[ERROR: llama_decode failed]";
+        batchDone.notify_all();
+        return;
+    }
+    const double load_ms = elapsed_ms(acquire_start);
+    if (instance.ctx != batchCtx) {
+        // 生成の途中でモデルが追い出されて読み直された（スロットのKVはもう無い）
+        for (BatchSlot& slot : batchSlots) {
+            if (!slot.request) continue;
+            PQ_LOG_WARN(Log::categoryForRole(slot.request->role), "batch: context was reloaded, stopping generation");
+            if (slot.request->prefilling()) slot.request->output = "[ERROR: llama_decode failed]";
+            releaseSlot(slot, nullptr);
         }
-        
-        processed_tokens += current_batch_size;
+        batchCtx = instance.ctx;
     }
-    llama_batch_free(batch);
 
-    std::string result_str;
-    int n_cur = n_tokens;
-    
-    // サンプラー設定
-    struct llama_sampler_chain_params sparams = llama_sampler_chain_default_params();
-    llama_sampler* sampler = llama_sampler_chain_init(sparams);
-    
-    if (role == "GM") {
-        // JSON生成用：より確定的
-        llama_sampler_chain_add(sampler, llama_sampler_init_temp(0.3f));
-        llama_sampler_chain_add(sampler, llama_sampler_init_top_k(20));
-        llama_sampler_chain_add(sampler, llama_sampler_init_top_p(0.85f, 1));
-    } else {
-        // NPC会話用：自然な多様性
-        llama_sampler_chain_add(sampler, llama_sampler_init_temp(0.7f));
-        llama_sampler_chain_add(sampler, llama_sampler_init_top_k(35));
-        llama_sampler_chain_add(sampler, llama_sampler_init_top_p(0.9f, 1));
+    ThreadPoolLease pool_lease(*this);
+    llama_context* ctx = instance.ctx;
+    llama_memory_t mem = llama_get_memory(ctx);
+    const llama_vocab* vocab = llama_model_get_vocab(instance.model);
+    const int n_vocab = llama_vocab_n_tokens(vocab);
+    const AppliedAdapter& adapter = appliedAdapters[ctx];
+    const PrefixCache::Space space(adapter.adapter, adapter.scale);
+    const LlmContextConfig& context = contextConfigs.at(roleConfigs.at(leader->role).model_path);
+    const llama_seq_id seq_base = MAX_CLASSIFY_CANDIDATES + context.prefix_cache_leaves;
+
+    // 同じモデルとアダプターのリクエストを先に来た順に空いたスロットへ入れる（違うものは今の組が終わるまで待つ）。
+    // 同時にプリフィルすると、前のプロンプトが木に入る前に次が fork して共通部分を使い回せないので、1件ずつ入れる
+    bool prefilling = false;
+    for (const BatchSlot& slot : batchSlots) {
+        if (slot.request && slot.request->prefilling()) prefilling = true;
     }
-    llama_sampler_chain_add(sampler, llama_sampler_init_dist(1234));
-    
-    llama_batch gen_batch = llama_batch_init(1, 0, 1);
+    int admitted = 0;
+    for (size_t s = 0; s < batchSlots.size() && !batchQueue.empty() && !prefilling; ++s) {
+        BatchSlot& slot = batchSlots[s];
+        if (slot.request) continue;
+        BatchRequest* request = batchQueue.front();
+        if (batchGroupKey(*request) != batchGroup) break;
+        batchQueue.pop_front();
+        slot.request = request;
+        slot.seq = seq_base + static_cast<llama_seq_id>(s);
+        request->admitted = std::chrono::steady_clock::now();
+        request->exchange->load_ms = load_ms;
+        admitted++;
 
-    bool has_started_json = false;
-    int brace_count = 0;
-    
-    std::vector<std::string> stop_tokens = {"<|eot_id|>", "<|end_of_text|>", "[/GPT]", "</s>"};
-    
-    // トークン数制限を更に削減してエラーを回避
-    int max_tokens = (role == "GM" || role == "BATTLE") ? 150 : 80;
+        llama_memory_seq_rm(mem, slot.seq, -1, -1);
+        if (instance.prefix) {
+            const int n_prompt = static_cast<int>(request->tokens.size());
+            const uint64_t evictions = instance.prefix->evictions();
+            {
+                PQ_TRACE_NAMED_SCOPE(fork_span, "llm", "prefix fork");
+                request->n_past = instance.prefix->fork(space, request->tokens.data(), n_prompt, slot.seq, request->max_tokens);
+                PQ_TRACE_ARG(fork_span, "reused_tokens", request->n_past);
+            }
+            request->exchange->reused_tokens = request->n_past;
+            std::lock_guard<std::mutex> lock(metricsMutex);
+            prefixStats.lookups++;
+            if (request->n_past > 0) prefixStats.hits++;
+            prefixStats.reused_tokens += static_cast<uint64_t>(request->n_past);
+            prefixStats.prefilled_tokens += static_cast<uint64_t>(n_prompt - request->n_past);
+            prefixStats.evictions += instance.prefix->evictions() - evictions;
+        }
 
-    // リアルタイム表示は重要な情報のみ
-    if (role == "GM") {
-        std::cout << "=== GM RAW OUTPUT ===\n";
+        // サンプラーはスロットごと。リクエストごとにリセットし、乱数はリクエストごとのシードで初期化
+        if (slot.samplerRole != request->role) {
+            if (slot.sampler) llama_sampler_free(slot.sampler);
+            slot.sampler = createRoleSampler(request->role);
+            slot.samplerRole = request->role;
+        }
+        llama_sampler_reset(slot.sampler);
+        slot.rng.seed(request->seed);
+        slot.candidates.resize(n_vocab);
+        prefilling = request->prefilling();
     }
 
-    for (int i = 0; i < max_tokens; ++i) {
-        llama_token new_token_id = llama_sampler_sample(sampler, instance.ctx, -1);
-        llama_sampler_accept(sampler, new_token_id);
-
-        if (llama_vocab_is_eog(vocab, new_token_id)) break;
+    // 生成中のスロットは次の1トークンずつ入れ、残りの枠をプリフィル中のプロンプトで埋める
+    llama_batch& batch = batchBuffer;
+    batch.n_tokens = 0;
+    auto add = [&batch](llama_token token, int pos, llama_seq_id seq, bool logits) {
+        int i = batch.n_tokens++;
+        batch.token[i] = token;
+        batch.pos[i] = pos;
+        batch.n_seq_id[i] = 1;
+        batch.seq_id[i][0] = seq;
+        batch.logits[i] = logits;
+    };
+    int active = 0;
+    int generating = 0;
+    for (BatchSlot& slot : batchSlots) {
+        slot.chunk = 0;
+        slot.row = -1;
+        if (!slot.request) continue;
+        active++;
+        if (slot.request->prefilling()) continue;
+        slot.row = batch.n_tokens;
+        slot.chunk = 1;
+        add(slot.request->next, slot.request->n_past, slot.seq, true);
+        generating++;
+    }
+    for (BatchSlot& slot : batchSlots) {
+        BatchRequest* request = slot.request;
+        if (!request || !request->prefilling()) continue;
+        const int n_prompt = static_cast<int>(request->tokens.size());
+        const int chunk = std::min(batchSize() - batch.n_tokens, n_prompt - request->n_past);
+        if (chunk <= 0) break;
+        for (int i = 0; i < chunk; ++i) {
+            const int pos = request->n_past + i;
+            // 最後のトークンでのみlogitsを有効化（生成に必要）
+            add(request->tokens[pos], pos, slot.seq, pos == n_prompt - 1);
+        }
+        slot.chunk = chunk;
+        if (request->n_past + chunk == n_prompt) slot.row = batch.n_tokens - 1;
+    }
+    if (batch.n_tokens == 0) return;
 
-        char piece[128] = {0};
-        int len = llama_token_to_piece(vocab, new_token_id, piece, sizeof(piece), 0, false);
-        if (len < 0) break;
-        std::string piece_str(piece, len);
+    int rc = 0;
+    {
+        PQ_TRACE_NAMED_SCOPE(decode_span, "llm", "batch decode");
+        PQ_TRACE_ARG(decode_span, "tokens", batch.n_tokens);
+        PQ_TRACE_ARG(decode_span, "sequences", active);
+        rc = llama_decode(ctx, batch);
+        if (rc != 0 && instance.prefix && instance.prefix->cachedTokens() > 0) {
+            // 残したKVでセルが埋まって入らなかった場合は、木を捨てて計算し直す
+            PQ_LOG_WARN(LogCategory::LLM, "batched decode failed with " << instance.prefix->cachedTokens() << " cached tokens, clearing prefix cache");
+            instance.prefix->clear();
+            rc = llama_decode(ctx, batch);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(metricsMutex);
+        batchStats.requests += static_cast<uint64_t>(admitted);
+        batchStats.peak_active = std::max(batchStats.peak_active, active);
+        if (rc == 0) {
+            batchStats.steps++;
+            batchStats.tokens += static_cast<uint64_t>(batch.n_tokens);
+            batchStats.generated += static_cast<uint64_t>(generating);
+        }
+    }
+    if (rc != 0) {
+        // このバッチに入れたリクエストは、生成中ならそこまでの結果を、プリフィル中ならエラーを返す
+        PQ_LOG_WARN(LogCategory::LLM, "batched llama_decode failed (" << batch.n_tokens << " tokens), stopping " << active << " requests");
+        for (BatchSlot& slot : batchSlots) {
+            if (!slot.request || slot.chunk == 0) continue;
+            if (slot.request->prefilling()) slot.request->output = "[ERROR: llama_decode failed]";
+            releaseSlot(slot, mem);
+        }
+        return;
+    }
 
-        result_str.append(piece_str);
-        
-        if (role == "GM") {
-            std::cout << piece_str << std::flush;
+    for (BatchSlot& slot : batchSlots) {
+        BatchRequest* request = slot.request;
+        if (!request || slot.chunk == 0) continue;
+        const bool was_prefilling = request->prefilling();
+        request->n_past += slot.chunk;
+        if (slot.row < 0) continue;  // プロンプトの途中まで
+        LlmExchange& exchange = *request->exchange;
+        if (was_prefilling) {
+            exchange.prefill_ms = elapsed_ms(request->admitted);
+            if (instance.prefix) instance.prefix->insert(space, request->tokens.data(), request->n_past, slot.seq);
         }
 
-        // 停止トークンのチェック
-        for (const auto& stop_token : stop_tokens) {
-            if (result_str.find(stop_token) != std::string::npos) {
-                goto generation_done;
-            }
+        llama_token token;
+        {
+            PQ_TRACE_SCOPE("llm", "sample");
+            token = sampleLogits(slot.sampler, slot.candidates, slot.rng, llama_get_logits_ith(ctx, slot.row));
         }
+        if (request->generated == 0) exchange.first_token_ms = elapsed_ms(request->start);
+        request->generated++;
+        exchange.generated_tokens++;
 
-        // 役割別の終了条件判定
-        if (role == "GM") {
-            // GM用：JSON形式の完了を検出
-            if (!has_started_json && piece_str.find('{') != std::string::npos) {
-                has_started_json = true;
-            }
-            if (has_started_json) {
-                for(char c : piece_str) {
-                    if (c == '{') brace_count++;
-                    if (c == '}') brace_count--;
-                }
-                if (brace_count <= 0 && has_started_json) break;
-            }
-        } else if (role == "BATTLE") {
-            // 戦闘用：JSON形式の完了を検出
-            if (!has_started_json && piece_str.find('{') != std::string::npos) {
-                has_started_json = true;
-            }
-            if (has_started_json) {
-                for(char c : piece_str) {
-                    if (c == '{') brace_count++;
-                    if (c == '}') brace_count--;
-                }
-                if (brace_count <= 0 && has_started_json) break;
-            }
-        } else {
-            // NPC会話の自然な終了
-            if ((piece_str.find("。") != std::string::npos || 
-                 piece_str.find("！") != std::string::npos || 
-                 piece_str.find("？") != std::string::npos) && 
-                result_str.length() > 20) {
-                break;
-            }
+        if (!appendToken(vocab, token, request->output, request->json_output, request->on_token, request->role) ||
+            request->generated >= request->max_tokens) {
+            releaseSlot(slot, mem);
+            continue;
         }
-        
-        gen_batch.n_tokens = 1;
-        gen_batch.token[0] = new_token_id;
-        gen_batch.pos[0] = n_cur;
-        gen_batch.n_seq_id[0] = 1;
-        gen_batch.seq_id[0][0] = 0;
-        gen_batch.logits[0] = true;
-        
-        // バッチサイズチェック（コンテキストサイズ制限）
-        if (n_cur >= 2048 - 1) {  // コンテキストサイズの上限近くで停止
-            std::cout << "\n[WARNING: Context size limit reached, stopping generation]" << std::endl;
-            break;
+        // コンテキストサイズの上限近くで停止
+        if (request->n_past >= request->n_ctx - 1) {
+            PQ_LOG_WARN(Log::categoryForRole(request->role), "context size limit reached, stopping generation");
+            releaseSlot(slot, mem);
+            continue;
         }
-        
-        if (llama_decode(instance.ctx, gen_batch) != 0) {
-            std::cout << "\n[WARNING: llama_decode failed, stopping generation]" << std::endl;
+        request->next = token;
+    }
+    // 断片を貯めたリクエストの依頼元を起こす（on_token はそちらで呼ぶ）
+    for (const BatchSlot& slot : batchSlots) {
+        if (slot.request && !slot.request->pending.empty()) {
+            batchDone.notify_all();
             break;
         }
-        n_cur++;
     }
-    
-generation_done:
-    llama_batch_free(gen_batch);
-    llama_sampler_free(sampler);
+}
 
-    if (role == "GM") {
-        std::cout << std::endl;
-        std::cout << "=== END GM RAW OUTPUT ===\n";
-        std::cout << "=== GM BEFORE CLEANUP ===\n";
-        std::cout << "\"" << result_str << "\"" << std::endl;
-        std::cout << "=== END GM BEFORE CLEANUP ===\n" << std::endl;
-    }
-    
+std::string LlmManager::cleanupOutput(const std::string& role, std::string result_str) {
+    static const std::string_view battle_cleanup_tokens[] = {"<|eot_id|>", "<|end_of_text|>", "</s>"};
+    static const std::string_view cleanup_tokens[] = {
+        "<|eot_id|>", "<|start_header_id|>", "<|end_header_id|>", 
+        "<|begin_of_text|>", "[/GPT]", "[GPT]", "</s>", "<s>", "<|end_of_text|>"
+    };
+    auto truncate_at = [&](std::string_view token) {
+        size_t pos = result_str.find(token.data(), 0, token.size());
+        if (pos != std::string::npos) result_str.resize(pos);
+    };
     if (role == "BATTLE") {
-        std::vector<std::string> battle_cleanup_tokens = {
-            "<|eot_id|>", "<|end_of_text|>", "</s>"
-        };
-        
-        for (const auto& token : battle_cleanup_tokens) {
-            size_t pos = result_str.find(token);
-            if (pos != std::string::npos) {
-                result_str = result_str.substr(0, pos);
-            }
-        }
+        for (std::string_view token : battle_cleanup_tokens) truncate_at(token);
     } else {
         // 通常のクリーンアップ
-        std::vector<std::string> cleanup_tokens = {
-            "<|eot_id|>", "<|start_header_id|>", "<|end_header_id|>", 
-            "<|begin_of_text|>", "[/GPT]", "[GPT]", "</s>", "<s>", "<|end_of_text|>"
-        };
-        
-        for (const auto& token : cleanup_tokens) {
-            size_t pos = result_str.find(token);
-            if (pos != std::string::npos) {
-                result_str = result_str.substr(0, pos);
-            }
-        }
+        for (std::string_view token : cleanup_tokens) truncate_at(token);
     }
     
-    if (role == "BATTLE") {
-        std::cout << "=== BATTLE AFTER CLEANUP ===\n";
-        std::cout << "\"" << result_str << "\"" << std::endl;
-        std::cout << "=== END BATTLE AFTER CLEANUP ===\n" << std::endl;
-    }
-    if (role == "GM") {
-        std::cout << "=== GM AFTER CLEANUP ===\n";
-        std::cout << "\"" << result_str << "\"" << std::endl;
-        std::cout << "=== END GM AFTER CLEANUP ===\n" << std::endl;
-    }
+    PQ_LOG_DEBUG(Log::categoryForRole(role), "output after cleanup: \"" << result_str << "\"");
     
     return result_str;
 }
 
-std::string LlmManager::generateNpcDialogue(const std::vector<ChatMessage>& history, const std::string& scene_context) {
-    std::string world_lore = 
+std::string LlmManager::generateNpcDialogue(const ConversationView& history, const std::string& scene_context) {
+    PQ_TRACE_SCOPE("llm", "generateNpcDialogue");
+    // 世界設定 → 人物設定 → 関連する記憶 → 場面と会話、の順に並べ、変わりやすいものほど後ろに置く。
+    // 前の2つはどの会話でも同じトークン列になるので、KVは PrefixCache から使い回される
+    // （NPC が増えても、計算し直すのは人物設定から後ろだけ）。
+    // 世界設定はここには核だけを書き、細部は data/content.txt の [lore] から発言に関係する分だけを引く
+    static const std::string world_lore =
         "=== 世界設定 ===\n"
-        "かつて、世界は万物の調和を司る「調和のクリスタル」の恩恵を受け、平和と繁栄を謳歌していた。\n"
-        "しかし、ある日、どこからともなく現れた謎の災厄「静寂」が世界を覆い始める。\n"
-        "「静寂」は生命力と色彩を奪い、世界を無音の灰色に変えていく恐ろしい現象である。\n\n"
-        "物語は、世界の片隅にある「始まりの村」から始まる。\n"
-        "この村は古い結界によって「静寂」から守られているが、結界の力は年々弱くなっている。\n"
-        "村のすぐそばには「静寂の森」が広がり、そこには「静寂」に侵された魔物たちが徘徊している。\n\n"
-        "村の長老（あなた）は古代の知識を持つ賢者で、「調和のクリスタル」を復活させる方法を探している。\n"
-        "最近の研究で、森の奥深くにある古い神殿に手がかりがあると分かったが、\n"
-        "そこに辿り着くには多くの危険を乗り越えなければならない。\n"
-        "長老は新たな勇者の到来を待ち望んでいる。\n\n";
+        "世界は万物の調和を司る「調和のクリスタル」に守られてきたが、生命力と色彩を奪う災厄「静寂」に覆われつつある。\n"
+        "物語は「始まりの村」から始まる。村の長老（あなた）はクリスタルを復活させる方法を探し、新たな勇者を待っている。\n\n";
 
-    std::string system_prompt =
-        world_lore +
+    static const std::string elder_persona =
         "=== あなたの役割 ===\n"
-        "あなたは始まりの村の長老です。プレイヤーに対して親切で知恵深い助言をしてください。\n"
-        "現在の状況: " + scene_context + "\n\n"
+        "あなたは始まりの村の長老です。プレイヤーに対して親切で知恵深い助言をしてください。\n\n"
         "特徴：\n"
         "- 長老らしい落ち着いた口調で話す（「〜じゃ」「〜のう」などの語尾を使用）\n"
         "- プレイヤーの発言に適切に反応する\n"
@@ -324,14 +1418,21 @@ std::string LlmManager::generateNpcDialogue(const std::vector<ChatMessage>& hist
         "- 若者を励まし、希望を与えようとする\n"
         "- 古代の知識や魔法について語ることができる\n"
         "- 村の結界や森の危険について警告する\n\n"
-        "親しみやすい日本語で、長老のセリフのみを出力してください。";
+        "親しみやすい日本語で、長老のセリフのみを出力してください。\n\n";
+
+    std::string system_prefix = "<|begin_of_text|><|start_header_id|>system<|end_header_id|>\n\n";
+    if (!compactPrompt("NPC")) {
+        // 世界設定と長老の人物像はアダプターが持っている
+        system_prefix += world_lore + elder_persona;
+    }
+    const std::string situation = "現在の状況: " + scene_context;
 
     std::stringstream ss;
-    ss << "<|begin_of_text|><|start_header_id|>system<|end_header_id|>\n\n" << system_prompt << "<|eot_id|>";
+    ss << situation << "<|eot_id|>";
     
     bool has_initial_greeting = false;
-    for (const auto& msg : history) {
-        if (msg.role == "assistant" && !msg.content.empty()) {
+    for (size_t i = 0; i < history.size(); ++i) {
+        if (history[i].role == ChatRole::ASSISTANT && !history[i].text.empty()) {
             has_initial_greeting = true;
             break;
         }
@@ -342,23 +1443,30 @@ std::string LlmManager::generateNpcDialogue(const std::vector<ChatMessage>& hist
         ss << "<|start_header_id|>assistant<|end_header_id|>\n\n長老: あなたか...。よく来てくれた。話したいことがある。<|eot_id|>";
     }
     
-    int start_idx = std::max(0, (int)history.size() - 5);
-    for (int i = start_idx; i < history.size(); ++i) {
-        const auto& msg = history[i];
-        if (msg.role == "system") continue;
-        if (msg.role == "user") {
-            ss << "<|start_header_id|>user<|end_header_id|>\n\nプレイヤー: " << msg.content << "<|eot_id|>";
-        } else if (msg.role == "assistant") {
-            ss << "<|start_header_id|>assistant<|end_header_id|>\n\n長老: " << msg.content << "<|eot_id|>";
+    // 履歴はトークン予算に収まるだけ新しいものから入れる
+    static const std::string tail = "<|start_header_id|>assistant<|end_header_id|>\n\n長老: ";
+    std::string head = ss.str();
+    size_t first_turn = history.size();
+    std::string packed = packHistory("NPC", history, system_prefix + head + tail, &first_turn);
+
+    // 履歴に入り切らなかった古い会話・出来事と世界設定の細部から、直近の発言に関係する分を残りの予算で入れる
+    std::string memories;
+    if (const llama_vocab* vocab = roleVocab("NPC")) {
+        const int n_ctx = contextSize("NPC");
+        int available = n_ctx - tokenLength(vocab, system_prefix + head + packed + tail) - promptBudget("NPC", n_ctx).max_new_tokens - 1;
+        int budget = std::min(static_cast<int>(static_cast<int64_t>(RETRIEVAL_TOKENS) * n_ctx / BASE_CONTEXT_SIZE), available);
+        std::string query = scene_context;
+        for (size_t i = history.size(); i > 0; --i) {
+            if (history[i - 1].role == ChatRole::USER && !history[i - 1].text.empty()) {
+                query = history[i - 1].text;
+                break;
+            }
         }
+        uint64_t exclude_from = first_turn < history.size() ? history[first_turn].serial : UINT64_MAX;
+        memories = retrieveMemories(query, exclude_from, budget, vocab);
     }
-    ss << "<|start_header_id|>assistant<|end_header_id|>\n\n長老: ";
-    
-    std::string raw_response = run_inference("NPC", ss.str());
-    
-    std::cout << "=== NPC PROMPT SENT ===\n";
-    std::cout << ss.str() << std::endl;
-    std::cout << "=== END NPC PROMPT ===\n" << std::endl;
+
+    std::string raw_response = run_inference("NPC", system_prefix + memories + head + packed + tail);
     
     // Llama3の特殊トークンを除去
     std::vector<std::string> tokens_to_remove = {
@@ -380,14 +1488,44 @@ std::string LlmManager::generateNpcDialogue(const std::vector<ChatMessage>& hist
         raw_response = raw_response.substr(first, last - first + 1);
     }
     
-    std::cout << "=== NPC RAW RESPONSE ===\n";
-    std::cout << "\"" << raw_response << "\"" << std::endl;
-    std::cout << "=== END NPC RAW RESPONSE ===\n" << std::endl;
+    PQ_LOG_INFO(LogCategory::NPC, "response: \"" << raw_response << "\"");
     
     return raw_response;
 }
 
-GmResponse LlmManager::generateGmResponse(const std::vector<ChatMessage>& history) {
+GmResponse LlmManager::generateGmResponse(const ConversationView& history, const GmDecisionCallback& on_decision) {
+    PQ_TRACE_SCOPE("llm", "generateGmResponse");
+    // 直前の長老の発言が同じ場面で、意味の近い発言なら過去の判断を再利用する
+    auto start_time = std::chrono::steady_clock::now();
+    std::vector<float> embedding;
+    std::string cache_bucket = "GM";
+    const std::string* last_user = nullptr;
+    for (size_t i = history.size(); i > 0; --i) {
+        const ChatTurn& turn = history[i - 1];
+        if (turn.role == ChatRole::USER && !last_user) last_user = &turn.text;
+        if (turn.role == ChatRole::ASSISTANT) { cache_bucket += "\x1f" + turn.text; break; }
+    }
+    const std::string cache_key = last_user ? *last_user : std::string();
+    cache_bucket += "\x1f" + gmCacheSignature(cache_key);
+    std::string replayed;
+    if (replayCacheHit("GM", cache_key, replayed)) {
+        GmResponse cached = parseGmResponse(replayed);
+        if (on_decision) on_decision(cached);
+        return cached;
+    }
+    bool cacheable = gmCache && last_user && !last_user->empty() && embed(SemanticCache<GmResponse>::normalizeInput(*last_user), embedding);
+    if (cacheable) {
+        GmResponse cached;
+        float score = 0.0f;
+        if (gmCache->lookup(cache_bucket, embedding, cached, &score)) {
+            PQ_LOG_INFO(LogCategory::GM, "semantic cache hit (similarity " << score << ")");
+            recordCacheHit("GM", cache_key, toJson(cached));
+            if (on_decision) on_decision(cached);
+            recordCacheResult(true, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count());
+            return cached;
+        }
+    }
+
     std::string system_prompt =
         "あなたは日本語RPGのゲームマスターです。プレイヤーとの会話を分析し、JSON形式で応答してください。\n\n"
         "世界設定：\n"
@@ -395,65 +1533,147 @@ GmResponse LlmManager::generateGmResponse(const std::vector<ChatMessage>& histor
         "- プレイヤーは「始まりの村」にいる\n"
         "- 長老は「調和のクリスタル」を復活させる方法を探している\n"
         "- 森には「静寂」に侵された魔物がいる\n\n"
-        "必須フォーマット：\n"
+        "必須フォーマット（キーはこの順番で出力すること）：\n"
         "{\n"
-        "  \"scene_context\": \"現在の状況や雰囲気の説明\",\n"
         "  \"action\": \"CONTINUE/DEPART\",\n"
-        "  \"items\": [\"アイテム名1\", \"アイテム名2\"]\n"
+        "  \"items\": [\"アイテム名1\", \"アイテム名2\"],\n"
+        "  \"scene_context\": \"現在の状況や雰囲気の説明\"\n"
         "}\n\n"
         "判断基準：\n"
         "- プレイヤーが冒険に出発する意思を明確に示した場合：action=\"DEPART\"\n"
         "- その他の場合：action=\"CONTINUE\"\n"
         "- DEPART時は items に [\"初心者の剣\", \"革の鎧\"] を設定\n\n"
         "プレイヤーの発言内容と文脈を十分に考慮して判断してください。";
+    if (compactPrompt("GM")) {
+        // 判断基準とJSONの形式はアダプターが持っている
+        system_prompt = "会話を分析し、判定をJSONで出力してください。";
+    }
 
+    std::string head = "<|begin_of_text|><|start_header_id|>system<|end_header_id|>\n\n" + system_prompt + "<|eot_id|>";
     std::stringstream ss;
-    ss << "<|begin_of_text|><|start_header_id|>system<|end_header_id|>\n\n" << system_prompt << "<|eot_id|>";
-    
-    int start_idx = std::max(0, (int)history.size() - 6);
-    for (int i = start_idx; i < history.size(); ++i) {
-        const auto& msg = history[i];
-        if (msg.role == "system") continue;
-        if (msg.role == "user") {
-            ss << "<|start_header_id|>user<|end_header_id|>\n\nプレイヤー: " << msg.content << "<|eot_id|>";
-        } else if (msg.role == "assistant") {
-            ss << "<|start_header_id|>assistant<|end_header_id|>\n\n長老: " << msg.content << "<|eot_id|>";
-        }
-    }
-    ss << "<|start_header_id|>user<|end_header_id|>\n\n上記の会話を分析してください。<|eot_id|>";
-    ss << "<|start_header_id|>assistant<|end_header_id|>\n\n";
+    ss << head << packHistory("GM", history, head + GM_PROMPT_TAIL) << GM_PROMPT_TAIL;
 
-    std::string raw_response = run_inference("GM", ss.str());
-    
-    std::cout << "=== GM RESPONSE BEFORE PARSING ===\n";
-    std::cout << "\"" << raw_response << "\"" << std::endl;
-    std::cout << "=== END GM RESPONSE ===\n" << std::endl;
-    
-    GmResponse result = parseGmResponse(raw_response);
-    
-    std::cout << "=== PARSED GM RESPONSE ===\n";
-    std::cout << "scene_context: \"" << result.scene_context << "\"" << std::endl;
-    std::cout << "action: \"" << result.action << "\"" << std::endl;
-    std::cout << "items: [";
-    for (size_t i = 0; i < result.items.size(); ++i) {
-        std::cout << "\"" << result.items[i] << "\"";
-        if (i < result.items.size() - 1) std::cout << ", ";
-    }
-    std::cout << "]" << std::endl;
-    std::cout << "=== END PARSED RESPONSE ===\n" << std::endl;
+    // 生成と同時にパースし、JSONが閉じた時点で生成を止める。
+    // action と items が揃った時点で、scene_context の生成を待たずに判定を渡す。
+    GmResponse result;
+    GmResponseBuilder builder(result);
+    JsonStream stream(builder);
+    bool decided = false;
+    bool completed = false;
+    bool stopped = false;
+    std::string raw_response = run_inference("GM", ss.str(), false, [&](std::string_view piece) {
+        bool done = stream.feed(piece);
+        if (on_decision && !decided && builder.decisionReady()) {
+            decided = true;
+            if (!on_decision(result)) {
+                stopped = true;  // 依頼元が打ち切った
+                return false;
+            }
+        }
+        return !done;
+    }, "", &completed);
+    builder.finish();
+    if (on_decision && !decided) on_decision(result);
     
+    PQ_LOG_INFO(LogCategory::GM, "action=" << result.action << " items=[" << joinItems(result.items)
+                << "] scene_context=\"" << result.scene_context << "\"");
+
+    // 取り消された・打ち切られた生成は途中までの応答なので、キャッシュにも取り逃しの記録にも入れない
+    if (cacheable && completed && !stopped) {
+        gmCache->insert(cache_bucket, embedding, result);
+        recordCacheResult(false, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count());
+    }
     return result;
 }
 
-BattleResponse LlmManager::generateBattleResponse(const std::string& player_stats, const std::string& enemy_stats, const std::string& player_action, const std::string& enemy_info) {
+GmResponse LlmManager::generateGmDecision(const ConversationView& history, const GmDecisionCallback& on_decision) {
+    PQ_TRACE_SCOPE("llm", "generateGmDecision");
+    std::string system_prompt =
+        "あなたは日本語RPGのゲームマスターです。プレイヤーとの会話を分析し、次の行動を判定してください。\n\n"
+        "世界設定：\n"
+        "- 世界は「静寂」という災厄に脅かされている\n"
+        "- プレイヤーは「始まりの村」にいる\n"
+        "- 長老は「調和のクリスタル」を復活させる方法を探している\n"
+        "- 森には「静寂」に侵された魔物がいる\n\n"
+        "判断基準：\n"
+        "- プレイヤーが冒険に出発する意思を明確に示した場合：DEPART\n"
+        "- その他の場合：CONTINUE\n\n"
+        "CONTINUE か DEPART のどちらか一語だけを答えてください。";
+
+    std::string head = "<|begin_of_text|><|start_header_id|>system<|end_header_id|>\n\n" + system_prompt + "<|eot_id|>";
+    std::stringstream ss;
+    ss << head << packHistory("GM", history, head + GM_PROMPT_TAIL) << GM_PROMPT_TAIL;
+
+    static const std::vector<std::string> actions = {"CONTINUE", "DEPART"};
+    ClassifyResult decision = classify("GM", ss.str(), actions);
+
+    // 渡すアイテムと場面の説明はコンテンツの定義なので、呼び出し側（GameSession）が補う
+    GmResponse res;
+    res.action = decision.index == 1 ? "DEPART" : "CONTINUE";
+    if (on_decision) on_decision(res);
+
+    if (decision.index >= 0) {
+        PQ_LOG_INFO(LogCategory::GM, "decision action=" << res.action
+                    << " logprob/token CONTINUE=" << decision.logprobs[0] << " (" << decision.tokens[0] << " tokens)"
+                    << " DEPART=" << decision.logprobs[1] << " (" << decision.tokens[1] << " tokens)");
+    } else {
+        PQ_LOG_INFO(LogCategory::GM, "decision action=" << res.action << " (classifier failed)");
+    }
+    return res;
+}
+
+BattleResponse LlmManager::generateBattleResponse(const std::string& player_stats, const std::string& enemy_stats, const std::string& player_action,
+                                                  const std::string& enemy_info, const BattleDecisionCallback& on_decision) {
+    PQ_TRACE_SCOPE("llm", "generateBattleResponse");
+    // ダメージはHPに依存しないので、HPを除いたステータスと敵情報を状態として照合する
+    auto without_hp = [](const std::string& stats) {
+        if (stats.rfind("HP:", 0) != 0) return stats;
+        size_t sep = stats.find(", ");
+        return sep == std::string::npos ? std::string() : stats.substr(sep + 2);
+    };
+    auto start_time = std::chrono::steady_clock::now();
+    std::vector<float> embedding;
+    std::string cache_bucket = "BATTLE\x1f" + enemy_info + "\x1f" + without_hp(player_stats) + "\x1f" + without_hp(enemy_stats) +
+                               "\x1f" + battleCacheSignature(player_action);
+    BattleResponse cached;
+    bool cache_hit = false;
+    std::string replayed;
+    if (replayCacheHit("BATTLE", player_action, replayed)) {
+        cached = parseBattleResponse(replayed);
+        cache_hit = true;
+    }
+    bool cacheable = !cache_hit && battleCache && embed(SemanticCache<BattleResponse>::normalizeInput(player_action), embedding);
+    if (cacheable) {
+        float score = 0.0f;
+        if (battleCache->lookup(cache_bucket, embedding, cached, &score)) {
+            PQ_LOG_INFO(LogCategory::BATTLE, "semantic cache hit (similarity " << score << ")");
+            recordCacheHit("BATTLE", player_action, toJson(cached));
+            cache_hit = true;
+        }
+    }
+    if (cache_hit) {
+        // 判定は再利用し、今回の言い回しに合わせて描写だけ作り直す
+        if (on_decision) {
+            BattleResponse decision = cached;
+            decision.effect_text.clear();
+            on_decision(decision);
+        }
+        std::string outcome = cached.hit ? "攻撃が命中し、" + std::to_string(cached.damage) + "のダメージを与えた" : "攻撃は外れた";
+        std::string narration = generateBattleNarration(player_action, enemy_info, outcome);
+        if (!narration.empty()) cached.effect_text = narration;
+        recordCacheResult(true, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count());
+        return cached;
+    }
+
     std::string system_prompt =
         "あなたは戦闘の裁定者です。「静寂」に侵された魔物との戦いを裁定します。\n"
         "以下のステータスを持つキャラクターが、指定された方法で攻撃します。\n"
         "この攻撃がどの程度のダメージを与えるか、命中するか、そして何か追加効果が発生するかを判断し、\n"
         "以下のJSON形式で結果を返してください。JSON以外のテキストは絶対に出力してはいけません。\n\n"
+        "キーは必ずこの順番で出力してください。\n\n"
         "{\n"
-        "  \"damage\": 数値,\n"
         "  \"hit\": true/false,\n"
+        "  \"damage\": 数値,\n"
         "  \"effect_text\": \"追加効果の説明テキスト\"\n"
         "}\n\n"
         "攻撃側ステータス: " + player_stats + "\n"
@@ -461,168 +1681,440 @@ BattleResponse LlmManager::generateBattleResponse(const std::string& player_stat
         "敵の情報: " + enemy_info + "\n"
         "攻撃方法: " + player_action + "\n\n"
         "判定基準：\n"
-        "- 基本ダメージは攻撃力から防御力を引いた値\n"
+        "- 基本ダメージは攻撃力から防御力の半分を引いた値（魔法の攻撃なら魔力から魔法防御の半分を引いた値、最低1）\n"
         "- 攻撃方法が敵の弱点に該当する場合、ダメージを1.5～2倍に増加\n"
         "- 命中率は攻撃方法の妥当性で判断（通常80-90%）\n"
         "- 弱点攻撃の場合はeffect_textで弱点を突いたことを説明";
+    if (compactPrompt("BATTLE")) {
+        // 判定基準とJSONの形式はアダプターが持っているので、今回の入力だけを渡す
+        system_prompt =
+            "攻撃側ステータス: " + player_stats + "\n"
+            "防御側ステータス: " + enemy_stats + "\n"
+            "敵の情報: " + enemy_info + "\n"
+            "攻撃方法: " + player_action;
+    }
 
     std::stringstream ss;
     ss << "<|begin_of_text|><|start_header_id|>system<|end_header_id|>\n\n" << system_prompt << "<|eot_id|>";
     ss << "<|start_header_id|>assistant<|end_header_id|>\n\n";
     
-    std::string raw_response = run_inference("BATTLE", ss.str());
-    
-    BattleResponse result = parseBattleResponse(raw_response);
-    
-    // ★★★ 簡潔な結果表示のみ ★★★
-    std::cout << "=== BATTLE RESULT ===\n";
-    std::cout << "damage: " << result.damage << std::endl;
-    std::cout << "hit: " << (result.hit) << std::endl;
-    std::cout << "effect_text: " << result.effect_text << std::endl;
-    std::cout << "==================\n" << std::endl;
+    // hit と damage が揃った時点で、effect_text の生成を待たずに判定を渡す
+    BattleResponse result;
+    BattleResponseBuilder builder(result);
+    JsonStream stream(builder);
+    bool decided = false;
+    bool completed = false;
+    bool stopped = false;
+    run_inference("BATTLE", ss.str(), false, [&](std::string_view piece) {
+        bool done = stream.feed(piece);
+        if (on_decision && !decided && builder.decisionReady()) {
+            decided = true;
+            if (!on_decision(result)) {
+                stopped = true;  // 依頼元が打ち切った
+                return false;
+            }
+        }
+        return !done;
+    }, "", &completed);
+    builder.finish();
+    if (on_decision && !decided) on_decision(result);
     
+    PQ_LOG_INFO(LogCategory::BATTLE, "damage=" << result.damage << " hit=" << result.hit
+                << " effect_text=\"" << result.effect_text << "\"");
+
+    // 取り消された・打ち切られた生成は途中までの応答なので、キャッシュにも取り逃しの記録にも入れない
+    if (cacheable && completed && !stopped) {
+        battleCache->insert(cache_bucket, embedding, result);
+        recordCacheResult(false, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count());
+    }
     return result;
 }
 
+std::string LlmManager::generateBattleNarration(const std::string& player_action, const std::string& enemy_info, const std::string& outcome) {
+    PQ_TRACE_SCOPE("llm", "generateBattleNarration");
+    std::string system_prompt =
+        "あなたは戦闘の語り手です。「静寂」に侵された魔物との戦いの一場面を描写します。\n"
+        "結果はすでに決まっています。結果を変えたり、数値を書いたりしてはいけません。\n"
+        "プレイヤーの攻撃方法と結果に合う、臨場感のある日本語の一文だけを出力してください。\n\n"
+        "敵の情報: " + enemy_info + "\n"
+        "攻撃方法: " + player_action + "\n"
+        "結果: " + outcome;
 
-GmResponse LlmManager::parseGmResponse(const std::string& raw_str) {
-    GmResponse res;
-    res.scene_context = "若者との会話を続けている。";
+    std::stringstream ss;
+    ss << "<|begin_of_text|><|start_header_id|>system<|end_header_id|>\n\n" << system_prompt << "<|eot_id|>";
+    ss << "<|start_header_id|>assistant<|end_header_id|>\n\n";
 
-    size_t start_pos = raw_str.find('{');
-    size_t end_pos = raw_str.rfind('}');
-    if (start_pos == std::string::npos || end_pos == std::string::npos || start_pos >= end_pos) {
-        return res;
+    // 描写は判定と並行して頼まれるので、判定のシードの系列を進めない
+    std::string narration = run_inference("BATTLE", ss.str(), true, nullptr, "NARRATION");
+    if (narration.rfind("[ERROR", 0) == 0) return "";
+    return narration;
+}
+
+namespace {
+// logits の行から token の対数確率を求める（log-softmax）
+float tokenLogprob(const float* logits, int n_vocab, llama_token token) {
+    float max_logit = logits[0];
+    for (int i = 1; i < n_vocab; ++i) max_logit = std::max(max_logit, logits[i]);
+    double sum = 0.0;
+    for (int i = 0; i < n_vocab; ++i) sum += std::exp(static_cast<double>(logits[i] - max_logit));
+    return logits[token] - max_logit - static_cast<float>(std::log(sum));
+}
+} // namespace
+
+ClassifyResult LlmManager::classify(const std::string& role, const std::string& prompt, const std::vector<std::string>& candidates) {
+    ClassifyResult result;
+    if (!roleConfigs.count(role) || candidates.empty() || candidates.size() > MAX_CLASSIFY_CANDIDATES) {
+        PQ_LOG_ERROR(LogCategory::LLM, "classify: invalid role '" << role << "' or candidate count " << candidates.size());
+        return result;
     }
-    std::string json_str = raw_str.substr(start_pos, end_pos - start_pos + 1);
-
-    auto getValue = [&](const std::string& key) -> std::string {
-        size_t key_pos = json_str.find("\"" + key + "\"");
-        if (key_pos == std::string::npos) return "";
-        size_t colon_pos = json_str.find(":", key_pos);
-        if (colon_pos == std::string::npos) return "";
-        size_t start_quote_pos = json_str.find("\"", colon_pos);
-        if (start_quote_pos == std::string::npos) return "";
-        size_t end_quote_pos = json_str.find("\"", start_quote_pos + 1);
-        if (end_quote_pos == std::string::npos) return "";
-        std::string value = json_str.substr(start_quote_pos + 1, end_quote_pos - start_quote_pos - 1);
-        return value;
+    PQ_TRACE_SCOPE("llm", "classify");
+    const auto start_time = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(inferenceMutex);
+
+    LlmExchange exchange;
+    exchange.kind = LlmExchangeKind::CLASSIFY;
+    exchange.role = role;
+    exchange.wait_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+    if (recorder) exchange.prompt = prompt;
+    auto finish = [&](ClassifyResult res) {
+        if (recorder) {
+            exchange.output = res.index >= 0 ? candidates[res.index] : "";
+            exchange.total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+            recorder->exchange(exchange);
+        }
+        return res;
     };
-    
-    res.scene_context = getValue("scene_context");
-    res.action = getValue("action");
-
-    size_t items_key_pos = json_str.find("\"items\"");
-    if (items_key_pos != std::string::npos) {
-        size_t array_start_pos = json_str.find("[", items_key_pos);
-        size_t array_end_pos = json_str.find("]", array_start_pos);
-        if (array_start_pos != std::string::npos && array_end_pos != std::string::npos) {
-            std::string items_substr = json_str.substr(array_start_pos + 1, array_end_pos - array_start_pos - 1);
-            std::stringstream ss(items_substr);
-            std::string item;
-            while (std::getline(ss, item, ',')) {
-                size_t start = item.find("\"");
-                size_t end = item.rfind("\"");
-                if (start != std::string::npos && end != std::string::npos && start != end) {
-                    res.items.push_back(item.substr(start + 1, end - start - 1));
-                }
+
+    if (recordedOutputs) {
+        LlmExchange recorded;
+        if (recordedOutputs->take(role, LlmExchangeKind::CLASSIFY, prompt, recorded)) {
+            auto it = std::find(candidates.begin(), candidates.end(), recorded.output);
+            if (it != candidates.end()) {
+                result.index = static_cast<int>(it - candidates.begin());
+                result.logprobs.assign(candidates.size(), 0.0f);
+                result.tokens.assign(candidates.size(), 0);
             }
+        } else {
+            PQ_LOG_WARN(Log::categoryForRole(role), "replay: no recorded classification left for role '" << role << "'");
         }
+        exchange.prompt = prompt;
+        return finish(result);
     }
 
-    if (res.action.empty()) res.action = "CONTINUE";
-    if (res.scene_context.empty()) res.scene_context = "若者との会話を続けている。";
-    return res;
-}
+    ThreadPoolLease pool_lease(*this);
+    // アダプターは生成の出力形式を学習しているので、候補の比較はベースモデルで行う
+    LlmInstance instance;
+    if (!acquireRole(role, instance, false)) return finish(result);
+    llama_context* ctx = instance.ctx;
+    const auto* vocab = llama_model_get_vocab(instance.model);
+    const int n_vocab = llama_vocab_n_tokens(vocab);
 
-BattleResponse LlmManager::parseBattleResponse(const std::string& raw_str) {
-    BattleResponse res;
-    
-    size_t start_pos = raw_str.find('{');
-    size_t end_pos = raw_str.rfind('}');
-    
-    if (start_pos == std::string::npos || end_pos == std::string::npos || start_pos >= end_pos) {
-        res.damage = 0;
-        res.hit = false;
-        res.effect_text = "（攻撃ははずれた...）";
-        return res;
+    auto tokenize = [&](const std::string& text, bool parse_special) {
+        std::vector<llama_token> tokens(text.size() + 16);
+        int n = llama_tokenize(vocab, text.c_str(), (int)text.length(), tokens.data(), tokens.size(), false, parse_special);
+        tokens.resize(std::max(n, 0));
+        return tokens;
+    };
+
+    std::vector<llama_token> prompt_tokens = tokenize(prompt, true);
+    std::vector<std::vector<llama_token>> candidate_tokens;
+    size_t extra_tokens = 0;
+    for (const auto& candidate : candidates) {
+        candidate_tokens.push_back(tokenize(candidate, false));
+        if (candidate_tokens.back().empty()) return finish(result);
+        extra_tokens += candidate_tokens.back().size() - 1;
     }
-    
-    std::string json_str = raw_str.substr(start_pos, end_pos - start_pos + 1);
+    if (prompt_tokens.empty() || prompt_tokens.size() + extra_tokens >= llama_n_ctx(ctx)) return finish(result);
+    exchange.prompt_tokens = static_cast<int>(prompt_tokens.size());
 
-    auto getValue = [&](const std::string& key) -> std::string {
-        std::string search_key = "\"" + key + "\"";
-        size_t key_pos = json_str.find(search_key);
-        if (key_pos == std::string::npos) return "";
-        
-        size_t colon_pos = json_str.find(":", key_pos);
-        if (colon_pos == std::string::npos) return "";
-        
-        size_t value_start = colon_pos + 1;
-        while (value_start < json_str.length() && 
-               (json_str[value_start] == ' ' || json_str[value_start] == '\t' || 
-                json_str[value_start] == '\n' || json_str[value_start] == '\r')) {
-            value_start++;
+    // 1. プロンプトを seq 0 で事前計算し、最後の位置の分布から各候補の先頭トークンを評価
+    llama_memory_t mem = llama_get_memory(ctx);
+    if (!prefillShared(states.at(role), instance, prompt_tokens.data(), static_cast<int>(prompt_tokens.size()),
+                       static_cast<int>(extra_tokens))) {
+        return finish(result);
+    }
+
+    const float* last_logits = llama_get_logits_ith(ctx, -1);
+    result.logprobs.resize(candidates.size());
+    for (size_t c = 0; c < candidates.size(); ++c) {
+        result.logprobs[c] = tokenLogprob(last_logits, n_vocab, candidate_tokens[c][0]);
+    }
+
+    // 2. 残りのトークンは候補ごとにシーケンスを分け、プロンプトのKVを共有したまま1バッチで評価
+    if (extra_tokens > 0) {
+        const llama_pos n_prompt = static_cast<llama_pos>(prompt_tokens.size());
+        for (size_t c = 1; c < candidates.size(); ++c) {
+            llama_memory_seq_cp(mem, 0, static_cast<llama_seq_id>(c), -1, -1);
         }
-        
-        if (value_start >= json_str.length()) return "";
-        
-        char start_char = json_str[value_start];
-        
-        if (start_char == '"') {
-            size_t value_end = value_start + 1;
-            while (value_end < json_str.length()) {
-                if (json_str[value_end] == '"' && json_str[value_end - 1] != '\\') {
-                    break;
-                }
-                value_end++;
-            }
-            
-            if (value_end < json_str.length()) {
-                return json_str.substr(value_start + 1, value_end - value_start - 1);
-            }
-        } else if (std::isdigit(start_char) || start_char == 't' || start_char == 'f') {
-            size_t value_end = value_start;
-            while (value_end < json_str.length() && 
-                   json_str[value_end] != ',' && json_str[value_end] != '}' && 
-                   json_str[value_end] != '\n' && json_str[value_end] != '\r') {
-                value_end++;
-            }
-            
-            std::string result = json_str.substr(value_start, value_end - value_start);
-            while (!result.empty() && (result.back() == ' ' || result.back() == '\t')) {
-                result.pop_back();
+
+        llama_batch batch = llama_batch_init(static_cast<int32_t>(extra_tokens), 0, 1);
+        std::vector<std::pair<size_t, size_t>> rows;  // バッチ内の各行 → (候補, 次に評価するトークン位置)
+        for (size_t c = 0; c < candidates.size(); ++c) {
+            const auto& tokens = candidate_tokens[c];
+            for (size_t j = 0; j + 1 < tokens.size(); ++j) {
+                int i = batch.n_tokens++;
+                batch.token[i] = tokens[j];
+                batch.pos[i] = n_prompt + static_cast<llama_pos>(j);
+                batch.n_seq_id[i] = 1;
+                batch.seq_id[i][0] = static_cast<llama_seq_id>(c);
+                batch.logits[i] = true;
+                rows.push_back({c, j + 1});
             }
-            return result;
         }
-        
-        return "";
-    };
+        bool ok = llama_decode(ctx, batch) == 0;
+        llama_batch_free(batch);
+        if (!ok) return finish(ClassifyResult());
 
-    res.damage = 0;
-    res.hit = false;
-    res.effect_text = "攻撃は外れた...";
+        for (size_t i = 0; i < rows.size(); ++i) {
+            size_t c = rows[i].first;
+            llama_token next = candidate_tokens[c][rows[i].second];
+            result.logprobs[c] += tokenLogprob(llama_get_logits_ith(ctx, static_cast<int32_t>(i)), n_vocab, next);
+        }
+    }
+
+    // 語がいくつのトークンに分かれるかで判定が変わらないよう、1トークンあたりで比べる
+    result.tokens.resize(candidates.size());
+    for (size_t c = 0; c < candidates.size(); ++c) {
+        result.tokens[c] = static_cast<int>(candidate_tokens[c].size());
+        result.logprobs[c] /= static_cast<float>(result.tokens[c]);
+    }
+    result.index = static_cast<int>(std::max_element(result.logprobs.begin(), result.logprobs.end()) - result.logprobs.begin());
+    return finish(result);
+}
+
+std::string LlmManager::gmCacheSignature(const std::string& player_text) {
+    return SemanticCache<GmResponse>::keywordSignature(player_text, GM_CACHE_KEYWORDS);
+}
+
+std::string LlmManager::battleCacheSignature(const std::string& player_action) {
+    return SemanticCache<BattleResponse>::keywordSignature(player_action, BATTLE_CACHE_KEYWORDS);
+}
 
-    try {
-        std::string damage_str = getValue("damage");
-        if (!damage_str.empty()) {
-            res.damage = std::stoi(damage_str);
+bool LlmManager::enableSemanticCache(const std::string& embed_role, float threshold) {
+    auto config_it = roleConfigs.find(embed_role);
+    if (config_it == roleConfigs.end()) {
+        PQ_LOG_ERROR(LogCategory::LLM, "semantic cache: role '" << embed_role << "' not found");
+        return false;
+    }
+    // 埋め込みコンテキストは推論の mutex の外で使うので、元のモデルは追い出さないよう固定する
+    LlmInstance instance;
+    {
+        std::lock_guard<std::mutex> lock(inferenceMutex);
+        if (!acquireRole(embed_role, instance)) {
+            PQ_LOG_ERROR(LogCategory::LLM, "semantic cache: failed to load model for role '" << embed_role << "'");
+            return false;
         }
-    } catch (...) { 
-        res.damage = 0; 
+        if (!embedPath.empty()) modelPool->unpin(embedPath);
+        embedPath = config_it->second.model_path;
+        modelPool->pin(embedPath);
     }
 
-    std::string hit_str = getValue("hit");
-    res.hit = (hit_str == "true");
-    
-    std::string effect_text = getValue("effect_text");
-    if (!effect_text.empty()) {
-        res.effect_text = effect_text;
-    } else if (res.hit) {
-        res.effect_text = "攻撃が命中した！";
+    // 生成用とは別に、同じモデルで埋め込み専用の小さなコンテキストを作る
+    auto cparams = llama_context_default_params();
+    cparams.n_ctx = 512;
+    cparams.n_batch = 512;
+    cparams.n_ubatch = 512;  // プーリングは1回のデコードで全トークンを見る必要がある
+    // 埋め込みは推論と並行して走るので、共有プールは付けずに llama.cpp に任せる
+    cparams.n_threads = threadConfig.prefill_threads;
+    cparams.n_threads_batch = threadConfig.prefill_threads;
+    cparams.embeddings = true;
+    cparams.pooling_type = LLAMA_POOLING_TYPE_MEAN;
+    cparams.offload_kqv = false;
+
+    if (embedCtx) llama_free(embedCtx);
+    embedCtx = llama_init_from_model(instance.model, cparams);
+    if (!embedCtx) {
+        PQ_LOG_ERROR(LogCategory::LLM, "semantic cache: failed to create embedding context");
+        return false;
+    }
+
+    gmCache = std::make_unique<SemanticCache<GmResponse>>(threshold);
+    battleCache = std::make_unique<SemanticCache<BattleResponse>>(threshold);
+    PQ_LOG_INFO(LogCategory::LLM, "semantic cache enabled (embeddings from role '" << embed_role << "', threshold " << threshold << ")");
+    return true;
+}
+
+bool LlmManager::embed(const std::string& text, std::vector<float>& out) {
+    if (!embedCtx || text.empty()) return false;
+    PQ_TRACE_SCOPE("llm", "embed");
+    std::lock_guard<std::mutex> lock(embedMutex);
+    auto start_time = std::chrono::steady_clock::now();
+
+    const llama_model* model = llama_get_model(embedCtx);
+    const auto* vocab = llama_model_get_vocab(model);
+    int max_tokens = static_cast<int>(llama_n_batch(embedCtx));
+    std::vector<llama_token> tokens(text.size() + 16);
+    int n_tokens = llama_tokenize(vocab, text.c_str(), (int)text.length(), tokens.data(), tokens.size(), true, false);
+    if (n_tokens <= 0) return false;
+    n_tokens = std::min(n_tokens, max_tokens);
+
+    llama_memory_clear(llama_get_memory(embedCtx), true);
+    llama_batch batch = llama_batch_init(n_tokens, 0, 1);
+    for (int i = 0; i < n_tokens; ++i) {
+        batch.token[i] = tokens[i];
+        batch.pos[i] = i;
+        batch.n_seq_id[i] = 1;
+        batch.seq_id[i][0] = 0;
+        batch.logits[i] = true;
+    }
+    batch.n_tokens = n_tokens;
+    int rc = llama_decode(embedCtx, batch);
+    llama_batch_free(batch);
+    if (rc != 0) return false;
+
+    const float* embd = llama_get_embeddings_seq(embedCtx, 0);
+    if (!embd) return false;
+    out.assign(embd, embd + llama_model_n_embd(model));
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+    std::lock_guard<std::mutex> metrics_lock(metricsMutex);
+    cacheMetrics.embed_ms += ms;
+    return true;
+}
+
+void LlmManager::addLore(const std::string& text) {
+    if (!text.empty()) memory.add(MemoryKind::LORE, text);
+}
+
+void LlmManager::rememberTurn(const ChatTurn& turn) {
+    if (turn.text.empty()) return;
+    rememberEpisode(MemoryKind::CONVERSATION, (turn.role == ChatRole::USER ? "プレイヤー: " : "長老: ") + turn.text, turn.serial);
+}
+
+void LlmManager::rememberEvent(const std::string& text) {
+    rememberEpisode(MemoryKind::EVENT, text, 0);
+}
+
+void LlmManager::forgetEpisodes() {
+    std::lock_guard<std::mutex> lock(episodeMutex);
+    episodeCount = 0;
+    memory.remove(MemoryKind::CONVERSATION);
+    memory.remove(MemoryKind::EVENT);
+}
+
+void LlmManager::rememberEpisode(MemoryKind kind, std::string text, uint64_t serial) {
+    if (text.empty()) return;
+    std::lock_guard<std::mutex> lock(episodeMutex);
+    memory.add(kind, std::move(text), serial);
+    if (++episodeCount <= MAX_EPISODES) return;
+    // 古い4分の1をまとめて忘れる（1件ごとに索引を作り直さない）。残る記憶の埋め込みは計算し直さない
+    episodeCount -= memory.removeOldest(MAX_EPISODES / 4);
+}
+
+std::string LlmManager::retrieveMemories(const std::string& query, uint64_t exclude_from_serial, int token_budget, const llama_vocab* vocab) {
+    static const std::string header = "=== 関連する記憶 ===\n";
+    if (query.empty() || memory.size() == 0 || token_budget <= tokenLength(vocab, header) + 1) return "";
+    PQ_TRACE_SCOPE("llm", "retrieveMemories");
+    auto start_time = std::chrono::steady_clock::now();
+
+    // 埋め込みコンテキストがあれば、まだベクトルの無い文書を埋め込んでから言い換えにも強い検索にする
+    std::vector<float> query_vec;
+    bool use_vectors = false;
+    if (embedCtx) {
+        std::vector<float> vec;
+        for (const auto& [id, text] : memory.missingVectors()) {
+            if (embed(text, vec)) memory.setVector(id, vec);
+        }
+        use_vectors = embed(query, query_vec);
+    }
+    std::vector<MemoryHit> hits = memory.search(query, RETRIEVAL_TOP_K, exclude_from_serial, use_vectors ? &query_vec : nullptr);
+
+    std::string out;
+    int used = tokenLength(vocab, header) + 1;  // 末尾の空行
+    size_t taken = 0;
+    for (const MemoryHit& hit : hits) {
+        std::string line = "- " + hit.text + "\n";
+        int n = tokenLength(vocab, line);
+        if (used + n > token_budget) continue;  // 長いものは飛ばして短いものを入れる
+        out += line;
+        used += n;
+        taken++;
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+    PQ_LOG_DEBUG(LogCategory::NPC, "retrieved " << taken << " of " << hits.size() << " memories (" << used << " tokens, " << ms << " ms)");
+    return out.empty() ? "" : header + out + "\n";
+}
+
+void LlmManager::recordCacheHit(const std::string& role, const std::string& key, const std::string& response_json) {
+    if (!recorder) return;
+    LlmExchange exchange;
+    exchange.kind = LlmExchangeKind::CACHE_HIT;
+    exchange.role = role;
+    exchange.prompt = key;
+    exchange.output = response_json;
+    recorder->exchange(exchange);
+}
+
+bool LlmManager::replayCacheHit(const std::string& role, const std::string& key, std::string& response_json) {
+    LlmExchange recorded;
+    if (!recordedOutputs || !recordedOutputs->take(role, LlmExchangeKind::CACHE_HIT, key, recorded)) return false;
+    response_json = recorded.output;
+    recordCacheHit(role, key, response_json);
+    return true;
+}
+
+void LlmManager::recordCacheResult(bool hit, double ms) {
+    std::lock_guard<std::mutex> lock(metricsMutex);
+    cacheMetrics.cache_lookups++;
+    if (hit) {
+        cacheMetrics.cache_hits++;
+        cacheMetrics.hit_ms += ms;
     } else {
-        res.effect_text = "攻撃は外れた...";
+        cacheMetrics.miss_ms += ms;
+    }
+}
+
+LlmMetrics LlmManager::metrics() const {
+    std::lock_guard<std::mutex> lock(metricsMutex);
+    return cacheMetrics;
+}
+
+PrefixCacheMetrics LlmManager::prefixMetrics() const {
+    std::lock_guard<std::mutex> lock(metricsMutex);
+    return prefixStats;
+}
+
+LlmBatchMetrics LlmManager::batchMetrics() const {
+    std::lock_guard<std::mutex> lock(metricsMutex);
+    return batchStats;
+}
+
+void LlmManager::printMetrics() const {
+    ModelPoolMetrics pool = modelMetrics();
+    if (pool.loads > 0) {
+        PQ_LOG_INFO(LogCategory::LLM, "model pool: loads=" << pool.loads << " evictions=" << pool.evictions << " hits=" << pool.hits
+                    << " load=" << pool.load_ms << "ms peak=" << pool.peak_bytes / (1024 * 1024) << "MB");
+    }
+    PrefixCacheMetrics prefix = prefixMetrics();
+    if (prefix.lookups > 0) {
+        PQ_LOG_INFO(LogCategory::LLM, "prefix cache: lookups=" << prefix.lookups << " hits=" << prefix.hits << " reused_tokens="
+                    << prefix.reused_tokens << " prefilled_tokens=" << prefix.prefilled_tokens << " evictions=" << prefix.evictions);
+    }
+    LlmBatchMetrics batch = batchMetrics();
+    if (batch.steps > 0) {
+        PQ_LOG_INFO(LogCategory::LLM, "continuous batching: requests=" << batch.requests << " steps=" << batch.steps << " tokens/step="
+                    << batch.tokensPerStep() << " generated/step=" << batch.generatedPerStep() << " peak_active=" << batch.peak_active);
     }
+    LlmMetrics m = metrics();
+    if (m.cache_lookups == 0) return;
+    PQ_LOG_INFO(LogCategory::LLM, "semantic cache: lookups=" << m.cache_lookups << " hits=" << m.cache_hits
+                << " (" << m.hitRate() * 100.0 << "%) embedding=" << m.embed_ms << "ms saved~" << m.savedMs() << "ms");
+}
+
+GmResponse LlmManager::parseGmResponse(const std::string& raw_str) {
+    GmResponse res;
+    GmResponseBuilder builder(res);
+    JsonStream stream(builder);
+    stream.feed(raw_str);
+    builder.finish();
+    return res;
+}
 
+BattleResponse LlmManager::parseBattleResponse(const std::string& raw_str) {
+    BattleResponse res;
+    BattleResponseBuilder builder(res);
+    JsonStream stream(builder);
+    stream.feed(raw_str);
+    builder.finish();
     return res;
 }
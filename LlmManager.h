@@ -3,51 +3,461 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <memory>
 #include <map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <random>
+#include <functional>
+#include <future>
+#include <string_view>
 #include "llama.h"
+#include "SemanticCache.h"
+#include "JsonStream.h"
+#include "ConversationState.h"
+#include "ModelPool.h"
+#include "PrefixCache.h"
+#include "MemoryIndex.h"
+#include "SessionRecorder.h"
+#include "InferenceBackend.h"
 
-struct ChatMessage {
-    std::string role;
-    std::string content;
+// JsonStream のハンドラー。生成中の断片から応答の各フィールドをその場で埋める。
+class GmResponseBuilder : public JsonHandler {
+public:
+    explicit GmResponseBuilder(GmResponse& out);
+    void onKey(std::string_view key, int depth) override;
+    void onString(std::string_view value, int depth) override;
+    void onEndArray(int depth) override;
+    void finish();  // 欠けたフィールドに既定値を入れる
+
+    // action と items の配列が読み終わったか
+    bool decisionReady() const { return !res.action.empty() && itemsDone; }
+
+private:
+    GmResponse& res;
+    std::string currentKey;
+    bool itemsDone = false;
+};
+
+class BattleResponseBuilder : public JsonHandler {
+public:
+    explicit BattleResponseBuilder(BattleResponse& out);
+    void onKey(std::string_view key, int depth) override;
+    void onString(std::string_view value, int depth) override;
+    void onNumber(double value, int depth) override;
+    void onBool(bool value, int depth) override;
+    void finish();
+
+    // hit と damage の両方が読み終わったか
+    bool decisionReady() const { return hasHit && hasDamage; }
+
+private:
+    BattleResponse& res;
+    std::string currentKey;
+    bool hasHit = false;
+    bool hasDamage = false;
+};
+
+// classify() の結果。logprobs は候補ごとの1トークンあたりの対数確率、tokens はそのトークン数（候補と同じ順）。
+struct ClassifyResult {
+    int index = -1;
+    std::vector<float> logprobs;
+    std::vector<int> tokens;
+};
+
+// セマンティックキャッシュの効果測定用
+struct LlmMetrics {
+    uint64_t cache_lookups = 0;   // キャッシュを引いた回数
+    uint64_t cache_hits = 0;
+    double embed_ms = 0.0;        // 埋め込み計算の合計時間
+    double miss_ms = 0.0;         // キャッシュミス時の推論の合計時間
+    double hit_ms = 0.0;          // キャッシュヒット時の処理（再描写込み）の合計時間
+
+    double hitRate() const { return cache_lookups ? static_cast<double>(cache_hits) / cache_lookups : 0.0; }
+    // ヒットした呼び出しをミス時の平均時間で推論していた場合との差
+    double savedMs() const {
+        uint64_t misses = cache_lookups - cache_hits;
+        if (misses == 0) return 0.0;
+        return cache_hits * (miss_ms / misses) - hit_ms;
+    }
 };
 
-struct GmResponse {
-    std::string scene_context; 
-    std::string action = "CONTINUE";
-    std::vector<std::string> items;
+// 連続バッチ処理（setParallelSequences）の効果測定用
+struct LlmBatchMetrics {
+    uint64_t requests = 0;
+    uint64_t steps = 0;      // まとめて計算した llama_decode の回数
+    uint64_t tokens = 0;     // 各回のバッチに入れたトークンの合計（生成とプリフィル）
+    uint64_t generated = 0;  // うち生成中のシーケンスの1トークン
+    int peak_active = 0;     // 同時にスロットにあったリクエストの最大数
+
+    double tokensPerStep() const { return steps ? static_cast<double>(tokens) / steps : 0.0; }
+    double generatedPerStep() const { return steps ? static_cast<double>(generated) / steps : 0.0; }
+};
+
+// 推論スレッドの設定。生成（1トークンずつ）とプリフィル（プロンプトの一括処理）で別のプールを使う。
+// *_cpus は使ってよいCPU番号（空ならOSに任せる）。描画スレッド用のコアを外したり、
+// 1つのNUMAノードやCCXのコアだけを並べたりして使う。
+struct LlmThreadConfig {
+    int decode_threads = 8;
+    int prefill_threads = 8;
+    std::vector<int> decode_cpus;
+    std::vector<int> prefill_cpus;
+    uint32_t poll = 50;          // 仕事待ちのビジーポーリングの強さ（0〜100）。0 ならすぐ眠る
+    bool strict_cpu = false;     // true: スレッドを cpus の先頭から1コアずつ固定する
+    ggml_sched_priority prio = GGML_SCHED_PRIO_NORMAL;
+
+    // CPU 0 を描画用に空けた既定値に、環境変数 PQ_LLM_CPUS（例: "2-7"）、PQ_LLM_DECODE_CPUS、
+    // PQ_LLM_PREFILL_CPUS、PQ_LLM_DECODE_THREADS、PQ_LLM_PREFILL_THREADS、PQ_LLM_POLL、PQ_LLM_STRICT_CPU を反映する
+    static LlmThreadConfig fromEnvironment();
+    // "0,2-5" の形式。書式が不正なら false
+    static bool parseCpuList(const std::string& text, std::vector<int>& out);
 };
 
-struct BattleResponse {
-    int damage = 0;
-    bool hit = false;
-    std::string effect_text;
+// 推論コンテキストの設定。KVキャッシュを量子化すると同じメモリで長い文脈を持てる
+// （q8_0 で f16 の約半分、q4_0 で約3割）。V を量子化するには flash attention が必要。
+struct LlmContextConfig {
+    int n_ctx = 2048;
+    ggml_type type_k = GGML_TYPE_F16;
+    ggml_type type_v = GGML_TYPE_F16;
+    bool flash_attn = false;
+    // プロンプトの共通部分（世界設定・人物設定・会話の続き）のKVを残しておく数。0 なら毎回すべて計算する
+    int prefix_cache_leaves = 8;
+
+    // 既定値に、環境変数 PQ_LLM_CTX、PQ_LLM_KV_TYPE（K と V の両方）、PQ_LLM_KV_TYPE_K、
+    // PQ_LLM_KV_TYPE_V、PQ_LLM_FLASH_ATTN、PQ_LLM_PREFIX_CACHE を反映する
+    static LlmContextConfig fromEnvironment();
+    // "f16" / "q8_0" / "q5_1" / "q5_0" / "q4_1" / "q4_0"。それ以外は false
+    static bool parseCacheType(const std::string& text, ggml_type& out);
+    // 層ごとのKとVを n_ctx 分持つときの KV キャッシュの大きさ
+    size_t kvCacheBytes(const llama_model* model) const;
+};
+
+// 役割ごとの設定。model_path が同じ役割はベースモデルとコンテキストを共有し、LoRA アダプターだけを
+// リクエストごとに切り替える。
+struct LlmRoleConfig {
+    std::string model_path;
+    std::string lora_path;     // 空ならベースモデルのまま
+    float lora_scale = 1.0f;
+    // アダプターが人物像と出力形式を学習済みなら、長い指示文を省いた短いプロンプトにする（プリフィルが短くなる）
+    bool compact_prompt = false;
+    // model_path が同じ役割どうしでは n_ctx は大きい方を使い、KVの型と flash_attn は揃える必要がある
+    LlmContextConfig context;
+
+    // 生成結果を左右する設定を1行にまとめる（モデルとアダプターはファイル名だけ）。
+    // 推論ワーカーは、つないだゲームの設定と自分の設定をこれで比べる
+    std::string summary() const;
 };
 
-class LlmManager {
+// llama.cpp による推論
+class LlmManager : public InferenceBackend {
 public:
-    LlmManager(const std::map<std::string, std::string>& model_paths);
-    ~LlmManager();
+    LlmManager(const std::map<std::string, LlmRoleConfig>& roles, const LlmThreadConfig& thread_config = LlmThreadConfig());
+    // 役割 → モデルのパスだけを指定する（アダプターなし）
+    LlmManager(const std::map<std::string, std::string>& model_paths, const LlmThreadConfig& thread_config = LlmThreadConfig());
+    ~LlmManager() override;
 
     LlmManager(const LlmManager&) = delete;
     LlmManager& operator=(const LlmManager&) = delete;
 
-    GmResponse generateGmResponse(const std::vector<ChatMessage>& history);
-    std::string generateNpcDialogue(const std::vector<ChatMessage>& history, const std::string& scene_context);
-    BattleResponse generateBattleResponse(const std::string& player_stats, const std::string& enemy_stats, const std::string& player_action, const std::string& enemy_info = "");
+    // on_decision には判定フィールドが揃った時点の途中結果が1度だけ渡される（戻り値は最終結果）。
+    // 出力スキーマは判定フィールドを説明文より先に並べている。
+    GmResponse generateGmResponse(const ConversationView& history, const GmDecisionCallback& on_decision = nullptr) override;
+    // action（CONTINUE/DEPART）だけを classify() で1回の順伝播により決める（items と scene_context は空）
+    GmResponse generateGmDecision(const ConversationView& history, const GmDecisionCallback& on_decision = nullptr) override;
+    std::string generateNpcDialogue(const ConversationView& history, const std::string& scene_context) override;
+    BattleResponse generateBattleResponse(const std::string& player_stats, const std::string& enemy_stats, const std::string& player_action,
+                                          const std::string& enemy_info = "", const BattleDecisionCallback& on_decision = nullptr) override;
+    // 判定済みの戦闘結果に添える一文だけを生成する（ダメージや命中はBattleResolverが決める）
+    std::string generateBattleNarration(const std::string& player_action, const std::string& enemy_info, const std::string& outcome) override;
+
+    // 生成中のものはトークンの区切りで、ロック待ちのものは順番が来た時点で打ち切る
+    void cancelPending() override { cancelEpoch.fetch_add(1); }
+
+    // 範囲内でこのスレッドから呼んだ生成は、cancelPending() ではなく source が変わったときに打ち切る。
+    // 1つの LlmManager を共有する複数のセッションが、自分の生成だけを止めるのに使う
+    class CancelScope {
+    public:
+        explicit CancelScope(const std::atomic<uint64_t>& source);
+        ~CancelScope();
+        CancelScope(const CancelScope&) = delete;
+        CancelScope& operator=(const CancelScope&) = delete;
+    private:
+        const std::atomic<uint64_t>* previous;
+    };
+
+    // 生成のリクエストを n 件まで同時に受け付け、各シーケンスの次の1トークンとプロンプトのプリフィルを
+    // まとめて1回の llama_decode で計算する（複数のプレイヤーを受け持つサーバー用）。
+    // コンテキストのKVセルは n 本分増えるので、モデル1つのKVが kv_budget_bytes（0 は無制限）に収まる数に絞る。
+    // モデルを読み込む前に1度だけ呼ぶ。絞った結果が 1 以下なら1件ずつ直列に処理する
+    static constexpr int MAX_PARALLEL_SEQUENCES = 32;
+    static constexpr size_t DEFAULT_BATCH_KV_BYTES = size_t(4) * 1024 * 1024 * 1024;
+    void setParallelSequences(int n, size_t kv_budget_bytes = DEFAULT_BATCH_KV_BYTES);
+
+    // プロンプトを1回だけ事前計算し、各候補の続きとしての対数確率を比べて最も高いものを選ぶ。
+    // 複数トークンの候補は並列シーケンスとして1バッチで評価する（最大 MAX_CLASSIFY_CANDIDATES 個）。
+    // 合計はトークンが少ない候補ほど有利になるので、トークン数で割った平均で比べる
+    static constexpr int MAX_CLASSIFY_CANDIDATES = 4;
+    ClassifyResult classify(const std::string& role, const std::string& prompt, const std::vector<std::string>& candidates);
+
+    // 指定した役割のモデルで埋め込み用コンテキストを作り、GM・戦闘の応答キャッシュを有効にする。
+    // threshold はコサイン類似度のしきい値。埋め込みが近くても、判定を左右する語（出発・否定・問いかけ）の
+    // 有無が違う入力どうしは再利用しない（gmCacheSignature / battleCacheSignature が一致するものだけを照合する）
+    bool enableSemanticCache(const std::string& embed_role = "BATTLE", float threshold = 0.92f);
+    static std::string gmCacheSignature(const std::string& player_text);
+    static std::string battleCacheSignature(const std::string& player_action);
+    bool embed(const std::string& text, std::vector<float>& out);
+
+    LlmMetrics metrics() const;
+    PrefixCacheMetrics prefixMetrics() const;
+    LlmBatchMetrics batchMetrics() const;
+    void printMetrics() const override;
+
+    // 役割のモデルを裏で読み込んでおく（次の状態で使う役割のヒント）。読み込み済みなら何もしない
+    void prefetch(const std::string& role) override;
+    // モデルの重みとコンテキストに使ってよいメモリ。超えそうなら最後に使ったのが古いモデルから解放する（0 は無制限）
+    void setModelBudget(size_t bytes);
+    ModelPoolMetrics modelMetrics() const;
+
+    // 推論スレッドを眠らせる／起こす。ゲームが入力待ちの間は idle にしてポーリングでコアを使わせない。
+    // 推論中に idle にした場合は、その推論が終わった時点で止める。idle のまま推論が来ても自動で起きる。
+    void setThreadsIdle(bool idle) override;
+
+    // 発言のトークン数を数えて turn に入れる。履歴に追加する前に呼んでおけば、以降のリクエストでは数え直さない。
+    void measureTokens(const std::string& role, ChatTurn& turn) override;
+
+    // NPC のプロンプトに関係のある部分だけを引いて入れる記憶。世界設定の断片は起動時に、
+    // 会話と出来事はゲームの進行に合わせて足す（どのスレッドから呼んでもよい）
+    void addLore(const std::string& text) override;
+    void rememberTurn(const ChatTurn& turn) override;   // 履歴に追加した後の発言（serial が入ったもの）
+    void rememberEvent(const std::string& text) override;
+    void forgetEpisodes() override;                     // 会話と出来事を忘れる（世界設定は残す）
+
+    // 生成の乱数シード。役割ごとにリクエストを数えてシードを変えるので、各役割を同じ順で呼べば
+    // （役割どうしの前後が入れ替わっても）同じ結果になる。
+    void setSeed(uint32_t seed) override { baseSeed = seed; roleRequests.clear(); }
+
+    // 問い合わせ（プロンプト・シード・生成結果・時間）を recorder に書き出す。nullptr で止める
+    void setRecorder(SessionRecorder* recorder) override { this->recorder = recorder; }
+    // モデルを使わず、記録した結果を返す（ゲームループだけを計測する再生用）。先読みもしない
+    void setRecordedOutputs(RecordedOutputs* outputs) { recordedOutputs = outputs; }
+
+    // 生成済みの文字列全体をパースする（前置きの文章は読み飛ばす）
+    static GmResponse parseGmResponse(const std::string& json_str);
+    static BattleResponse parseBattleResponse(const std::string& json_str);
 
 private:
+    friend class LlmBench;
+
+    // 生成したトークン片ごとに呼ばれる。false を返すとそこで生成を打ち切る。
+    using TokenCallback = std::function<bool(std::string_view piece)>;
+
     struct LlmInstance {
         llama_model* model = nullptr;
         llama_context* ctx = nullptr;
+        PrefixCache* prefix = nullptr;  // 無効なら nullptr
+    };
+
+    // 役割ごとに1度だけ作り、リクエスト間で使い回す推論用の状態
+    struct InferenceState {
+        llama_sampler* sampler = nullptr;          // 融合 temp/top_k/top_p（最後の抽選は rng で行う）
+        llama_batch batch = {};                    // プロンプト用（n_batch）
+        int32_t batchCapacity = 0;
+        llama_batch genBatch = {};                 // 生成用（1トークン）
+        std::vector<llama_token> tokens;           // n_ctx
+        std::vector<llama_token_data> candidates;  // 語彙サイズ
+        std::string output;
+        std::mt19937 rng;
+    };
+
+    static const int BASE_CONTEXT_SIZE = 2048;  // promptBudget() の履歴の予算はこの長さのときのもの
+
+    std::map<std::string, LlmRoleConfig> roleConfigs;
+    std::map<std::string, LlmContextConfig> contextConfigs;  // model_path ごと（役割の設定をまとめたもの）
+    std::unique_ptr<ModelPool> modelPool;
+
+    // 読み込んだ LoRA（キーはベースモデルとアダプターのパス）。ベースモデルが追い出されたら一緒に解放する。
+    // 読み込みに失敗したものは nullptr のまま残し、毎回読み直さない。inferenceMutex で保護
+    std::map<std::string, llama_adapter_lora*> adapters;
+    struct AppliedAdapter {
+        llama_adapter_lora* adapter = nullptr;
+        float scale = 0.0f;
+    };
+    std::map<llama_context*, AppliedAdapter> appliedAdapters;  // コンテキストに今かかっているアダプター
+    // コンテキストごとのプロンプトのKVの木。作業用のシーケンス（0〜MAX_CLASSIFY_CANDIDATES-1）の後ろの番号を使う
+    std::map<llama_context*, std::unique_ptr<PrefixCache>> prefixCaches;
+    std::map<std::string, InferenceState> states;  // 最初にモデルを使ったときに作り、追い出されても残す
+    std::mutex inferenceMutex;  // 役割間でコンテキストを共有するため推論は直列化する
+    uint32_t baseSeed = 1234;
+    std::atomic<uint64_t> cancelEpoch{0};  // cancelPending() のたびに増やす
+    static thread_local const std::atomic<uint64_t>* cancelSource;  // CancelScope の中なら、cancelEpoch の代わりに見る
+    std::map<std::string, uint32_t> roleRequests;  // inferenceMutex で保護
+    uint32_t requestSeed(const std::string& role);  // inferenceMutex を持った状態で呼ぶ
+
+    SessionRecorder* recorder = nullptr;
+    RecordedOutputs* recordedOutputs = nullptr;
+
+    // 全コンテキストで共有するスレッドプール（推論は inferenceMutex で直列化されるので同時に使われない）
+    LlmThreadConfig threadConfig;
+    ggml_threadpool* decodePool = nullptr;
+    ggml_threadpool* prefillPool = nullptr;
+    std::atomic<bool> threadsIdleRequested{false};
+    bool threadsPaused = false;  // inferenceMutex で保護
+    void createThreadPools();
+    void applyThreadIdle();      // inferenceMutex を持った状態で呼ぶ
+
+    // 推論の間だけプールを起こしておき、抜けるときに idle の要求を反映する（inferenceMutex を持った状態で作る）
+    class ThreadPoolLease {
+    public:
+        explicit ThreadPoolLease(LlmManager& manager);
+        ~ThreadPoolLease() { manager.applyThreadIdle(); }
+    private:
+        LlmManager& manager;
+    };
+
+    std::mutex prefetchMutex;
+    std::vector<std::future<void>> prefetchJobs;
+
+    // 埋め込み（セマンティックキャッシュ用）
+    llama_context* embedCtx = nullptr;
+    std::string embedPath;  // 固定中のモデル
+    std::mutex embedMutex;
+    std::unique_ptr<SemanticCache<GmResponse>> gmCache;
+    std::unique_ptr<SemanticCache<BattleResponse>> battleCache;
+
+    // 世界設定と過去の会話・出来事の索引。埋め込みコンテキストがあれば BM25 と埋め込みを合わせて引く
+    static const size_t RETRIEVAL_TOP_K = 4;
+    static const int RETRIEVAL_TOKENS = 192;     // 2048 トークンのときの上限（コンテキストに比例）
+    static const size_t MAX_EPISODES = 512;      // 超えたら古い会話・出来事から忘れる
+    MemoryIndex memory;
+    std::mutex episodeMutex;
+    size_t episodeCount = 0;  // 索引にある会話と出来事の数。episodeMutex で保護
+    void rememberEpisode(MemoryKind kind, std::string text, uint64_t serial);
+    // query に関係のある記憶を箇条書きにする（token_budget に収まる分だけ）。
+    // exclude_from_serial 以降の発言はプロンプトの履歴に入っているので除く
+    std::string retrieveMemories(const std::string& query, uint64_t exclude_from_serial, int token_budget, const llama_vocab* vocab);
+
+    // 連続バッチ処理。run_inference() はリクエストを batchQueue に入れて待ち、batchLoop() が同じモデルと
+    // アダプターのリクエストをスロット（シーケンス）に割り当てて、1ステップごとに1つのバッチで進める。
+    // ステップの間は inferenceMutex を離すので、classify() や新しいリクエストはその間に入る。
+    // 依頼元の on_token（パースと途中結果の受け渡し）は batchLoop() では呼ばず、生成した断片を pending に貯めて
+    // 依頼元のスレッドが mutex の外で渡す（遅いコールバックがバッチ全体を止めないように）
+    struct BatchRequest {
+        std::string role;
+        bool use_adapter = true;
+        bool json_output = false;
+        const TokenCallback* on_token = nullptr;  // queuePiece を指す（依頼元に on_token が無ければ nullptr）
+        TokenCallback queuePiece;
+        std::vector<llama_token> tokens;  // プロンプト
+        int n_ctx = 0;                    // 1シーケンスの長さの上限
+        int max_tokens = 0;
+        uint32_t seed = 0;
+        const std::atomic<uint64_t>* cancel_source = nullptr;
+        uint64_t epoch = 0;
+        LlmExchange* exchange = nullptr;
+        std::chrono::steady_clock::time_point start, admitted;
+
+        // 以下は batchLoop() が書く（done になってから依頼元が読む）
+        int n_past = 0;        // シーケンスに計算済みのトークン数
+        int generated = 0;
+        llama_token next = 0;  // 次のステップで入れる、サンプリング済みのトークン
+        std::string output;
+        std::string pending;   // 依頼元がまだ on_token に渡していない断片
+        bool stopped = false;  // 依頼元の on_token が false を返した（依頼元が書く）
+        bool done = false;
+
+        bool prefilling() const { return n_past < static_cast<int>(tokens.size()); }
+        bool cancelled() const { return cancel_source->load(std::memory_order_relaxed) != epoch; }
+    };
+    struct BatchSlot {
+        BatchRequest* request = nullptr;
+        llama_seq_id seq = -1;
+        int chunk = 0;     // このステップでバッチに入れたトークン数
+        int32_t row = -1;  // このステップで logits を読むバッチ内の位置（無ければ -1）
+        llama_sampler* sampler = nullptr;  // samplerRole 用
+        std::string samplerRole;
+        std::vector<llama_token_data> candidates;
+        std::mt19937 rng;
+    };
+    int parallelSlots = 0;  // 0 なら直列
+    std::vector<BatchSlot> batchSlots;
+    std::deque<BatchRequest*> batchQueue;  // 以下 batchStopping まで inferenceMutex で保護
+    std::string batchGroup;                // スロットにあるリクエストのモデルとアダプター
+    llama_context* batchCtx = nullptr;     // スロットのシーケンスがあるコンテキスト
+    llama_batch batchBuffer = {};
+    std::condition_variable batchWake;     // batchLoop() を起こす
+    std::condition_variable batchDone;     // 依頼元を起こす
+    bool batchStopping = false;
+    std::thread batchThread;
+    int batchSize() const { return std::max(256, parallelSlots); }  // コンテキストの n_batch
+    std::string batchGroupKey(const BatchRequest& request) const;
+    std::string runBatched(const std::string& role, const std::string& prompt, bool plain_text, const TokenCallback& on_token,
+                           const std::atomic<uint64_t>& cancel_source, uint64_t epoch, LlmExchange& exchange,
+                           std::unique_lock<std::mutex>& lock, std::chrono::steady_clock::time_point start_time);
+    void batchLoop();
+    void batchStep();  // inferenceMutex を持った状態で呼ぶ
+    // リクエストを終えて依頼元を起こす。mem が nullptr ならシーケンスのKVは消さない（コンテキストごと無くなったとき）
+    void releaseSlot(BatchSlot& slot, llama_memory_t mem);
+
+    mutable std::mutex metricsMutex;
+    LlmMetrics cacheMetrics;
+    PrefixCacheMetrics prefixStats;
+    LlmBatchMetrics batchStats;
+    void recordCacheResult(bool hit, double ms);
+    // セマンティックキャッシュの命中を記録する／再生中なら記録した命中を取り出す（response_json は応答のJSON）
+    void recordCacheHit(const std::string& role, const std::string& key, const std::string& response_json);
+    bool replayCacheHit(const std::string& role, const std::string& key, std::string& response_json);
+
+    // 役割ごとのトークン予算。履歴は history_tokens（とコンテキストの残り）に収まるだけ新しい順に詰め、
+    // 生成用に max_new_tokens を必ず空けておく。
+    struct PromptBudget {
+        int history_tokens;
+        int max_new_tokens;
     };
+    // 履歴の予算はコンテキストの長さに比例して増やす
+    static PromptBudget promptBudget(const std::string& role, int n_ctx = BASE_CONTEXT_SIZE);
+    int contextSize(const std::string& role) const;
+    static std::string formatTurn(ChatRole role, std::string_view text);
+    static int turnTokens(const llama_vocab* vocab, const ChatTurn& turn);
+    static int tokenLength(const llama_vocab* vocab, const std::string& text);
+    // 固定部分（システムプロンプトと末尾）を除いた予算に収まる範囲の履歴をチャット形式で返す
+    // first_turn には入れた最も古い発言の位置が入る（何も入らなければ history.size()）
+    std::string packHistory(const std::string& role, const ConversationView& history, const std::string& fixed_prompt,
+                            size_t* first_turn = nullptr);
 
-    std::map<std::string, LlmInstance> instances;
 
-    std::string run_inference(const std::string& role, const std::string& prompt);
-    
-    GmResponse parseGmResponse(const std::string& json_str);
-    BattleResponse parseBattleResponse(const std::string& json_str);
+    // plain_text: JSONではなく地の文として生成する（文末で打ち切る）。
+    // seed_key: シードの系列（空なら role）。同じモデルを使う別の用途は別の系列にして、呼ばれる順番でシードが変わらないようにする。
+    // completed: 取り消されず、エラーも無く生成を終えたら true（途中までの結果をキャッシュに入れないため）
+    std::string run_inference(const std::string& role, const std::string& prompt, bool plain_text = false, const TokenCallback& on_token = nullptr,
+                              const std::string& seed_key = "", bool* completed = nullptr);
+    // 生成結果から特殊トークン以降を取り除く
+    static std::string cleanupOutput(const std::string& role, std::string result_str);
+    llama_context* createContext(const std::string& model_path, llama_model* model, size_t& context_bytes);
+    // 役割のモデルを読み込んで（必要なら推論状態も作って）返す。inferenceMutex を持った状態で呼ぶ
+    // use_adapter が false ならアダプターを外したベースモデルで計算する
+    bool acquireRole(const std::string& role, LlmInstance& out, bool use_adapter = true);
+    llama_adapter_lora* roleAdapter(const LlmRoleConfig& config, llama_model* model);
+    void releaseAdapters(const std::string& model_path, llama_context* ctx);  // モデルの追い出し時
+    bool compactPrompt(const std::string& role) const;
+    const llama_vocab* roleVocab(const std::string& role) const;
+    void createInferenceState(const std::string& role, llama_context* ctx, const llama_model* model);
+    // tokens[first, n_tokens) を seq 0 の続きとして計算する
+    bool decodePrompt(InferenceState& state, llama_context* ctx, const llama_token* tokens, int n_tokens, int first = 0);
+    // 作業用のシーケンスを空にし、共通部分のKVを使い回してプロンプトを seq 0 に計算する。
+    // reserve はこの後に生成・評価するトークン数（そのぶんのKVセルを空けておく）
+    bool prefillShared(InferenceState& state, const LlmInstance& instance, const llama_token* tokens, int n_tokens, int reserve);
+    llama_token sampleToken(InferenceState& state, llama_context* ctx);
+    // logits の行からサンプラーと rng で1トークンを選ぶ（candidates は語彙サイズ）
+    static llama_token sampleLogits(llama_sampler* sampler, std::vector<llama_token_data>& candidates, std::mt19937& rng, const float* logits);
+    static llama_sampler* createRoleSampler(const std::string& role);
+    // 生成したトークンを output に足す。続けるなら true（終端・停止トークン・on_token の打ち切り・地の文の文末で false）
+    static bool appendToken(const llama_vocab* vocab, llama_token token, std::string& output, bool json_output,
+                            const TokenCallback* on_token, const std::string& role);
 };
 
 #endif
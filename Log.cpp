@@ -0,0 +1,360 @@
+#include "Log.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace Log {
+
+namespace detail {
+static_assert(static_cast<size_t>(LogCategory::COUNT) == 5, "thresholds の初期値を合わせること");
+constexpr uint8_t STARTUP_LEVEL = static_cast<uint8_t>(LogLevel::Warn);
+std::atomic<uint8_t> thresholds[static_cast<size_t>(LogCategory::COUNT)] = {
+    {STARTUP_LEVEL}, {STARTUP_LEVEL}, {STARTUP_LEVEL}, {STARTUP_LEVEL}, {STARTUP_LEVEL}
+};
+}
+
+namespace {
+
+const char* const LEVEL_NAMES[] = {"TRACE", "DEBUG", "INFO ", "WARN ", "ERROR", "OFF  "};
+const char* const CATEGORY_NAMES[] = {"GAME", "LLM", "GM", "NPC", "BATTLE"};
+
+const size_t RECORD_TEXT = 232;
+const size_t RING_SIZE = 8192;  // 2のべき乗
+const size_t MAX_CHUNKS = RING_SIZE / 8;  // 1メッセージが使えるレコード数の上限（約230KB）
+
+struct Record {
+    int64_t time_us = 0;
+    uint16_t length = 0;
+    LogLevel level = LogLevel::Info;
+    LogCategory category = LogCategory::GAME;
+    bool continued = false;  // 次のレコードに続く
+    char text[RECORD_TEXT];
+};
+
+struct Cell {
+    std::atomic<size_t> sequence{0};
+    Record record;
+};
+
+// 複数の書き込み側と1つの読み出し側を持つ有界キュー（各セルの sequence で空き・書き込み済みを判定する）。
+// 1メッセージ分のレコードは連続した位置をまとめて確保するので、他のスレッドの行と混ざらない。
+class AsyncSink {
+public:
+    ~AsyncSink() { stop(); }
+
+    bool start(const LogConfig& cfg) {
+        std::lock_guard<std::mutex> lock(lifecycleMutex);
+        if (running.load()) return true;
+        config = cfg;
+        if (!openFile()) return false;
+        for (size_t i = 0; i < RING_SIZE; ++i) cells[i].sequence.store(i, std::memory_order_relaxed);
+        enqueuePos.store(0, std::memory_order_relaxed);
+        dequeuePos = 0;
+        running.store(true, std::memory_order_release);
+        worker = std::thread(&AsyncSink::run, this);
+        return true;
+    }
+
+    void stop() {
+        std::lock_guard<std::mutex> lock(lifecycleMutex);
+        if (!running.load()) return;
+        running.store(false, std::memory_order_release);
+        worker.join();
+        if (file) std::fclose(file);
+        file = nullptr;
+    }
+
+    // 書き出しスレッドが動いていなければ false
+    bool push(LogLevel level, LogCategory category, std::string_view message) {
+        if (!running.load(std::memory_order_acquire)) return false;
+
+        size_t chunks = std::max<size_t>(1, (message.size() + RECORD_TEXT - 1) / RECORD_TEXT);
+        if (chunks > MAX_CHUNKS) {
+            chunks = MAX_CHUNKS;
+            message = message.substr(0, MAX_CHUNKS * RECORD_TEXT);
+        }
+
+        // 最後のセルが空いていれば、読み出し側は順に空けていくのでそれより前も空いている
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            size_t last = pos + chunks - 1;
+            size_t seq = cells[last & (RING_SIZE - 1)].sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(last);
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + chunks, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed);  // 満杯。待たずに捨てる
+                return true;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        for (size_t i = 0; i < chunks; ++i) {
+            Cell& cell = cells[(pos + i) & (RING_SIZE - 1)];
+            Record& rec = cell.record;
+            size_t offset = i * RECORD_TEXT;
+            size_t length = std::min(RECORD_TEXT, message.size() - std::min(offset, message.size()));
+            rec.time_us = now;
+            rec.level = level;
+            rec.category = category;
+            rec.length = static_cast<uint16_t>(length);
+            rec.continued = (i + 1 < chunks);
+            if (length) std::memcpy(rec.text, message.data() + offset, length);
+            cell.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+        return true;
+    }
+
+private:
+    void run() {
+        fileOut.reserve(64 * 1024);
+        consoleOut.reserve(16 * 1024);
+        while (true) {
+            bool wasRunning = running.load(std::memory_order_acquire);
+            size_t n = drain();
+            uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+            if (lost) {
+                fileOut += "---- log: " + std::to_string(lost) + " message(s) dropped (ring buffer full) ----\n";
+            }
+            flush();
+            if (n == 0) {
+                if (!wasRunning) break;
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        }
+    }
+
+    size_t drain() {
+        size_t n = 0;
+        while (n < RING_SIZE) {
+            Cell& cell = cells[dequeuePos & (RING_SIZE - 1)];
+            if (cell.sequence.load(std::memory_order_acquire) != dequeuePos + 1) break;
+            format(cell.record);
+            cell.sequence.store(dequeuePos + RING_SIZE, std::memory_order_release);
+            dequeuePos++;
+            n++;
+        }
+        return n;
+    }
+
+    void format(const Record& rec) {
+        std::string_view text(rec.text, rec.length);
+        if (!inMessage) {
+            std::time_t seconds = static_cast<std::time_t>(rec.time_us / 1000000);
+            std::tm local{};
+#if defined(_WIN32)
+            localtime_s(&local, &seconds);
+#else
+            localtime_r(&seconds, &local);
+#endif
+            char header[64];
+            int len = std::snprintf(header, sizeof(header), "%02d:%02d:%02d.%03d %s [%s] ",
+                local.tm_hour, local.tm_min, local.tm_sec, static_cast<int>(rec.time_us / 1000 % 1000),
+                LEVEL_NAMES[static_cast<int>(rec.level)], CATEGORY_NAMES[static_cast<int>(rec.category)]);
+            fileOut.append(header, len);
+            toConsole = rec.level >= config.console_level;
+            if (toConsole) consoleOut.append(header + 13, len - 13);  // コンソールには時刻を付けない
+        }
+        fileOut.append(text);
+        if (toConsole) consoleOut.append(text);
+        inMessage = rec.continued;
+        if (!inMessage) {
+            fileOut += '\n';
+            if (toConsole) consoleOut += '\n';
+        }
+    }
+
+    void flush() {
+        if (!consoleOut.empty()) {
+            std::fwrite(consoleOut.data(), 1, consoleOut.size(), stdout);
+            std::fflush(stdout);
+            consoleOut.clear();
+        }
+        if (fileOut.empty()) return;
+        if (file) {
+            std::fwrite(fileOut.data(), 1, fileOut.size(), file);
+            std::fflush(file);
+            fileBytes += fileOut.size();
+            if (fileBytes >= config.max_file_bytes) rotate();
+        }
+        fileOut.clear();
+    }
+
+    bool openFile() {
+        std::error_code ec;
+        std::filesystem::path path = std::filesystem::u8path(config.path);
+        if (path.has_parent_path()) std::filesystem::create_directories(path.parent_path(), ec);
+        file = std::fopen(config.path.c_str(), "ab");
+        if (!file) {
+            std::cerr << "Log: failed to open " << config.path << std::endl;
+            return false;
+        }
+        std::fseek(file, 0, SEEK_END);
+        long size = std::ftell(file);
+        fileBytes = size > 0 ? static_cast<size_t>(size) : 0;
+        return true;
+    }
+
+    // app.log → app.log.1 → app.log.2 ... と回し、max_files を超えた分は消す
+    void rotate() {
+        std::fclose(file);
+        file = nullptr;
+        std::error_code ec;
+        for (int i = config.max_files; i >= 1; --i) {
+            std::string from = i == 1 ? config.path : config.path + "." + std::to_string(i - 1);
+            std::string to = config.path + "." + std::to_string(i);
+            std::filesystem::remove(std::filesystem::u8path(to), ec);
+            std::filesystem::rename(std::filesystem::u8path(from), std::filesystem::u8path(to), ec);
+        }
+        file = std::fopen(config.path.c_str(), "wb");
+        fileBytes = 0;
+    }
+
+    Cell cells[RING_SIZE];
+    std::atomic<size_t> enqueuePos{0};
+    size_t dequeuePos = 0;  // 書き出しスレッドだけが触る
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> dropped{0};
+    std::mutex lifecycleMutex;
+    std::thread worker;
+
+    LogConfig config;
+    FILE* file = nullptr;
+    size_t fileBytes = 0;
+    std::string fileOut;
+    std::string consoleOut;
+    bool inMessage = false;
+    bool toConsole = false;
+};
+
+AsyncSink& sink() {
+    static AsyncSink instance;
+    return instance;
+}
+
+thread_local std::string lineBuffer;
+
+bool parseLevel(std::string_view name, LogLevel& out) {
+    static const std::pair<std::string_view, LogLevel> names[] = {
+        {"trace", LogLevel::Trace}, {"debug", LogLevel::Debug}, {"info", LogLevel::Info},
+        {"warn", LogLevel::Warn}, {"error", LogLevel::Error}, {"off", LogLevel::Off}
+    };
+    for (const auto& entry : names) {
+        if (entry.first == name) { out = entry.second; return true; }
+    }
+    return false;
+}
+
+bool parseCategory(std::string_view name, LogCategory& out) {
+    static const std::pair<std::string_view, LogCategory> names[] = {
+        {"game", LogCategory::GAME}, {"llm", LogCategory::LLM}, {"gm", LogCategory::GM},
+        {"npc", LogCategory::NPC}, {"battle", LogCategory::BATTLE}
+    };
+    for (const auto& entry : names) {
+        if (entry.first == name) { out = entry.second; return true; }
+    }
+    return false;
+}
+
+// "trace" や "gm=trace,npc=info" の形式
+void applyLevelSpec(std::string spec) {
+    for (char& c : spec) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos) end = spec.size();
+        std::string_view item(spec.data() + start, end - start);
+        size_t eq = item.find('=');
+        LogLevel level;
+        LogCategory category;
+        if (eq == std::string_view::npos) {
+            if (parseLevel(item, level)) {
+                for (size_t i = 0; i < static_cast<size_t>(LogCategory::COUNT); ++i) setLevel(static_cast<LogCategory>(i), level);
+            }
+        } else if (parseCategory(item.substr(0, eq), category) && parseLevel(item.substr(eq + 1), level)) {
+            setLevel(category, level);
+        }
+        start = end + 1;
+    }
+}
+
+} // namespace
+
+bool start(const LogConfig& config) {
+    if (!sink().start(config)) return false;
+    for (size_t i = 0; i < static_cast<size_t>(LogCategory::COUNT); ++i) setLevel(static_cast<LogCategory>(i), config.level);
+    if (const char* spec = std::getenv("PQ_LOG_LEVEL")) applyLevelSpec(spec);
+    return true;
+}
+
+void stop() {
+    sink().stop();
+    for (size_t i = 0; i < static_cast<size_t>(LogCategory::COUNT); ++i) setLevel(static_cast<LogCategory>(i), LogLevel::Warn);
+}
+
+void setLevel(LogCategory category, LogLevel level) {
+    detail::thresholds[static_cast<size_t>(category)].store(static_cast<uint8_t>(level), std::memory_order_relaxed);
+}
+
+LogCategory categoryForRole(std::string_view role) {
+    if (role == "GM") return LogCategory::GM;
+    if (role == "NPC") return LogCategory::NPC;
+    if (role == "BATTLE") return LogCategory::BATTLE;
+    return LogCategory::LLM;
+}
+
+void write(LogLevel level, LogCategory category, std::string_view message) {
+    if (sink().push(level, category, message)) return;
+    // 書き出しスレッドがないときは Warn 以上だけをその場で出す
+    if (level >= LogLevel::Warn) {
+        std::cerr << LEVEL_NAMES[static_cast<int>(level)] << " [" << CATEGORY_NAMES[static_cast<int>(category)] << "] " << message << std::endl;
+    }
+}
+
+Line::Line(LogLevel l, LogCategory c) : level(l), category(c), buffer(lineBuffer) {
+    buffer.clear();
+    if (buffer.capacity() < 1024) buffer.reserve(1024);
+}
+
+Line::~Line() {
+    write(level, category, buffer);
+}
+
+Line& Line::operator<<(std::string_view text) {
+    buffer.append(text);
+    return *this;
+}
+
+Line& Line::operator<<(double value) {
+    char tmp[32];
+    int len = std::snprintf(tmp, sizeof(tmp), "%g", value);
+    if (len > 0) buffer.append(tmp, std::min<size_t>(len, sizeof(tmp) - 1));
+    return *this;
+}
+
+Line& Line::appendSigned(long long value) {
+    char tmp[24];
+    int len = std::snprintf(tmp, sizeof(tmp), "%lld", value);
+    buffer.append(tmp, len);
+    return *this;
+}
+
+Line& Line::appendUnsigned(unsigned long long value) {
+    char tmp[24];
+    int len = std::snprintf(tmp, sizeof(tmp), "%llu", value);
+    buffer.append(tmp, len);
+    return *this;
+}
+
+} // namespace Log
@@ -0,0 +1,106 @@
+// Log.h - Prompt Quest: レベル・カテゴリ付きの非同期ロガー
+//
+// 呼び出し側は固定長レコードをロックフリーのリングバッファに積むだけで、書式化済みの行の
+// ファイル（ローテーションあり）とコンソールへの書き出しはバックグラウンドのスレッドが行う。
+// リングが満杯のときは待たずに捨て、捨てた件数を後からログに残す。
+//
+// PQ_LOG_MIN_LEVEL より低いレベルの PQ_LOG_* はコンパイル時に消える（引数も評価されない）。
+// 実行時のしきい値はカテゴリごとに持ち、無効なら atomic を1回読むだけで済む。
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// 0=Trace 1=Debug 2=Info 3=Warn 4=Error 5=すべて無効
+#ifndef PQ_LOG_MIN_LEVEL
+#define PQ_LOG_MIN_LEVEL 0
+#endif
+
+// Windows の ERROR マクロ等と衝突しないよう、レベル名は大文字にしない
+enum class LogLevel : uint8_t { Trace, Debug, Info, Warn, Error, Off };
+
+enum class LogCategory : uint8_t { GAME, LLM, GM, NPC, BATTLE, COUNT };
+
+struct LogConfig {
+    std::string path = "logs/prompt_quest.log";
+    size_t max_file_bytes = 4 * 1024 * 1024;  // これを超えたら .1, .2, ... へ回す
+    int max_files = 3;                         // 残す古いファイルの数
+    LogLevel level = LogLevel::Debug;          // 全カテゴリの初期しきい値
+    LogLevel console_level = LogLevel::Info;   // これ以上のレベルはコンソールにも出す
+};
+
+namespace Log {
+
+// 書き出しスレッドを起動する。環境変数 PQ_LOG_LEVEL（例: "trace" や "gm=trace,npc=info"）で
+// しきい値を上書きできる。起動前と停止後は Warn 以上だけを標準エラーに直接書く。
+bool start(const LogConfig& config = LogConfig());
+void stop();  // 積まれたレコードを書き切ってから止める
+
+void setLevel(LogCategory category, LogLevel level);
+LogCategory categoryForRole(std::string_view role);  // "GM" / "NPC" / "BATTLE"、それ以外は LLM
+
+namespace detail {
+extern std::atomic<uint8_t> thresholds[static_cast<size_t>(LogCategory::COUNT)];
+}
+
+inline bool enabled(LogLevel level, LogCategory category) {
+    return static_cast<uint8_t>(level) >= detail::thresholds[static_cast<size_t>(category)].load(std::memory_order_relaxed);
+}
+
+void write(LogLevel level, LogCategory category, std::string_view message);
+
+// PQ_LOG_* が使う1行分の組み立て。スレッドごとのバッファを使い回すので確保は発生しない。
+class Line {
+public:
+    Line(LogLevel level, LogCategory category);
+    ~Line();
+    Line(const Line&) = delete;
+    Line& operator=(const Line&) = delete;
+
+    Line& operator<<(std::string_view text);
+    Line& operator<<(const char* text) { return *this << std::string_view(text ? text : ""); }
+    Line& operator<<(const std::string& text) { return *this << std::string_view(text); }
+    Line& operator<<(char c) { return *this << std::string_view(&c, 1); }
+    Line& operator<<(bool value) { return *this << (value ? "true" : "false"); }
+    Line& operator<<(double value);
+
+    template <typename T>
+    std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool> && !std::is_same_v<T, char>, Line&>
+    operator<<(T value) {
+        return std::is_signed_v<T> ? appendSigned(static_cast<long long>(value)) : appendUnsigned(static_cast<unsigned long long>(value));
+    }
+
+private:
+    Line& appendSigned(long long value);
+    Line& appendUnsigned(unsigned long long value);
+
+    LogLevel level;
+    LogCategory category;
+    std::string& buffer;
+};
+
+} // namespace Log
+
+#define PQ_LOG(level, category, expr) \
+    do { \
+        if constexpr (static_cast<int>(level) >= PQ_LOG_MIN_LEVEL) { \
+            if (Log::enabled(level, category)) { \
+                Log::Line pq_log_line_(level, category); \
+                pq_log_line_ << expr; \
+            } \
+        } \
+    } while (0)
+
+#define PQ_LOG_TRACE(category, expr) PQ_LOG(LogLevel::Trace, category, expr)
+#define PQ_LOG_DEBUG(category, expr) PQ_LOG(LogLevel::Debug, category, expr)
+#define PQ_LOG_INFO(category, expr) PQ_LOG(LogLevel::Info, category, expr)
+#define PQ_LOG_WARN(category, expr) PQ_LOG(LogLevel::Warn, category, expr)
+#define PQ_LOG_ERROR(category, expr) PQ_LOG(LogLevel::Error, category, expr)
+
+#endif
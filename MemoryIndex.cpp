@@ -0,0 +1,264 @@
+#include "MemoryIndex.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// BM25 の係数（一般的な値）
+const float BM25_K1 = 1.2f;
+const float BM25_B = 0.75f;
+// Reciprocal Rank Fusion の定数
+const float RRF_K = 60.0f;
+
+// UTF-8 を1文字ずつ読む。壊れたバイトは1バイトを1文字として扱う
+char32_t nextCodepoint(std::string_view text, size_t& i) {
+    unsigned char c = static_cast<unsigned char>(text[i]);
+    int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+    if (i + extra >= text.size() + (extra ? 0 : 1)) extra = 0;
+    char32_t cp = extra == 0 ? c : extra == 1 ? (c & 0x1F) : extra == 2 ? (c & 0x0F) : (c & 0x07);
+    for (int k = 1; k <= extra; ++k) {
+        unsigned char cc = static_cast<unsigned char>(text[i + k]);
+        if ((cc & 0xC0) != 0x80) {
+            extra = 0;
+            cp = c;
+            break;
+        }
+        cp = (cp << 6) | (cc & 0x3F);
+    }
+    i += 1 + extra;
+    return cp;
+}
+
+// 全角英数字は半角に、英字は小文字に揃える
+char32_t normalize(char32_t cp) {
+    if (cp >= 0xFF10 && cp <= 0xFF19) cp = cp - 0xFF10 + U'0';
+    else if (cp >= 0xFF21 && cp <= 0xFF3A) cp = cp - 0xFF21 + U'a';
+    else if (cp >= 0xFF41 && cp <= 0xFF5A) cp = cp - 0xFF41 + U'a';
+    if (cp >= U'A' && cp <= U'Z') cp = cp - U'A' + U'a';
+    return cp;
+}
+
+bool isAsciiWord(char32_t cp) {
+    return (cp >= U'0' && cp <= U'9') || (cp >= U'a' && cp <= U'z') || cp == U'_';
+}
+
+// 語の区切りになる文字（空白・記号・和文の句読点と括弧）
+bool isSeparator(char32_t cp) {
+    if (cp < 0x80) return !isAsciiWord(cp);
+    if (cp >= 0x3000 && cp <= 0x303F) return true;   // 、。「」『』【】など
+    if (cp >= 0xFF01 && cp <= 0xFF0F) return true;   // ！＂＃…／
+    if (cp >= 0xFF1A && cp <= 0xFF20) return true;   // ：；＜＝＞？＠
+    if (cp >= 0xFF3B && cp <= 0xFF40) return true;
+    if (cp >= 0xFF5B && cp <= 0xFF65) return true;   // ｛｜｝～ と半角の句読点
+    if (cp >= 0x2010 && cp <= 0x206F) return true;   // ―…‥ などの一般句読点
+    return cp == 0x30FB;                             // ・
+}
+
+uint64_t hashCodepoints(const char32_t* cps, size_t n, uint64_t salt) {
+    uint64_t h = 1469598103934665603ull ^ salt;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= static_cast<uint64_t>(cps[i]);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+} // namespace
+
+void MemoryIndex::terms(std::string_view text, std::vector<uint64_t>& out) {
+    out.clear();
+    std::vector<char32_t> run;  // 区切りまでの連続した文字
+    bool ascii_run = false;
+    auto flush = [&]() {
+        if (run.empty()) return;
+        if (ascii_run) {
+            out.push_back(hashCodepoints(run.data(), run.size(), 0x77));
+        } else if (run.size() == 1) {
+            out.push_back(hashCodepoints(run.data(), 1, 0x75));
+        } else {
+            for (size_t i = 0; i + 1 < run.size(); ++i) out.push_back(hashCodepoints(run.data() + i, 2, 0x62));
+        }
+        run.clear();
+    };
+
+    size_t i = 0;
+    while (i < text.size()) {
+        char32_t cp = normalize(nextCodepoint(text, i));
+        if (isSeparator(cp)) {
+            flush();
+            continue;
+        }
+        bool ascii = isAsciiWord(cp);
+        if (!run.empty() && ascii != ascii_run) flush();
+        ascii_run = ascii;
+        run.push_back(cp);
+    }
+    flush();
+}
+
+uint64_t MemoryIndex::add(MemoryKind kind, std::string text, uint64_t serial) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Document doc;
+    doc.id = nextId++;
+    doc.kind = kind;
+    doc.serial = serial;
+    doc.text = std::move(text);
+    docs.push_back(std::move(doc));
+    indexDocument(static_cast<uint32_t>(docs.size() - 1));
+    return docs.back().id;
+}
+
+void MemoryIndex::remove(MemoryKind kind) {
+    std::lock_guard<std::mutex> lock(mutex);
+    docs.erase(std::remove_if(docs.begin(), docs.end(), [kind](const Document& doc) { return doc.kind == kind; }), docs.end());
+    rebuild();
+}
+
+size_t MemoryIndex::removeOldest(size_t count) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // docs は追加した順に並んでいる
+    size_t removed = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < docs.size(); ++i) {
+        if (removed < count && docs[i].kind != MemoryKind::LORE) {
+            removed++;
+            continue;
+        }
+        if (kept != i) docs[kept] = std::move(docs[i]);
+        kept++;
+    }
+    docs.resize(kept);
+    if (removed > 0) rebuild();
+    return removed;
+}
+
+size_t MemoryIndex::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return docs.size();
+}
+
+std::vector<MemoryHit> MemoryIndex::search(std::string_view query, size_t k, uint64_t exclude_from_serial,
+                                           const std::vector<float>* query_vec) const {
+    std::vector<uint64_t> query_terms;
+    terms(query, query_terms);
+    std::sort(query_terms.begin(), query_terms.end());
+    query_terms.erase(std::unique(query_terms.begin(), query_terms.end()), query_terms.end());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<MemoryHit> hits;
+    if (docs.empty() || k == 0) return hits;
+
+    auto excluded = [&](const Document& doc) {
+        return doc.kind == MemoryKind::CONVERSATION && doc.serial >= exclude_from_serial;
+    };
+
+    // BM25
+    const float n_docs = static_cast<float>(docs.size());
+    const float avg_length = std::max(1.0f, static_cast<float>(totalLength) / n_docs);
+    std::vector<float> bm25(docs.size(), 0.0f);
+    for (uint64_t term : query_terms) {
+        auto it = postings.find(term);
+        if (it == postings.end()) continue;
+        const float df = static_cast<float>(it->second.size());
+        const float idf = std::log(1.0f + (n_docs - df + 0.5f) / (df + 0.5f));
+        for (const Posting& posting : it->second) {
+            const float tf = static_cast<float>(posting.tf);
+            const float norm = 1.0f - BM25_B + BM25_B * docs[posting.doc].length / avg_length;
+            bm25[posting.doc] += idf * tf * (BM25_K1 + 1.0f) / (tf + BM25_K1 * norm);
+        }
+    }
+
+    std::vector<uint32_t> candidates;
+    for (uint32_t i = 0; i < docs.size(); ++i) {
+        if (!excluded(docs[i]) && bm25[i] > 0.0f) candidates.push_back(i);
+    }
+    std::vector<float> score(docs.size(), 0.0f);
+
+    const bool use_vectors = query_vec && vectors.size() > 0 && static_cast<int>(query_vec->size()) == vectors.dims();
+    if (!use_vectors) {
+        for (uint32_t i : candidates) score[i] = bm25[i];
+    } else {
+        // BM25 と埋め込みのそれぞれの順位から RRF で合わせる（語が一致しない言い換えも拾える）
+        std::sort(candidates.begin(), candidates.end(), [&](uint32_t a, uint32_t b) { return bm25[a] > bm25[b]; });
+        for (size_t rank = 0; rank < candidates.size(); ++rank) score[candidates[rank]] += 1.0f / (RRF_K + rank + 1);
+
+        std::vector<float> similarity(vectors.size(), 0.0f);
+        vectors.scoreAll(query_vec->data(), similarity.data());
+        std::vector<uint32_t> by_vector;
+        for (uint32_t i = 0; i < docs.size(); ++i) {
+            if (docs[i].vectorRow >= 0 && !excluded(docs[i])) by_vector.push_back(i);
+        }
+        std::sort(by_vector.begin(), by_vector.end(), [&](uint32_t a, uint32_t b) {
+            return similarity[docs[a].vectorRow] > similarity[docs[b].vectorRow];
+        });
+        for (size_t rank = 0; rank < by_vector.size() && rank < k * 2; ++rank) {
+            uint32_t i = by_vector[rank];
+            if (score[i] == 0.0f) candidates.push_back(i);
+            score[i] += 1.0f / (RRF_K + rank + 1);
+        }
+    }
+
+    size_t n = std::min(k, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + n, candidates.end(), [&](uint32_t a, uint32_t b) {
+        return score[a] > score[b];
+    });
+    for (size_t i = 0; i < n; ++i) {
+        const Document& doc = docs[candidates[i]];
+        hits.push_back({doc.text, doc.kind, score[candidates[i]]});
+    }
+    return hits;
+}
+
+std::vector<std::pair<uint64_t, std::string>> MemoryIndex::missingVectors() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::pair<uint64_t, std::string>> missing;
+    for (const Document& doc : docs) {
+        if (doc.vectorRow < 0) missing.emplace_back(doc.id, doc.text);
+    }
+    return missing;
+}
+
+void MemoryIndex::setVector(uint64_t doc_id, const std::vector<float>& vec) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (vec.empty()) return;
+    auto it = std::find_if(docs.begin(), docs.end(), [doc_id](const Document& doc) { return doc.id == doc_id; });
+    if (it == docs.end() || it->vectorRow >= 0) return;
+    if (vectors.dims() != static_cast<int>(vec.size())) {
+        // 別のモデルの埋め込みとは比べられないので作り直す
+        vectors.reset(static_cast<int>(vec.size()));
+        for (Document& doc : docs) {
+            doc.vectorRow = -1;
+            doc.vec.clear();
+        }
+    }
+    it->vec = vec;
+    it->vectorRow = static_cast<long>(vectors.add(vec.data()));
+}
+
+void MemoryIndex::indexDocument(uint32_t index) {
+    Document& doc = docs[index];
+    std::vector<uint64_t> doc_terms;
+    terms(doc.text, doc_terms);
+    doc.length = static_cast<uint32_t>(doc_terms.size());
+    totalLength += doc.length;
+    std::sort(doc_terms.begin(), doc_terms.end());
+    for (size_t i = 0; i < doc_terms.size();) {
+        size_t j = i;
+        while (j < doc_terms.size() && doc_terms[j] == doc_terms[i]) ++j;
+        postings[doc_terms[i]].push_back({index, static_cast<uint32_t>(j - i)});
+        i = j;
+    }
+    if (!doc.vec.empty() && static_cast<int>(doc.vec.size()) == vectors.dims()) {
+        doc.vectorRow = static_cast<long>(vectors.add(doc.vec.data()));
+    }
+}
+
+void MemoryIndex::rebuild() {
+    postings.clear();
+    totalLength = 0;
+    vectors.reset(vectors.dims());
+    for (uint32_t i = 0; i < docs.size(); ++i) {
+        docs[i].vectorRow = -1;
+        indexDocument(i);
+    }
+}
@@ -0,0 +1,82 @@
+// MemoryIndex.h - Prompt Quest: 世界設定と過去の出来事を引くための検索索引（日本語の文字バイグラムによるBM25）
+
+#ifndef MEMORY_INDEX_H
+#define MEMORY_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "VectorIndex.h"
+
+enum class MemoryKind : uint8_t {
+    LORE,          // 世界設定の断片（data/content.txt の [lore] など）
+    CONVERSATION,  // 過去の発言
+    EVENT          // 戦闘の結果などの出来事
+};
+
+struct MemoryHit {
+    std::string text;
+    MemoryKind kind = MemoryKind::LORE;
+    float score = 0.0f;
+};
+
+// 短い文書をたくさん持ち、質問に関係の深いものから返す。
+// 日本語は単語に区切らず、連続する2文字（句読点や空白で切る）を語として BM25 で採点する。
+// 英数字は単語単位。埋め込みベクトルを与えた文書は、質問のベクトルとのコサイン類似度の順位も
+// 合わせて（Reciprocal Rank Fusion）並べる。
+//
+// 追加と検索は別のスレッドから呼んでよい（ゲームのスレッドが出来事を足し、推論スレッドが引く）。
+class MemoryIndex {
+public:
+    // serial は会話の発言の通し番号（ChatTurn::serial）。戻り値は文書の番号（setVector 用）
+    uint64_t add(MemoryKind kind, std::string text, uint64_t serial = 0);
+    // 種類ごとに消す（新しいゲームで会話と出来事を忘れる）
+    void remove(MemoryKind kind);
+    // 世界設定以外の文書を古いものから count 件消す。残る文書の埋め込みはそのまま使う。戻り値は消した件数
+    size_t removeOldest(size_t count);
+    size_t size() const;
+
+    // 上位 k 件。exclude_from_serial 以上の番号の発言は（プロンプトの履歴に入っているので）除く。
+    // query_vec を渡すと、ベクトルを持つ文書は埋め込みの近さも考慮する
+    std::vector<MemoryHit> search(std::string_view query, size_t k, uint64_t exclude_from_serial = UINT64_MAX,
+                                  const std::vector<float>* query_vec = nullptr) const;
+
+    // 埋め込みがまだ無い文書（番号と本文）
+    std::vector<std::pair<uint64_t, std::string>> missingVectors() const;
+    void setVector(uint64_t doc_id, const std::vector<float>& vec);
+
+    // 検索語への分解（日本語は文字バイグラム、英数字は小文字の単語）。語のハッシュ値を返す
+    static void terms(std::string_view text, std::vector<uint64_t>& out);
+
+private:
+    struct Document {
+        uint64_t id = 0;
+        MemoryKind kind = MemoryKind::LORE;
+        uint64_t serial = 0;
+        std::string text;
+        uint32_t length = 0;      // 語の数
+        long vectorRow = -1;      // vectors の行（埋め込みが無ければ -1）
+        std::vector<float> vec;   // 索引を作り直すときのために元のベクトルも持つ
+    };
+    struct Posting {
+        uint32_t doc;  // docs の位置
+        uint32_t tf;
+    };
+
+    mutable std::mutex mutex;
+    std::vector<Document> docs;
+    std::unordered_map<uint64_t, std::vector<Posting>> postings;
+    uint64_t totalLength = 0;
+    uint64_t nextId = 1;
+    VectorIndex vectors;
+
+    void indexDocument(uint32_t doc);
+    void rebuild();
+};
+
+#endif
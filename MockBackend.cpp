@@ -0,0 +1,389 @@
+#include "MockBackend.h"
+#include "LlmManager.h"
+#include "Log.h"
+#include "SessionRecorder.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+std::string_view trim(std::string_view s) {
+    const char* ws = " \t\r\n";
+    size_t first = s.find_first_not_of(ws);
+    if (first == std::string_view::npos) return {};
+    size_t last = s.find_last_not_of(ws);
+    return s.substr(first, last - first + 1);
+}
+
+std::vector<std::string> splitList(std::string_view value) {
+    std::vector<std::string> out;
+    size_t start = 0;
+    while (start <= value.size()) {
+        size_t comma = value.find(',', start);
+        if (comma == std::string_view::npos) comma = value.size();
+        std::string_view part = trim(value.substr(start, comma - start));
+        if (!part.empty()) out.emplace_back(part);
+        start = comma + 1;
+    }
+    return out;
+}
+
+bool parseNumber(std::string_view text, double& out) {
+    std::string s(trim(text));
+    if (s.empty()) return false;
+    char* end = nullptr;
+    out = std::strtod(s.c_str(), &end);
+    return *end == '\0' && out >= 0.0;
+}
+
+// 日本語は1文字、英数字・記号は4文字までを1トークンとして区切る（実際のトークナイザーのおおよその粒度）
+std::vector<std::string_view> splitTokens(std::string_view text) {
+    std::vector<std::string_view> tokens;
+    size_t i = 0;
+    while (i < text.size()) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        size_t len = 1;
+        if (c >= 0x80) {
+            len = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        } else {
+            while (len < 4 && i + len < text.size() && static_cast<unsigned char>(text[i + len]) < 0x80) ++len;
+        }
+        len = std::min(len, text.size() - i);
+        tokens.push_back(text.substr(i, len));
+        i += len;
+    }
+    return tokens;
+}
+
+double msBetween(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+} // namespace
+
+double MockLatency::sample(std::mt19937& rng) const {
+    switch (distribution) {
+        case Distribution::FIXED:
+            return a;
+        case Distribution::UNIFORM:
+            return std::uniform_real_distribution<double>(a, std::max(a, b))(rng);
+        case Distribution::LOGNORMAL:
+            return a > 0.0 ? std::lognormal_distribution<double>(std::log(a), b)(rng) : 0.0;
+    }
+    return 0.0;
+}
+
+bool MockLatency::parse(const std::string& text, MockLatency& out) {
+    std::string_view value = trim(text);
+    MockLatency latency;
+    size_t colon = value.find(':');
+    if (colon == std::string_view::npos) {
+        latency.distribution = Distribution::FIXED;
+        if (!parseNumber(value, latency.a)) return false;
+    } else {
+        std::string_view kind = trim(value.substr(0, colon));
+        std::string_view args = value.substr(colon + 1);
+        if (kind == "uniform") {
+            size_t dash = args.find('-');
+            if (dash == std::string_view::npos) return false;
+            latency.distribution = Distribution::UNIFORM;
+            if (!parseNumber(args.substr(0, dash), latency.a) || !parseNumber(args.substr(dash + 1), latency.b)) return false;
+            if (latency.b < latency.a) return false;
+        } else if (kind == "lognormal") {
+            size_t comma = args.find(',');
+            if (comma == std::string_view::npos) return false;
+            latency.distribution = Distribution::LOGNORMAL;
+            if (!parseNumber(args.substr(0, comma), latency.a) || !parseNumber(args.substr(comma + 1), latency.b)) return false;
+        } else {
+            return false;
+        }
+    }
+    out = latency;
+    return true;
+}
+
+MockBackend::~MockBackend() {
+    printMetrics();
+}
+
+bool MockBackend::loadScript(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Failed to open mock script: " << path << std::endl;
+        return false;
+    }
+
+    auto fail = [&](int line_no, const std::string& msg) {
+        std::cerr << path << ":" << line_no << ": " << msg << std::endl;
+        return false;
+    };
+
+    std::map<std::string, MockRoleScript> loaded;
+    std::string role;
+    MockRoleScript current;
+    bool in_role = false;
+    auto flush = [&]() {
+        if (in_role && !role.empty()) loaded[role] = std::move(current);
+        current = MockRoleScript();
+        role.clear();
+    };
+
+    std::string raw;
+    int line_no = 0;
+    while (std::getline(in, raw)) {
+        line_no++;
+        std::string_view line = trim(raw);
+        if (line_no == 1 && line.substr(0, 3) == "\xEF\xBB\xBF") line = trim(line.substr(3));
+        if (line.empty() || line[0] == '#') continue;
+
+        if (line.front() == '[' && line.back() == ']') {
+            if (line != "[role]") return fail(line_no, "unknown section " + std::string(line));
+            if (in_role && role.empty()) return fail(line_no, "previous [role] has no name");
+            flush();
+            in_role = true;
+            continue;
+        }
+        if (!in_role) return fail(line_no, "expected [role]");
+
+        size_t eq = line.find('=');
+        if (eq == std::string_view::npos) return fail(line_no, "expected 'key = value'");
+        std::string_view key = trim(line.substr(0, eq));
+        std::string_view value = trim(line.substr(eq + 1));
+
+        if (key == "name") {
+            role = std::string(value);
+        } else if (key == "first_token") {
+            if (!MockLatency::parse(std::string(value), current.first_token)) return fail(line_no, "invalid latency '" + std::string(value) + "'");
+        } else if (key == "per_token") {
+            if (!MockLatency::parse(std::string(value), current.per_token)) return fail(line_no, "invalid latency '" + std::string(value) + "'");
+        } else if (key == "error_rate") {
+            double rate = 0.0;
+            if (!parseNumber(value, rate) || rate > 1.0) return fail(line_no, "error_rate must be between 0 and 1");
+            current.error_rate = static_cast<float>(rate);
+        } else if (key == "reply") {
+            size_t arrow = value.find("=>");
+            if (arrow == std::string_view::npos) return fail(line_no, "reply needs 'keywords => output'");
+            MockReply reply;
+            reply.keywords = splitList(value.substr(0, arrow));
+            reply.output = std::string(trim(value.substr(arrow + 2)));
+            if (reply.keywords.empty()) return fail(line_no, "reply has no keywords");
+            current.replies.push_back(std::move(reply));
+        } else if (key == "output") {
+            current.outputs.emplace_back(value);
+        } else {
+            return fail(line_no, "unknown role key '" + std::string(key) + "'");
+        }
+    }
+    if (in_role && role.empty()) return fail(line_no, "last [role] has no name");
+    flush();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& pair : loaded) scripts[pair.first] = std::move(pair.second);
+    return true;
+}
+
+void MockBackend::setRole(const std::string& role, MockRoleScript script) {
+    std::lock_guard<std::mutex> lock(mutex);
+    scripts[role] = std::move(script);
+}
+
+MockRoleScript MockBackend::roleScript(const std::string& role) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = scripts.find(role);
+    return it == scripts.end() ? MockRoleScript() : it->second;
+}
+
+void MockBackend::setSeed(uint32_t seed) {
+    std::lock_guard<std::mutex> lock(mutex);
+    baseSeed = seed;
+    roleRequests.clear();
+}
+
+void MockBackend::cancelPending() {
+    {
+        std::lock_guard<std::mutex> lock(cancelMutex);
+        cancelEpoch.fetch_add(1);
+    }
+    cancelSignal.notify_all();
+}
+
+bool MockBackend::waitUntil(std::chrono::steady_clock::time_point deadline, uint64_t epoch) {
+    std::unique_lock<std::mutex> lock(cancelMutex);
+    return cancelSignal.wait_until(lock, deadline, [&]() { return cancelEpoch.load() != epoch; });
+}
+
+const std::string& MockBackend::defaultOutput(const std::string& role) {
+    static const std::string gm = "{\"action\": \"CONTINUE\", \"items\": [], \"scene_context\": \"若者との会話を続けている。\"}";
+    static const std::string npc = "うむ、よく来てくれたのう。";
+    static const std::string battle = "{\"hit\": true, \"damage\": 10, \"effect_text\": \"攻撃が命中した。\"}";
+    static const std::string narration = "刃が魔物をかすめた。";
+    if (role == "GM") return gm;
+    if (role == "BATTLE") return battle;
+    if (role == "NARRATION") return narration;
+    return npc;
+}
+
+std::string MockBackend::lastPlayerText(const ConversationView& history) {
+    for (size_t i = history.size(); i > 0; --i) {
+        if (history[i - 1].role == ChatRole::USER) return history[i - 1].text;
+    }
+    return "";
+}
+
+std::string MockBackend::generate(const std::string& role, const std::string& input, bool single_step, const TokenCallback& on_token) {
+    const auto call_time = std::chrono::steady_clock::now();
+    const uint64_t epoch = cancelEpoch.load();
+    std::unique_lock<std::mutex> serial_lock(generateMutex, std::defer_lock);
+    if (serialized) serial_lock.lock();
+    const auto start_time = std::chrono::steady_clock::now();
+
+    LlmExchange exchange;
+    exchange.role = role;
+    exchange.prompt = input;
+    exchange.wait_ms = msBetween(call_time, start_time);
+
+    std::mt19937 rng;
+    MockLatency first_token, per_token;
+    std::string output;
+    bool inject_error = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // LlmManager と同じく、役割名のハッシュと役割ごとの呼び出し回数でシードを決める
+        uint32_t salt = 2166136261u;
+        for (char c : role) {
+            salt ^= static_cast<uint8_t>(c);
+            salt *= 16777619u;
+        }
+        uint32_t n = roleRequests[role]++;
+        exchange.seed = baseSeed + salt + n;
+        rng.seed(exchange.seed);
+        stats.requests++;
+
+        auto it = scripts.find(role);
+        if (it != scripts.end()) {
+            const MockRoleScript& script = it->second;
+            first_token = script.first_token;
+            per_token = script.per_token;
+            inject_error = script.error_rate > 0.0f && std::uniform_real_distribution<float>(0.0f, 1.0f)(rng) < script.error_rate;
+            for (const MockReply& reply : script.replies) {
+                bool match = std::any_of(reply.keywords.begin(), reply.keywords.end(),
+                                         [&](const std::string& keyword) { return input.find(keyword) != std::string::npos; });
+                if (match) {
+                    output = reply.output;
+                    break;
+                }
+            }
+            if (output.empty() && !script.outputs.empty()) output = script.outputs[n % script.outputs.size()];
+        }
+        if (output.empty()) output = defaultOutput(role);
+        if (inject_error) stats.errors++;
+    }
+    if (inject_error) throw std::runtime_error("mock backend: injected failure for role " + role);
+
+    const double scale = latencyScale.load();
+    auto delay = [scale](double ms) {
+        return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(ms * scale));
+    };
+
+    std::string result;
+    bool cancelled = cancelEpoch.load() != epoch;
+    auto deadline = start_time + delay(first_token.sample(rng));
+    if (!cancelled && single_step) {
+        cancelled = waitUntil(deadline, epoch);
+        if (!cancelled) result = output;
+        exchange.first_token_ms = msBetween(call_time, std::chrono::steady_clock::now());
+        exchange.generated_tokens = 1;
+    } else if (!cancelled) {
+        for (std::string_view token : splitTokens(output)) {
+            if (waitUntil(deadline, epoch)) {
+                cancelled = true;
+                break;
+            }
+            if (exchange.generated_tokens++ == 0) exchange.first_token_ms = msBetween(call_time, std::chrono::steady_clock::now());
+            result.append(token);
+            if (on_token && !on_token(token)) break;
+            deadline += delay(per_token.sample(rng));
+        }
+    }
+
+    const auto end_time = std::chrono::steady_clock::now();
+    exchange.total_ms = msBetween(call_time, end_time);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.busy_ms += msBetween(start_time, end_time);
+        if (cancelled) stats.cancelled++;
+    }
+    if (cancelled) PQ_LOG_DEBUG(Log::categoryForRole(role), "mock: cancelled after " << exchange.generated_tokens << " tokens");
+    if (recorder) {
+        exchange.output = result;
+        recorder->exchange(exchange);
+    }
+    return result;
+}
+
+GmResponse MockBackend::generateGmResponse(const ConversationView& history, const GmDecisionCallback& on_decision) {
+    GmResponse result;
+    GmResponseBuilder builder(result);
+    JsonStream stream(builder);
+    bool decided = false;
+    generate("GM", lastPlayerText(history), false, [&](std::string_view piece) {
+        bool done = stream.feed(piece);
+        if (on_decision && !decided && builder.decisionReady()) {
+            decided = true;
+            if (!on_decision(result)) return false;
+        }
+        return !done;
+    });
+    builder.finish();
+    if (on_decision && !decided) on_decision(result);
+    return result;
+}
+
+GmResponse MockBackend::generateGmDecision(const ConversationView& history, const GmDecisionCallback& on_decision) {
+    GmResponse result = LlmManager::parseGmResponse(generate("GM", lastPlayerText(history), true, nullptr));
+    if (on_decision) on_decision(result);
+    return result;
+}
+
+std::string MockBackend::generateNpcDialogue(const ConversationView& history, const std::string& scene_context) {
+    return generate("NPC", lastPlayerText(history), false, nullptr);
+}
+
+BattleResponse MockBackend::generateBattleResponse(const std::string& player_stats, const std::string& enemy_stats, const std::string& player_action,
+                                                   const std::string& enemy_info, const BattleDecisionCallback& on_decision) {
+    BattleResponse result;
+    BattleResponseBuilder builder(result);
+    JsonStream stream(builder);
+    bool decided = false;
+    generate("BATTLE", player_action, false, [&](std::string_view piece) {
+        bool done = stream.feed(piece);
+        if (on_decision && !decided && builder.decisionReady()) {
+            decided = true;
+            if (!on_decision(result)) return false;
+        }
+        return !done;
+    });
+    builder.finish();
+    if (on_decision && !decided) on_decision(result);
+    return result;
+}
+
+std::string MockBackend::generateBattleNarration(const std::string& player_action, const std::string& enemy_info, const std::string& outcome) {
+    return generate("NARRATION", player_action, false, nullptr);
+}
+
+MockMetrics MockBackend::metrics() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+void MockBackend::printMetrics() const {
+    MockMetrics m = metrics();
+    if (m.requests == 0) return;
+    PQ_LOG_INFO(LogCategory::LLM, "mock backend: requests=" << m.requests << " cancelled=" << m.cancelled << " errors=" << m.errors
+                << " busy=" << m.busy_ms << "ms");
+}
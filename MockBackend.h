@@ -0,0 +1,110 @@
+// MockBackend.h - Prompt Quest: モデルを使わない推論（遅延の分布と台本どおりの出力）。ゲームループの負荷試験用
+
+#ifndef MOCK_BACKEND_H
+#define MOCK_BACKEND_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "InferenceBackend.h"
+
+// 遅延（ミリ秒）の分布
+struct MockLatency {
+    enum class Distribution : uint8_t { FIXED, UNIFORM, LOGNORMAL };
+    Distribution distribution = Distribution::FIXED;
+    double a = 0.0;  // FIXED: 値、UNIFORM: 最小、LOGNORMAL: 中央値
+    double b = 0.0;  // UNIFORM: 最大、LOGNORMAL: σ
+
+    double sample(std::mt19937& rng) const;
+    // "120"（固定）/ "uniform:80-200" / "lognormal:300,0.5"。失敗時は false
+    static bool parse(const std::string& text, MockLatency& out);
+};
+
+// 入力にキーワードのどれかを含むときに返す出力
+struct MockReply {
+    std::vector<std::string> keywords;
+    std::string output;
+};
+
+// 役割ごとの台本。役割は GM / NPC / BATTLE / NARRATION（戦闘の描写）
+struct MockRoleScript {
+    MockLatency first_token;          // 呼び出しから最初のトークンまで（プリフィル相当）
+    MockLatency per_token;            // 以降のトークンごと
+    float error_rate = 0.0f;          // この割合で例外を投げる（ゲーム側の例外処理の確認用）
+    std::vector<MockReply> replies;   // 上から順に照合する
+    std::vector<std::string> outputs; // どの reply にも当たらなければ順に繰り返す（空なら役割の既定の出力）
+};
+
+struct MockMetrics {
+    uint64_t requests = 0;
+    uint64_t cancelled = 0;   // cancelPending() で打ち切った数
+    uint64_t errors = 0;      // error_rate で投げた例外の数
+    double busy_ms = 0.0;     // 生成していた時間の合計（待ちを含まない）
+};
+
+// 出力は日本語1文字・英数字4文字を1トークンとして区切り、遅延を挟みながら on_token 相当に流すので、
+// 判定フィールドが先に届く動き（on_decision）も実際の推論と同じ順で起きる。
+class MockBackend : public InferenceBackend {
+public:
+    MockBackend() = default;
+    ~MockBackend() override;  // 集計をログに出す
+
+    // data/mock_llm.txt の形式の台本を読み込む。失敗時はエラーを出力して false
+    bool loadScript(const std::string& path);
+    void setRole(const std::string& role, MockRoleScript script);
+    MockRoleScript roleScript(const std::string& role) const;  // 無ければ既定（遅延0・既定の出力）
+    // すべての遅延に掛ける（0 で待たない）
+    void setLatencyScale(double scale) { latencyScale = scale; }
+    // true（既定）なら実際の推論と同じく1度に1つだけ生成し、残りは順番を待つ
+    void setSerialized(bool serialized) { this->serialized = serialized; }
+
+    GmResponse generateGmResponse(const ConversationView& history, const GmDecisionCallback& on_decision = nullptr) override;
+    GmResponse generateGmDecision(const ConversationView& history, const GmDecisionCallback& on_decision = nullptr) override;
+    std::string generateNpcDialogue(const ConversationView& history, const std::string& scene_context) override;
+    BattleResponse generateBattleResponse(const std::string& player_stats, const std::string& enemy_stats, const std::string& player_action,
+                                          const std::string& enemy_info = "", const BattleDecisionCallback& on_decision = nullptr) override;
+    std::string generateBattleNarration(const std::string& player_action, const std::string& enemy_info, const std::string& outcome) override;
+
+    void cancelPending() override;
+    void setSeed(uint32_t seed) override;
+    void setRecorder(SessionRecorder* recorder) override { this->recorder = recorder; }
+    void printMetrics() const override;
+
+    MockMetrics metrics() const;
+
+private:
+    using TokenCallback = std::function<bool(std::string_view)>;
+
+    mutable std::mutex mutex;  // scripts・roleRequests・stats を保護
+    std::map<std::string, MockRoleScript> scripts;
+    std::map<std::string, uint32_t> roleRequests;
+    uint32_t baseSeed = 1234;
+    MockMetrics stats;
+
+    std::atomic<double> latencyScale{1.0};
+    std::atomic<bool> serialized{true};
+    std::mutex generateMutex;  // serialized のとき生成を直列化する
+
+    std::mutex cancelMutex;
+    std::condition_variable cancelSignal;
+    std::atomic<uint64_t> cancelEpoch{0};
+
+    SessionRecorder* recorder = nullptr;
+
+    // 台本から出力を選び、遅延を挟みながら流す。single_step なら最初のトークンの遅延だけで全体を返す（分類相当）
+    std::string generate(const std::string& role, const std::string& input, bool single_step, const TokenCallback& on_token);
+    // epoch 以降に cancelPending() が呼ばれたら true を返す（deadline まで待つ）
+    bool waitUntil(std::chrono::steady_clock::time_point deadline, uint64_t epoch);
+    static std::string lastPlayerText(const ConversationView& history);
+    static const std::string& defaultOutput(const std::string& role);
+};
+
+#endif
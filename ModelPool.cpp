@@ -0,0 +1,183 @@
+#include "ModelPool.h"
+#include "Log.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <system_error>
+#include <utility>
+
+ModelPool::ModelPool(size_t budgetBytes, ContextFactory makeContext)
+    : makeContext(std::move(makeContext)), budgetBytes(budgetBytes) {}
+
+ModelPool::~ModelPool() {
+    for (auto& pair : entries) {
+        Entry& entry = pair.second;
+        if (entry.ctx) llama_free(entry.ctx);
+        if (entry.model) llama_model_free(entry.model);
+        if (entry.vocabModel) llama_model_free(entry.vocabModel);
+    }
+}
+
+bool ModelPool::add(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (entries.count(path)) return true;
+
+    auto params = llama_model_default_params();
+    params.vocab_only = true;
+    llama_model* vocab_model = llama_model_load_from_file(path.c_str(), params);
+    if (!vocab_model) return false;
+
+    Entry& entry = entries[path];
+    entry.vocabModel = vocab_model;
+    std::error_code ec;
+    entry.fileBytes = static_cast<size_t>(std::filesystem::file_size(path, ec));
+    if (ec) entry.fileBytes = 0;
+    return true;
+}
+
+const llama_vocab* ModelPool::vocab(const std::string& path) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(path);
+    return it == entries.end() ? nullptr : llama_model_get_vocab(it->second.vocabModel);
+}
+
+const llama_model* ModelPool::info(const std::string& path) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(path);
+    return it == entries.end() ? nullptr : it->second.vocabModel;
+}
+
+bool ModelPool::acquire(const std::string& path, llama_model*& model, llama_context*& ctx) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(path);
+    if (it == entries.end()) return false;
+    Entry& entry = it->second;
+
+    if (entry.model) {
+        stats.hits++;
+    } else {
+        evictToFit(entry.fileBytes + entry.contextBytes, path);
+        if (!load(path, entry)) return false;
+    }
+    touch(entry);
+    model = entry.model;
+    ctx = entry.ctx;
+    return true;
+}
+
+bool ModelPool::resident(const std::string& path) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(path);
+    return it != entries.end() && it->second.model != nullptr;
+}
+
+void ModelPool::pin(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(path);
+    if (it != entries.end()) it->second.pins++;
+}
+
+void ModelPool::unpin(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(path);
+    if (it != entries.end() && it->second.pins > 0) it->second.pins--;
+}
+
+void ModelPool::setBudget(size_t newBudgetBytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    budgetBytes = newBudgetBytes;
+    evictToFit(0, "");
+}
+
+size_t ModelPool::budget() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return budgetBytes;
+}
+
+ModelPoolMetrics ModelPool::metrics() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    ModelPoolMetrics m = stats;
+    m.resident_models = lru.size();
+    return m;
+}
+
+void ModelPool::setEvictCallback(EvictCallback callback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    onEvict = std::move(callback);
+}
+
+bool ModelPool::load(const std::string& path, Entry& entry) {
+    PQ_TRACE_SCOPE("llm", "loadModel");
+    auto start_time = std::chrono::steady_clock::now();
+
+    auto mparams = llama_model_default_params();
+    mparams.use_mmap = false;  // 追い出したときに確実にメモリを返すため、ページキャッシュには頼らない
+    mparams.use_mlock = false;
+    llama_model* model = llama_model_load_from_file(path.c_str(), mparams);
+    if (!model) {
+        PQ_LOG_ERROR(LogCategory::LLM, "failed to load model: " << path);
+        return false;
+    }
+    size_t context_bytes = 0;
+    llama_context* ctx = makeContext(path, model, context_bytes);
+    if (!ctx) {
+        PQ_LOG_ERROR(LogCategory::LLM, "failed to create context for model: " << path);
+        llama_model_free(model);
+        return false;
+    }
+
+    entry.model = model;
+    entry.ctx = ctx;
+    entry.contextBytes = context_bytes;
+    entry.bytes = static_cast<size_t>(llama_model_size(model)) + entry.contextBytes;
+    lru.push_front(path);
+    entry.lruIt = lru.begin();
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+    stats.loads++;
+    stats.load_ms += ms;
+    stats.resident_bytes += entry.bytes;
+    stats.context_bytes += entry.contextBytes;
+    stats.peak_bytes = std::max(stats.peak_bytes, stats.resident_bytes);
+    PQ_LOG_INFO(LogCategory::LLM, "loaded model " << path << " (" << entry.bytes / (1024 * 1024) << " MB, " << static_cast<int>(ms)
+                << " ms, resident " << stats.resident_bytes / (1024 * 1024) << " MB)");
+    if (budgetBytes && stats.resident_bytes > budgetBytes) {
+        PQ_LOG_WARN(LogCategory::LLM, "model memory over budget: " << stats.resident_bytes / (1024 * 1024) << " MB / "
+                    << budgetBytes / (1024 * 1024) << " MB");
+    }
+    return true;
+}
+
+void ModelPool::unload(const std::string& path, Entry& entry) {
+    if (onEvict) onEvict(path, entry.ctx);
+    llama_free(entry.ctx);
+    llama_model_free(entry.model);
+    entry.ctx = nullptr;
+    entry.model = nullptr;
+    stats.resident_bytes -= entry.bytes;
+    stats.context_bytes -= entry.contextBytes;
+    stats.evictions++;
+    PQ_LOG_INFO(LogCategory::LLM, "evicted model " << path << " (" << entry.bytes / (1024 * 1024) << " MB, resident "
+                << stats.resident_bytes / (1024 * 1024) << " MB)");
+    entry.bytes = 0;
+}
+
+void ModelPool::touch(Entry& entry) {
+    if (entry.lruIt != lru.begin()) {
+        lru.splice(lru.begin(), lru, entry.lruIt);
+    }
+}
+
+void ModelPool::evictToFit(size_t incomingBytes, const std::string& keep) {
+    if (budgetBytes == 0) return;
+    auto it = lru.end();
+    while (stats.resident_bytes + incomingBytes > budgetBytes && it != lru.begin()) {
+        --it;
+        if (*it == keep) continue;
+        Entry& entry = entries.at(*it);
+        if (entry.pins > 0) continue;
+        unload(*it, entry);
+        it = lru.erase(it);
+    }
+}
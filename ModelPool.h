@@ -0,0 +1,92 @@
+// ModelPool.h - Prompt Quest: モデルの遅延読み込みとメモリ予算によるLRU追い出し
+
+#ifndef MODEL_POOL_H
+#define MODEL_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include "llama.h"
+
+struct ModelPoolMetrics {
+    uint64_t loads = 0;        // 重みの読み込み回数（追い出し後の読み直しを含む）
+    uint64_t evictions = 0;
+    uint64_t hits = 0;         // 読み込み済みのモデルをそのまま使えた回数
+    double load_ms = 0.0;      // 読み込み（コンテキスト作成込み）の合計時間
+    size_t resident_bytes = 0; // 常駐中のモデルとコンテキストの合計
+    size_t context_bytes = 0;  // そのうちコンテキスト（KV キャッシュ）の分
+    size_t peak_bytes = 0;
+    size_t resident_models = 0;
+};
+
+// GGUF のパスごとに、重み（llama_model）と生成用コンテキストを必要になった時点で読み込む。
+// 語彙だけは登録時に読んで常駐させ、トークン数の計算では重みを読まない。
+// 予算を超えそうなら、固定されていないモデルを最後に使った順が古いものから解放する。
+//
+// acquire() は他のモデルを解放することがあるので、呼び出し側は返したコンテキストを使い終わるまで
+// 次の acquire() を呼ばないよう直列化すること（LlmManager は推論の mutex の中で呼ぶ）。
+class ModelPool {
+public:
+    // 読み込んだモデルから生成用コンテキストを作る。失敗したら nullptr。
+    // context_bytes にはコンテキストが確保したメモリ（主に KV キャッシュ）を返す
+    using ContextFactory = std::function<llama_context*(const std::string& path, llama_model* model, size_t& context_bytes)>;
+
+    ModelPool(size_t budgetBytes, ContextFactory makeContext);
+    ~ModelPool();
+
+    ModelPool(const ModelPool&) = delete;
+    ModelPool& operator=(const ModelPool&) = delete;
+
+    // 語彙を読み込んで登録する（重みは読まない）。ファイルが無い・壊れていれば false
+    bool add(const std::string& path);
+    const llama_vocab* vocab(const std::string& path) const;
+    // 語彙と一緒に読んだハイパーパラメータ（層の数・幅）だけを持つモデル。KVの大きさの見積もり用
+    const llama_model* info(const std::string& path) const;
+
+    // 重みとコンテキストを返す。読み込まれていなければ読み込む。失敗したら false
+    bool acquire(const std::string& path, llama_model*& model, llama_context*& ctx);
+    bool resident(const std::string& path) const;
+
+    // 固定したモデルは追い出さない（他のスレッドから並行して使うコンテキストがある場合など）
+    void pin(const std::string& path);
+    void unpin(const std::string& path);
+
+    void setBudget(size_t budgetBytes);  // 0 は無制限
+    size_t budget() const;
+    ModelPoolMetrics metrics() const;
+
+    // 追い出す直前に呼ばれる（コンテキストに依存するキャッシュを捨てるため）
+    using EvictCallback = std::function<void(const std::string& path, llama_context* ctx)>;
+    void setEvictCallback(EvictCallback callback);
+
+private:
+    struct Entry {
+        llama_model* vocabModel = nullptr;  // vocab_only で読んだもの（常駐）
+        llama_model* model = nullptr;
+        llama_context* ctx = nullptr;
+        size_t fileBytes = 0;
+        size_t bytes = 0;           // 常駐中の重み＋コンテキスト
+        size_t contextBytes = 0;    // コンテキストの大きさ（読み込み前の見積もりにも使う）
+        int pins = 0;
+        std::list<std::string>::iterator lruIt;
+    };
+
+    mutable std::mutex mutex;
+    ContextFactory makeContext;
+    EvictCallback onEvict;
+    size_t budgetBytes;
+    std::map<std::string, Entry> entries;
+    std::list<std::string> lru;  // 常駐中のものだけ。先頭が最も新しく使われたもの
+    ModelPoolMetrics stats;
+
+    bool load(const std::string& path, Entry& entry);
+    void unload(const std::string& path, Entry& entry);
+    void touch(Entry& entry);
+    void evictToFit(size_t incomingBytes, const std::string& keep);
+};
+
+#endif
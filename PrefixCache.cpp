@@ -0,0 +1,187 @@
+#include "PrefixCache.h"
+#include <algorithm>
+
+PrefixCache::PrefixCache(llama_context* ctx, llama_seq_id seq_base, int max_leaves, int n_ctx)
+    : ctx(ctx), seqBase(seq_base), maxLeaves(max_leaves), nCtx(n_ctx) {
+    for (int i = max_leaves - 1; i >= 0; --i) freeSeqs.push_back(seq_base + i);
+}
+
+int PrefixCache::fork(Space space, const llama_token* tokens, int n, llama_seq_id dst_seq, int reserve) {
+    std::unique_ptr<Node>& root = roots[space];
+    if (!root) root = std::make_unique<Node>();
+
+    // 最後のトークンは logits を得るために計算し直す
+    Node* deepest = nullptr;
+    int matched = std::min(match(root.get(), tokens, n, deepest), n - 1);
+    const Node* keep = matched > 0 ? deepest : nullptr;
+
+    // 一致した部分は使い回すので、新しく要るのは残りの計算と生成の分だけ
+    while (totalTokens + static_cast<size_t>(n - matched + reserve) > static_cast<size_t>(nCtx)) {
+        if (evictOne(keep)) continue;
+        if (!keep) break;
+        keep = nullptr;  // 一致した枝を残すと入らないなら、それも捨てる
+        matched = 0;
+    }
+    // 一致した枝を捨て始めた場合も、残った部分は使う（木にあるものは必ず dst_seq と共有させる）
+    if (!keep) matched = std::min(match(root.get(), tokens, n, deepest), n - 1);
+    if (matched <= 0) return 0;
+
+    Node* leaf = anyLeaf(deepest);
+    llama_memory_seq_cp(llama_get_memory(ctx), leaf->seq, dst_seq, 0, matched);
+    touch(leaf);
+    return matched;
+}
+
+void PrefixCache::insert(Space space, const llama_token* tokens, int n, llama_seq_id src_seq) {
+    if (n <= 0 || maxLeaves <= 0) return;
+    std::unique_ptr<Node>& root = roots[space];
+    if (!root) root = std::make_unique<Node>();
+
+    Node* node = root.get();
+    int pos = 0;
+    while (pos < n) {
+        auto it = node->children.find(tokens[pos]);
+        if (it == node->children.end()) break;
+        Node* child = it->second.get();
+        size_t common = 0;
+        while (common < child->edge.size() && pos + static_cast<int>(common) < n && child->edge[common] == tokens[pos + common]) ++common;
+        if (common == child->edge.size()) {
+            node = child;
+            pos += static_cast<int>(common);
+            continue;
+        }
+        if (pos + static_cast<int>(common) == n) {
+            // 既にある枝の途中で終わっている（KVは持っている）
+            touch(anyLeaf(child));
+            return;
+        }
+        // 枝の途中で分かれるので、分かれ目に節を挟む
+        auto mid = std::make_unique<Node>();
+        mid->edge.assign(child->edge.begin(), child->edge.begin() + common);
+        mid->parent = node;
+        child->edge.erase(child->edge.begin(), child->edge.begin() + common);
+        child->parent = mid.get();
+        mid->children[child->edge[0]] = std::move(it->second);
+        Node* mid_ptr = mid.get();
+        it->second = std::move(mid);
+        node = mid_ptr;
+        pos += static_cast<int>(common);
+        break;
+    }
+    if (pos == n) {
+        // 同じプロンプトが既にある
+        if (node != root.get()) touch(anyLeaf(node));
+        return;
+    }
+
+    llama_memory_t mem = llama_get_memory(ctx);
+    llama_seq_id seq = -1;
+    if (node->seq >= 0) {
+        // 葉をそのまま延ばす場合は、その葉のシーケンスを新しい葉に引き継ぐ
+        seq = node->seq;
+        node->seq = -1;
+        llama_memory_seq_rm(mem, seq, -1, -1);
+    } else {
+        if (freeSeqs.empty() && !evictOne(node->parent ? node : nullptr)) return;
+        seq = freeSeqs.back();
+        freeSeqs.pop_back();
+    }
+
+    auto leaf = std::make_unique<Node>();
+    leaf->edge.assign(tokens + pos, tokens + n);
+    leaf->parent = node;
+    leaf->seq = seq;
+    Node* leaf_ptr = leaf.get();
+    node->children[tokens[pos]] = std::move(leaf);
+    totalTokens += static_cast<size_t>(n - pos);
+    llama_memory_seq_cp(mem, src_seq, seq, 0, n);
+    touch(leaf_ptr);
+}
+
+void PrefixCache::clear() {
+    llama_memory_t mem = llama_get_memory(ctx);
+    for (int i = 0; i < maxLeaves; ++i) llama_memory_seq_rm(mem, seqBase + i, -1, -1);
+    roots.clear();
+    freeSeqs.clear();
+    for (int i = maxLeaves - 1; i >= 0; --i) freeSeqs.push_back(seqBase + i);
+    totalTokens = 0;
+}
+
+int PrefixCache::match(Node* root, const llama_token* tokens, int n, Node*& deepest) const {
+    Node* node = root;
+    deepest = root;
+    int pos = 0;
+    while (pos < n) {
+        auto it = node->children.find(tokens[pos]);
+        if (it == node->children.end()) break;
+        Node* child = it->second.get();
+        size_t common = 0;
+        while (common < child->edge.size() && pos + static_cast<int>(common) < n && child->edge[common] == tokens[pos + common]) ++common;
+        pos += static_cast<int>(common);
+        deepest = child;
+        if (common < child->edge.size()) break;
+        node = child;
+    }
+    return pos;
+}
+
+PrefixCache::Node* PrefixCache::anyLeaf(Node* node) {
+    while (!node->children.empty()) node = node->children.begin()->second.get();
+    return node;
+}
+
+bool PrefixCache::contains(const Node* ancestor, const Node* node) {
+    for (; node; node = node->parent) {
+        if (node == ancestor) return true;
+    }
+    return false;
+}
+
+void PrefixCache::touch(Node* leaf) {
+    leaf->lastUsed = ++tick;
+}
+
+void PrefixCache::removeLeaf(Node* leaf) {
+    llama_memory_seq_rm(llama_get_memory(ctx), leaf->seq, -1, -1);
+    freeSeqs.push_back(leaf->seq);
+    totalTokens -= leaf->edge.size();
+
+    // 葉が無くなった節は、どのシーケンスもKVを持たないので一緒に外す
+    Node* parent = leaf->parent;
+    llama_token key = leaf->edge[0];
+    parent->children.erase(key);
+    while (parent->parent && parent->children.empty()) {
+        totalTokens -= parent->edge.size();
+        Node* grand = parent->parent;
+        key = parent->edge[0];
+        grand->children.erase(key);
+        parent = grand;
+    }
+
+    // 子が1つだけになった節は子と繋げる（子の側を残すので、子孫へのポインタは無効にならない）
+    if (parent->parent && parent->children.size() == 1) {
+        std::unique_ptr<Node> child = std::move(parent->children.begin()->second);
+        child->edge.insert(child->edge.begin(), parent->edge.begin(), parent->edge.end());
+        Node* grand = parent->parent;
+        child->parent = grand;
+        key = child->edge[0];
+        grand->children[key] = std::move(child);  // parent はここで解放される
+    }
+}
+
+bool PrefixCache::evictOne(const Node* keep) {
+    Node* oldest = nullptr;
+    std::vector<Node*> stack;
+    for (auto& pair : roots) stack.push_back(pair.second.get());
+    while (!stack.empty()) {
+        Node* node = stack.back();
+        stack.pop_back();
+        for (auto& pair : node->children) stack.push_back(pair.second.get());
+        if (node->seq < 0 || (keep && contains(keep, node))) continue;
+        if (!oldest || node->lastUsed < oldest->lastUsed) oldest = node;
+    }
+    if (!oldest) return false;
+    removeLeaf(oldest);
+    evictionCount++;
+    return true;
+}
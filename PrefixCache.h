@@ -0,0 +1,81 @@
+// PrefixCache.h - Prompt Quest: プロンプトの共通部分のKVを使い回すための基数木
+
+#ifndef PREFIX_CACHE_H
+#define PREFIX_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "llama.h"
+
+struct PrefixCacheMetrics {
+    uint64_t lookups = 0;
+    uint64_t hits = 0;              // 1トークン以上を使い回せた回数
+    uint64_t reused_tokens = 0;     // KVをコピーで済ませたトークン数
+    uint64_t prefilled_tokens = 0;  // 実際に計算したトークン数
+    uint64_t evictions = 0;         // 追い出した葉の数
+};
+
+// 1つのコンテキストに残したプロンプトを、トークン列の基数木として管理する。
+// 例えば NPC のプロンプトなら、世界設定が根に近い枝、人物ごとの設定がその下の枝、会話ごとの続きが葉になる。
+//
+// KV は葉ごとに1つのシーケンス（CACHE_SEQ_BASE 以降の番号）として持つ。内側の節の部分は、その下のどの葉の
+// シーケンスにも含まれている（unified KV ではシーケンス間のコピーはセルの共有なので、共通部分の
+// メモリは1つ分で済む）。新しいリクエストは最も深く一致した位置までのKVを作業用のシーケンスにコピーし、
+// 残りだけを計算する。
+//
+// 木のトークン数の合計が KV セルの使用量になるので、足りなければ最後に使ったのが古い葉から捨てる。
+class PrefixCache {
+public:
+    // アダプターが違えば同じトークン列でもKVが違うので、木を分ける
+    using Space = std::pair<const void*, float>;
+
+    // seq_base 以降の max_leaves 個のシーケンスを葉に使う。n_ctx はコンテキストのセル数
+    PrefixCache(llama_context* ctx, llama_seq_id seq_base, int max_leaves, int n_ctx);
+
+    PrefixCache(const PrefixCache&) = delete;
+    PrefixCache& operator=(const PrefixCache&) = delete;
+
+    // tokens[0, n) を計算する前に呼ぶ。一致した長さ（最大 n - 1）までのKVを dst_seq にコピーして返す。
+    // あわせて、残りの計算と reserve トークンの生成に足りるセルを空ける
+    int fork(Space space, const llama_token* tokens, int n, llama_seq_id dst_seq, int reserve);
+    // src_seq に tokens[0, n) のKVが揃った時点で呼ぶ。葉として残す
+    void insert(Space space, const llama_token* tokens, int n, llama_seq_id src_seq);
+    // 木を空にしてシーケンスを解放する（計算に失敗したときなど）
+    void clear();
+
+    size_t cachedTokens() const { return totalTokens; }
+    uint64_t evictions() const { return evictionCount; }
+
+private:
+    struct Node {
+        std::vector<llama_token> edge;  // 親からこの節までのトークン
+        std::map<llama_token, std::unique_ptr<Node>> children;
+        Node* parent = nullptr;
+        llama_seq_id seq = -1;          // 葉だけが持つ
+        uint64_t lastUsed = 0;
+    };
+
+    llama_context* ctx;
+    llama_seq_id seqBase;
+    int maxLeaves;
+    int nCtx;
+    std::vector<llama_seq_id> freeSeqs;
+    std::map<Space, std::unique_ptr<Node>> roots;
+    size_t totalTokens = 0;
+    uint64_t tick = 0;
+    uint64_t evictionCount = 0;
+
+    // 一致した長さと、一致が終わった節（その下の葉はどれも一致部分のKVを持つ）
+    int match(Node* root, const llama_token* tokens, int n, Node*& deepest) const;
+    static Node* anyLeaf(Node* node);
+    static bool contains(const Node* ancestor, const Node* node);
+    void touch(Node* leaf);
+    void removeLeaf(Node* leaf);
+    bool evictOne(const Node* keep);  // keep の下の葉は残す。捨てられる葉がなければ false
+};
+
+#endif
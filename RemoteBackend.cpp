@@ -0,0 +1,351 @@
+#include "RemoteBackend.h"
+#include "Log.h"
+#include <chrono>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+const int SEND_TIMEOUT_MS = 1000;    // 要求のリングが空くまで待つ時間
+const int RECEIVE_POLL_MS = 100;     // 応答が無いときにワーカーの生存を確かめる間隔
+const int HANDSHAKE_TIMEOUT_MS = 5000;  // 役割の設定を確かめてもらうのを待つ時間
+}
+
+RemoteBackend::~RemoteBackend() {
+    failAll("", true);
+    std::lock_guard<std::mutex> lock(sendMutex);
+    disconnectLocked();
+}
+
+bool RemoteBackend::connect(const std::string& name, const std::map<std::string, std::string>& role_configs) {
+    std::lock_guard<std::mutex> lock(sendMutex);
+    disconnectLocked();
+    workerName = name;
+    roleConfigs = role_configs;
+    if (!connectLocked()) {
+        PQ_LOG_WARN(LogCategory::LLM, "inference worker '" << name << "' is not available");
+        return false;
+    }
+    PQ_LOG_INFO(LogCategory::LLM, "connected to inference worker '" << name << "' (slot " << slotIndex << ")");
+    return true;
+}
+
+bool RemoteBackend::connectLocked() {
+    if (!shm.open(workerName)) return false;
+    ipc::SharedRegion* region = shm.region();
+    if (!ipc::processAlive(region->workerPid.load(std::memory_order_relaxed))) {
+        shm.close();  // 異常終了したワーカーの残り
+        return false;
+    }
+
+    for (size_t i = 0; i < ipc::MAX_CLIENTS; ++i) {
+        ipc::ClientSlot& slot = region->slots[i];
+        uint32_t expected = static_cast<uint32_t>(ipc::SlotState::FREE);
+        if (!slot.state.compare_exchange_strong(expected, static_cast<uint32_t>(ipc::SlotState::CLAIMING))) continue;
+        // ここで終了しても、ワーカーが pid の無い・終了したプロセスの CLAIMING の枠を空ける
+        slot.pid.store(ipc::currentPid(), std::memory_order_release);
+
+        // ワーカーは CONNECTED になるまでこの枠に触れないので、ここでリングを初期化してよい
+        ipc::Ring(slot.requests, slot.requestData).reset();
+        ipc::Ring(slot.responses, slot.responseData).reset();
+        slot.state.store(static_cast<uint32_t>(ipc::SlotState::CONNECTED), std::memory_order_release);
+
+        slotIndex = i;
+        connected = true;
+        lost = false;
+        receiving = true;
+        receiver = std::thread(&RemoteBackend::receiveLoop, this);
+        if (!handshakeLocked()) {
+            disconnectLocked();
+            return false;
+        }
+
+        // 新しいワーカーかもしれないので、設定と記憶の元を送り直す（ワーカー側で重複は捨てる）
+        writeLocked(ipc::MessageWriter(ipc::MessageType::SET_SEED, 0).u32(seed));
+        for (const auto& text : lore) writeLocked(ipc::MessageWriter(ipc::MessageType::ADD_LORE, 0).str(text));
+        if (idleState >= 0) writeLocked(ipc::MessageWriter(ipc::MessageType::THREADS_IDLE, 0).u8(static_cast<uint8_t>(idleState)));
+        return true;
+    }
+
+    PQ_LOG_WARN(LogCategory::LLM, "inference worker '" << workerName << "' has no free client slot");
+    shm.close();
+    return false;
+}
+
+bool RemoteBackend::handshakeLocked() {
+    const uint64_t id = nextId++;
+    auto request = std::make_shared<Pending>();
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pending[id] = request;
+    }
+    ipc::MessageWriter message(ipc::MessageType::ROLE_CONFIGS, id);
+    message.u32(static_cast<uint32_t>(roleConfigs.size()));
+    for (const auto& pair : roleConfigs) message.str(pair.first).str(pair.second);
+
+    std::string error = "no answer";
+    if (writeLocked(message)) {
+        std::unique_lock<std::mutex> lock(request->mutex);
+        if (request->done.wait_for(lock, std::chrono::milliseconds(HANDSHAKE_TIMEOUT_MS), [&]() { return request->finished; })) {
+            error = request->cancelled ? "cancelled" : request->error;
+        }
+    }
+    findPending(id, true);
+    if (!error.empty()) {
+        PQ_LOG_WARN(LogCategory::LLM, "inference worker '" << workerName << "' refused the connection: " << error);
+        return false;
+    }
+    return true;
+}
+
+void RemoteBackend::disconnectLocked() {
+    receiving = false;
+    if (receiver.joinable()) receiver.join();
+    if (connected) {
+        ipc::SharedRegion* region = shm.region();
+        region->slots[slotIndex].state.store(static_cast<uint32_t>(ipc::SlotState::CLOSED), std::memory_order_release);
+        region->doorbell.fetch_add(1, std::memory_order_release);
+        ipc::wake(region->doorbell);
+        connected = false;
+    }
+    shm.close();
+}
+
+bool RemoteBackend::writeLocked(const ipc::MessageWriter& message) {
+    ipc::SharedRegion* region = shm.region();
+    ipc::ClientSlot& slot = region->slots[slotIndex];
+    if (!ipc::Ring(slot.requests, slot.requestData).write(message.data(), SEND_TIMEOUT_MS)) {
+        PQ_LOG_WARN(LogCategory::LLM, "inference worker did not accept a request (" << message.data().size() << " bytes)");
+        return false;
+    }
+    region->doorbell.fetch_add(1, std::memory_order_release);
+    ipc::wake(region->doorbell);
+    return true;
+}
+
+bool RemoteBackend::send(const ipc::MessageWriter& message, bool reconnect) {
+    std::lock_guard<std::mutex> lock(sendMutex);
+    if (!connected || lost) {
+        if (!reconnect || workerName.empty()) return false;
+        disconnectLocked();
+        if (!connectLocked()) return false;
+        reconnects++;
+        PQ_LOG_INFO(LogCategory::LLM, "reconnected to inference worker '" << workerName << "'");
+    }
+    return writeLocked(message);
+}
+
+bool RemoteBackend::call(uint64_t id, const ipc::MessageWriter& message, std::string& result,
+                         GmDecisionCallback on_gm, BattleDecisionCallback on_battle) {
+    requests++;
+    auto request = std::make_shared<Pending>();
+    request->onGm = std::move(on_gm);
+    request->onBattle = std::move(on_battle);
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pending[id] = request;
+    }
+    if (!send(message, true)) {
+        findPending(id, true);
+        failures++;
+        throw std::runtime_error("inference worker is not available");
+    }
+
+    std::unique_lock<std::mutex> lock(request->mutex);
+    request->done.wait(lock, [&]() { return request->finished; });
+    if (!request->error.empty()) {
+        failures++;
+        throw std::runtime_error(request->error);
+    }
+    if (request->cancelled) return false;
+    result = std::move(request->result);
+    return true;
+}
+
+std::shared_ptr<RemoteBackend::Pending> RemoteBackend::findPending(uint64_t id, bool remove) {
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    auto it = pending.find(id);
+    if (it == pending.end()) return nullptr;  // 取り消し済み
+    auto request = it->second;
+    if (remove) pending.erase(it);
+    return request;
+}
+
+void RemoteBackend::failAll(const std::string& error, bool cancelled) {
+    std::map<uint64_t, std::shared_ptr<Pending>> waiting;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        waiting.swap(pending);
+    }
+    for (auto& pair : waiting) {
+        Pending& request = *pair.second;
+        std::lock_guard<std::mutex> lock(request.mutex);
+        request.finished = true;
+        request.cancelled = cancelled;
+        request.error = error;
+        request.done.notify_all();
+    }
+}
+
+void RemoteBackend::receiveLoop() {
+    ipc::SharedRegion* region = shm.region();
+    ipc::ClientSlot& slot = region->slots[slotIndex];
+    const uint32_t generation = slot.generation.load(std::memory_order_acquire);
+    ipc::Ring responses(slot.responses, slot.responseData);
+    std::string message;
+
+    while (receiving) {
+        if (!responses.read(message, RECEIVE_POLL_MS)) {
+            // 落ちた・止めた・枠を空けられた（こちらが止まっていると見なされた）ときは、待っている要求を失敗させる
+            bool alive = region->magic.load(std::memory_order_acquire) == ipc::MAGIC &&
+                         ipc::processAlive(region->workerPid.load(std::memory_order_relaxed)) &&
+                         slot.generation.load(std::memory_order_acquire) == generation;
+            if (!alive) {
+                PQ_LOG_WARN(LogCategory::LLM, "inference worker '" << workerName << "' went away");
+                lost = true;
+                failAll("inference worker exited", false);
+                return;
+            }
+            continue;
+        }
+
+        ipc::MessageReader in(message);
+        if (!in.ok()) continue;
+        switch (in.type()) {
+            case ipc::MessageType::GM_DECISION_READY: {
+                auto request = findPending(in.id(), false);
+                if (request && request->onGm) request->onGm(ipc::readGm(in));
+                break;
+            }
+            case ipc::MessageType::BATTLE_DECISION_READY: {
+                auto request = findPending(in.id(), false);
+                if (request && request->onBattle) request->onBattle(ipc::readBattle(in));
+                break;
+            }
+            case ipc::MessageType::GM_RESULT:
+            case ipc::MessageType::BATTLE_RESULT:
+            case ipc::MessageType::TEXT_RESULT:
+            case ipc::MessageType::ERROR_RESULT: {
+                auto request = findPending(in.id(), true);
+                if (!request) break;
+                std::lock_guard<std::mutex> lock(request->mutex);
+                if (in.type() == ipc::MessageType::ERROR_RESULT) {
+                    request->error = in.str();
+                    if (request->error.empty()) request->error = "inference worker failed";
+                } else {
+                    request->result = std::move(message);
+                }
+                request->finished = true;
+                request->done.notify_all();
+                break;
+            }
+            default:
+                PQ_LOG_WARN(LogCategory::LLM, "unexpected message from inference worker: " << static_cast<int>(in.type()));
+                break;
+        }
+    }
+}
+
+GmResponse RemoteBackend::generateGmResponse(const ConversationView& history, const GmDecisionCallback& on_decision) {
+    uint64_t id = nextId++;
+    ipc::MessageWriter message(ipc::MessageType::GM_RESPONSE, id);
+    ipc::writeHistory(message, history);
+    std::string result;
+    if (!call(id, message, result, on_decision)) return GmResponse();
+    ipc::MessageReader in(result);
+    return ipc::readGm(in);
+}
+
+GmResponse RemoteBackend::generateGmDecision(const ConversationView& history, const GmDecisionCallback& on_decision) {
+    uint64_t id = nextId++;
+    ipc::MessageWriter message(ipc::MessageType::GM_DECISION, id);
+    ipc::writeHistory(message, history);
+    std::string result;
+    if (!call(id, message, result, on_decision)) return GmResponse();
+    ipc::MessageReader in(result);
+    return ipc::readGm(in);
+}
+
+std::string RemoteBackend::generateNpcDialogue(const ConversationView& history, const std::string& scene_context) {
+    uint64_t id = nextId++;
+    ipc::MessageWriter message(ipc::MessageType::NPC_DIALOGUE, id);
+    ipc::writeHistory(message, history);
+    message.str(scene_context);
+    std::string result;
+    if (!call(id, message, result)) return "";
+    ipc::MessageReader in(result);
+    return in.str();
+}
+
+BattleResponse RemoteBackend::generateBattleResponse(const std::string& player_stats, const std::string& enemy_stats, const std::string& player_action,
+                                                     const std::string& enemy_info, const BattleDecisionCallback& on_decision) {
+    uint64_t id = nextId++;
+    ipc::MessageWriter message(ipc::MessageType::BATTLE_RESPONSE, id);
+    message.str(player_stats).str(enemy_stats).str(player_action).str(enemy_info);
+    std::string result;
+    if (!call(id, message, result, nullptr, on_decision)) return BattleResponse();
+    ipc::MessageReader in(result);
+    return ipc::readBattle(in);
+}
+
+std::string RemoteBackend::generateBattleNarration(const std::string& player_action, const std::string& enemy_info, const std::string& outcome) {
+    uint64_t id = nextId++;
+    ipc::MessageWriter message(ipc::MessageType::BATTLE_NARRATION, id);
+    message.str(player_action).str(enemy_info).str(outcome);
+    std::string result;
+    if (!call(id, message, result)) return "";
+    ipc::MessageReader in(result);
+    return in.str();
+}
+
+void RemoteBackend::cancelPending() {
+    failAll("", true);
+    send(ipc::MessageWriter(ipc::MessageType::CANCEL, 0), false);
+}
+
+void RemoteBackend::setSeed(uint32_t seed) {
+    {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        this->seed = seed;
+    }
+    send(ipc::MessageWriter(ipc::MessageType::SET_SEED, 0).u32(seed), false);
+}
+
+void RemoteBackend::prefetch(const std::string& role) {
+    send(ipc::MessageWriter(ipc::MessageType::PREFETCH, 0).str(role), false);
+}
+
+void RemoteBackend::setThreadsIdle(bool idle) {
+    // 毎フレーム呼ばれるので、変わったときだけ送る
+    {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        if (idleState == (idle ? 1 : 0)) return;
+        idleState = idle ? 1 : 0;
+    }
+    send(ipc::MessageWriter(ipc::MessageType::THREADS_IDLE, 0).u8(idle ? 1 : 0), false);
+}
+
+void RemoteBackend::addLore(const std::string& text) {
+    {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        lore.push_back(text);
+    }
+    send(ipc::MessageWriter(ipc::MessageType::ADD_LORE, 0).str(text), false);
+}
+
+void RemoteBackend::rememberTurn(const ChatTurn& turn) {
+    send(ipc::MessageWriter(ipc::MessageType::REMEMBER_TURN, 0).u8(static_cast<uint8_t>(turn.role)).u64(turn.serial).str(turn.text), false);
+}
+
+void RemoteBackend::rememberEvent(const std::string& text) {
+    send(ipc::MessageWriter(ipc::MessageType::REMEMBER_EVENT, 0).str(text), false);
+}
+
+void RemoteBackend::forgetEpisodes() {
+    send(ipc::MessageWriter(ipc::MessageType::FORGET_EPISODES, 0), false);
+}
+
+void RemoteBackend::printMetrics() const {
+    if (requests == 0) return;
+    PQ_LOG_INFO(LogCategory::LLM, "inference worker: requests=" << requests.load() << " failures=" << failures.load()
+                << " reconnects=" << reconnects.load());
+}
@@ -0,0 +1,103 @@
+// RemoteBackend.h - Prompt Quest: 別プロセスの推論ワーカー（tools/inference_worker）に推論を頼む窓口
+//
+// ワーカーはモデルと KV キャッシュを持ったまま動き続けるので、ゲームを起動し直してもモデルの読み込みを待たない。
+// 同じワーカーに複数のゲームをつないでもよい（最大 ipc::MAX_CLIENTS）。ワーカーが落ちたら待っている要求は
+// 例外で失敗し（ゲームは代わりの台詞を出す）、次の要求のときにつなぎ直す。
+// つなぐときに役割ごとの設定（LlmRoleConfig::summary()）を送り、ワーカーの設定と違えば断られる。
+
+#ifndef REMOTE_BACKEND_H
+#define REMOTE_BACKEND_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "InferenceBackend.h"
+#include "InferenceIpc.h"
+
+class RemoteBackend : public InferenceBackend {
+public:
+    RemoteBackend() = default;
+    ~RemoteBackend() override;
+
+    // name のワーカーにつなぐ。role_configs は役割 → LlmRoleConfig::summary()。
+    // ワーカーが動いていない・空き枠が無い・設定が違うときはエラーを出力して false
+    bool connect(const std::string& name, const std::map<std::string, std::string>& role_configs);
+
+    // on_decision はワーカーから途中結果が届いた時点で受信スレッドから呼ぶ（戻り値で生成は止められない）
+    GmResponse generateGmResponse(const ConversationView& history, const GmDecisionCallback& on_decision = nullptr) override;
+    GmResponse generateGmDecision(const ConversationView& history, const GmDecisionCallback& on_decision = nullptr) override;
+    std::string generateNpcDialogue(const ConversationView& history, const std::string& scene_context) override;
+    BattleResponse generateBattleResponse(const std::string& player_stats, const std::string& enemy_stats, const std::string& player_action,
+                                          const std::string& enemy_info = "", const BattleDecisionCallback& on_decision = nullptr) override;
+    std::string generateBattleNarration(const std::string& player_action, const std::string& enemy_info, const std::string& outcome) override;
+
+    // 待っている呼び出しはすぐに空の結果を返す。ワーカーの生成は、つないでいるのが自分だけのときに打ち切られる
+    void cancelPending() override;
+    // シード・記憶はワーカーの LlmManager に入る。他のゲームもつないでいる間は、混ざらないようワーカーが捨てる
+    void setSeed(uint32_t seed) override;
+    void prefetch(const std::string& role) override;
+    void setThreadsIdle(bool idle) override;
+    void addLore(const std::string& text) override;
+    void rememberTurn(const ChatTurn& turn) override;
+    void rememberEvent(const std::string& text) override;
+    void forgetEpisodes() override;
+    void printMetrics() const override;
+
+private:
+    // 返事を待っている要求
+    struct Pending {
+        std::mutex mutex;
+        std::condition_variable done;
+        bool finished = false;
+        bool cancelled = false;
+        std::string error;    // 空でなければ失敗
+        std::string result;   // 結果のメッセージ全体
+        GmDecisionCallback onGm;
+        BattleDecisionCallback onBattle;
+    };
+
+    std::string workerName;
+    std::map<std::string, std::string> roleConfigs;  // 役割 → LlmRoleConfig::summary()
+    ipc::SharedMemory shm;
+    size_t slotIndex = 0;
+    std::mutex sendMutex;        // 要求のリングへの書き込みと接続・切断を直列化する
+    bool connected = false;      // sendMutex で保護
+    std::thread receiver;
+    std::atomic<bool> receiving{false};
+    std::atomic<bool> lost{false};  // 受信スレッドがワーカーの終了に気づいた
+
+    std::mutex pendingMutex;
+    std::map<uint64_t, std::shared_ptr<Pending>> pending;
+    std::atomic<uint64_t> nextId{1};
+
+    // つなぎ直したときに送り直す設定（sendMutex で保護）
+    uint32_t seed = 1234;
+    std::vector<std::string> lore;
+    int idleState = -1;  // 最後に送った setThreadsIdle（-1: 未送信）
+
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> failures{0};
+    std::atomic<uint64_t> reconnects{0};
+
+    bool connectLocked();
+    // 役割の設定を送り、ワーカーが受け入れたら true
+    bool handshakeLocked();
+    void disconnectLocked();
+    bool writeLocked(const ipc::MessageWriter& message);
+    // 送れなかった（つながらない・時間切れ）ときは false。reconnect なら切れていればつなぎ直す
+    bool send(const ipc::MessageWriter& message, bool reconnect);
+    // 要求を送って結果のメッセージを result に受け取る。取り消されたら false、失敗したら例外
+    bool call(uint64_t id, const ipc::MessageWriter& message, std::string& result,
+              GmDecisionCallback on_gm = nullptr, BattleDecisionCallback on_battle = nullptr);
+    void receiveLoop();
+    std::shared_ptr<Pending> findPending(uint64_t id, bool remove);
+    void failAll(const std::string& error, bool cancelled);
+};
+
+#endif
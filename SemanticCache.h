@@ -0,0 +1,131 @@
+// SemanticCache.h - Prompt Quest: 意味の近い入力に過去の応答を再利用するキャッシュ
+
+#ifndef SEMANTIC_CACHE_H
+#define SEMANTIC_CACHE_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include "VectorIndex.h"
+
+// 状態バケット（役割・敵・ステータス等を連結した文字列）ごとにベクトル索引を持つ。
+// 状態は完全一致、プレイヤーの入力は埋め込みの類似度で照合する。
+template <typename T>
+class SemanticCache {
+public:
+    SemanticCache(float threshold, size_t capacity_per_bucket = 256)
+        : similarityThreshold(threshold), capacity(capacity_per_bucket) {}
+
+    bool lookup(const std::string& bucket, const std::vector<float>& embedding, T& out, float* score = nullptr) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = buckets.find(bucket);
+        if (it == buckets.end() || it->second.index.dims() != static_cast<int>(embedding.size())) return false;
+
+        float best = 0.0f;
+        long index = it->second.index.search(embedding.data(), &best);
+        if (score) *score = best;
+        if (index < 0 || best < similarityThreshold) return false;
+        out = it->second.values[index];
+        return true;
+    }
+
+    void insert(const std::string& bucket, const std::vector<float>& embedding, const T& value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Bucket& b = buckets[bucket];
+        if (b.index.dims() != static_cast<int>(embedding.size())) {
+            b.index.reset(static_cast<int>(embedding.size()));
+            b.values.clear();
+            b.next = 0;
+        }
+        if (b.values.size() < capacity) {
+            b.index.add(embedding.data());
+            b.values.push_back(value);
+        } else {
+            // 満杯なら古いものから上書き
+            b.index.set(b.next, embedding.data());
+            b.values[b.next] = value;
+            b.next = (b.next + 1) % capacity;
+        }
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t total = 0;
+        for (const auto& pair : buckets) total += pair.second.values.size();
+        return total;
+    }
+
+    // 埋め込み前の入力の正規化（前後の空白と文末の句読点を落とす）
+    static std::string normalizeInput(const std::string& text) {
+        static const char* const trims[] = {" ", "\t", "\r", "\n", "　", "。", "！", "？", "!", "?", "、", "."};
+        std::string s = text;
+        bool changed = true;
+        while (changed && !s.empty()) {
+            changed = false;
+            for (const char* t : trims) {
+                std::string token(t);
+                if (s.size() >= token.size() && s.compare(0, token.size(), token) == 0) { s.erase(0, token.size()); changed = true; }
+                if (s.size() >= token.size() && s.compare(s.size() - token.size(), token.size(), token) == 0) { s.erase(s.size() - token.size()); changed = true; }
+            }
+        }
+        return s;
+    }
+
+    // 入力がそれぞれのグループの語を含むかを '0'/'1' で並べる（英字は小文字にして照合）。
+    // 状態バケットに足すと、否定の有無のように埋め込みでは近くても判定が逆になる入力どうしは再利用しない。
+    // 英字で始まる・終わる語は単語の境界でだけ一致させ（"not" は "nothing" に含まれない）、末尾が '$' の語は
+    // 文末（後ろの空白と「。！!」を除いた最後）にあるときだけ一致させる
+    static std::string keywordSignature(const std::string& text, const std::vector<std::vector<std::string>>& groups) {
+        std::string lower = text;
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](char c) { return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c; });
+        std::string sentence = lower;
+        static const char* const trailing[] = {" ", "\t", "\r", "\n", "　", "。", "！", "!"};
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (const char* t : trailing) {
+                std::string token(t);
+                if (sentence.size() >= token.size() && sentence.compare(sentence.size() - token.size(), token.size(), token) == 0) {
+                    sentence.erase(sentence.size() - token.size());
+                    changed = true;
+                }
+            }
+        }
+        auto isWordChar = [](char c) { return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '\''; };
+        auto contains = [&](const std::string& keyword) {
+            if (!keyword.empty() && keyword.back() == '$') {
+                const size_t n = keyword.size() - 1;
+                return sentence.size() >= n && sentence.compare(sentence.size() - n, n, keyword, 0, n) == 0;
+            }
+            const bool word_start = isWordChar(keyword.front());
+            const bool word_end = isWordChar(keyword.back());
+            for (size_t pos = lower.find(keyword); pos != std::string::npos; pos = lower.find(keyword, pos + 1)) {
+                const size_t end = pos + keyword.size();
+                if (word_start && pos > 0 && isWordChar(lower[pos - 1])) continue;
+                if (word_end && end < lower.size() && isWordChar(lower[end])) continue;
+                return true;
+            }
+            return false;
+        };
+        std::string signature;
+        for (const auto& group : groups) {
+            signature += std::any_of(group.begin(), group.end(), contains) ? '1' : '0';
+        }
+        return signature;
+    }
+
+private:
+    struct Bucket {
+        VectorIndex index;
+        std::vector<T> values;
+        size_t next = 0;
+    };
+
+    std::unordered_map<std::string, Bucket> buckets;
+    float similarityThreshold;
+    size_t capacity;
+    mutable std::mutex mutex;
+};
+
+#endif
@@ -0,0 +1,262 @@
+#include "SessionRecorder.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+
+const char* SESSION_MAGIC = "PQSESSION";
+const int SESSION_VERSION = 1;
+
+std::string escape(const std::string& text) {
+    std::string out;
+    out.reserve(text.size());
+    for (char c : text) {
+        switch (c) {
+            case '\\': out += "\\\\"; break;
+            case '\t': out += "\\t"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            default: out += c; break;
+        }
+    }
+    return out;
+}
+
+std::string unescape(const std::string& text) {
+    std::string out;
+    out.reserve(text.size());
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] != '\\' || i + 1 == text.size()) {
+            out += text[i];
+            continue;
+        }
+        char c = text[++i];
+        out += c == 't' ? '\t' : c == 'n' ? '\n' : c == 'r' ? '\r' : c;
+    }
+    return out;
+}
+
+std::vector<std::string> splitFields(const std::string& line) {
+    std::vector<std::string> fields;
+    size_t begin = 0;
+    while (true) {
+        size_t tab = line.find('\t', begin);
+        fields.push_back(line.substr(begin, tab == std::string::npos ? std::string::npos : tab - begin));
+        if (tab == std::string::npos) break;
+        begin = tab + 1;
+    }
+    return fields;
+}
+
+bool parseInputKind(const std::string& name, SessionInputKind& out) {
+    for (SessionInputKind kind : {SessionInputKind::START, SessionInputKind::TEXT, SessionInputKind::DEPART, SessionInputKind::EQUIP}) {
+        if (name == sessionInputKindName(kind)) {
+            out = kind;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parseExchangeKind(const std::string& name, LlmExchangeKind& out) {
+    for (LlmExchangeKind kind : {LlmExchangeKind::GENERATE, LlmExchangeKind::CLASSIFY, LlmExchangeKind::CACHE_HIT}) {
+        if (name == llmExchangeKindName(kind)) {
+            out = kind;
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+const char* sessionInputKindName(SessionInputKind kind) {
+    switch (kind) {
+        case SessionInputKind::START: return "START";
+        case SessionInputKind::TEXT: return "TEXT";
+        case SessionInputKind::DEPART: return "DEPART";
+        case SessionInputKind::EQUIP: return "EQUIP";
+    }
+    return "?";
+}
+
+const char* llmExchangeKindName(LlmExchangeKind kind) {
+    switch (kind) {
+        case LlmExchangeKind::GENERATE: return "GENERATE";
+        case LlmExchangeKind::CLASSIFY: return "CLASSIFY";
+        case LlmExchangeKind::CACHE_HIT: return "CACHE_HIT";
+    }
+    return "?";
+}
+
+// ---- 書き出し ----
+
+bool SessionRecorder::open(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    out.open(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "Failed to open session file for writing: " << path << std::endl;
+        return false;
+    }
+    start = std::chrono::steady_clock::now();
+    lastPrompt.clear();
+    out << SESSION_MAGIC << '\t' << SESSION_VERSION << '\n';
+    out.flush();
+    return true;
+}
+
+uint32_t SessionRecorder::elapsedMs() const {
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+void SessionRecorder::setting(const std::string& key, const std::string& value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!out.is_open()) return;
+    out << "S\t" << escape(key) << '\t' << escape(value) << '\n';
+    out.flush();
+}
+
+void SessionRecorder::input(const std::string& state, const SessionInput& input) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!out.is_open()) return;
+    out << "I\t" << elapsedMs() << '\t' << state << '\t' << sessionInputKindName(input.kind) << '\t' << input.item << '\t'
+        << escape(input.text) << '\n';
+    out.flush();
+}
+
+void SessionRecorder::exchange(const LlmExchange& exchange) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!out.is_open()) return;
+    std::string& previous = lastPrompt[exchange.role];
+    size_t common = 0;
+    size_t limit = std::min(previous.size(), exchange.prompt.size());
+    while (common < limit && previous[common] == exchange.prompt[common]) ++common;
+
+    out << "L\t" << elapsedMs() << '\t' << llmExchangeKindName(exchange.kind) << '\t' << escape(exchange.role) << '\t' << exchange.seed << '\t'
+        << exchange.wait_ms << '\t' << exchange.load_ms << '\t' << exchange.prefill_ms << '\t' << exchange.first_token_ms << '\t'
+        << exchange.total_ms << '\t' << exchange.prompt_tokens << '\t' << exchange.reused_tokens << '\t' << exchange.generated_tokens << '\t'
+        << common << '\t' << escape(exchange.prompt.substr(common)) << '\t' << escape(exchange.output) << '\n';
+    out.flush();
+    previous = exchange.prompt;
+}
+
+void SessionRecorder::phase(const std::string& name, double ms) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!out.is_open()) return;
+    out << "P\t" << elapsedMs() << '\t' << escape(name) << '\t' << ms << '\n';
+    out.flush();
+}
+
+// ---- 読み込み ----
+
+bool SessionFile::load(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "Failed to open session file: " << path << std::endl;
+        return false;
+    }
+    settings.clear();
+    inputs.clear();
+    exchanges.clear();
+    phases.clear();
+
+    auto fail = [&](int line_no, const std::string& msg) {
+        std::cerr << path << ":" << line_no << ": " << msg << std::endl;
+        return false;
+    };
+
+    std::map<std::string, std::string> last_prompt;
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line)) {
+        line_no++;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+        std::vector<std::string> f = splitFields(line);
+
+        if (line_no == 1) {
+            if (f.size() < 2 || f[0] != SESSION_MAGIC) return fail(line_no, "not a session file");
+            if (std::atoi(f[1].c_str()) != SESSION_VERSION) return fail(line_no, "unsupported session version " + f[1]);
+            continue;
+        }
+
+        if (f[0] == "S" && f.size() == 3) {
+            settings[unescape(f[1])] = unescape(f[2]);
+        } else if (f[0] == "I" && f.size() == 6) {
+            RecordedInput rec;
+            rec.t_ms = static_cast<uint32_t>(std::strtoul(f[1].c_str(), nullptr, 10));
+            rec.state = f[2];
+            if (!parseInputKind(f[3], rec.input.kind)) return fail(line_no, "unknown input kind '" + f[3] + "'");
+            rec.input.item = std::atoi(f[4].c_str());
+            rec.input.text = unescape(f[5]);
+            inputs.push_back(std::move(rec));
+        } else if (f[0] == "L" && f.size() == 16) {
+            RecordedExchange rec;
+            LlmExchange& e = rec.exchange;
+            rec.t_ms = static_cast<uint32_t>(std::strtoul(f[1].c_str(), nullptr, 10));
+            if (!parseExchangeKind(f[2], e.kind)) return fail(line_no, "unknown exchange kind '" + f[2] + "'");
+            e.role = unescape(f[3]);
+            e.seed = static_cast<uint32_t>(std::strtoul(f[4].c_str(), nullptr, 10));
+            e.wait_ms = std::atof(f[5].c_str());
+            e.load_ms = std::atof(f[6].c_str());
+            e.prefill_ms = std::atof(f[7].c_str());
+            e.first_token_ms = std::atof(f[8].c_str());
+            e.total_ms = std::atof(f[9].c_str());
+            e.prompt_tokens = std::atoi(f[10].c_str());
+            e.reused_tokens = std::atoi(f[11].c_str());
+            e.generated_tokens = std::atoi(f[12].c_str());
+            std::string& previous = last_prompt[e.role];
+            size_t common = std::strtoul(f[13].c_str(), nullptr, 10);
+            if (common > previous.size()) return fail(line_no, "prompt refers past the previous prompt of role '" + e.role + "'");
+            e.prompt = previous.substr(0, common) + unescape(f[14]);
+            e.output = unescape(f[15]);
+            previous = e.prompt;
+            exchanges.push_back(std::move(rec));
+        } else if (f[0] == "P" && f.size() == 4) {
+            RecordedPhase rec;
+            rec.t_ms = static_cast<uint32_t>(std::strtoul(f[1].c_str(), nullptr, 10));
+            rec.name = unescape(f[2]);
+            rec.ms = std::atof(f[3].c_str());
+            phases.push_back(std::move(rec));
+        } else {
+            return fail(line_no, "malformed record");
+        }
+    }
+    if (line_no == 0) return fail(0, "empty session file");
+    return true;
+}
+
+std::string SessionFile::setting(const std::string& key, const std::string& fallback) const {
+    auto it = settings.find(key);
+    return it == settings.end() ? fallback : it->second;
+}
+
+// ---- 記録した結果での再生 ----
+
+RecordedOutputs::RecordedOutputs(const std::vector<RecordedExchange>& exchanges) {
+    for (const RecordedExchange& rec : exchanges) queues[rec.exchange.role].push_back(rec.exchange);
+}
+
+bool RecordedOutputs::take(const std::string& role, LlmExchangeKind kind, const std::string& prompt, LlmExchange& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::deque<LlmExchange>& queue = queues[role];
+    if (queue.empty() || queue.front().kind != kind) {
+        if (kind != LlmExchangeKind::CACHE_HIT) missingCount++;
+        return false;
+    }
+    out = std::move(queue.front());
+    queue.pop_front();
+    if (out.prompt != prompt) mismatchCount++;
+    return true;
+}
+
+size_t RecordedOutputs::missing() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return missingCount;
+}
+
+size_t RecordedOutputs::promptMismatches() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return mismatchCount;
+}
@@ -0,0 +1,134 @@
+// SessionRecorder.h - Prompt Quest: プレイの記録（入力・プロンプト・シード・生成結果・時間）と再生用の読み込み
+
+#ifndef SESSION_RECORDER_H
+#define SESSION_RECORDER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// プレイヤーの操作（SDL のイベントではなく、ゲームが受け付けた単位で記録する）
+enum class SessionInputKind : uint8_t {
+    START,   // タイトルで Enter
+    TEXT,    // 会話・戦闘で入力した文
+    DEPART,  // 出発ボタン
+    EQUIP    // もちもの欄のクリック
+};
+
+struct SessionInput {
+    SessionInputKind kind = SessionInputKind::TEXT;
+    std::string text;  // TEXT のとき
+    int item = -1;     // EQUIP のとき（もちもの欄の位置）
+};
+
+enum class LlmExchangeKind : uint8_t {
+    GENERATE,  // run_inference による生成
+    CLASSIFY,  // 候補の対数確率比較
+    CACHE_HIT  // セマンティックキャッシュから応答を再利用した
+};
+
+// LLM への1回の問い合わせ
+struct LlmExchange {
+    LlmExchangeKind kind = LlmExchangeKind::GENERATE;
+    std::string role;
+    uint32_t seed = 0;
+    std::string prompt;  // CACHE_HIT では照合に使った入力
+    // GENERATE: 後処理前の生成結果、CLASSIFY: 選んだ候補（失敗なら空）、CACHE_HIT: 再利用した応答（JSON）
+    std::string output;
+    double wait_ms = 0.0;         // 他の役割の推論を待った時間
+    double load_ms = 0.0;         // モデルの読み込み（とアダプターの切り替え）
+    double prefill_ms = 0.0;
+    double first_token_ms = 0.0;  // 呼び出しから最初のトークンまで
+    double total_ms = 0.0;
+    int prompt_tokens = 0;
+    int reused_tokens = 0;        // PrefixCache から使い回したトークン数
+    int generated_tokens = 0;
+};
+
+struct RecordedInput {
+    uint32_t t_ms = 0;  // 記録を始めてからの時間
+    std::string state;  // 受け付けたときのゲームの状態
+    SessionInput input;
+};
+
+struct RecordedExchange {
+    uint32_t t_ms = 0;
+    LlmExchange exchange;
+};
+
+// ゲーム側から見た処理の区切り（GM の応答が届くまで、など）
+struct RecordedPhase {
+    uint32_t t_ms = 0;
+    std::string name;
+    double ms = 0.0;
+};
+
+// 1行1レコードのテキスト形式で書き出す。文字列中のタブと改行はエスケープし、
+// プロンプトは同じ役割の直前のプロンプトと共通の先頭をバイト数だけで書く（世界設定や指示文を繰り返さない）。
+// レコードごとに書き切るので、途中で落ちても直前までは残る。どのスレッドから呼んでもよい。
+class SessionRecorder {
+public:
+    // 失敗時はエラーを出力して false
+    bool open(const std::string& path);
+    bool isOpen() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return out.is_open();
+    }
+
+    // 再生に必要な設定（シード・モデル・ゲームの切り替え）。入力や問い合わせより前に書く
+    void setting(const std::string& key, const std::string& value);
+    void input(const std::string& state, const SessionInput& input);
+    void exchange(const LlmExchange& exchange);
+    void phase(const std::string& name, double ms);
+
+private:
+    mutable std::mutex mutex;
+    std::ofstream out;
+    std::chrono::steady_clock::time_point start;
+    std::map<std::string, std::string> lastPrompt;  // 役割 → 直前のプロンプト
+
+    uint32_t elapsedMs() const;
+};
+
+// 記録ファイルの読み込み
+struct SessionFile {
+    std::map<std::string, std::string> settings;
+    std::vector<RecordedInput> inputs;
+    std::vector<RecordedExchange> exchanges;
+    std::vector<RecordedPhase> phases;
+
+    // 失敗時はエラーを出力して false
+    bool load(const std::string& path);
+    std::string setting(const std::string& key, const std::string& fallback = "") const;
+};
+
+// 記録した問い合わせの結果を、役割ごとに記録した順で返す（モデルを使わずにゲームループだけを動かす）。
+// 役割をまたいだ順序は問わないので、非同期の描写が会話と前後しても対応が崩れない
+class RecordedOutputs {
+public:
+    explicit RecordedOutputs(const std::vector<RecordedExchange>& exchanges);
+
+    // 役割の次の記録が kind なら out に入れて取り出す。違う種類なら取り出さずに false
+    // （GENERATE・CLASSIFY で記録が無ければ欠落として数える）。prompt が記録と違えば食い違いとして数える
+    bool take(const std::string& role, LlmExchangeKind kind, const std::string& prompt, LlmExchange& out);
+
+    size_t missing() const;
+    size_t promptMismatches() const;
+
+private:
+    mutable std::mutex mutex;
+    std::map<std::string, std::deque<LlmExchange>> queues;
+    size_t missingCount = 0;
+    size_t mismatchCount = 0;
+};
+
+const char* sessionInputKindName(SessionInputKind kind);
+const char* llmExchangeKindName(LlmExchangeKind kind);
+
+#endif
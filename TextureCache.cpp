@@ -0,0 +1,231 @@
+#include "TextureCache.h"
+#include "AssetBundle.h"
+#include "Log.h"
+#include "Trace.h"
+#include <SDL_image.h>
+#include <algorithm>
+#include <atomic>
+
+void SDL_Texture_Deleter::operator()(SDL_Texture* tex) const { if (tex) SDL_DestroyTexture(tex); }
+
+namespace {
+
+std::atomic<uint64_t> textureCreations{0};
+
+// 乗算済みアルファ用のブレンドモード（dst = src + dst * (1 - srcA)）
+SDL_BlendMode premultipliedBlendMode() {
+    static const SDL_BlendMode mode = SDL_ComposeCustomBlendMode(
+        SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD,
+        SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD);
+    return mode;
+}
+
+// カラーキーに一致するピクセルのアルファを0にする（SDL_SetColorKeyと同じ完全一致判定）
+void applyColorKey(SDL_Surface* surf, SDL_Color key) {
+    const Uint32 keyRgb = (Uint32(key.r) << 16) | (Uint32(key.g) << 8) | Uint32(key.b);
+    SDL_LockSurface(surf);
+    for (int y = 0; y < surf->h; ++y) {
+        Uint32* row = reinterpret_cast<Uint32*>(static_cast<Uint8*>(surf->pixels) + y * surf->pitch);
+        for (int x = 0; x < surf->w; ++x) {
+            if ((row[x] & 0x00FFFFFFu) == keyRgb) row[x] = keyRgb;  // ARGB8888でアルファ0
+        }
+    }
+    SDL_UnlockSurface(surf);
+}
+
+} // namespace
+
+TexturePtr createTextureFromSurface(SDL_Renderer* renderer, SDL_Surface* surface) {
+    textureCreations.fetch_add(1, std::memory_order_relaxed);
+    return TexturePtr(SDL_CreateTextureFromSurface(renderer, surface));
+}
+
+uint64_t textureCreationCount() {
+    return textureCreations.load(std::memory_order_relaxed);
+}
+
+void setTextureAlpha(SDL_Texture* tex, Uint8 alpha) {
+    if (!tex) return;
+    SDL_BlendMode mode;
+    if (SDL_GetTextureBlendMode(tex, &mode) == 0 && mode == premultipliedBlendMode()) {
+        SDL_SetTextureColorMod(tex, alpha, alpha, alpha);
+    } else {
+        SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
+    }
+    SDL_SetTextureAlphaMod(tex, alpha);
+}
+
+void TextureCache::fitSize(int srcW, int srcH, int targetW, int targetH, int& outW, int& outH) {
+    outW = srcW;
+    outH = srcH;
+    if (targetW <= 0 && targetH <= 0) return;
+
+    if (targetW > 0 && targetH > 0) {
+        // 両辺指定は引き伸ばし描画（背景など）
+        outW = std::min(srcW, targetW);
+        outH = std::min(srcH, targetH);
+        return;
+    }
+    float scale = (targetH > 0) ? static_cast<float>(targetH) / srcH : static_cast<float>(targetW) / srcW;
+    if (scale >= 1.0f) return;
+    outW = std::max(1, static_cast<int>(srcW * scale + 0.5f));
+    outH = std::max(1, static_cast<int>(srcH * scale + 0.5f));
+}
+
+TextureCache::TextureCache(SDL_Renderer* renderer, const std::string& basePath, size_t budgetBytes)
+    : renderer(renderer), basePath(basePath), budgetBytes(budgetBytes) {}
+
+TextureCache::~TextureCache() {
+    entries.clear();
+    lru.clear();
+}
+
+bool TextureCache::preload(const TextureDesc& desc) {
+    descs[desc.file] = desc;
+    if (entries.count(desc.file)) return true;
+    Entry* entry = load(desc);
+    if (!entry) return false;
+    touch(*entry);
+    return true;
+}
+
+SDL_Texture* TextureCache::get(const std::string& file) {
+    auto it = entries.find(file);
+    if (it != entries.end()) {
+        touch(it->second);
+        return it->second.texture.get();
+    }
+
+    auto desc_it = descs.find(file);
+    if (desc_it == descs.end()) {
+        PQ_LOG_ERROR(LogCategory::GAME, "Texture not registered: " << file);
+        return nullptr;
+    }
+    Entry* entry = load(desc_it->second);
+    if (!entry) return nullptr;
+    touch(*entry);
+    return entry->texture.get();
+}
+
+void TextureCache::beginFrame() {
+    frame++;
+}
+
+void TextureCache::setBudget(size_t newBudgetBytes) {
+    budgetBytes = newBudgetBytes;
+    evictToFit(0);
+}
+
+TextureCache::Entry* TextureCache::load(const TextureDesc& desc) {
+    PQ_TRACE_SCOPE("asset", "loadTexture");
+    size_t bytes = 0;
+    TexturePtr tex = bundle ? loadFromBundle(desc, bytes) : nullptr;
+    if (!tex) tex = loadFromImage(desc, bytes);
+    if (!tex) return nullptr;
+    return insert(desc.file, std::move(tex), bytes);
+}
+
+TexturePtr TextureCache::loadFromBundle(const TextureDesc& desc, size_t& bytes) {
+    // バンドルの画像はパッカーで縮小・透過処理済みなので、そのまま転送する
+    BundleImage image;
+    if (!bundle->find(desc.file, image, bundleScratch)) return nullptr;
+
+    bytes = static_cast<size_t>(image.width) * image.height * 4;
+    evictToFit(bytes);
+
+    textureCreations.fetch_add(1, std::memory_order_relaxed);
+    TexturePtr tex(SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, image.width, image.height));
+    if (!tex || SDL_UpdateTexture(tex.get(), NULL, image.pixels, image.pitch) != 0) {
+        PQ_LOG_ERROR(LogCategory::GAME, "Failed to upload bundle image: " << desc.file << " - " << SDL_GetError());
+        return nullptr;
+    }
+    if (SDL_SetTextureBlendMode(tex.get(), premultipliedBlendMode()) != 0) {
+        // カスタムブレンド非対応のレンダラー（ソフトウェア等）では通常のブレンドで代用する
+        SDL_SetTextureBlendMode(tex.get(), SDL_BLENDMODE_BLEND);
+    }
+    return tex;
+}
+
+TexturePtr TextureCache::loadFromImage(const TextureDesc& desc, size_t& bytes) {
+    std::string fullPath = basePath + desc.file;
+    PQ_LOG_DEBUG(LogCategory::GAME, "Loading texture: " << fullPath);
+    SDL_Surface* loaded = IMG_Load(fullPath.c_str());
+    if (!loaded) {
+        PQ_LOG_ERROR(LogCategory::GAME, "Failed to load image: " << desc.file << " - " << IMG_GetError());
+        return nullptr;
+    }
+
+    SDL_Surface* surf = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0);
+    SDL_FreeSurface(loaded);
+    if (!surf) {
+        PQ_LOG_ERROR(LogCategory::GAME, "Failed to convert image: " << desc.file << " - " << SDL_GetError());
+        return nullptr;
+    }
+    if (desc.use_color_key) applyColorKey(surf, desc.color_key);
+
+    // 描画サイズまで縮小してから転送する
+    int w, h;
+    fitSize(surf->w, surf->h, desc.target_w, desc.target_h, w, h);
+    if (w != surf->w || h != surf->h) {
+        SDL_Surface* scaled = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_ARGB8888);
+        if (scaled) {
+            SDL_SetSurfaceBlendMode(surf, SDL_BLENDMODE_NONE);
+#if SDL_VERSION_ATLEAST(2, 0, 16)
+            int rc = SDL_SoftStretchLinear(surf, NULL, scaled, NULL);
+#else
+            int rc = SDL_BlitScaled(surf, NULL, scaled, NULL);
+#endif
+            if (rc == 0) {
+                SDL_FreeSurface(surf);
+                surf = scaled;
+            } else {
+                PQ_LOG_ERROR(LogCategory::GAME, "Failed to scale image: " << desc.file << " - " << SDL_GetError());
+                SDL_FreeSurface(scaled);
+            }
+        }
+    }
+
+    bytes = static_cast<size_t>(surf->w) * surf->h * 4;
+    evictToFit(bytes);
+
+    TexturePtr tex = createTextureFromSurface(renderer, surf);
+    SDL_FreeSurface(surf);
+    if (!tex) {
+        PQ_LOG_ERROR(LogCategory::GAME, "Failed to create texture for: " << desc.file << " - " << SDL_GetError());
+        return nullptr;
+    }
+    if (desc.use_color_key) SDL_SetTextureBlendMode(tex.get(), SDL_BLENDMODE_BLEND);
+    return tex;
+}
+
+TextureCache::Entry* TextureCache::insert(const std::string& file, TexturePtr tex, size_t bytes) {
+    Entry& entry = entries[file];
+    entry.texture = std::move(tex);
+    entry.bytes = bytes;
+    lru.push_front(file);
+    entry.lruIt = lru.begin();
+    usedBytesTotal += bytes;
+    return &entry;
+}
+
+void TextureCache::touch(Entry& entry) {
+    entry.lastUsedFrame = frame;
+    if (entry.lruIt != lru.begin()) {
+        lru.splice(lru.begin(), lru, entry.lruIt);
+    }
+}
+
+void TextureCache::evictToFit(size_t incomingBytes) {
+    // このフレームで使用中のテクスチャは、ポインタが描画中のため追い出さない
+    auto it = lru.end();
+    while (usedBytesTotal + incomingBytes > budgetBytes && it != lru.begin()) {
+        --it;
+        auto entry_it = entries.find(*it);
+        if (entry_it->second.lastUsedFrame == frame) continue;
+
+        PQ_LOG_DEBUG(LogCategory::GAME, "Evicting texture: " << *it << " (" << entry_it->second.bytes / 1024 << " KB)");
+        usedBytesTotal -= entry_it->second.bytes;
+        entries.erase(entry_it);
+        it = lru.erase(it);
+    }
+}
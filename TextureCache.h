@@ -0,0 +1,95 @@
+// TextureCache.h - Prompt Quest: 表示解像度に合わせたテクスチャキャッシュ
+
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <string>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include <SDL2/SDL.h>
+
+class AssetBundle;
+
+struct SDL_Texture_Deleter { void operator()(SDL_Texture* tex) const; };
+using TexturePtr = std::unique_ptr<SDL_Texture, SDL_Texture_Deleter>;
+
+// テクスチャ生成はここを通す（ベンチマークで1フレームあたりの生成数を数えるため）
+TexturePtr createTextureFromSurface(SDL_Renderer* renderer, SDL_Surface* surface);
+uint64_t textureCreationCount();
+
+// フェード用のアルファ設定。バンドル由来の乗算済みアルファのテクスチャは色も一緒に減衰させる。
+void setTextureAlpha(SDL_Texture* tex, Uint8 alpha);
+
+// 画像の読み込み方法。target_w / target_h は実際に描画される最大サイズで、
+// 0 を指定した辺はアスペクト比から求める。元画像より大きくはしない。
+struct TextureDesc {
+    std::string file;
+    int target_w = 0;
+    int target_h = 0;
+    bool use_color_key = false;
+    SDL_Color color_key = {0, 0, 0, 255};
+};
+
+class TextureCache {
+public:
+    TextureCache(SDL_Renderer* renderer, const std::string& basePath, size_t budgetBytes);
+    ~TextureCache();
+
+    TextureCache(const TextureCache&) = delete;
+    TextureCache& operator=(const TextureCache&) = delete;
+
+    // デコード済みバンドルを設定する。バンドルにある画像はデコードせずに転送する。
+    void setBundle(const AssetBundle* assetBundle) { bundle = assetBundle; }
+
+    // 読み込み方法を登録して即座に読み込む（起動時のファイル欠落検出用）
+    bool preload(const TextureDesc& desc);
+
+    // テクスチャを取得する。追い出されていれば登録済みの方法で読み込み直す。
+    // 返したポインタはそのフレームの間だけ有効。
+    SDL_Texture* get(const std::string& file);
+
+    // フレーム開始時に呼ぶ。前フレームまでに使われたテクスチャが追い出し対象になる。
+    void beginFrame();
+
+    void setBudget(size_t budgetBytes);
+    size_t budget() const { return budgetBytes; }
+    size_t usedBytes() const { return usedBytesTotal; }
+    size_t residentCount() const { return entries.size(); }
+
+    // 描画される最大サイズを求める（拡大はしない）。アセットパッカーと共通。
+    static void fitSize(int srcW, int srcH, int targetW, int targetH, int& outW, int& outH);
+
+private:
+    struct Entry {
+        TexturePtr texture;
+        size_t bytes = 0;
+        Uint64 lastUsedFrame = 0;
+        std::list<std::string>::iterator lruIt;
+    };
+
+    SDL_Renderer* renderer;
+    const AssetBundle* bundle = nullptr;
+    std::string basePath;
+    size_t budgetBytes;
+    size_t usedBytesTotal = 0;
+    Uint64 frame = 0;
+
+    std::unordered_map<std::string, TextureDesc> descs;
+    std::unordered_map<std::string, Entry> entries;
+    std::list<std::string> lru;  // 先頭が最も新しく使われたもの
+    std::vector<uint8_t> bundleScratch;  // LZ4展開用
+
+    Entry* load(const TextureDesc& desc);
+    TexturePtr loadFromBundle(const TextureDesc& desc, size_t& bytes);
+    TexturePtr loadFromImage(const TextureDesc& desc, size_t& bytes);
+    Entry* insert(const std::string& file, TexturePtr tex, size_t bytes);
+    void touch(Entry& entry);
+    void evictToFit(size_t incomingBytes);
+};
+
+#endif
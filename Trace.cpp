@@ -0,0 +1,207 @@
+#include "Trace.h"
+#include "Log.h"
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+namespace Trace {
+
+namespace detail {
+std::atomic<bool> capturing{false};
+
+int64_t nowNs() {
+    static const auto epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+}
+
+namespace {
+
+// 1スレッドあたりの記録数の上限（約48MB）。超えた分は捨てて件数だけ数える
+const size_t MAX_EVENTS_PER_THREAD = 1 << 20;
+
+struct Event {
+    const char* name;
+    const char* category;
+    const char* argName;
+    int64_t beginNs;
+    int64_t endNs;
+    int64_t argValue;
+};
+
+// 書き込むのは持ち主のスレッドだけなので、mutex は書き出し時以外は競合しない
+struct ThreadBuffer {
+    std::mutex mutex;
+    std::vector<Event> events;
+    std::string name;
+    uint32_t tid = 0;
+    bool alive = true;
+    uint64_t dropped = 0;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    uint32_t nextTid = 1;
+};
+
+Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+// スレッド終了後もバッファは Registry が持ち続ける（std::async のスレッドは区間を残してすぐ終わる）
+struct ThreadHolder {
+    std::shared_ptr<ThreadBuffer> buffer;
+    ~ThreadHolder() {
+        if (!buffer) return;
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+        buffer->alive = false;
+    }
+};
+
+thread_local ThreadHolder holder;
+
+ThreadBuffer& threadBuffer() {
+    if (!holder.buffer) {
+        auto buffer = std::make_shared<ThreadBuffer>();
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        buffer->tid = reg.nextTid++;
+        buffer->name = "thread " + std::to_string(buffer->tid);
+        reg.buffers.push_back(buffer);
+        holder.buffer = std::move(buffer);
+    }
+    return *holder.buffer;
+}
+
+void writeEscaped(std::FILE* out, std::string_view text) {
+    std::fputc('"', out);
+    for (char c : text) {
+        unsigned char u = static_cast<unsigned char>(c);
+        if (c == '"' || c == '\\') {
+            std::fputc('\\', out);
+            std::fputc(c, out);
+        } else if (u < 0x20) {
+            std::fprintf(out, "\\u%04x", u);
+        } else {
+            std::fputc(c, out);
+        }
+    }
+    std::fputc('"', out);
+}
+
+// ナノ秒をトレース形式のマイクロ秒（小数3桁）で書く
+void writeMicros(std::FILE* out, int64_t ns) {
+    std::fprintf(out, "%" PRId64 ".%03d", ns / 1000, static_cast<int>(ns % 1000));
+}
+
+} // namespace
+
+void detail::record(const char* name, const char* category, int64_t begin_ns, int64_t end_ns, const char* arg_name, int64_t arg_value) {
+    if (!capturing.load(std::memory_order_relaxed)) return;  // 記録中に始まり停止後に終わった区間は捨てる
+    ThreadBuffer& buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    if (buffer.events.size() >= MAX_EVENTS_PER_THREAD) {
+        ++buffer.dropped;
+        return;
+    }
+    buffer.events.push_back({name, category, arg_name, begin_ns, end_ns, arg_value});
+}
+
+void setThreadName(const std::string& name) {
+    ThreadBuffer& buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.name = name;
+}
+
+bool start() {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    if (detail::capturing.load()) return false;
+
+    // 終了済みのスレッドのバッファはここで手放す
+    std::vector<std::shared_ptr<ThreadBuffer>> kept;
+    for (auto& buffer : reg.buffers) {
+        std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+        if (!buffer->alive) continue;
+        buffer->events.clear();
+        buffer->dropped = 0;
+        kept.push_back(buffer);
+    }
+    reg.buffers = std::move(kept);
+
+    detail::capturing.store(true);
+    PQ_LOG_INFO(LogCategory::GAME, "trace capture started");
+    return true;
+}
+
+bool stop(const std::string& path) {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    if (!detail::capturing.exchange(false)) return false;
+
+    struct Snapshot {
+        uint32_t tid;
+        std::string name;
+        std::vector<Event> events;
+    };
+    std::vector<Snapshot> threads;
+    uint64_t dropped = 0;
+    size_t total = 0;
+    for (auto& buffer : reg.buffers) {
+        std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+        if (buffer->events.empty()) continue;
+        threads.push_back({buffer->tid, buffer->name, std::move(buffer->events)});
+        buffer->events.clear();
+        dropped += buffer->dropped;
+        total += threads.back().events.size();
+    }
+
+    std::error_code ec;
+    std::filesystem::path file_path(path);
+    if (file_path.has_parent_path()) std::filesystem::create_directories(file_path.parent_path(), ec);
+    std::FILE* out = std::fopen(path.c_str(), "wb");
+    if (!out) {
+        PQ_LOG_ERROR(LogCategory::GAME, "failed to open trace file: " << path);
+        return false;
+    }
+
+    std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", out);
+    std::fputs("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Prompt Quest\"}}", out);
+    for (const Snapshot& thread : threads) {
+        std::fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", thread.tid);
+        writeEscaped(out, thread.name);
+        std::fputs("}}", out);
+        for (const Event& event : thread.events) {
+            std::fputs(",\n{\"name\":", out);
+            writeEscaped(out, event.name);
+            std::fputs(",\"cat\":", out);
+            writeEscaped(out, event.category);
+            std::fputs(",\"ph\":\"X\",\"ts\":", out);
+            writeMicros(out, event.beginNs);
+            std::fputs(",\"dur\":", out);
+            writeMicros(out, event.endNs - event.beginNs);
+            std::fprintf(out, ",\"pid\":1,\"tid\":%u", thread.tid);
+            if (event.argName) {
+                std::fputs(",\"args\":{", out);
+                writeEscaped(out, event.argName);
+                std::fprintf(out, ":%" PRId64 "}", event.argValue);
+            }
+            std::fputc('}', out);
+        }
+    }
+    std::fputs("\n]}\n", out);
+    bool ok = std::fclose(out) == 0;
+
+    if (dropped > 0) PQ_LOG_WARN(LogCategory::GAME, "trace buffer full, dropped " << dropped << " events");
+    PQ_LOG_INFO(LogCategory::GAME, "trace written: " << path << " (" << total << " events, " << threads.size() << " threads)");
+    return ok;
+}
+
+} // namespace Trace
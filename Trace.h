@@ -0,0 +1,76 @@
+// Trace.h - Prompt Quest: Chrome / Perfetto 形式のトレース記録
+//
+// PQ_TRACE_SCOPE で囲んだ区間の開始時刻・長さ・スレッドをスレッドごとのバッファに貯め、
+// Trace::stop() で chrome://tracing や ui.perfetto.dev で開ける JSON に書き出す。
+// 記録していない間の PQ_TRACE_SCOPE は atomic を1回読むだけで、時刻も取らない。
+// 区間名・カテゴリ名は文字列リテラルなど、書き出しまで生きている文字列を渡すこと。
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// 0 にすると PQ_TRACE_* はコードごと消える
+#ifndef PQ_TRACE
+#define PQ_TRACE 1
+#endif
+
+namespace Trace {
+
+// 記録を始める（前回の記録は捨てる）。すでに記録中なら false
+bool start();
+// 記録を止めて path に書き出す。記録中でなければ false
+bool stop(const std::string& path);
+
+// 書き出し時の表示名。呼んだスレッドに付く
+void setThreadName(const std::string& name);
+
+namespace detail {
+extern std::atomic<bool> capturing;
+int64_t nowNs();
+void record(const char* name, const char* category, int64_t begin_ns, int64_t end_ns, const char* arg_name, int64_t arg_value);
+}
+
+// 記録中か
+inline bool active() { return detail::capturing.load(std::memory_order_relaxed); }
+
+// 生成から破棄までを1つの区間として記録する。arg() で数値を1つだけ添えられる
+class Scope {
+public:
+    Scope(const char* name, const char* category)
+        : name(name), category(category), begin(active() ? detail::nowNs() : -1) {}
+    ~Scope() {
+        if (begin >= 0) detail::record(name, category, begin, detail::nowNs(), argName, argValue);
+    }
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+    void arg(const char* key, int64_t value) { argName = key; argValue = value; }
+
+private:
+    const char* name;
+    const char* category;
+    int64_t begin;
+    const char* argName = nullptr;
+    int64_t argValue = 0;
+};
+
+} // namespace Trace
+
+#define PQ_TRACE_CONCAT_(a, b) a##b
+#define PQ_TRACE_CONCAT(a, b) PQ_TRACE_CONCAT_(a, b)
+
+#if PQ_TRACE
+// 無名の区間。引数を付けたいときは PQ_TRACE_NAMED_SCOPE で変数名を付ける
+#define PQ_TRACE_SCOPE(category, name) Trace::Scope PQ_TRACE_CONCAT(pq_trace_scope_, __LINE__)(name, category)
+#define PQ_TRACE_NAMED_SCOPE(var, category, name) Trace::Scope var(name, category)
+#define PQ_TRACE_ARG(var, key, value) var.arg(key, static_cast<int64_t>(value))
+#else
+#define PQ_TRACE_SCOPE(category, name) do {} while (0)
+#define PQ_TRACE_NAMED_SCOPE(var, category, name) do {} while (0)
+#define PQ_TRACE_ARG(var, key, value) do {} while (0)
+#endif
+
+#endif
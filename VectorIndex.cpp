@@ -0,0 +1,94 @@
+#include "VectorIndex.h"
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+void VectorIndex::reset(int dims) {
+    dimensions = dims;
+    stride = (static_cast<size_t>(dims) + 7) & ~static_cast<size_t>(7);
+    count = 0;
+    data.clear();
+    queryScratch.assign(stride, 0.0f);
+}
+
+void VectorIndex::store(float* dst, const float* src) const {
+    double norm = 0.0;
+    for (int i = 0; i < dimensions; ++i) norm += static_cast<double>(src[i]) * src[i];
+    float inv = norm > 0.0 ? static_cast<float>(1.0 / std::sqrt(norm)) : 0.0f;
+    for (int i = 0; i < dimensions; ++i) dst[i] = src[i] * inv;
+    for (size_t i = dimensions; i < stride; ++i) dst[i] = 0.0f;
+}
+
+size_t VectorIndex::add(const float* vec) {
+    data.resize((count + 1) * stride);
+    store(data.data() + count * stride, vec);
+    return count++;
+}
+
+void VectorIndex::set(size_t index, const float* vec) {
+    if (index >= count) return;
+    store(data.data() + index * stride, vec);
+}
+
+float VectorIndex::dot(const float* a, const float* b, size_t n) {
+    // n は8の倍数（行は0埋めで揃えてある）
+#if defined(__AVX2__)
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+#if defined(__FMA__)
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+#else
+        acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
+#endif
+    }
+    for (; i < n; i += 8) {
+        acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    }
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+#else
+    // 独立した累積を4本に分けてコンパイラのベクトル化を効かせる
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    for (size_t i = 0; i < n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    return (s0 + s1) + (s2 + s3);
+#endif
+}
+
+long VectorIndex::search(const float* query, float* score) const {
+    if (count == 0) return -1;
+    store(queryScratch.data(), query);
+
+    long best = -1;
+    float best_score = -2.0f;
+    for (size_t i = 0; i < count; ++i) {
+        float s = dot(queryScratch.data(), data.data() + i * stride, stride);
+        if (s > best_score) {
+            best_score = s;
+            best = static_cast<long>(i);
+        }
+    }
+    if (score) *score = best_score;
+    return best;
+}
+
+void VectorIndex::scoreAll(const float* query, float* out) const {
+    if (count == 0) return;
+    store(queryScratch.data(), query);
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = dot(queryScratch.data(), data.data() + i * stride, stride);
+    }
+}
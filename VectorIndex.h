@@ -0,0 +1,41 @@
+// VectorIndex.h - Prompt Quest: 埋め込みベクトルのフラットな近傍探索（コサイン類似度）
+
+#ifndef VECTOR_INDEX_H
+#define VECTOR_INDEX_H
+
+#include <vector>
+#include <cstddef>
+
+// 正規化済みベクトルを1本の配列に詰めて持ち、全件の内積を取って最も近いものを返す。
+// 数百件規模ならグラフ索引（HNSW等）より速く、実装も単純。
+class VectorIndex {
+public:
+    VectorIndex() = default;
+    explicit VectorIndex(int dims) { reset(dims); }
+
+    void reset(int dims);
+    int dims() const { return dimensions; }
+    size_t size() const { return count; }
+
+    // ベクトルは内部で正規化される。戻り値は追加した位置。
+    size_t add(const float* vec);
+    void set(size_t index, const float* vec);
+
+    // 最も類似度の高い位置を返す（空なら -1）。score にはコサイン類似度を入れる。
+    long search(const float* query, float* score) const;
+    // 全件のコサイン類似度を out（size() 個）に入れる
+    void scoreAll(const float* query, float* out) const;
+
+    static float dot(const float* a, const float* b, size_t n);
+
+private:
+    void store(float* dst, const float* src) const;
+
+    int dimensions = 0;
+    size_t stride = 0;  // 8要素単位に切り上げた行の長さ（余りは0埋め）
+    size_t count = 0;
+    std::vector<float> data;
+    mutable std::vector<float> queryScratch;
+};
+
+#endif
@@ -0,0 +1,212 @@
+// battle_bench.cpp - Prompt Quest: 同梱のコンテンツで決めた手順の戦闘を最後まで遊び、勝てることを確かめる（モデル不要）
+//
+// data/content.txt の森の守護者を相手に、GameSession を遅延0の MockBackend（data/mock_llm.txt）で動かす。
+// 長老に出発を告げ、もらった装備を身につけ、手順ごとに決まった攻撃を決着がつくまで入れ続ける。
+// 手順ごとに --seeds 個のシードで戦い、勝率と決着までのターン数を、最後に1回の判定の時間を出力する。
+// 倒した後に、その戦闘の描写がログに流れた場合も失敗にする。
+// 火の魔法で戦う手順が、既定のシード（BattleResolver::DEFAULT_SEED）で勝てない、または勝率が
+// --min-win-rate を下回ったら終了コード1を返す（ステータスや計算式を変えたときの確認用）。
+//
+// 使い方: battle_bench [--root <リポジトリ直下>] [--seeds N] [--min-win-rate R]
+
+#include "BattleResolver.h"
+#include "ContentDatabase.h"
+#include "GameSession.h"
+#include "Log.h"
+#include "MockBackend.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const int MAX_WAIT_STEPS = 5000;  // 1ms ずつ進めて、これで状態が変わらなければ止まったとみなす
+const int MAX_BATTLE_TURNS = 100;
+
+// 戦い方の手順
+struct Plan {
+    const char* name;
+    const char* action;
+    bool equip;      // 出発のときにもらった装備を身につける
+    bool required;   // 勝てなければ失敗にする
+};
+
+const Plan PLANS[] = {
+    {"fire magic", "火の魔法を放つ", true, true},
+    {"fire sword", "炎をまとった剣で突く", true, false},
+    {"sword", "剣で斬りかかる", true, false},
+    {"fire magic, no gear", "火の魔法を放つ", false, false},
+};
+
+struct BattleResult {
+    bool finished = false;  // 勝つか倒れるまで進んだ
+    bool won = false;
+    bool lateText = false;  // 倒した後に、その戦闘の説明文や描写がログに流れた
+    int turns = 0;
+};
+
+} // namespace
+
+class BattleBench {
+public:
+    struct Options {
+        std::string root = "./";
+        int seeds = 200;
+        double minWinRate = 0.95;
+    };
+
+    explicit BattleBench(const Options& options) : options(options) {}
+
+    bool init() {
+        if (!content.loadFromFile(options.root + "data/content.txt")) return false;
+        if (!mock.loadScript(options.root + "data/mock_llm.txt")) return false;
+        mock.setLatencyScale(0.0);
+        return true;
+    }
+
+    // 1回の戦闘。出発と装備までを済ませ、攻撃を入れ続ける
+    BattleResult play(const Plan& plan, uint32_t seed) {
+        BattleResult result;
+        GameSession session(content);
+        session.options.seed = seed;
+        session.options.storyLineMs = 0;
+        if (!session.init()) return result;
+        session.setBackend(&mock);
+
+        uint32_t now = 0;
+        auto advance = [&](auto done) {
+            for (int i = 0; i < MAX_WAIT_STEPS; ++i) {
+                session.update(++now);
+                if (done()) return true;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            return false;
+        };
+        auto input = [&](SessionInputKind kind, const std::string& text = "", int item = -1) {
+            SessionInput in;
+            in.kind = kind;
+            in.text = text;
+            in.item = item;
+            return session.applyInput(in, now);
+        };
+        using State = GameSession::State;
+
+        if (!input(SessionInputKind::START) || !advance([&]() { return session.state() == State::CONVERSATION; })) return result;
+        if (!input(SessionInputKind::TEXT, "わかりました、森へ行きます！")) return result;
+        if (!advance([&]() { return session.state() == State::CONVERSATION && session.departureAvailable(); })) return result;
+        if (!input(SessionInputKind::DEPART) || !advance([&]() { return session.state() == State::BATTLE; })) return result;
+        if (plan.equip) {
+            for (int i = 0; i < static_cast<int>(session.inventory().size()); ++i) input(SessionInputKind::EQUIP, "", i);
+        }
+
+        while (session.state() == State::BATTLE && result.turns < MAX_BATTLE_TURNS) {
+            if (!input(SessionInputKind::TEXT, plan.action)) return result;
+            result.turns++;
+            if (!advance([&]() { return session.state() != State::PROCESSING_BATTLE; })) return result;
+        }
+        // 倒すと会話に、倒れるとタイトルに戻る
+        result.finished = session.state() != State::BATTLE;
+        result.won = session.state() == State::CONVERSATION && session.enemyStats().hp == 0;
+        session.waitPending();
+        if (result.won) {
+            // 決め手の攻撃の描写は、倒した後に届いても捨てられる
+            session.update(++now);
+            const std::string& last = session.log().back();
+            const std::string defeated = "を倒した！";
+            result.lateText = last.size() < defeated.size() || last.compare(last.size() - defeated.size(), defeated.size(), defeated) != 0;
+        }
+        return result;
+    }
+
+    // 判定1回の時間（ナノ秒）
+    double resolveNs() {
+        const Monster& enemy = content.monster(content.area(content.findArea("静寂の森")).monsters.front());
+        Stats player = {50, 20, 15, 13, 18, 8, 7};  // 剣と鎧を装備したプレイヤー
+        BattleResolver resolver;
+        resolver.begin(enemy);
+        const int iterations = 1000000;
+        long long total = 0;
+        const auto start = Clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            total += resolver.resolvePlayerAttack(player, enemy.stats, PLANS[i % (sizeof(PLANS) / sizeof(PLANS[0]))].action).damage;
+        }
+        const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+        if (total == 0) std::cerr << "no damage dealt" << std::endl;  // 最適化で消されないように使う
+        return ns;
+    }
+
+private:
+    Options options;
+    ContentDatabase content;
+    MockBackend mock;
+};
+
+int main(int argc, char** argv) {
+    BattleBench::Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--root" && i + 1 < argc) options.root = argv[++i];
+        else if (arg == "--seeds" && i + 1 < argc) options.seeds = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--min-win-rate" && i + 1 < argc) options.minWinRate = std::atof(argv[++i]);
+        else {
+            std::cerr << "Usage: battle_bench [--root <dir>] [--seeds N] [--min-win-rate R]" << std::endl;
+            return 1;
+        }
+    }
+    if (!options.root.empty() && options.root.back() != '/') options.root += '/';
+
+    LogConfig log_config;
+    log_config.path = "logs/battle_bench.log";
+    log_config.console_level = LogLevel::Warn;  // 戦闘ごとの情報ログで表が埋もれないように
+    Log::start(log_config);
+
+    BattleBench bench(options);
+    if (!bench.init()) {
+        Log::stop();
+        return 1;
+    }
+
+    bool failed = false;
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << std::left << std::setw(22) << "plan" << std::right << std::setw(8) << "win %" << std::setw(12) << "mean turns"
+              << std::setw(10) << "default" << std::endl;
+    for (const Plan& plan : PLANS) {
+        int wins = 0, stuck = 0, late = 0, turns = 0;
+        BattleResult fixed;  // 既定のシードでの結果
+        for (int s = 0; s < options.seeds; ++s) {
+            BattleResult result = bench.play(plan, static_cast<uint32_t>(BattleResolver::DEFAULT_SEED + s));
+            if (s == 0) fixed = result;
+            if (!result.finished) stuck++;
+            if (result.won) wins++;
+            if (result.lateText) late++;
+            turns += result.turns;
+        }
+        const double win_rate = static_cast<double>(wins) / options.seeds;
+        std::cout << std::left << std::setw(22) << plan.name << std::right << std::setw(8) << win_rate * 100.0
+                  << std::setw(12) << static_cast<double>(turns) / options.seeds
+                  << std::setw(10) << (fixed.won ? "win" : fixed.finished ? "lose" : "stuck") << std::endl;
+        if (stuck > 0) {
+            std::cerr << plan.name << ": " << stuck << " battles did not finish" << std::endl;
+            failed = true;
+        }
+        if (late > 0) {
+            std::cerr << plan.name << ": " << late << " battles logged text after the enemy was defeated" << std::endl;
+            failed = true;
+        }
+        if (plan.required && (!fixed.won || win_rate < options.minWinRate)) {
+            std::cerr << plan.name << ": the scripted battle against the shipped content must be winnable" << std::endl;
+            failed = true;
+        }
+    }
+    std::cout << "resolvePlayerAttack: " << std::setprecision(0) << bench.resolveNs() << " ns/call" << std::endl;
+
+    Log::stop();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,158 @@
+// cache_bench.cpp - Prompt Quest: セマンティックキャッシュの照合の確認と速度
+//
+// 判定が逆になる入力の組（「森へ行きます」と「森へは行きません」など）を、まったく同じ埋め込みで
+// SemanticCache に入れて引き、否定・問いかけの違う入力には過去の判定を返さないこと、同じ意味の言い換えには
+// 返すこと、語の一部（「必ず」の「ず」、"good" の "go"）や文中の「？」で判定を変えないことを確かめる
+// （埋め込みが最も近いという最悪の場合を作るので、モデル不要）。誤りがあれば終了コード1。
+// --model を付けると、その組の実際の埋め込み（enableSemanticCache と同じ平均プーリング）のコサイン類似度も出す。
+// 最後に、バケットが満杯のときの lookup 1回の時間を出す。
+//
+// 使い方: cache_bench [--model <gguf>] [--iterations N]
+
+#include "LlmManager.h"
+#include "SemanticCache.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const int DIMS = 256;
+const float THRESHOLD = 0.92f;  // LlmManager::enableSemanticCache の既定
+
+// cached を入れた後に query を引く。hit はキャッシュを使ってよいか
+struct CachePair {
+    bool battle;
+    const char* cached;
+    const char* query;
+    bool hit;
+};
+
+const CachePair PAIRS[] = {
+    {false, "森へ行きます", "森へは行きません", false},
+    {false, "森へ行きます", "よし、森へ行きます", true},
+    {false, "出発します", "まだ出発しません", false},
+    {false, "出発します", "今すぐ出発します", true},
+    {false, "旅立つ準備はできています", "旅立つ準備はできていません", false},
+    {false, "旅立つ準備はできています", "旅立つ準備ができました", true},
+    {false, "森へ行きます", "森へ行くべきですか？", false},
+    {false, "I will depart", "I won't depart", false},
+    {false, "I will depart", "I will depart now", true},
+    {false, "I will depart", "I will not depart", false},
+    {false, "森へ行きます", "森へ行くのか", false},
+    // 語の一部や文中の記号で判定を変えない
+    {false, "行きます", "必ず行きます", true},
+    {false, "進みます", "少しずつ進みます", true},
+    {false, "森へ行きます", "静かな森へ行きます", true},
+    {false, "森へ行きます", "本当？ では森へ行きます", true},
+    {false, "Tell me more", "Sounds good, tell me more", true},
+    {false, "Tell me about the forest", "Tell me about the goblins", true},
+    {false, "I will depart", "I will depart, nothing can stop me", true},
+    {true, "火の魔法を放つ", "火の魔法を使わずに斬る", false},
+    {true, "火の魔法を放つ", "火の魔法を撃つ", true},
+    {true, "火の魔法を放つ", "必ず火の魔法を放つ", true},
+};
+
+std::vector<float> randomVector(std::mt19937& rng) {
+    std::normal_distribution<float> dist(0.0f, 1.0f);
+    std::vector<float> v(DIMS);
+    float norm = 0.0f;
+    for (float& x : v) {
+        x = dist(rng);
+        norm += x * x;
+    }
+    for (float& x : v) x /= std::sqrt(norm);
+    return v;
+}
+
+float cosine(const std::vector<float>& a, const std::vector<float>& b) {
+    float dot = 0.0f, na = 0.0f, nb = 0.0f;
+    for (size_t i = 0; i < a.size() && i < b.size(); ++i) {
+        dot += a[i] * b[i];
+        na += a[i] * a[i];
+        nb += b[i] * b[i];
+    }
+    return na > 0.0f && nb > 0.0f ? dot / std::sqrt(na * nb) : 0.0f;
+}
+
+// LlmManager と同じく、状態バケットに判定を左右する語の有無を足す
+std::string bucketFor(const CachePair& pair, const std::string& text) {
+    return pair.battle ? "BATTLE\x1f" + LlmManager::battleCacheSignature(text) : "GM\x1f" + LlmManager::gmCacheSignature(text);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string model;
+    int iterations = 100000;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--model" && i + 1 < argc) model = argv[++i];
+        else if (arg == "--iterations" && i + 1 < argc) iterations = std::max(1, std::atoi(argv[++i]));
+        else {
+            std::cerr << "Usage: cache_bench [--model <gguf>] [--iterations N]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::unique_ptr<LlmManager> llm;
+    if (!model.empty()) {
+        llm = std::make_unique<LlmManager>(std::map<std::string, std::string>{{"BATTLE", model}});
+        if (!llm->enableSemanticCache("BATTLE", THRESHOLD)) return 1;
+    }
+
+    // ---- 正しさ ----
+    int failures = 0;
+    std::mt19937 rng(1234);
+    // 全角文字で桁がずれないよう、文字列は行末に置く
+    std::cout << std::left << std::setw(8) << "expect" << std::setw(8) << "got" << std::setw(8) << (llm ? "cosine" : "")
+              << "cached -> query" << std::endl;
+    for (const CachePair& pair : PAIRS) {
+        // 埋め込みが同じ（類似度1）でも、語の有無が違えば引けてはいけない
+        std::vector<float> embedding = randomVector(rng);
+        SemanticCache<int> cache(THRESHOLD);
+        cache.insert(bucketFor(pair, pair.cached), embedding, 1);
+        int value = 0;
+        bool hit = cache.lookup(bucketFor(pair, pair.query), embedding, value);
+        if (hit != pair.hit) failures++;
+
+        std::string similarity;
+        if (llm) {
+            std::vector<float> a, b;
+            if (llm->embed(SemanticCache<int>::normalizeInput(pair.cached), a) && llm->embed(SemanticCache<int>::normalizeInput(pair.query), b)) {
+                similarity = std::to_string(cosine(a, b)).substr(0, 5);
+            }
+        }
+        std::cout << std::left << std::setw(8) << (pair.hit ? "hit" : "miss") << std::setw(8) << (hit ? "hit" : "miss")
+                  << std::setw(8) << similarity << pair.cached << " -> " << pair.query << (hit != pair.hit ? "  FAIL" : "")
+                  << std::endl;
+    }
+
+    // ---- 速度 ----
+    SemanticCache<int> full(THRESHOLD);
+    for (int i = 0; i < 256; ++i) full.insert("GM", randomVector(rng), i);
+    std::vector<float> query = randomVector(rng);
+    int value = 0;
+    size_t hits = 0;
+    const auto start = Clock::now();
+    for (int i = 0; i < iterations; ++i) hits += full.lookup("GM", query, value);
+    const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+    std::cout << "lookup (256 entries, " << DIMS << " dims): " << std::fixed << std::setprecision(0) << ns << " ns"
+              << (hits > 0 ? " (hit)" : "") << std::endl;
+
+    if (failures > 0) {
+        std::cerr << failures << " cache decisions were wrong" << std::endl;
+        return 1;
+    }
+    return 0;
+}
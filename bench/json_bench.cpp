@@ -0,0 +1,196 @@
+// json_bench.cpp - Prompt Quest: GM・戦闘応答パーサーのマイクロベンチマーク
+//
+// 代表的なLLM出力（前置き付き、エスケープ・カンマ入りの名前、\uエスケープ等）を
+//   - 文字列全体を一度に渡した場合
+//   - トークン片程度（1〜6バイト）に区切って逐次渡した場合
+// の両方で JsonStream に通し、1応答あたりの時間を計測する。比較用に以前の find/substr 方式の
+// GMパーサーも計測する。
+// あわせて、入力を乱数で壊した変種（切り詰め・バイト置換・挿入）を大量に作り、一括と逐次で
+// 結果が一致すること・異常終了しないことを確認する。不一致があれば終了コード1を返す。
+//
+// 使い方: json_bench [--iterations N] [--mutations N] [--seed S]
+
+#include "LlmManager.h"
+#include "JsonStream.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <random>
+#include <sstream>
+#include <functional>
+#include <cstdlib>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const std::vector<std::string> GM_SAMPLES = {
+    "{\n  \"scene_context\": \"若者との会話を続けている。\",\n  \"action\": \"CONTINUE\",\n  \"items\": []\n}",
+    "承知しました。以下が判定です。\n{\"scene_context\": \"若者が森へ旅立つ決意を固めた。\", \"action\": \"DEPART\", \"items\": [\"初心者の剣\", \"革の鎧\"]}",
+    "{\"scene_context\": \"長老は\\\"静寂\\\"について語った\\n（結界は弱まっている）\", \"action\": \"CONTINUE\", \"items\": [\"薬草, 上質\", \"\\u5149\\u306e\\u77f3\", \"\\ud83d\\udde1\"]}",
+    "{\"scene_context\": \"出発の準備\", \"action\": \"DEPART\", \"items\": [\"初心者の剣\"], \"extra\": {\"nested\": [1, 2.5e3, true, null]}}",
+};
+
+const std::vector<std::string> BATTLE_SAMPLES = {
+    "{\n  \"damage\": 18,\n  \"hit\": true,\n  \"effect_text\": \"炎が木の身体を焼き、守護者がよろめいた！\"\n}",
+    "{\"damage\": 0, \"hit\": false, \"effect_text\": \"攻撃は空を切った...\"}",
+    "結果:\n{\"damage\": \"25\", \"hit\": \"true\", \"effect_text\": \"弱点の「火」を突いた！\"}",
+};
+
+// 以前の find/substr 方式（比較用）
+GmResponse legacyParseGm(const std::string& raw_str) {
+    GmResponse res;
+    size_t start_pos = raw_str.find('{');
+    size_t end_pos = raw_str.rfind('}');
+    if (start_pos == std::string::npos || end_pos == std::string::npos || start_pos >= end_pos) return res;
+    std::string json_str = raw_str.substr(start_pos, end_pos - start_pos + 1);
+    auto getValue = [&](const std::string& key) -> std::string {
+        size_t key_pos = json_str.find("\"" + key + "\"");
+        if (key_pos == std::string::npos) return "";
+        size_t colon_pos = json_str.find(":", key_pos);
+        if (colon_pos == std::string::npos) return "";
+        size_t start_quote_pos = json_str.find("\"", colon_pos);
+        if (start_quote_pos == std::string::npos) return "";
+        size_t end_quote_pos = json_str.find("\"", start_quote_pos + 1);
+        if (end_quote_pos == std::string::npos) return "";
+        return json_str.substr(start_quote_pos + 1, end_quote_pos - start_quote_pos - 1);
+    };
+    res.scene_context = getValue("scene_context");
+    res.action = getValue("action");
+    size_t items_key_pos = json_str.find("\"items\"");
+    if (items_key_pos != std::string::npos) {
+        size_t array_start_pos = json_str.find("[", items_key_pos);
+        size_t array_end_pos = json_str.find("]", array_start_pos);
+        if (array_start_pos != std::string::npos && array_end_pos != std::string::npos) {
+            std::stringstream ss(json_str.substr(array_start_pos + 1, array_end_pos - array_start_pos - 1));
+            std::string item;
+            while (std::getline(ss, item, ',')) {
+                size_t start = item.find("\"");
+                size_t end = item.rfind("\"");
+                if (start != std::string::npos && end != std::string::npos && start != end) {
+                    res.items.push_back(item.substr(start + 1, end - start - 1));
+                }
+            }
+        }
+    }
+    return res;
+}
+
+template <typename Builder, typename Response>
+Response parseChunked(const std::string& text, std::mt19937& rng) {
+    Response res;
+    Builder builder(res);
+    JsonStream stream(builder);
+    std::uniform_int_distribution<size_t> piece(1, 6);
+    for (size_t pos = 0; pos < text.size();) {
+        size_t n = std::min(piece(rng), text.size() - pos);
+        if (stream.feed(std::string_view(text).substr(pos, n))) break;
+        pos += n;
+    }
+    builder.finish();
+    return res;
+}
+
+bool sameGm(const GmResponse& a, const GmResponse& b) {
+    return a.scene_context == b.scene_context && a.action == b.action && a.items == b.items;
+}
+
+bool sameBattle(const BattleResponse& a, const BattleResponse& b) {
+    return a.damage == b.damage && a.hit == b.hit && a.effect_text == b.effect_text;
+}
+
+std::string mutate(const std::string& src, std::mt19937& rng) {
+    static const char alphabet[] = "{}[]\":,\\u0123456789abcdeftrnl -.\n";
+    std::string s = src;
+    std::uniform_int_distribution<int> op(0, 2);
+    int edits = 1 + static_cast<int>(rng() % 4);
+    for (int e = 0; e < edits && !s.empty(); ++e) {
+        size_t pos = rng() % s.size();
+        char c = alphabet[rng() % (sizeof(alphabet) - 1)];
+        switch (op(rng)) {
+            case 0: s.resize(pos); break;          // 生成途中で打ち切られた出力
+            case 1: s[pos] = c; break;
+            default: s.insert(s.begin() + pos, c); break;
+        }
+    }
+    return s;
+}
+
+double nsPerCall(int iterations, const std::function<void()>& fn) {
+    auto t0 = Clock::now();
+    for (int i = 0; i < iterations; ++i) fn();
+    return std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / iterations;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int iterations = 20000;
+    int mutations = 20000;
+    unsigned seed = 1234;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--iterations" && i + 1 < argc) iterations = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--mutations" && i + 1 < argc) mutations = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--seed" && i + 1 < argc) seed = static_cast<unsigned>(std::atoi(argv[++i]));
+        else {
+            std::cerr << "Usage: json_bench [--iterations N] [--mutations N] [--seed S]" << std::endl;
+            return 1;
+        }
+    }
+    std::mt19937 rng(seed);
+
+    // ---- 速度 ----
+    size_t sink = 0;
+    double gmLegacy = nsPerCall(iterations, [&] { for (const auto& s : GM_SAMPLES) sink += legacyParseGm(s).items.size(); });
+    double gmWhole = nsPerCall(iterations, [&] { for (const auto& s : GM_SAMPLES) sink += LlmManager::parseGmResponse(s).items.size(); });
+    double gmChunked = nsPerCall(iterations, [&] {
+        for (const auto& s : GM_SAMPLES) sink += parseChunked<GmResponseBuilder, GmResponse>(s, rng).items.size();
+    });
+    double battleWhole = nsPerCall(iterations, [&] { for (const auto& s : BATTLE_SAMPLES) sink += LlmManager::parseBattleResponse(s).damage; });
+    double battleChunked = nsPerCall(iterations, [&] {
+        for (const auto& s : BATTLE_SAMPLES) sink += parseChunked<BattleResponseBuilder, BattleResponse>(s, rng).damage;
+    });
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << std::left << std::setw(36) << "parser" << std::right << std::setw(14) << "ns / response" << std::endl;
+    std::cout << std::left << std::setw(36) << "GM find/substr (previous)" << std::right << std::setw(14) << gmLegacy / GM_SAMPLES.size() << std::endl;
+    std::cout << std::left << std::setw(36) << "GM JsonStream (whole)" << std::right << std::setw(14) << gmWhole / GM_SAMPLES.size() << std::endl;
+    std::cout << std::left << std::setw(36) << "GM JsonStream (token pieces)" << std::right << std::setw(14) << gmChunked / GM_SAMPLES.size() << std::endl;
+    std::cout << std::left << std::setw(36) << "BATTLE JsonStream (whole)" << std::right << std::setw(14) << battleWhole / BATTLE_SAMPLES.size() << std::endl;
+    std::cout << std::left << std::setw(36) << "BATTLE JsonStream (token pieces)" << std::right << std::setw(14) << battleChunked / BATTLE_SAMPLES.size() << std::endl;
+
+    // ---- 正しさ ----
+    int failures = 0;
+    GmResponse items = LlmManager::parseGmResponse(GM_SAMPLES[2]);
+    if (items.items.size() != 3 || items.items[0] != "薬草, 上質" || items.items[1] != "光の石" || items.items[2] != "\xF0\x9F\x97\xA1") {
+        std::cerr << "FAIL: escaped / comma-containing item names" << std::endl;
+        failures++;
+    }
+    BattleResponse quoted = LlmManager::parseBattleResponse(BATTLE_SAMPLES[2]);
+    if (quoted.damage != 25 || !quoted.hit) {
+        std::cerr << "FAIL: string-typed damage/hit" << std::endl;
+        failures++;
+    }
+
+    // 壊れた入力でも、一括と逐次の結果が一致すること
+    for (int m = 0; m < mutations; ++m) {
+        if (m % 2 == 0) {
+            std::string s = mutate(GM_SAMPLES[rng() % GM_SAMPLES.size()], rng);
+            if (!sameGm(LlmManager::parseGmResponse(s), parseChunked<GmResponseBuilder, GmResponse>(s, rng))) {
+                std::cerr << "FAIL: chunked GM parse differs for input: " << s << std::endl;
+                failures++;
+            }
+        } else {
+            std::string s = mutate(BATTLE_SAMPLES[rng() % BATTLE_SAMPLES.size()], rng);
+            if (!sameBattle(LlmManager::parseBattleResponse(s), parseChunked<BattleResponseBuilder, BattleResponse>(s, rng))) {
+                std::cerr << "FAIL: chunked BATTLE parse differs for input: " << s << std::endl;
+                failures++;
+            }
+        }
+    }
+    std::cout << "mutated inputs checked: " << mutations << ", failures: " << failures << " (" << (sink & 1) << ")" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,359 @@
+// llm_bench.cpp - Prompt Quest: LLM推論のマイクロベンチマーク
+//
+// LlmManager::run_inference を同じプロンプトで繰り返し実行し、1リクエストあたりの時間と
+// 生成トークンあたりのメモリ確保回数（operator new）を計測する。最初のトークンまでの確保は
+// リクエスト単位のもの（出力文字列の返却など）として除外し、トークン間の確保だけを数える。
+// ggml 内部の malloc は計測対象外。トークン間の時間のばらつき（p50/p99）も出す。
+//
+// 使い方: llm_bench --model <gguf> [--role GM|NPC|BATTLE] [--requests N] [--require-zero-alloc] [--pin] [--idle-between]
+//                  [--ctx N] [--kv TYPE] [--kv-k TYPE] [--kv-v TYPE] [--flash-attn] [--prefix-cache N] [--history N] [--sweep]
+//   --require-zero-alloc を指定すると、定常状態でトークン間の確保が1回でもあれば終了コード1を返す。
+//   --pin はゲームと同じ LlmThreadConfig::fromEnvironment()（CPU 0 を空ける・PQ_LLM_* の指定）でプールを作る。
+//   --idle-between はリクエストの間にスレッドプールを止めて 200ms 待ち、ゲームの入力待ちからの再開を再現する。
+//   --ctx / --kv* / --flash-attn はコンテキストの設定（LlmContextConfig）。--history N は会話を N 往復足して
+//   プロンプトを長くする。--sweep は KV の型と flash attention の組み合わせを順に試し、KVキャッシュの大きさ、
+//   速度、f16 の出力からのずれ（先頭から一致したトークンの割合）を表にする。
+//   同じプロンプトを繰り返すので、既定ではプリフィルの大半が PrefixCache から使い回される。
+//   プリフィル込みで測るときは --prefix-cache 0 を付ける。
+
+#include "LlmManager.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <thread>
+
+// ---- メモリ確保の計測（このバイナリ内のすべての new を数える） ----
+namespace {
+std::atomic<uint64_t> allocCount{0};
+}
+
+void* operator new(std::size_t size) {
+    allocCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const char* const BENCH_PROMPT =
+    "<|begin_of_text|><|start_header_id|>system<|end_header_id|>\n\n"
+    "あなたは始まりの村の長老です。長老らしい落ち着いた口調で、若者に森の危険を警告してください。<|eot_id|>"
+    "<|start_header_id|>user<|end_header_id|>\n\nプレイヤー: 森には何がいるのですか？<|eot_id|>"
+    "<|start_header_id|>assistant<|end_header_id|>\n\n";
+
+const char* const HISTORY_TURN =
+    "<|start_header_id|>user<|end_header_id|>\n\nプレイヤー: 村の結界はいつからあるのですか？<|eot_id|>"
+    "<|start_header_id|>assistant<|end_header_id|>\n\n長老: わしの祖父の代よりも前からじゃ。"
+    "クリスタルの力を借りて、静寂の侵入を防いでおる。<|eot_id|>";
+
+std::string benchPrompt(int history_turns) {
+    std::string prompt = BENCH_PROMPT;
+    if (history_turns <= 0) return prompt;
+    // システムプロンプトの直後に過去の会話を挟む
+    std::string history;
+    for (int i = 0; i < history_turns; ++i) history += HISTORY_TURN;
+    size_t pos = prompt.find("<|start_header_id|>user");
+    prompt.insert(pos, history);
+    return prompt;
+}
+
+struct RequestSample {
+    double ms = 0.0;
+    double first_token_ms = 0.0;  // プリフィル込み
+    int tokens = 0;
+    uint64_t request_allocs = 0;  // リクエスト全体
+    uint64_t token_allocs = 0;    // 2トークン目以降のトークン間
+};
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0.0;
+    size_t index = std::min(values.size() - 1, static_cast<size_t>(p * (values.size() - 1) + 0.5));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+} // namespace
+
+class LlmBench {
+public:
+    LlmBench(LlmManager& manager, const std::string& role, std::string prompt) : llm(manager), role(role), prompt(std::move(prompt)) {
+        tokenGapsMs.reserve(1 << 16);  // トークン間で確保しないよう先に取っておく
+        outputText.reserve(1 << 16);
+        outputEnds.reserve(1 << 12);
+    }
+
+    RequestSample runOnce() {
+        RequestSample s;
+        uint64_t last = 0;
+        Clock::time_point last_token;
+        auto t0 = Clock::now();
+        outputText.clear();
+        outputEnds.clear();
+        LlmManager::TokenCallback on_token = [&](std::string_view piece) {
+            uint64_t now = allocCount.load(std::memory_order_relaxed);
+            Clock::time_point now_time = Clock::now();
+            if (s.tokens == 0) s.first_token_ms = std::chrono::duration<double, std::milli>(now_time - t0).count();
+            if (s.tokens > 0) {
+                s.token_allocs += now - last;
+                if (tokenGapsMs.size() < tokenGapsMs.capacity()) {
+                    tokenGapsMs.push_back(std::chrono::duration<double, std::milli>(now_time - last_token).count());
+                }
+            }
+            // 容量内に収まる間だけ記録する（トークン間で確保しない）
+            if (outputEnds.size() < outputEnds.capacity() && outputText.size() + piece.size() <= outputText.capacity()) {
+                outputText.append(piece);
+                outputEnds.push_back(outputText.size());
+            }
+            last = now;
+            last_token = now_time;
+            s.tokens++;
+            return true;
+        };
+
+        uint64_t a0 = allocCount.load();
+        t0 = Clock::now();
+        std::string out = llm.run_inference(role, prompt, role != "GM" && role != "BATTLE", on_token);
+        s.ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+        s.request_allocs = allocCount.load() - a0;
+        return s;
+    }
+
+    // 直前のリクエストで生成したトークン列
+    std::vector<std::string> lastOutput() const {
+        std::vector<std::string> pieces;
+        size_t begin = 0;
+        for (size_t end : outputEnds) {
+            pieces.push_back(outputText.substr(begin, end - begin));
+            begin = end;
+        }
+        return pieces;
+    }
+
+    std::vector<double> tokenGapsMs;  // 2トークン目以降の、前のトークンからの時間
+
+private:
+    LlmManager& llm;
+    std::string role;
+    std::string prompt;
+    std::string outputText;
+    std::vector<size_t> outputEnds;
+};
+
+namespace {
+
+struct RunOptions {
+    std::string model;
+    std::string role;
+    int requests = 10;
+    int history = 0;
+    bool pin = false;
+    bool idleBetween = false;
+};
+
+struct RunResult {
+    std::vector<RequestSample> samples;
+    std::vector<double> tokenGapsMs;
+    std::vector<std::vector<std::string>> outputs;  // リクエストごとの生成トークン列
+    ModelPoolMetrics pool;
+    PrefixCacheMetrics prefix;
+};
+
+RunResult runConfig(const RunOptions& options, const LlmContextConfig& context) {
+    RunResult result;
+    LlmRoleConfig config;
+    config.model_path = options.model;
+    config.context = context;
+    LlmManager llm({{options.role, config}}, options.pin ? LlmThreadConfig::fromEnvironment() : LlmThreadConfig());
+    LlmBench bench(llm, options.role, benchPrompt(options.history));
+    bench.runOnce();  // ウォームアップ（初回のみの確保を除外）
+    bench.tokenGapsMs.clear();
+    for (int i = 0; i < options.requests; ++i) {
+        if (options.idleBetween) {
+            // 入力待ちの間プールを止めておき、止めたまま次のリクエストを出す（推論の開始時に起きる）
+            llm.setThreadsIdle(true);
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+        result.samples.push_back(bench.runOnce());
+        result.outputs.push_back(bench.lastOutput());
+    }
+    result.tokenGapsMs = bench.tokenGapsMs;
+    result.pool = llm.modelMetrics();
+    result.prefix = llm.prefixMetrics();
+    return result;
+}
+
+double tokensPerSecond(const RunResult& run) {
+    double total_ms = 0.0;
+    uint64_t total_tokens = 0;
+    for (const auto& s : run.samples) {
+        total_ms += s.ms;
+        total_tokens += s.tokens;
+    }
+    return total_ms > 0.0 ? total_tokens * 1000.0 / total_ms : 0.0;
+}
+
+double meanFirstTokenMs(const RunResult& run) {
+    double total = 0.0;
+    for (const auto& s : run.samples) total += s.first_token_ms;
+    return run.samples.empty() ? 0.0 : total / run.samples.size();
+}
+
+// 基準の出力と先頭から一致したトークンの割合（リクエストごとの平均）と、完全に一致したリクエスト数
+double prefixAgreement(const RunResult& run, const RunResult& reference, int& identical) {
+    identical = 0;
+    double total = 0.0;
+    size_t n = std::min(run.outputs.size(), reference.outputs.size());
+    for (size_t i = 0; i < n; ++i) {
+        const auto& a = run.outputs[i];
+        const auto& b = reference.outputs[i];
+        size_t same = 0;
+        while (same < a.size() && same < b.size() && a[same] == b[same]) ++same;
+        size_t longest = std::max(a.size(), b.size());
+        total += longest ? static_cast<double>(same) / longest : 1.0;
+        if (a == b) ++identical;
+    }
+    return n ? total / n : 0.0;
+}
+
+std::string contextLabel(const LlmContextConfig& context) {
+    return std::string(ggml_type_name(context.type_k)) + "/" + ggml_type_name(context.type_v) + (context.flash_attn ? " fa" : "");
+}
+
+int runSweep(const RunOptions& options, int n_ctx, int prefix_cache_leaves) {
+    // f16 を基準に、flash attention の有無と KV の量子化を順に比べる
+    std::vector<LlmContextConfig> configs;
+    auto add = [&](ggml_type k, ggml_type v, bool flash_attn) {
+        LlmContextConfig context;
+        context.n_ctx = n_ctx;
+        context.type_k = k;
+        context.type_v = v;
+        context.flash_attn = flash_attn;
+        context.prefix_cache_leaves = prefix_cache_leaves;
+        configs.push_back(context);
+    };
+    add(GGML_TYPE_F16, GGML_TYPE_F16, false);
+    add(GGML_TYPE_F16, GGML_TYPE_F16, true);
+    add(GGML_TYPE_Q8_0, GGML_TYPE_Q8_0, true);
+    add(GGML_TYPE_Q8_0, GGML_TYPE_Q4_0, true);
+    add(GGML_TYPE_Q4_0, GGML_TYPE_Q4_0, true);
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "role " << options.role << ", n_ctx " << n_ctx << ", history " << options.history
+              << " turns, " << options.requests << " requests per config" << std::endl;
+    std::cout << std::left << std::setw(16) << "KV" << std::right << std::setw(10) << "KV MB" << std::setw(13) << "resident MB"
+              << std::setw(10) << "tok/s" << std::setw(12) << "1st tok ms" << std::setw(12) << "agreement" << std::setw(11) << "identical"
+              << std::endl;
+
+    RunResult reference;
+    for (size_t i = 0; i < configs.size(); ++i) {
+        RunResult run = runConfig(options, configs[i]);
+        if (i == 0) reference = run;
+        int identical = 0;
+        double agreement = prefixAgreement(run, reference, identical);
+        std::cout << std::left << std::setw(16) << contextLabel(configs[i]) << std::right
+                  << std::setw(10) << run.pool.context_bytes / (1024.0 * 1024.0)
+                  << std::setw(13) << run.pool.resident_bytes / (1024.0 * 1024.0)
+                  << std::setw(10) << tokensPerSecond(run)
+                  << std::setw(12) << meanFirstTokenMs(run)
+                  << std::setw(11) << agreement * 100.0 << "%"
+                  << std::setw(8) << identical << "/" << run.outputs.size() << std::endl;
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    RunOptions options;
+    options.role = "NPC";
+    LlmContextConfig context;
+    bool requireZeroAlloc = false;
+    bool sweep = false;
+    const char* usage = "Usage: llm_bench --model <gguf> [--role GM|NPC|BATTLE] [--requests N] [--require-zero-alloc] [--pin] [--idle-between]\n"
+                        "                 [--ctx N] [--kv TYPE] [--kv-k TYPE] [--kv-v TYPE] [--flash-attn] [--prefix-cache N] [--history N] [--sweep]";
+    bool ok = true;
+    for (int i = 1; i < argc && ok; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--model" && i + 1 < argc) options.model = argv[++i];
+        else if (arg == "--role" && i + 1 < argc) options.role = argv[++i];
+        else if (arg == "--requests" && i + 1 < argc) options.requests = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--require-zero-alloc") requireZeroAlloc = true;
+        else if (arg == "--pin") options.pin = true;
+        else if (arg == "--idle-between") options.idleBetween = true;
+        else if (arg == "--ctx" && i + 1 < argc) context.n_ctx = std::max(256, std::atoi(argv[++i]));
+        else if (arg == "--kv" && i + 1 < argc) {
+            ok = LlmContextConfig::parseCacheType(argv[++i], context.type_k);
+            context.type_v = context.type_k;
+        }
+        else if (arg == "--kv-k" && i + 1 < argc) ok = LlmContextConfig::parseCacheType(argv[++i], context.type_k);
+        else if (arg == "--kv-v" && i + 1 < argc) ok = LlmContextConfig::parseCacheType(argv[++i], context.type_v);
+        else if (arg == "--flash-attn") context.flash_attn = true;
+        else if (arg == "--prefix-cache" && i + 1 < argc) context.prefix_cache_leaves = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--history" && i + 1 < argc) options.history = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--sweep") sweep = true;
+        else ok = false;
+    }
+    if (!ok || options.model.empty()) {
+        std::cerr << usage << std::endl;
+        return 1;
+    }
+    if (ggml_is_quantized(context.type_v)) context.flash_attn = true;  // LlmManager と同じく自動で有効にする
+
+    RunResult run;
+    try {
+        if (sweep) return runSweep(options, context.n_ctx, context.prefix_cache_leaves);
+        run = runConfig(options, context);
+    } catch (const std::exception& e) {
+        std::cerr << "Fatal LLM Error: " << e.what() << std::endl;
+        return 1;
+    }
+    const std::string& role = options.role;
+    const std::vector<RequestSample>& samples = run.samples;
+    const std::vector<double>& tokenGapsMs = run.tokenGapsMs;
+
+    double total_ms = 0.0;
+    uint64_t total_tokens = 0, total_request_allocs = 0, total_token_allocs = 0;
+    for (const auto& s : samples) {
+        total_ms += s.ms;
+        total_tokens += s.tokens;
+        total_request_allocs += s.request_allocs;
+        total_token_allocs += s.token_allocs;
+    }
+    double n = static_cast<double>(samples.size());
+    uint64_t steady_tokens = total_tokens > samples.size() ? total_tokens - samples.size() : 0;
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "role:                    " << role << std::endl;
+    std::cout << "requests:                " << samples.size() << std::endl;
+    std::cout << "context:                 " << context.n_ctx << " tokens, KV " << contextLabel(context)
+              << " (" << run.pool.context_bytes / (1024 * 1024) << " MB, resident " << run.pool.resident_bytes / (1024 * 1024) << " MB)" << std::endl;
+    std::cout << "mean ms / request:       " << total_ms / n << std::endl;
+    std::cout << "tokens / s:              " << (total_ms > 0.0 ? total_tokens * 1000.0 / total_ms : 0.0) << std::endl;
+    std::cout << "mean ms to first token:  " << meanFirstTokenMs(run) << std::endl;
+    std::cout << "prefix reused / total:   " << run.prefix.reused_tokens << " / " << run.prefix.reused_tokens + run.prefix.prefilled_tokens
+              << " tokens" << std::endl;
+    std::cout << "allocs / request:        " << total_request_allocs / n << std::endl;
+    std::cout << "allocs / token (steady): " << (steady_tokens ? static_cast<double>(total_token_allocs) / steady_tokens : 0.0) << std::endl;
+    double gap_p50 = percentile(tokenGapsMs, 0.50);
+    double gap_p99 = percentile(tokenGapsMs, 0.99);
+    std::cout << "token gap p50 / p99 ms:  " << gap_p50 << " / " << gap_p99 << " (jitter " << gap_p99 - gap_p50 << ")" << std::endl;
+
+    if (requireZeroAlloc && total_token_allocs > 0) {
+        std::cerr << "REGRESSION: " << total_token_allocs << " heap allocations between generated tokens" << std::endl;
+        return 1;
+    }
+    return 0;
+}
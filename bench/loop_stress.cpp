@@ -0,0 +1,356 @@
+// loop_stress.cpp - Prompt Quest: MockBackend でゲームループに負荷をかける試験（モデル不要）
+//
+// 台本どおりの応答を遅延の分布に従って返す MockBackend を Game に差し込み、乱数で選んだプレイヤーの操作
+// （会話・出発・攻撃・装備）を受け付けられる状態になり次第入れ続ける。推論待ちの間も毎フレーム入力を試し、
+// 受け付けてしまわないこと、倒れたときに生成中の応答が打ち切られること、状態が止まらないことを確かめる。
+// 出力は1ターン（入力から次の入力を受け付けるまで）の時間と、推論待ちの間と待っていない間のフレーム時間。
+//
+// 使い方: loop_stress [--root <リポジトリ直下>] [--script <台本>] [--turns N] [--seed S] [--latency-scale X]
+//                     [--error-rate R] [--llm-battle] [--no-classifier] [--csv <出力>] [--max-frame-ms X] [--timeout 秒]
+//   --latency-scale  台本の遅延に掛ける（既定 0.05。1 で実際のモデルに近い速さ）
+//   --error-rate     全ての役割で推論をこの割合で失敗させる（台本の error_rate を上書き）
+//   --llm-battle     戦闘の判定も MockBackend に頼む（既定は BattleResolver で決め、描写だけを頼む）
+//   --max-frame-ms   推論待ちの間のフレーム（update + render）の平均が超えたら終了コード1
+
+#define SDL_MAIN_HANDLED
+#include "Game.h"
+#include "Log.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double msSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+struct Stat {
+    double mean = 0.0, p95 = 0.0, max = 0.0;
+    size_t n = 0;
+};
+
+Stat summarize(std::vector<double> values) {
+    Stat s;
+    s.n = values.size();
+    if (values.empty()) return s;
+    std::sort(values.begin(), values.end());
+    for (double v : values) s.mean += v;
+    s.mean /= static_cast<double>(values.size());
+    s.p95 = values[std::min(values.size() - 1, values.size() * 95 / 100)];
+    s.max = values.back();
+    return s;
+}
+
+const char* const TALK_LINES[] = {
+    "こんにちは、長老さま。",
+    "静寂とは何なのですか？",
+    "調和のクリスタルについて教えてください。",
+    "森にはどんな魔物がいるのですか？",
+    "わかりました、森へ行きます！",
+    "旅立つ準備はできています。",
+};
+
+const char* const ATTACK_LINES[] = {
+    "剣で斬りかかる",
+    "火の魔法を放つ",
+    "炎をまとった剣で突く",
+    "盾を構えて体当たりする",
+    "足元を狙って斬る",
+};
+
+} // namespace
+
+class LoopStress {
+public:
+    struct Options {
+        std::string root = "./";
+        std::string script = "data/mock_llm.txt";
+        int turns = 200;
+        uint32_t seed = 1234;
+        double latencyScale = 0.05;
+        double errorRate = -1.0;  // 負なら台本のまま
+        bool llmBattle = false;
+        bool classifier = true;
+        double timeout_s = 30.0;
+    };
+
+    LoopStress(Game& game, const Options& options) : game(game), options(options), rng(options.seed) {}
+
+    bool init() {
+        game.basePath = options.root;
+        if (!game.initVideo(true) || !game.initContent()) return false;
+
+        auto mock = std::make_unique<MockBackend>();
+        if (!mock->loadScript(options.root + options.script)) return false;
+        mock->setLatencyScale(options.latencyScale);
+        if (options.errorRate >= 0.0) {
+            // 台本の遅延と出力はそのままで、失敗の割合だけを上書きする
+            for (const char* role : {"GM", "NPC", "BATTLE", "NARRATION"}) {
+                MockRoleScript script = mock->roleScript(role);
+                script.error_rate = static_cast<float>(options.errorRate);
+                mock->setRole(role, script);
+            }
+        }
+        backend = mock.get();
+        game.llm = std::move(mock);
+        GameSessionOptions& rules = game.session.options;
+        rules.seed = options.seed;
+        rules.storyLineMs = 0;
+        rules.nativeBattleResolver = !options.llmBattle;
+        rules.gmClassifier = options.classifier;
+        return game.initLlm();
+    }
+
+    // 操作を turns 回受け付けさせ、最後の推論が終わるまで回す。状態が止まったら false
+    bool run() {
+        const auto start = Clock::now();
+        auto last_progress = start;
+        auto turn_start = start;
+        bool in_turn = false;
+        Game::GameState turn_state = Game::GameState::TITLE;
+        Game::GameState previous = game.session.state();
+
+        while (accepted < options.turns || game.session.llmBusy() || game.session.state() == Game::GameState::STORY ||
+               game.session.state() == Game::GameState::TRANSITION_TO_FOREST) {
+            const bool busy = game.session.llmBusy();
+            if (accepted < options.turns) {
+                SessionInput input = nextInput();
+                const Game::GameState before = game.session.state();
+                bool waiting = !acceptsInput(before) && before != Game::GameState::STORY &&
+                               before != Game::GameState::TRANSITION_TO_FOREST;
+                if (game.applyInput(input)) {
+                    if (waiting) acceptedWhileBusy++;
+                    accepted++;
+                    inputCounts[sessionInputKindName(input.kind)]++;
+                    if (input.kind == SessionInputKind::TEXT) {
+                        in_turn = true;
+                        turn_state = before;
+                        turn_start = Clock::now();
+                    }
+                    last_progress = Clock::now();
+                } else if (waiting) {
+                    rejectedWhileBusy++;
+                }
+            }
+
+            auto frame_start = Clock::now();
+            game.update();
+            game.render();
+            (busy ? busyFrameMs : idleFrameMs).push_back(msSince(frame_start));
+
+            if (game.session.state() != previous) {
+                countTransition(previous, game.session.state());
+                previous = game.session.state();
+                last_progress = Clock::now();
+            }
+            // 次の入力を受け付けられるようになったらターンの終わり（戦闘の描写は次の攻撃と並行して届く）
+            if (in_turn && acceptsInput(game.session.state())) {
+                (turn_state == Game::GameState::BATTLE ? battleTurnMs : talkTurnMs).push_back(msSince(turn_start));
+                in_turn = false;
+            }
+
+            if (msSince(last_progress) > options.timeout_s * 1000.0) {
+                std::cerr << "stuck in state " << GameSession::stateName(game.session.state()) << " after " << accepted << " inputs" << std::endl;
+                return false;
+            }
+        }
+        elapsedMs = msSince(start);
+        return true;
+    }
+
+    // 推論の途中で終了したときに、ゲームの後始末がどれだけ待つか
+    void startPendingRequest() {
+        if (game.session.state() == Game::GameState::TITLE) game.applyInput({SessionInputKind::START, "", -1});
+        for (int i = 0; i < 1000 && game.session.state() != Game::GameState::CONVERSATION; ++i) game.update();
+        game.applyInput({SessionInputKind::TEXT, TALK_LINES[0], -1});
+        game.update();  // GM への問い合わせを始める
+    }
+
+    MockMetrics backendMetrics() const { return backend->metrics(); }
+
+    int accepted = 0;
+    int acceptedWhileBusy = 0;  // 推論待ちの間に受け付けてしまった入力（0 でなければ不具合）
+    int rejectedWhileBusy = 0;
+    int games = 0, departures = 0, victories = 0, defeats = 0;
+    std::map<std::string, int> inputCounts;
+    double elapsedMs = 0.0;
+    std::vector<double> talkTurnMs, battleTurnMs, busyFrameMs, idleFrameMs;
+
+private:
+    Game& game;
+    Options options;
+    std::mt19937 rng;
+    MockBackend* backend = nullptr;
+
+    static bool acceptsInput(Game::GameState state) {
+        return state == Game::GameState::TITLE || state == Game::GameState::CONVERSATION || state == Game::GameState::BATTLE;
+    }
+
+    template <size_t N>
+    const char* pick(const char* const (&lines)[N]) {
+        return lines[std::uniform_int_distribution<size_t>(0, N - 1)(rng)];
+    }
+
+    // 今の状態でプレイヤーがしそうな操作（受け付けられない状態でも試す）
+    SessionInput nextInput() {
+        SessionInput input;
+        switch (game.session.state()) {
+            case Game::GameState::TITLE:
+                input.kind = SessionInputKind::START;
+                break;
+            case Game::GameState::CONVERSATION:
+                if (game.session.departureAvailable() && rng() % 2 == 0) {
+                    input.kind = SessionInputKind::DEPART;
+                } else {
+                    input.text = pick(TALK_LINES);
+                }
+                break;
+            case Game::GameState::BATTLE:
+                if (!game.session.inventory().empty() && rng() % 6 == 0) {
+                    input.kind = SessionInputKind::EQUIP;
+                    input.item = static_cast<int>(rng() % game.session.inventory().size());
+                } else {
+                    input.text = pick(ATTACK_LINES);
+                }
+                break;
+            default:
+                input.text = pick(ATTACK_LINES);
+                break;
+        }
+        return input;
+    }
+
+    void countTransition(Game::GameState from, Game::GameState to) {
+        if (from == Game::GameState::TITLE && to == Game::GameState::STORY) games++;
+        if (to == Game::GameState::TRANSITION_TO_FOREST) departures++;
+        if (from == Game::GameState::PROCESSING_BATTLE || from == Game::GameState::BATTLE) {
+            if (to == Game::GameState::CONVERSATION) victories++;
+            if (to == Game::GameState::TITLE) defeats++;
+        }
+    }
+};
+
+int main(int argc, char** argv) {
+    LoopStress::Options options;
+    std::string csvPath;
+    double maxFrameMs = 0.0;
+    bool usage = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--root" && i + 1 < argc) options.root = argv[++i];
+        else if (arg == "--script" && i + 1 < argc) options.script = argv[++i];
+        else if (arg == "--turns" && i + 1 < argc) options.turns = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--seed" && i + 1 < argc) options.seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--latency-scale" && i + 1 < argc) options.latencyScale = std::max(0.0, std::atof(argv[++i]));
+        else if (arg == "--error-rate" && i + 1 < argc) options.errorRate = std::min(1.0, std::max(0.0, std::atof(argv[++i])));
+        else if (arg == "--llm-battle") options.llmBattle = true;
+        else if (arg == "--no-classifier") options.classifier = false;
+        else if (arg == "--csv" && i + 1 < argc) csvPath = argv[++i];
+        else if (arg == "--max-frame-ms" && i + 1 < argc) maxFrameMs = std::atof(argv[++i]);
+        else if (arg == "--timeout" && i + 1 < argc) options.timeout_s = std::max(1.0, std::atof(argv[++i]));
+        else usage = true;
+    }
+    if (usage) {
+        std::cerr << "Usage: loop_stress [--root <dir>] [--script <file>] [--turns N] [--seed S] [--latency-scale X] [--error-rate R]"
+                     " [--llm-battle] [--no-classifier] [--csv <file>] [--max-frame-ms X] [--timeout S]" << std::endl;
+        return 1;
+    }
+    if (!options.root.empty() && options.root.back() != '/') options.root += '/';
+
+    Log::start(LogConfig());
+    SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+
+    bool completed = false;
+    double shutdownMs = 0.0;
+    MockMetrics metrics;
+    Stat talk, battle, busyFrame, idleFrame;
+    int accepted = 0, acceptedWhileBusy = 0, rejectedWhileBusy = 0;
+    int games = 0, departures = 0, victories = 0, defeats = 0;
+    double elapsed = 0.0;
+    std::map<std::string, int> inputCounts;
+    {
+        std::map<std::string, LlmRoleConfig> noModels;  // 推論は MockBackend が返す
+        auto game = std::make_unique<Game>(noModels);
+        LoopStress stress(*game, options);
+        if (!stress.init()) {
+            std::cerr << "Failed to initialize the game (fonts/images/" << options.script << " under " << options.root << "?)" << std::endl;
+            Log::stop();
+            return 1;
+        }
+        completed = stress.run();
+        accepted = stress.accepted;
+        acceptedWhileBusy = stress.acceptedWhileBusy;
+        rejectedWhileBusy = stress.rejectedWhileBusy;
+        games = stress.games;
+        departures = stress.departures;
+        victories = stress.victories;
+        defeats = stress.defeats;
+        elapsed = stress.elapsedMs;
+        inputCounts = stress.inputCounts;
+        talk = summarize(stress.talkTurnMs);
+        battle = summarize(stress.battleTurnMs);
+        busyFrame = summarize(stress.busyFrameMs);
+        idleFrame = summarize(stress.idleFrameMs);
+
+        // 長老の応答を待っている途中で終了し、後始末が生成の終わりを待たずに済むかを測る
+        if (completed) stress.startPendingRequest();
+        metrics = stress.backendMetrics();
+        auto shutdown_start = Clock::now();
+        game.reset();
+        shutdownMs = msSince(shutdown_start);
+    }
+    Log::stop();
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Inputs accepted: " << accepted << " in " << elapsed / 1000.0 << " s (";
+    for (auto it = inputCounts.begin(); it != inputCounts.end(); ++it) {
+        std::cout << (it == inputCounts.begin() ? "" : ", ") << it->first << " " << it->second;
+    }
+    std::cout << ")" << (completed ? "" : " (stopped)") << std::endl;
+    std::cout << "Games " << games << ", departures " << departures << ", victories " << victories << ", defeats " << defeats << std::endl;
+    std::cout << "Mock requests " << metrics.requests << ", cancelled " << metrics.cancelled << ", injected errors " << metrics.errors << std::endl;
+    std::cout << "Inputs rejected while waiting: " << rejectedWhileBusy << ", accepted while waiting: " << acceptedWhileBusy << std::endl;
+
+    auto line = [](const char* name, const Stat& s) {
+        std::cout << std::left << std::setw(22) << name << std::right << std::setw(8) << s.n << "  mean " << std::setw(9) << s.mean
+                  << " ms  p95 " << std::setw(9) << s.p95 << " ms  max " << std::setw(9) << s.max << " ms" << std::endl;
+    };
+    line("talk turn", talk);
+    line("battle turn", battle);
+    std::cout << std::setprecision(3);
+    line("frame (waiting)", busyFrame);
+    line("frame (idle)", idleFrame);
+    std::cout << "Shutdown with a request in flight: " << shutdownMs << " ms" << std::endl;
+
+    if (!csvPath.empty()) {
+        std::ofstream csv(csvPath);
+        csv << "name,count,mean_ms,p95_ms,max_ms\n";
+        const std::pair<const char*, Stat> rows[] = {
+            {"talk_turn", talk}, {"battle_turn", battle}, {"frame_waiting", busyFrame}, {"frame_idle", idleFrame}};
+        for (const auto& row : rows) {
+            csv << row.first << "," << row.second.n << "," << row.second.mean << "," << row.second.p95 << "," << row.second.max << "\n";
+        }
+        csv << "shutdown,1," << shutdownMs << "," << shutdownMs << "," << shutdownMs << "\n";
+    }
+
+    if (!completed) return 1;
+    if (acceptedWhileBusy > 0) {
+        std::cerr << "FAIL: " << acceptedWhileBusy << " inputs were accepted while waiting for inference" << std::endl;
+        return 1;
+    }
+    if (maxFrameMs > 0.0 && busyFrame.mean > maxFrameMs) {
+        std::cerr << "REGRESSION: frame mean while waiting " << busyFrame.mean << " ms > " << maxFrameMs << " ms" << std::endl;
+        return 1;
+    }
+    return 0;
+}
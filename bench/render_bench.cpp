@@ -0,0 +1,311 @@
+// render_bench.cpp - Prompt Quest: ヘッドレス描画ベンチマーク
+//
+// SDLのdummyビデオドライバとソフトウェアレンダラーで Game の描画処理を実行し、
+// 代表的なゲーム状態ごとに1フレームと各描画関数のCPU時間、メモリ確保回数、
+// テクスチャ生成数を計測する。GPUやディスプレイのないLinux環境でも動作する。
+//
+// 使い方: render_bench [--root <リポジトリ直下>] [--frames N] [--csv <出力>] [--max-frame-ms X]
+//   --max-frame-ms を指定すると、いずれかの状態の平均フレーム時間が超えた場合に終了コード1を返す。
+
+#define SDL_MAIN_HANDLED
+#include "Game.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// ---- メモリ確保の計測（このバイナリ内のすべての new を数える） ----
+namespace {
+std::atomic<uint64_t> allocCount{0};
+std::atomic<uint64_t> allocBytes{0};
+}
+
+void* operator new(std::size_t size) {
+    allocCount.fetch_add(1, std::memory_order_relaxed);
+    allocBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Sample {
+    double ms = 0.0;
+    uint64_t allocs = 0;
+    uint64_t bytes = 0;
+    uint64_t textures = 0;
+};
+
+struct Summary {
+    std::string name;
+    double mean_ms = 0.0, p50_ms = 0.0, p95_ms = 0.0, max_ms = 0.0;
+    double allocs = 0.0, bytes = 0.0, textures = 0.0;
+};
+
+Summary summarize(const std::string& name, std::vector<Sample> samples) {
+    Summary s;
+    s.name = name;
+    if (samples.empty()) return s;
+    std::sort(samples.begin(), samples.end(), [](const Sample& a, const Sample& b) { return a.ms < b.ms; });
+    for (const auto& x : samples) {
+        s.mean_ms += x.ms;
+        s.allocs += x.allocs;
+        s.bytes += x.bytes;
+        s.textures += x.textures;
+    }
+    double n = static_cast<double>(samples.size());
+    s.mean_ms /= n; s.allocs /= n; s.bytes /= n; s.textures /= n;
+    s.p50_ms = samples[samples.size() / 2].ms;
+    s.p95_ms = samples[std::min(samples.size() - 1, samples.size() * 95 / 100)].ms;
+    s.max_ms = samples.back().ms;
+    return s;
+}
+
+Sample measure(const std::function<void()>& fn) {
+    uint64_t a0 = allocCount.load(), b0 = allocBytes.load(), t0 = textureCreationCount();
+    auto start = Clock::now();
+    fn();
+    auto end = Clock::now();
+    Sample s;
+    s.ms = std::chrono::duration<double, std::milli>(end - start).count();
+    s.allocs = allocCount.load() - a0;
+    s.bytes = allocBytes.load() - b0;
+    s.textures = textureCreationCount() - t0;
+    return s;
+}
+
+} // namespace
+
+class RenderBench {
+public:
+    RenderBench(Game& game, int frames) : game(game), frames(frames) {}
+
+    // LLMを読み込まずに、非表示ウィンドウ＋ソフトウェアレンダラーで初期化する
+    bool init(const std::string& root) {
+        game.basePath = root;
+        if (!game.initVideo(true) || !game.initContent()) return false;
+        SDL_RendererInfo info;
+        if (SDL_GetRendererInfo(game.renderer, &info) == 0) {
+            std::cout << "Renderer: " << info.name << ", frames per scenario: " << frames << std::endl;
+        }
+        return true;
+    }
+
+    struct Scenario {
+        std::string name;
+        std::function<void(int frame)> setup;   // 毎フレーム呼ばれる（フェード値などを進める）
+    };
+
+    std::vector<Summary> run() {
+        std::vector<Summary> results;
+        for (const auto& scenario : scenarios()) {
+            reset();
+            scenario.setup(0);
+
+            // ウォームアップ（キャッシュへの初回読み込みを除外）
+            for (int i = 0; i < 5; ++i) game.render();
+
+            std::vector<Sample> frameSamples;
+            for (int i = 0; i < frames; ++i) {
+                scenario.setup(i);
+                frameSamples.push_back(measure([&] { game.render(); }));
+            }
+            results.push_back(summarize(scenario.name + "/frame", frameSamples));
+
+            for (const auto& fn : functions()) {
+                if (!fn.applies()) continue;
+                std::vector<Sample> samples;
+                for (int i = 0; i < frames; ++i) {
+                    scenario.setup(i);
+                    game.textureCache->beginFrame();
+                    samples.push_back(measure(fn.call));
+                }
+                results.push_back(summarize(scenario.name + "/" + fn.name, samples));
+            }
+        }
+        return results;
+    }
+
+private:
+    Game& game;
+    int frames;
+
+    struct Function {
+        std::string name;
+        std::function<bool()> applies;
+        std::function<void()> call;
+    };
+
+    using State = Game::GameState;
+
+    void reset() {
+        game.resetGame();
+        game.inputText.clear();
+        game.npcImageAlpha = 0;
+        game.session.currentEnemyTemplate = nullptr;
+    }
+
+    std::vector<Function> functions() {
+        auto isTitle = [this] { return game.session.currentState == State::TITLE; };
+        auto isBattle = [this] { return game.session.currentState == State::BATTLE || game.session.currentState == State::PROCESSING_BATTLE; };
+        auto isField = [=] { return !isTitle() && !isBattle(); };
+        auto notTitle = [=] { return !isTitle(); };
+        return {
+            {"render_Title", isTitle, [this] { game.render_Title(); }},
+            {"render_Field", isField, [this] { game.render_Field(); }},
+            {"render_Battle", isBattle, [this] { game.render_Battle(); }},
+            {"renderUI", notTitle, [this] { game.renderUI(); }},
+            {"renderStatusPanel", notTitle, [this] { game.renderStatusPanel(); }},
+            {"renderEnemyStatusPanel", isBattle, [this] { game.renderEnemyStatusPanel(); }},
+        };
+    }
+
+    void fillConversationLog() {
+        const char* lines[] = {
+            "> こんにちは、長老。村の様子がおかしいようですが、何があったのですか？",
+            "長老: おお、若者よ。よく来てくれた。実は「静寂」が村の結界を少しずつ蝕んでおるのじゃ。",
+            "> 「静寂」とは一体何なのでしょうか。詳しく教えてください。",
+            "長老: 「静寂」は生命力と色彩を奪い、世界を無音の灰色に変えてしまう恐ろしい災厄じゃ。森の魔物たちもその影響を受けておる。",
+            "> 調和のクリスタルを復活させる方法はあるのですか？",
+            "長老: 森の奥深くにある古い神殿に手がかりがあるはずじゃ。しかし、そこへ辿り着くには多くの危険を乗り越えねばならぬのう。",
+        };
+        game.session.conversationLog.clear();
+        for (int i = 0; i < 20; ++i) game.session.pushToLog(lines[i % 6]);
+    }
+
+    void fillInventory() {
+        // もちもの欄に収まる最大数まで詰める
+        game.session.playerInventory.clear();
+        while (game.session.playerInventory.size() < 8 && !game.content.items().empty()) {
+            for (const auto& item : game.content.items()) {
+                if (game.session.playerInventory.size() >= 8) break;
+                game.session.playerInventory.push_back(item);
+            }
+        }
+        if (!game.session.playerInventory.empty()) game.session.playerInventory[0].is_equipped = true;
+    }
+
+    std::vector<Scenario> scenarios() {
+        return {
+            {"title", [this](int) { game.session.currentState = State::TITLE; }},
+            {"conversation_full_log", [this](int frame) {
+                if (frame == 0) {
+                    game.session.currentState = State::CONVERSATION;
+                    game.session.isNpcImageVisible = true;
+                    game.npcImageAlpha = 255;
+                    game.inputText = "クリスタルについてもっと教えてください";
+                    fillConversationLog();
+                }
+            }},
+            {"conversation_full_inventory", [this](int frame) {
+                if (frame == 0) {
+                    game.session.currentState = State::CONVERSATION;
+                    game.session.isNpcImageVisible = true;
+                    game.npcImageAlpha = 255;
+                    game.session.showDepartureButton = true;
+                    fillConversationLog();
+                    fillInventory();
+                }
+            }},
+            {"transition_fading", [this](int frame) {
+                game.session.currentState = State::TRANSITION_TO_FOREST;
+                game.session.isForestBgVisible = true;
+                game.forestBgAlpha = static_cast<Uint8>(1 + (frame * game.fadeSpeed) % 254);
+                game.npcImageAlpha = static_cast<Uint8>(255 - game.forestBgAlpha);
+                if (frame == 0) fillConversationLog();
+            }},
+            {"battle_fading", [this](int frame) {
+                game.session.currentState = State::BATTLE;
+                if (frame == 0) {
+                    game.session.currentEnemyTemplate = &game.content.monster(game.content.area(game.session.forestArea()).monsters.front());
+                    game.session.currentEnemyStats = game.session.currentEnemyTemplate->stats;
+                    fillConversationLog();
+                    fillInventory();
+                }
+                game.session.isMonsterVisible = true;
+                game.monsterAlpha = static_cast<Uint8>(1 + (frame * game.fadeSpeed) % 254);
+            }},
+        };
+    }
+};
+
+int main(int argc, char** argv) {
+    std::string root = "./";
+    std::string csvPath;
+    int frames = 200;
+    double maxFrameMs = 0.0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--root" && i + 1 < argc) root = argv[++i];
+        else if (arg == "--frames" && i + 1 < argc) frames = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--csv" && i + 1 < argc) csvPath = argv[++i];
+        else if (arg == "--max-frame-ms" && i + 1 < argc) maxFrameMs = std::atof(argv[++i]);
+        else {
+            std::cerr << "Usage: render_bench [--root <dir>] [--frames N] [--csv <file>] [--max-frame-ms X]" << std::endl;
+            return 1;
+        }
+    }
+    if (!root.empty() && root.back() != '/') root += '/';
+
+    // ディスプレイなしで動かす
+    SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+
+    std::vector<Summary> results;
+    {
+        std::map<std::string, LlmRoleConfig> noModels;  // LLMは読み込まない
+        Game game(noModels);
+        RenderBench bench(game, frames);
+        if (!bench.init(root)) {
+            std::cerr << "Failed to initialize headless renderer (fonts/images under " << root << "?)" << std::endl;
+            return 1;
+        }
+        results = bench.run();
+    }
+
+    std::cout << std::left << std::setw(48) << "scenario/function"
+              << std::right << std::setw(10) << "mean ms" << std::setw(10) << "p50 ms" << std::setw(10) << "p95 ms" << std::setw(10) << "max ms"
+              << std::setw(10) << "allocs" << std::setw(12) << "bytes" << std::setw(10) << "textures" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    for (const auto& r : results) {
+        std::cout << std::left << std::setw(48) << r.name
+                  << std::right << std::setw(10) << r.mean_ms << std::setw(10) << r.p50_ms << std::setw(10) << r.p95_ms << std::setw(10) << r.max_ms
+                  << std::setprecision(1) << std::setw(10) << r.allocs << std::setw(12) << r.bytes << std::setw(10) << r.textures
+                  << std::setprecision(3) << std::endl;
+    }
+
+    if (!csvPath.empty()) {
+        std::ofstream csv(csvPath);
+        csv << "name,mean_ms,p50_ms,p95_ms,max_ms,allocs_per_call,bytes_per_call,textures_per_call\n";
+        for (const auto& r : results) {
+            csv << r.name << "," << r.mean_ms << "," << r.p50_ms << "," << r.p95_ms << "," << r.max_ms << ","
+                << r.allocs << "," << r.bytes << "," << r.textures << "\n";
+        }
+    }
+
+    if (maxFrameMs > 0.0) {
+        bool failed = false;
+        for (const auto& r : results) {
+            if (r.name.size() > 6 && r.name.compare(r.name.size() - 6, 6, "/frame") == 0 && r.mean_ms > maxFrameMs) {
+                std::cerr << "REGRESSION: " << r.name << " mean " << r.mean_ms << " ms > " << maxFrameMs << " ms" << std::endl;
+                failed = true;
+            }
+        }
+        if (failed) return 1;
+    }
+    return 0;
+}
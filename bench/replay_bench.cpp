@@ -0,0 +1,333 @@
+// replay_bench.cpp - Prompt Quest: 記録したプレイ（PQ_RECORD）の再生ベンチマーク
+//
+// 記録ファイルのシード・モデル設定・ゲームの切り替えで Game を非表示ウィンドウに作り、記録した入力を
+// 同じ状態になった時点で入れ直して Game::update / render を回す。再生中の問い合わせは別のファイルに記録し、
+// 最後に元の記録と役割ごとに突き合わせる（時間・出力の一致・プロンプトの一致）。
+//
+//   既定       : 実際のモデルで推論し、記録した時と速度・出力を比べる（同じシードなので出力は一致するはず）
+//   --outputs  : 記録した生成結果を返してモデルを使わない。ゲームループ（更新・描画・プロンプト組み立て）だけを計測する
+//
+// 使い方: replay_bench --session <記録> [--root <リポジトリ直下>] [--outputs] [--realtime] [--record <再生の記録>]
+//                      [--csv <出力>] [--fail-on-diff] [--max-frame-ms X] [--timeout 秒]
+//   --realtime      記録した時刻より前には入力しない（既定は受け付けられる状態になり次第すぐ入れる）
+//   --fail-on-diff  出力かプロンプトが記録と違う問い合わせがあれば終了コード1
+//   --max-frame-ms  フレーム（update + render）の平均が超えたら終了コード1
+
+#define SDL_MAIN_HANDLED
+#include "Game.h"
+#include "Log.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double msSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+struct Stat {
+    double mean = 0.0, p95 = 0.0, max = 0.0;
+};
+
+Stat summarize(std::vector<double> values) {
+    Stat s;
+    if (values.empty()) return s;
+    std::sort(values.begin(), values.end());
+    for (double v : values) s.mean += v;
+    s.mean /= static_cast<double>(values.size());
+    s.p95 = values[std::min(values.size() - 1, values.size() * 95 / 100)];
+    s.max = values.back();
+    return s;
+}
+
+// Game::startRecording が書いた設定から役割の設定を組み立てる
+std::map<std::string, LlmRoleConfig> roleConfigsFromSession(const SessionFile& session) {
+    std::map<std::string, LlmRoleConfig> roles;
+    for (const auto& pair : session.settings) {
+        const std::string& key = pair.first;
+        if (key.rfind("role.", 0) != 0) continue;
+        size_t dot = key.find('.', 5);
+        if (dot == std::string::npos) continue;
+        LlmRoleConfig& config = roles[key.substr(5, dot - 5)];
+        const std::string field = key.substr(dot + 1);
+        const std::string& value = pair.second;
+        if (field == "model") config.model_path = value;
+        else if (field == "lora") config.lora_path = value;
+        else if (field == "lora_scale") config.lora_scale = static_cast<float>(std::atof(value.c_str()));
+        else if (field == "compact_prompt") config.compact_prompt = value == "1";
+        else if (field == "n_ctx") config.context.n_ctx = std::atoi(value.c_str());
+        else if (field == "kv_type_k") LlmContextConfig::parseCacheType(value, config.context.type_k);
+        else if (field == "kv_type_v") LlmContextConfig::parseCacheType(value, config.context.type_v);
+        else if (field == "flash_attn") config.context.flash_attn = value == "1";
+        else if (field == "prefix_cache") config.context.prefix_cache_leaves = std::atoi(value.c_str());
+    }
+    return roles;
+}
+
+// 役割ごとの突き合わせ結果
+struct RoleComparison {
+    std::string role;
+    size_t recorded = 0, replayed = 0;
+    size_t same_output = 0, same_prompt = 0;
+    std::vector<double> recorded_ms, replayed_ms;
+    std::vector<double> recorded_first_ms, replayed_first_ms;
+};
+
+} // namespace
+
+class ReplayBench {
+public:
+    struct Options {
+        std::string root = "./";
+        bool outputs = false;
+        bool realtime = false;
+        double timeout_s = 300.0;
+    };
+
+    ReplayBench(Game& game, const SessionFile& session, const Options& options)
+        : game(game), session(session), options(options) {}
+
+    bool init(RecordedOutputs* outputs, const std::string& record_path) {
+        game.basePath = options.root;
+        if (!game.initVideo(true) || !game.initContent()) return false;
+
+        auto flag = [this](const char* key, bool fallback) { return session.setting(key, fallback ? "1" : "0") == "1"; };
+        GameSessionOptions& rules = game.session.options;
+        rules.seed = static_cast<uint32_t>(std::strtoul(session.setting("seed", "1234").c_str(), nullptr, 10));
+        game.useSemanticCache = flag("semantic_cache", game.useSemanticCache);
+        rules.gmClassifier = flag("gm_classifier", rules.gmClassifier);
+        rules.nativeBattleResolver = flag("native_battle", rules.nativeBattleResolver);
+        rules.battleNarration = flag("battle_narration", rules.battleNarration);
+        game.recordedOutputs = outputs;
+        game.recordPath = record_path;
+        // 導入と移動の文章は待たない（--realtime では記録した時と同じ間隔）
+        if (!options.realtime) rules.storyLineMs = 0;
+        return game.initLlm();
+    }
+
+    // 全ての入力を入れ終わり、推論と文章の送りが終わるまで回す。途中で進まなくなったら false
+    bool run() {
+        const auto start = Clock::now();
+        auto last_progress = start;
+        size_t next = 0;
+        while (true) {
+            if (next < session.inputs.size()) {
+                const RecordedInput& rec = session.inputs[next];
+                bool ready = rec.state == GameSession::stateName(game.session.state()) && !game.session.llmBusy() &&
+                             (!options.realtime || msSince(start) >= rec.t_ms);
+                if (ready) {
+                    if (!game.applyInput(rec.input)) {
+                        std::cerr << "input " << next << " (" << sessionInputKindName(rec.input.kind) << ") was not accepted" << std::endl;
+                    }
+                    next++;
+                    applied++;
+                    last_progress = Clock::now();
+                }
+            } else if (!game.session.llmBusy() && game.session.state() != Game::GameState::STORY &&
+                       game.session.state() != Game::GameState::TRANSITION_TO_FOREST) {
+                break;
+            }
+
+            auto frame_start = Clock::now();
+            game.update();
+            updateMs.push_back(msSince(frame_start));
+            auto render_start = Clock::now();
+            game.render();
+            renderMs.push_back(msSince(render_start));
+            frameMs.push_back(msSince(frame_start));
+
+            if (msSince(last_progress) > options.timeout_s * 1000.0) {
+                std::cerr << "stuck in state " << GameSession::stateName(game.session.state()) << " waiting for input " << next
+                          << (next < session.inputs.size() ? " (recorded in " + session.inputs[next].state + ")" : std::string()) << std::endl;
+                return false;
+            }
+            if (options.realtime) SDL_Delay(16);
+        }
+        elapsedMs = msSince(start);
+        return true;
+    }
+
+    size_t applied = 0;
+    double elapsedMs = 0.0;
+    std::vector<double> frameMs, updateMs, renderMs;
+
+private:
+    Game& game;
+    const SessionFile& session;
+    Options options;
+};
+
+int main(int argc, char** argv) {
+    std::string sessionPath, recordPath, csvPath;
+    ReplayBench::Options options;
+    bool failOnDiff = false;
+    double maxFrameMs = 0.0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--session" && i + 1 < argc) sessionPath = argv[++i];
+        else if (arg == "--root" && i + 1 < argc) options.root = argv[++i];
+        else if (arg == "--outputs") options.outputs = true;
+        else if (arg == "--realtime") options.realtime = true;
+        else if (arg == "--record" && i + 1 < argc) recordPath = argv[++i];
+        else if (arg == "--csv" && i + 1 < argc) csvPath = argv[++i];
+        else if (arg == "--fail-on-diff") failOnDiff = true;
+        else if (arg == "--max-frame-ms" && i + 1 < argc) maxFrameMs = std::atof(argv[++i]);
+        else if (arg == "--timeout" && i + 1 < argc) options.timeout_s = std::max(1.0, std::atof(argv[++i]));
+        else {
+            sessionPath.clear();
+            break;
+        }
+    }
+    if (sessionPath.empty()) {
+        std::cerr << "Usage: replay_bench --session <file> [--root <dir>] [--outputs] [--realtime] [--record <file>]"
+                     " [--csv <file>] [--fail-on-diff] [--max-frame-ms X] [--timeout S]" << std::endl;
+        return 1;
+    }
+    if (!options.root.empty() && options.root.back() != '/') options.root += '/';
+    if (recordPath.empty()) recordPath = sessionPath + ".replay";
+
+    SessionFile session;
+    if (!session.load(sessionPath)) return 1;
+    std::cout << "Session: " << session.inputs.size() << " inputs, " << session.exchanges.size() << " LLM exchanges, seed "
+              << session.setting("seed", "?") << (options.outputs ? " (recorded outputs)" : " (live model)") << std::endl;
+
+    Log::start(LogConfig());
+    SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+
+    bool completed = false;
+    size_t applied = 0, missing = 0, outputs_mismatches = 0;
+    double elapsed = 0.0;
+    Stat frame, update, render;
+    size_t frames = 0;
+    {
+        RecordedOutputs outputs(session.exchanges);  // Game より後に解放する
+        Game game(roleConfigsFromSession(session));
+        ReplayBench bench(game, session, options);
+        if (!bench.init(options.outputs ? &outputs : nullptr, recordPath)) {
+            std::cerr << "Failed to initialize the game (fonts/images/models under " << options.root << "?)" << std::endl;
+            Log::stop();
+            return 1;
+        }
+        completed = bench.run();
+        applied = bench.applied;
+        elapsed = bench.elapsedMs;
+        frames = bench.frameMs.size();
+        frame = summarize(bench.frameMs);
+        update = summarize(bench.updateMs);
+        render = summarize(bench.renderMs);
+        missing = outputs.missing();
+        outputs_mismatches = outputs.promptMismatches();
+    }  // Game の解放で推論が終わり、再生の記録が閉じる
+    Log::stop();
+
+    SessionFile replay;
+    if (!replay.load(recordPath)) return 1;
+
+    // 役割ごとに記録順で突き合わせる
+    std::map<std::string, RoleComparison> roles;
+    std::map<std::string, std::vector<const LlmExchange*>> recorded, replayed;
+    for (const auto& rec : session.exchanges) recorded[rec.exchange.role].push_back(&rec.exchange);
+    for (const auto& rec : replay.exchanges) replayed[rec.exchange.role].push_back(&rec.exchange);
+    size_t differences = 0;
+    std::ofstream csv;
+    if (!csvPath.empty()) {
+        csv.open(csvPath);
+        csv << "role,index,kind,recorded_total_ms,replayed_total_ms,recorded_first_token_ms,replayed_first_token_ms,"
+               "recorded_prefill_ms,replayed_prefill_ms,same_prompt,same_output\n";
+    }
+    for (const auto& pair : recorded) {
+        RoleComparison& c = roles[pair.first];
+        c.role = pair.first;
+        c.recorded = pair.second.size();
+        const auto& other = replayed[pair.first];
+        c.replayed = other.size();
+        for (size_t i = 0; i < pair.second.size(); ++i) {
+            const LlmExchange& a = *pair.second[i];
+            c.recorded_ms.push_back(a.total_ms);
+            if (a.kind == LlmExchangeKind::GENERATE) c.recorded_first_ms.push_back(a.first_token_ms);
+            if (i >= other.size()) {
+                differences++;
+                continue;
+            }
+            const LlmExchange& b = *other[i];
+            c.replayed_ms.push_back(b.total_ms);
+            if (b.kind == LlmExchangeKind::GENERATE) c.replayed_first_ms.push_back(b.first_token_ms);
+            bool same_prompt = a.kind == b.kind && a.prompt == b.prompt;
+            bool same_output = a.kind == b.kind && a.output == b.output;
+            c.same_prompt += same_prompt;
+            c.same_output += same_output;
+            if (!same_prompt || !same_output) differences++;
+            if (csv.is_open()) {
+                csv << c.role << "," << i << "," << llmExchangeKindName(a.kind) << "," << a.total_ms << "," << b.total_ms << ","
+                    << a.first_token_ms << "," << b.first_token_ms << "," << a.prefill_ms << "," << b.prefill_ms << ","
+                    << same_prompt << "," << same_output << "\n";
+            }
+        }
+    }
+    for (const auto& pair : replayed) {
+        if (!recorded.count(pair.first)) differences += pair.second.size();
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Inputs applied: " << applied << "/" << session.inputs.size() << ", wall time " << elapsed / 1000.0 << " s"
+              << (completed ? "" : " (stopped)") << std::endl;
+    std::cout << std::left << std::setw(8) << "role" << std::right << std::setw(12) << "requests" << std::setw(14) << "rec mean ms"
+              << std::setw(14) << "play mean ms" << std::setw(14) << "rec p95 ms" << std::setw(14) << "play p95 ms"
+              << std::setw(14) << "rec 1st ms" << std::setw(14) << "play 1st ms" << std::setw(10) << "prompt" << std::setw(10) << "output"
+              << std::endl;
+    for (const auto& pair : roles) {
+        const RoleComparison& c = pair.second;
+        Stat a = summarize(c.recorded_ms), b = summarize(c.replayed_ms);
+        Stat af = summarize(c.recorded_first_ms), bf = summarize(c.replayed_first_ms);
+        std::cout << std::left << std::setw(8) << c.role << std::right << std::setw(12) << (std::to_string(c.replayed) + "/" + std::to_string(c.recorded))
+                  << std::setw(14) << a.mean << std::setw(14) << b.mean << std::setw(14) << a.p95 << std::setw(14) << b.p95
+                  << std::setw(14) << af.mean << std::setw(14) << bf.mean
+                  << std::setw(10) << (std::to_string(c.same_prompt) + "/" + std::to_string(c.recorded))
+                  << std::setw(10) << (std::to_string(c.same_output) + "/" + std::to_string(c.recorded)) << std::endl;
+    }
+
+    // ゲーム側から見た待ち時間（GM の応答が届くまで、など）
+    std::map<std::string, std::pair<std::vector<double>, std::vector<double>>> phases;
+    for (const auto& p : session.phases) phases[p.name].first.push_back(p.ms);
+    for (const auto& p : replay.phases) phases[p.name].second.push_back(p.ms);
+    for (const auto& pair : phases) {
+        Stat a = summarize(pair.second.first), b = summarize(pair.second.second);
+        std::cout << "phase " << std::left << std::setw(10) << pair.first << std::right << " recorded " << a.mean << " ms (n="
+                  << pair.second.first.size() << "), replayed " << b.mean << " ms (n=" << pair.second.second.size() << ")" << std::endl;
+    }
+
+    std::cout << std::setprecision(3);
+    auto line = [](const char* name, const Stat& s) {
+        std::cout << std::left << std::setw(8) << name << std::right << " mean " << s.mean << " ms, p95 " << s.p95 << " ms, max " << s.max
+                  << " ms" << std::endl;
+    };
+    std::cout << frames << " frames" << std::endl;
+    line("frame", frame);
+    line("update", update);
+    line("render", render);
+    if (options.outputs && outputs_mismatches > 0) {
+        std::cout << "Prompts differing from the recording: " << outputs_mismatches << std::endl;
+    }
+    if (missing > 0) std::cout << "Recorded outputs missing for " << missing << " requests (the session diverged)" << std::endl;
+    std::cout << "Replay recorded to " << recordPath << std::endl;
+
+    if (!completed) return 1;
+    if (failOnDiff && differences > 0) {
+        std::cerr << "REGRESSION: " << differences << " LLM exchanges differ from the recording" << std::endl;
+        return 1;
+    }
+    if (maxFrameMs > 0.0 && frame.mean > maxFrameMs) {
+        std::cerr << "REGRESSION: frame mean " << frame.mean << " ms > " << maxFrameMs << " ms" << std::endl;
+        return 1;
+    }
+    return 0;
+}
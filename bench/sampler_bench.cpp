@@ -0,0 +1,135 @@
+// sampler_bench.cpp - Prompt Quest: 融合サンプラーと標準チェーンの比較ベンチマーク
+//
+// Llama-3 の語彙サイズ（128256）の乱数 logit に対して、標準の temp → top_k → top_p チェーンと
+// createFusedSampler をそれぞれ適用し、1回あたりの時間を計測する。同時に両者が残した候補
+// （トークンIDの並びと確率）が一致することを毎回確認し、不一致があれば終了コード1を返す。
+// モデルは読み込まない。
+//
+// 使い方: sampler_bench [--vocab N] [--trials N] [--temp T] [--top-k K] [--top-p P] [--seed S]
+
+#include "FusedSampler.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Timing {
+    std::vector<double> us;
+
+    void add(double v) { us.push_back(v); }
+    double mean() const {
+        double s = 0.0;
+        for (double v : us) s += v;
+        return us.empty() ? 0.0 : s / us.size();
+    }
+    double percentile(double q) const {
+        if (us.empty()) return 0.0;
+        std::vector<double> sorted = us;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[std::min(sorted.size() - 1, static_cast<size_t>(sorted.size() * q))];
+    }
+};
+
+double applyTimed(llama_sampler* sampler, std::vector<llama_token_data>& buf, llama_token_data_array& arr) {
+    arr = {buf.data(), buf.size(), -1, false};
+    auto t0 = Clock::now();
+    llama_sampler_apply(sampler, &arr);
+    return std::chrono::duration<double, std::micro>(Clock::now() - t0).count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int vocab = 128256;
+    int trials = 200;
+    float temp = 0.7f;
+    int topK = 35;
+    float topP = 0.9f;
+    unsigned seed = 1234;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--vocab" && i + 1 < argc) vocab = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--trials" && i + 1 < argc) trials = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--temp" && i + 1 < argc) temp = static_cast<float>(std::atof(argv[++i]));
+        else if (arg == "--top-k" && i + 1 < argc) topK = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--top-p" && i + 1 < argc) topP = static_cast<float>(std::atof(argv[++i]));
+        else if (arg == "--seed" && i + 1 < argc) seed = static_cast<unsigned>(std::atoi(argv[++i]));
+        else {
+            std::cerr << "Usage: sampler_bench [--vocab N] [--trials N] [--temp T] [--top-k K] [--top-p P] [--seed S]" << std::endl;
+            return 1;
+        }
+    }
+
+    llama_sampler* reference = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    llama_sampler_chain_add(reference, llama_sampler_init_temp(temp));
+    llama_sampler_chain_add(reference, llama_sampler_init_top_k(topK));
+    llama_sampler_chain_add(reference, llama_sampler_init_top_p(topP, 1));
+
+    llama_sampler* fused = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    llama_sampler_chain_add(fused, createFusedSampler(temp, topK, topP, 1));
+
+    // 実際の logit に近づけるため、正規分布の上に少数の突出した候補を混ぜる
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> noise(0.0f, 2.0f);
+    std::uniform_int_distribution<int> pick(0, vocab - 1);
+    std::vector<float> logits(vocab);
+    std::vector<llama_token_data> bufRef(vocab), bufFused(vocab);
+    llama_token_data_array arrRef, arrFused;
+
+    Timing timeRef, timeFused;
+    int mismatches = 0;
+    double maxProbDiff = 0.0;
+    size_t survivors = 0;
+
+    for (int t = 0; t < trials; ++t) {
+        for (int i = 0; i < vocab; ++i) logits[i] = noise(rng);
+        for (int j = 0; j < 8; ++j) logits[pick(rng)] += 8.0f + j;
+        for (int i = 0; i < vocab; ++i) {
+            bufRef[i] = {i, logits[i], 0.0f};
+            bufFused[i] = {i, logits[i], 0.0f};
+        }
+
+        timeRef.add(applyTimed(reference, bufRef, arrRef));
+        timeFused.add(applyTimed(fused, bufFused, arrFused));
+
+        bool same = arrRef.size == arrFused.size;
+        for (size_t i = 0; same && i < arrRef.size; ++i) {
+            same = arrRef.data[i].id == arrFused.data[i].id;
+            maxProbDiff = std::max(maxProbDiff, static_cast<double>(std::fabs(arrRef.data[i].p - arrFused.data[i].p)));
+        }
+        if (!same) mismatches++;
+        survivors += arrFused.size;
+    }
+    bool probsMatch = maxProbDiff < 1e-5;
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "vocab " << vocab << ", trials " << trials << ", temp " << temp << ", top_k " << topK << ", top_p " << topP
+#if defined(__AVX512F__)
+              << " [AVX-512]"
+#elif defined(__AVX2__)
+              << " [AVX2]"
+#else
+              << " [scalar]"
+#endif
+              << std::endl;
+    std::cout << std::left << std::setw(24) << "sampler" << std::right << std::setw(12) << "mean us" << std::setw(12) << "p50 us" << std::setw(12) << "p95 us" << std::endl;
+    std::cout << std::left << std::setw(24) << "temp+top_k+top_p" << std::right << std::setw(12) << timeRef.mean() << std::setw(12) << timeRef.percentile(0.5) << std::setw(12) << timeRef.percentile(0.95) << std::endl;
+    std::cout << std::left << std::setw(24) << "fused" << std::right << std::setw(12) << timeFused.mean() << std::setw(12) << timeFused.percentile(0.5) << std::setw(12) << timeFused.percentile(0.95) << std::endl;
+    std::cout << "speedup: " << (timeFused.mean() > 0.0 ? timeRef.mean() / timeFused.mean() : 0.0) << "x" << std::endl;
+    std::cout << "mean survivors: " << static_cast<double>(survivors) / trials << std::endl;
+    std::cout << "distribution check: " << (mismatches == 0 && probsMatch ? "identical" : "MISMATCH")
+              << " (token mismatches " << mismatches << ", max |p diff| " << std::scientific << maxProbDiff << ")" << std::endl;
+
+    llama_sampler_free(reference);
+    llama_sampler_free(fused);
+    return (mismatches == 0 && probsMatch) ? 0 : 1;
+}
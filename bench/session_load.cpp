@@ -0,0 +1,294 @@
+// session_load.cpp - Prompt Quest: game_server に同時に遊ぶプレイヤーをつなぎ、セッション数ごとの処理量と待ち時間を測る（POSIX のみ）
+//
+// プレイヤー1人につき1スレッドで接続し、受け付けられ次第、会話（出発できるようになれば半々で出発）と戦闘の
+// 行動を送り続ける。1ターンは SAY を送ってから READY が返るまで（長老の返答・戦闘の結果が出そろうまで）。
+// 導入と森への移動の行送りは計測に入れないので、サーバーは --story-ms 0 で起動しておくと待ちが減る。
+//
+// 使い方: session_load [--host 127.0.0.1] [--port 7700] [--sessions 1,2,4,8] [--seconds 30] [--seed S] [--csv <出力>]
+//   各セッション数について --seconds 秒だけ遊ばせ、その間に終わったターンを集計する。
+//   サーバーの --max-sessions は最大のセッション数以上にしておく。
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const int READ_TIMEOUT_S = 120;  // 返事がこれより遅ければ、サーバーが止まったとみなす
+
+double msSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+struct Stat {
+    double mean = 0.0, p50 = 0.0, p95 = 0.0, max = 0.0;
+    size_t n = 0;
+};
+
+Stat summarize(std::vector<double> values) {
+    Stat s;
+    s.n = values.size();
+    if (values.empty()) return s;
+    std::sort(values.begin(), values.end());
+    for (double v : values) s.mean += v;
+    s.mean /= static_cast<double>(values.size());
+    s.p50 = values[values.size() / 2];
+    s.p95 = values[std::min(values.size() - 1, values.size() * 95 / 100)];
+    s.max = values.back();
+    return s;
+}
+
+const char* const TALK_LINES[] = {
+    "こんにちは、長老さま。",
+    "静寂とは何なのですか？",
+    "調和のクリスタルについて教えてください。",
+    "森にはどんな魔物がいるのですか？",
+    "わかりました、森へ行きます！",
+    "旅立つ準備はできています。",
+};
+
+const char* const ATTACK_LINES[] = {
+    "剣で斬りかかる",
+    "火の魔法を放つ",
+    "炎をまとった剣で突く",
+    "盾を構えて体当たりする",
+    "足元を狙って斬る",
+};
+
+// game_server との1接続（行単位の送受信）
+class Connection {
+public:
+    ~Connection() {
+        if (fd >= 0) close(fd);
+    }
+
+    bool open(const std::string& host, int port) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return false;
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) return false;
+        if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) return false;
+        int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        timeval timeout = {READ_TIMEOUT_S, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        return true;
+    }
+
+    bool send(const std::string& line) {
+        std::string data = line + "\n";
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) return false;
+            sent += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // 1行読む（改行は含まない）。切断・タイムアウトなら false
+    bool readLine(std::string& line) {
+        for (;;) {
+            size_t end = buffer.find('\n');
+            if (end != std::string::npos) {
+                line = buffer.substr(0, end);
+                buffer.erase(0, end + 1);
+                return true;
+            }
+            char chunk[4096];
+            ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0) return false;
+            buffer.append(chunk, static_cast<size_t>(n));
+        }
+    }
+
+private:
+    int fd = -1;
+    std::string buffer;
+};
+
+} // namespace
+
+class SessionLoad {
+public:
+    struct Options {
+        std::string host = "127.0.0.1";
+        int port = 7700;
+        std::vector<int> sessions = {1, 2, 4, 8};
+        double seconds = 30.0;
+        uint32_t seed = 1234;
+    };
+
+    struct Result {
+        int sessions = 0;
+        int connected = 0;
+        int errors = 0;          // 切断・タイムアウト・拒否
+        double seconds = 0.0;
+        std::vector<double> turnMs;
+    };
+
+    explicit SessionLoad(const Options& options) : options(options) {}
+
+    Result run(int sessions) {
+        Result result;
+        result.sessions = sessions;
+        const auto start = Clock::now();
+        const auto deadline = start + std::chrono::milliseconds(static_cast<int64_t>(options.seconds * 1000.0));
+        std::vector<std::thread> players;
+        for (int i = 0; i < sessions; ++i) {
+            players.emplace_back([this, i, sessions, deadline, &result]() { play(options.seed + static_cast<uint32_t>(sessions * 1000 + i), deadline, result); });
+        }
+        for (auto& player : players) player.join();
+        result.seconds = options.seconds;
+        return result;
+    }
+
+private:
+    Options options;
+    std::mutex resultMutex;
+
+    // 1人分のプレイ。deadline を過ぎたら、その時点のターンを終えてから抜ける
+    void play(uint32_t seed, Clock::time_point deadline, Result& result) {
+        std::mt19937 rng(seed);
+        std::vector<double> turns;
+        bool ok = false;
+        auto finish = [&]() {
+            std::lock_guard<std::mutex> lock(resultMutex);
+            result.turnMs.insert(result.turnMs.end(), turns.begin(), turns.end());
+            if (ok) result.connected++;
+            else result.errors++;
+        };
+
+        Connection conn;
+        std::string line;
+        if (!conn.open(options.host, options.port) || !conn.readLine(line) || line.compare(0, 6, "HELLO\t") != 0) {
+            if (line.compare(0, 6, "ERROR\t") == 0) std::cerr << "server: " << line.substr(6) << std::endl;
+            finish();
+            return;
+        }
+
+        std::string state = "TITLE";
+        bool can_depart = false;
+        while (Clock::now() < deadline) {
+            std::string command;
+            bool timed = false;
+            if (state == "TITLE") {
+                command = "START";  // 接続直後と、倒れてタイトルに戻ったとき
+            } else if (state == "CONVERSATION") {
+                if (can_depart && rng() % 2 == 0) {
+                    command = "DEPART";
+                } else {
+                    command = std::string("SAY\t") + TALK_LINES[rng() % (sizeof(TALK_LINES) / sizeof(TALK_LINES[0]))];
+                    timed = true;
+                }
+            } else if (state == "BATTLE") {
+                command = std::string("SAY\t") + ATTACK_LINES[rng() % (sizeof(ATTACK_LINES) / sizeof(ATTACK_LINES[0]))];
+                timed = true;
+            } else {
+                break;  // READY はどれかの状態で返る
+            }
+
+            const auto sent = Clock::now();
+            if (!conn.send(command)) break;
+            bool ready = false;
+            while (conn.readLine(line)) {
+                if (line.compare(0, 7, "DEPART\t") == 0) can_depart = line.back() == '1';
+                if (line.compare(0, 6, "READY\t") == 0) {
+                    state = line.substr(6);
+                    ready = true;
+                    break;
+                }
+                if (line.compare(0, 6, "ERROR\t") == 0) {
+                    // 受け付けられなかった（直前の STATE で状態を合わせてやり直す）
+                    ready = true;
+                    timed = false;
+                    break;
+                }
+                if (line.compare(0, 6, "STATE\t") == 0) state = line.substr(6);
+            }
+            if (!ready) break;
+            // 集計の区切りをまたいだターンは数えない
+            if (timed && Clock::now() <= deadline) turns.push_back(msSince(sent));
+        }
+        ok = Clock::now() >= deadline;
+        if (ok) conn.send("QUIT");
+        finish();
+    }
+};
+
+int main(int argc, char** argv) {
+    SessionLoad::Options options;
+    std::string csvPath;
+    bool usage = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--host" && i + 1 < argc) options.host = argv[++i];
+        else if (arg == "--port" && i + 1 < argc) options.port = std::atoi(argv[++i]);
+        else if (arg == "--seconds" && i + 1 < argc) options.seconds = std::max(1.0, std::atof(argv[++i]));
+        else if (arg == "--seed" && i + 1 < argc) options.seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--csv" && i + 1 < argc) csvPath = argv[++i];
+        else if (arg == "--sessions" && i + 1 < argc) {
+            options.sessions.clear();
+            std::string list = argv[++i];
+            for (size_t begin = 0; begin <= list.size();) {
+                size_t end = std::min(list.find(',', begin), list.size());
+                int n = std::atoi(list.substr(begin, end - begin).c_str());
+                if (n > 0) options.sessions.push_back(n);
+                begin = end + 1;
+            }
+            if (options.sessions.empty()) usage = true;
+        }
+        else usage = true;
+    }
+    if (usage) {
+        std::cerr << "Usage: session_load [--host <addr>] [--port N] [--sessions 1,2,4,8] [--seconds S] [--seed S] [--csv <file>]" << std::endl;
+        return 1;
+    }
+
+    SessionLoad load(options);
+    std::vector<SessionLoad::Result> results;
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << std::right << std::setw(8) << "sessions" << std::setw(8) << "turns" << std::setw(10) << "turns/s"
+              << std::setw(11) << "mean ms" << std::setw(11) << "p50 ms" << std::setw(11) << "p95 ms" << std::setw(11) << "max ms"
+              << std::setw(8) << "errors" << std::endl;
+    bool failed = false;
+    for (int sessions : options.sessions) {
+        SessionLoad::Result result = load.run(sessions);
+        Stat turn = summarize(result.turnMs);
+        std::cout << std::setw(8) << sessions << std::setw(8) << turn.n << std::setw(10) << turn.n / result.seconds
+                  << std::setw(11) << turn.mean << std::setw(11) << turn.p50 << std::setw(11) << turn.p95 << std::setw(11) << turn.max
+                  << std::setw(8) << result.errors << std::endl;
+        if (result.errors > 0) failed = true;
+        results.push_back(std::move(result));
+    }
+
+    if (!csvPath.empty()) {
+        std::ofstream csv(csvPath);
+        csv << "sessions,turns,turns_per_s,mean_ms,p50_ms,p95_ms,max_ms,errors\n";
+        for (const auto& result : results) {
+            Stat turn = summarize(result.turnMs);
+            csv << result.sessions << "," << turn.n << "," << turn.n / result.seconds << "," << turn.mean << "," << turn.p50 << ","
+                << turn.p95 << "," << turn.max << "," << result.errors << "\n";
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -1,35 +1,58 @@
 // main.cpp - Prompt Quest entry point
 #include "Game.h"
+#include "Log.h"
+#include "Trace.h"
 #include <stdexcept>
 #include <iostream>
 #include <map>
+#include <cstdlib>
 
 #if defined(_WIN32)
 #include <Windows.h>
 #endif
 
-int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
 #if defined(_WIN32)
+int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
     SetConsoleOutputCP(CP_UTF8);
+#else
+int main(int argc, char** argv) {
 #endif
 
+    // PQ_LOG_LEVEL でレベルを変えられる（例: PQ_LOG_LEVEL=gm=trace,npc=info）
+    Log::start(LogConfig());
+    Trace::setThreadName("main");
+
+    // PQ_TRACE=<パス> を指定すると起動直後から記録し、終了時に書き出す（実行中は F12 でも取れる）
+    const char* trace_path = std::getenv("PQ_TRACE");
+    if (trace_path && *trace_path) Trace::start();
+
     try {
         // Llama3.1ベースの日本語チューニングモデル Llama-3.1-8B-EZO-1.1-it
-        std::map<std::string, std::string> model_paths = {
-            {"GM", "llama.cpp/models/Llama-3.1-8B-EZO-1.1-it.i1-Q4_K_M.gguf"},     
-            {"NPC", "llama.cpp/models/Llama-3.1-8B-EZO-1.1-it.i1-Q4_K_M.gguf"},  
-            {"BATTLE", "llama.cpp/models/Llama-3.1-8B-EZO-1.1-it.i1-Q4_K_M.gguf"}
+        // 役割ごとに LoRA を重ねる場合は lora_path を指定する（ベースモデルは共有される）。例:
+        //   {"BATTLE", {base_model, "llama.cpp/models/lora/battle-judge.gguf", 1.0f, true}}
+        const std::string base_model = "llama.cpp/models/Llama-3.1-8B-EZO-1.1-it.i1-Q4_K_M.gguf";
+        std::map<std::string, LlmRoleConfig> role_configs = {
+            {"GM", {base_model}},
+            {"NPC", {base_model}},
+            {"BATTLE", {base_model}}
         };
+        // PQ_LLM_CTX=8192 PQ_LLM_KV_TYPE=q8_0 PQ_LLM_FLASH_ATTN=1 などで、長い会話を同じメモリで扱える
+        const LlmContextConfig context = LlmContextConfig::fromEnvironment();
+        for (auto& pair : role_configs) pair.second.context = context;
 
-        Game game(model_paths);
+        Game game(role_configs);
         if (game.init()) {
             game.run();
         }
     } catch (const std::exception& e) {
-        std::cerr << "A fatal error occurred: " << e.what() << std::endl;
+        PQ_LOG_ERROR(LogCategory::GAME, "A fatal error occurred: " << e.what());
+        if (trace_path && *trace_path) Trace::stop(trace_path);
+        Log::stop();
         SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Fatal Error", e.what(), NULL);
         return 1;
     }
     
+    if (trace_path && *trace_path) Trace::stop(trace_path);
+    Log::stop();  // Game のデストラクタが出したログまで書き切る
     return 0;
 }
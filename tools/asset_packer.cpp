@@ -0,0 +1,302 @@
+// asset_packer.cpp - Prompt Quest: 画像をデコード済みバンドルにまとめるオフラインツール
+//
+// 使い方（リポジトリ直下で実行）: asset_packer tools/assets.manifest assets.pqab [--lz4]
+//
+// マニフェストは1行1画像:
+//   <画像パス> <幅> <高さ> [key=RRGGBB] [tolerance=N]
+// 幅・高さはゲーム内で描画される最大サイズ（0はアスペクト比から求める）。
+// key を指定すると、画像の外周から繋がっているキー色付近の領域を透過にする。
+// JPEGのノイズで完全一致しない背景も抜け、内側の同色部分（白いひげ等）は残る。
+
+#define SDL_MAIN_HANDLED
+#include "AssetBundle.h"
+#include "TextureCache.h"
+#include <SDL2/SDL.h>
+#include <SDL_image.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+#if defined(PQ_HAVE_LZ4)
+#include <lz4.h>
+#endif
+
+namespace {
+
+struct PackItem {
+    std::string file;
+    int target_w = 0;
+    int target_h = 0;
+    bool use_color_key = false;
+    SDL_Color key = {0, 0, 0, 255};
+    int tolerance = 24;
+};
+
+struct PackedImage {
+    std::string name;
+    int width = 0;
+    int height = 0;
+    uint32_t compression = bundle::COMPRESSION_NONE;
+    uint64_t raw_size = 0;
+    std::vector<uint8_t> stored;
+};
+
+bool parseManifest(const std::string& path, std::vector<PackItem>& items) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Failed to open manifest: " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line)) {
+        line_no++;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+
+        std::istringstream ss(line);
+        PackItem item;
+        if (!(ss >> item.file >> item.target_w >> item.target_h)) {
+            std::cerr << path << ":" << line_no << ": expected '<file> <width> <height>'" << std::endl;
+            return false;
+        }
+        std::string opt;
+        while (ss >> opt) {
+            if (opt.rfind("key=", 0) == 0 && opt.size() == 10) {
+                unsigned long rgb = std::strtoul(opt.c_str() + 4, nullptr, 16);
+                item.use_color_key = true;
+                item.key = {Uint8((rgb >> 16) & 0xFF), Uint8((rgb >> 8) & 0xFF), Uint8(rgb & 0xFF), 255};
+            } else if (opt.rfind("tolerance=", 0) == 0) {
+                item.tolerance = std::max(0, std::atoi(opt.c_str() + 10));
+            } else {
+                std::cerr << path << ":" << line_no << ": unknown option '" << opt << "'" << std::endl;
+                return false;
+            }
+        }
+        if (item.file.size() >= bundle::NAME_SIZE) {
+            std::cerr << path << ":" << line_no << ": path too long: " << item.file << std::endl;
+            return false;
+        }
+        items.push_back(item);
+    }
+    return true;
+}
+
+int colorDistance(const uint8_t* px, SDL_Color key) {
+    int dr = std::abs(px[0] - key.r);
+    int dg = std::abs(px[1] - key.g);
+    int db = std::abs(px[2] - key.b);
+    return std::max(dr, std::max(dg, db));
+}
+
+// 外周から繋がるキー色領域を透過にし、境界は距離に応じてアルファをなだらかにする
+void removeBackground(SDL_Surface* surf, SDL_Color key, int tolerance) {
+    const int w = surf->w;
+    const int h = surf->h;
+    auto pixel = [&](int x, int y) { return static_cast<uint8_t*>(surf->pixels) + y * surf->pitch + x * 4; };
+
+    std::vector<uint8_t> background(static_cast<size_t>(w) * h, 0);
+    std::vector<int> stack;
+    auto push = [&](int x, int y) {
+        size_t idx = static_cast<size_t>(y) * w + x;
+        if (background[idx] || colorDistance(pixel(x, y), key) > tolerance) return;
+        background[idx] = 1;
+        stack.push_back(static_cast<int>(idx));
+    };
+    for (int x = 0; x < w; ++x) { push(x, 0); push(x, h - 1); }
+    for (int y = 0; y < h; ++y) { push(0, y); push(w - 1, y); }
+
+    while (!stack.empty()) {
+        int idx = stack.back();
+        stack.pop_back();
+        int x = idx % w, y = idx / w;
+        if (x > 0) push(x - 1, y);
+        if (x < w - 1) push(x + 1, y);
+        if (y > 0) push(x, y - 1);
+        if (y < h - 1) push(x, y + 1);
+    }
+
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            uint8_t* px = pixel(x, y);
+            if (background[static_cast<size_t>(y) * w + x]) {
+                px[3] = 0;
+                continue;
+            }
+            // 背景に接する画素はキー色からの距離で半透明にする（縁のにじみ対策）
+            bool edge = (x > 0 && background[static_cast<size_t>(y) * w + x - 1]) ||
+                        (x < w - 1 && background[static_cast<size_t>(y) * w + x + 1]) ||
+                        (y > 0 && background[static_cast<size_t>(y - 1) * w + x]) ||
+                        (y < h - 1 && background[static_cast<size_t>(y + 1) * w + x]);
+            if (!edge) continue;
+            int d = colorDistance(px, key);
+            if (d < tolerance * 2) {
+                int a = tolerance > 0 ? 255 * (d - tolerance) / tolerance : 255;
+                px[3] = static_cast<uint8_t>(std::max(0, std::min(255, a)) * px[3] / 255);
+            }
+        }
+    }
+}
+
+void premultiply(SDL_Surface* surf) {
+    for (int y = 0; y < surf->h; ++y) {
+        uint8_t* px = static_cast<uint8_t*>(surf->pixels) + y * surf->pitch;
+        for (int x = 0; x < surf->w; ++x, px += 4) {
+            unsigned a = px[3];
+            px[0] = static_cast<uint8_t>((px[0] * a + 127) / 255);
+            px[1] = static_cast<uint8_t>((px[1] * a + 127) / 255);
+            px[2] = static_cast<uint8_t>((px[2] * a + 127) / 255);
+        }
+    }
+}
+
+bool packImage(const PackItem& item, bool use_lz4, PackedImage& out) {
+    const std::string& path = item.file;
+    SDL_Surface* loaded = IMG_Load(path.c_str());
+    if (!loaded) {
+        std::cerr << "Failed to load image: " << path << " - " << IMG_GetError() << std::endl;
+        return false;
+    }
+    SDL_Surface* surf = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+    SDL_FreeSurface(loaded);
+    if (!surf) {
+        std::cerr << "Failed to convert image: " << path << " - " << SDL_GetError() << std::endl;
+        return false;
+    }
+
+    if (item.use_color_key) removeBackground(surf, item.key, item.tolerance);
+    // 縮小の前に乗算済みにしておくと、透過の縁が暗くにじまない
+    premultiply(surf);
+
+    int w, h;
+    TextureCache::fitSize(surf->w, surf->h, item.target_w, item.target_h, w, h);
+    if (w != surf->w || h != surf->h) {
+        SDL_Surface* scaled = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_RGBA32);
+#if SDL_VERSION_ATLEAST(2, 0, 16)
+        int rc = scaled ? SDL_SoftStretchLinear(surf, NULL, scaled, NULL) : -1;
+#else
+        // 2.0.16 より前には線形補間の縮小が無い（最近傍になるので、縁が粗くなる）
+        int rc = scaled ? SDL_SoftStretch(surf, NULL, scaled, NULL) : -1;
+#endif
+        if (rc != 0) {
+            std::cerr << "Failed to scale image: " << path << " - " << SDL_GetError() << std::endl;
+            if (scaled) SDL_FreeSurface(scaled);
+            SDL_FreeSurface(surf);
+            return false;
+        }
+        SDL_FreeSurface(surf);
+        surf = scaled;
+    }
+
+    out.name = item.file;
+    out.width = surf->w;
+    out.height = surf->h;
+    out.raw_size = static_cast<uint64_t>(surf->w) * surf->h * 4;
+
+    std::vector<uint8_t> raw(out.raw_size);
+    for (int y = 0; y < surf->h; ++y) {
+        std::memcpy(raw.data() + static_cast<size_t>(y) * surf->w * 4, static_cast<uint8_t*>(surf->pixels) + y * surf->pitch, static_cast<size_t>(surf->w) * 4);
+    }
+    SDL_FreeSurface(surf);
+
+#if defined(PQ_HAVE_LZ4)
+    if (use_lz4) {
+        std::vector<uint8_t> compressed(LZ4_compressBound(static_cast<int>(raw.size())));
+        int n = LZ4_compress_default(reinterpret_cast<const char*>(raw.data()), reinterpret_cast<char*>(compressed.data()),
+                                     static_cast<int>(raw.size()), static_cast<int>(compressed.size()));
+        // 縮まらない画像は非圧縮のまま（読み込み時に展開が不要になる）
+        if (n > 0 && static_cast<size_t>(n) < raw.size()) {
+            compressed.resize(n);
+            out.stored = std::move(compressed);
+            out.compression = bundle::COMPRESSION_LZ4;
+            return true;
+        }
+    }
+#else
+    (void)use_lz4;
+#endif
+    out.stored = std::move(raw);
+    return true;
+}
+
+bool writeBundle(const std::string& path, const std::vector<PackedImage>& images) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        std::cerr << "Failed to open output: " << path << std::endl;
+        return false;
+    }
+
+    bundle::BundleHeader header = {};
+    std::memcpy(header.magic, bundle::MAGIC, sizeof(bundle::MAGIC));
+    header.version = bundle::VERSION;
+    header.entry_count = static_cast<uint32_t>(images.size());
+
+    auto align = [](uint64_t v) { return (v + bundle::DATA_ALIGN - 1) / bundle::DATA_ALIGN * bundle::DATA_ALIGN; };
+    uint64_t offset = align(sizeof(header) + images.size() * sizeof(bundle::BundleEntry));
+
+    std::vector<bundle::BundleEntry> entries(images.size());
+    for (size_t i = 0; i < images.size(); ++i) {
+        auto& e = entries[i];
+        std::memset(&e, 0, sizeof(e));
+        std::strncpy(e.name, images[i].name.c_str(), bundle::NAME_SIZE - 1);
+        e.width = images[i].width;
+        e.height = images[i].height;
+        e.compression = images[i].compression;
+        e.offset = offset;
+        e.stored_size = images[i].stored.size();
+        e.raw_size = images[i].raw_size;
+        offset = align(offset + e.stored_size);
+    }
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(bundle::BundleEntry));
+    for (size_t i = 0; i < images.size(); ++i) {
+        uint64_t pos = static_cast<uint64_t>(out.tellp());
+        std::vector<char> padding(entries[i].offset - pos, 0);
+        out.write(padding.data(), padding.size());
+        out.write(reinterpret_cast<const char*>(images[i].stored.data()), images[i].stored.size());
+    }
+    return static_cast<bool>(out);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: asset_packer <manifest> <output.pqab> [--lz4]" << std::endl;
+        return 1;
+    }
+    std::string manifest = argv[1];
+    std::string output = argv[2];
+    bool use_lz4 = (argc > 3 && std::strcmp(argv[3], "--lz4") == 0);
+#if !defined(PQ_HAVE_LZ4)
+    if (use_lz4) std::cerr << "Warning: built without LZ4, writing uncompressed bundle" << std::endl;
+#endif
+
+    std::vector<PackItem> items;
+    if (!parseManifest(manifest, items)) return 1;
+
+    if (!(IMG_Init(IMG_INIT_JPG | IMG_INIT_PNG) & IMG_INIT_JPG)) {
+        std::cerr << "IMG_Init Error: " << IMG_GetError() << std::endl;
+        return 1;
+    }
+
+    std::vector<PackedImage> images;
+    for (const auto& item : items) {
+        PackedImage image;
+        if (!packImage(item, use_lz4, image)) { IMG_Quit(); return 1; }
+        std::cout << item.file << ": " << image.width << "x" << image.height
+                  << " (" << image.stored.size() / 1024 << " KB" << (image.compression == bundle::COMPRESSION_LZ4 ? ", lz4" : "") << ")" << std::endl;
+        images.push_back(std::move(image));
+    }
+    IMG_Quit();
+
+    if (!writeBundle(output, images)) return 1;
+    std::cout << "Wrote " << images.size() << " images to " << output << std::endl;
+    return 0;
+}
@@ -0,0 +1,487 @@
+// game_server.cpp - Prompt Quest: 画面を持たずに複数のプレイヤーのゲームを進めるサーバー（POSIX のみ）
+//
+// 使い方（リポジトリ直下で実行）: game_server [--port 7700] [--host 127.0.0.1] [--max-sessions 16] [--parallel 8]
+//                                            [--kv-budget-mb 4096] [--root <dir>] [--model <gguf>] [--mock <台本>]
+//                                            [--story-ms 2500] [--seed S]
+//   --parallel      LlmManager で同時に生成するリクエストの数（連続バッチ処理。1 なら1件ずつ）
+//   --kv-budget-mb  モデル1つのKVキャッシュの上限。--parallel はこれに収まる数に絞られる（0 は無制限）
+//   --mock      モデルを使わず MockBackend の台本で応答する（バッチ処理は模さない）
+//
+// TCP の1接続が1つの GameSession（1人分の会話・GMの判定・戦闘・もちもの）になる。どのセッションの推論も
+// 1つの LlmManager に入り、生成中の各セッションの次の1トークンは同じ llama_decode でまとめて計算される。
+// 長老の記憶（会話と出来事）はプレイヤーの間で混ざらないよう、サーバーでは使わない（世界設定だけを引く）。
+// GMの判定は候補の比較（classify()。バッチの外でプリフィルを1件ずつ計算し、その間は他の生成が止まる）ではなく、
+// ほかの生成と同じバッチに入る JSON の生成で行う。
+//
+// 行単位のテキストで、フィールドはタブ区切り（本文中のタブと改行は空白に置き換える）。
+//   クライアント → サーバー: START / SAY <文> / DEPART / EQUIP <もちもの欄の位置> / QUIT
+//   サーバー → クライアント: HELLO <セッション番号> / STATE <状態> / LOG <行> / DEPART <0|1> /
+//     STATUS <hp> <mp> <atk> <def> <mat> <mdf> <spd> / ENEMY <名前> <hp> / ITEMS <名前[*=装備中]>... /
+//     READY <状態>（受け付けた操作の結果が出そろい、次の操作を受け付けられるようになった）/ ERROR <理由>
+// PQ_LLM_CTX などの設定はゲームと同じ環境変数で指定する。Ctrl+C で止める。
+
+#include "GameSession.h"
+#include "LlmManager.h"
+#include "Log.h"
+#include "MockBackend.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+const int POLL_TIMEOUT_MS = 10;          // 入力が無くても、この間隔でセッションを進める
+const size_t MAX_LINE_BYTES = 4096;      // これより長い行を送ってくる接続は切る
+const size_t MAX_PENDING_BYTES = 1 << 20;  // 読まない接続への送信がこれを超えたら切る
+
+volatile std::sig_atomic_t stopRequested = 0;
+
+void onSignal(int) { stopRequested = 1; }
+
+// 共有の推論をセッションごとに包む。cancelPending() はこのセッションの生成だけを打ち切り、
+// 長老の記憶とシード・記録は他のプレイヤーと混ざらないよう共有の推論に渡さない
+class SessionBackend : public InferenceBackend {
+public:
+    // manager は shared が LlmManager のとき（打ち切りを CancelScope で分ける）。MockBackend なら nullptr
+    SessionBackend(InferenceBackend& shared, LlmManager* manager) : shared(shared), manager(manager) {}
+
+    GmResponse generateGmResponse(const ConversationView& history, const GmDecisionCallback& on_decision) override {
+        return scoped([&]() { return shared.generateGmResponse(history, on_decision); });
+    }
+    GmResponse generateGmDecision(const ConversationView& history, const GmDecisionCallback& on_decision) override {
+        return scoped([&]() { return shared.generateGmDecision(history, on_decision); });
+    }
+    std::string generateNpcDialogue(const ConversationView& history, const std::string& scene_context) override {
+        return scoped([&]() { return shared.generateNpcDialogue(history, scene_context); });
+    }
+    BattleResponse generateBattleResponse(const std::string& player_stats, const std::string& enemy_stats, const std::string& player_action,
+                                          const std::string& enemy_info, const BattleDecisionCallback& on_decision) override {
+        return scoped([&]() { return shared.generateBattleResponse(player_stats, enemy_stats, player_action, enemy_info, on_decision); });
+    }
+    std::string generateBattleNarration(const std::string& player_action, const std::string& enemy_info, const std::string& outcome) override {
+        return scoped([&]() { return shared.generateBattleNarration(player_action, enemy_info, outcome); });
+    }
+
+    // MockBackend の cancelPending() は全員の応答を打ち切るので、モックでは遅延が終わるのを待つ
+    void cancelPending() override { cancelEpoch.fetch_add(1); }
+    void setSeed(uint32_t) override {}
+    void prefetch(const std::string& role) override { shared.prefetch(role); }
+    void measureTokens(const std::string& role, ChatTurn& turn) override { shared.measureTokens(role, turn); }
+
+private:
+    InferenceBackend& shared;
+    LlmManager* manager;
+    std::atomic<uint64_t> cancelEpoch{0};
+
+    template <typename F>
+    auto scoped(F&& generate) -> decltype(generate()) {
+        if (!manager) return generate();
+        LlmManager::CancelScope scope(cancelEpoch);
+        return generate();
+    }
+};
+
+// 1行に収まるようにタブと改行を空白にする
+std::string field(std::string text) {
+    for (char& c : text) {
+        if (c == '\t' || c == '\n' || c == '\r') c = ' ';
+    }
+    return text;
+}
+
+struct Connection {
+    int fd = -1;
+    uint32_t id = 0;
+    std::string input;
+    std::string output;
+    // backend はセッションより長く生きる（セッションのデストラクタが生成の終わりを待つ）
+    std::unique_ptr<SessionBackend> backend;
+    std::unique_ptr<GameSession> session;
+
+    // クライアントに送った内容（変わったものだけを送る）
+    uint64_t sentLines = 0;
+    std::string sentState, sentDeparture, sentStatus, sentEnemy, sentItems;
+    bool awaitingReady = false;  // 受け付けた操作の READY をまだ送っていない
+};
+
+class GameServer {
+public:
+    struct Options {
+        std::string host = "127.0.0.1";
+        int port = 7700;
+        size_t maxSessions = 16;
+        uint32_t seed = BattleResolver::DEFAULT_SEED;
+        uint32_t storyLineMs = 2500;
+    };
+
+    GameServer(const ContentDatabase& content, InferenceBackend& llm, LlmManager* manager, const Options& options)
+        : content(content), llm(llm), manager(manager), options(options) {}
+
+    ~GameServer() {
+        if (listenFd >= 0) close(listenFd);
+        for (auto& conn : connections) {
+            if (conn->fd >= 0) close(conn->fd);
+        }
+    }
+
+    bool listen() {
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listenFd < 0) {
+            std::cerr << "socket failed: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        int reuse = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(options.port));
+        if (inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr) != 1) {
+            std::cerr << "invalid host address: " << options.host << std::endl;
+            return false;
+        }
+        if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(listenFd, 64) != 0) {
+            std::cerr << "cannot listen on " << options.host << ":" << options.port << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+        return true;
+    }
+
+    void run() {
+        PQ_LOG_INFO(LogCategory::GAME, "game server listening on " << options.host << ":" << options.port
+                    << " (max " << options.maxSessions << " sessions)");
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<pollfd> fds;
+        while (!stopRequested) {
+            fds.clear();
+            fds.push_back({listenFd, POLLIN, 0});
+            for (auto& conn : connections) {
+                fds.push_back({conn->fd, static_cast<short>(POLLIN | (conn->output.empty() ? 0 : POLLOUT)), 0});
+            }
+            if (poll(fds.data(), fds.size(), POLL_TIMEOUT_MS) < 0 && errno != EINTR) {
+                PQ_LOG_ERROR(LogCategory::GAME, "poll failed: " << std::strerror(errno));
+                break;
+            }
+            const uint32_t now_ms = static_cast<uint32_t>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+
+            if (fds[0].revents & POLLIN) accept(now_ms);
+            for (size_t i = 1; i < fds.size(); ++i) {
+                Connection& conn = *connections[i - 1];
+                if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) receive(conn, now_ms);
+                if (conn.fd >= 0 && (fds[i].revents & POLLOUT)) flush(conn);
+            }
+
+            bool idle = true;
+            for (auto& conn : connections) {
+                if (conn->fd < 0) continue;
+                conn->session->update(now_ms);
+                publish(*conn);
+                flush(*conn);
+                if (conn->session->llmBusy()) idle = false;
+            }
+            llm.setThreadsIdle(idle);
+            sweep();
+        }
+
+        PQ_LOG_INFO(LogCategory::GAME, "stopping game server (" << connections.size() << " sessions)");
+        for (auto& conn : connections) disconnect(*conn);
+        sweep();
+        for (auto& conn : closing) conn->session->waitPending();
+        closing.clear();
+    }
+
+private:
+    const ContentDatabase& content;
+    InferenceBackend& llm;
+    LlmManager* manager;
+    Options options;
+    int listenFd = -1;
+    uint32_t nextId = 1;
+    std::vector<std::unique_ptr<Connection>> connections;
+    std::list<std::unique_ptr<Connection>> closing;  // 切断したが、生成中の応答がまだ届いていない
+
+    void accept(uint32_t now_ms) {
+        for (;;) {
+            int fd = ::accept(listenFd, nullptr, nullptr);
+            if (fd < 0) return;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            int nodelay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+            if (connections.size() >= options.maxSessions) {
+                const std::string full = "ERROR\tserver full\n";
+                (void)::send(fd, full.data(), full.size(), MSG_NOSIGNAL);
+                close(fd);
+                PQ_LOG_WARN(LogCategory::GAME, "rejected a connection: " << connections.size() << " sessions already");
+                continue;
+            }
+
+            auto conn = std::make_unique<Connection>();
+            conn->fd = fd;
+            conn->id = nextId++;
+            conn->backend = std::make_unique<SessionBackend>(llm, manager);
+            conn->session = std::make_unique<GameSession>(content);
+            GameSession& session = *conn->session;
+            session.options.seed = options.seed + conn->id;  // 戦闘の乱数はプレイヤーごとに変える
+            session.options.storyLineMs = options.storyLineMs;
+            session.options.gmClassifier = false;  // 判定もバッチに入れる（classify() はバッチの外で全体を止める）
+            if (!session.init()) {
+                close(fd);
+                continue;
+            }
+            session.setBackend(conn->backend.get());
+            session.update(now_ms);
+            conn->output += "HELLO\t" + std::to_string(conn->id) + "\n";
+            publish(*conn);
+            PQ_LOG_INFO(LogCategory::GAME, "session " << conn->id << " connected (" << connections.size() + 1 << " sessions)");
+            connections.push_back(std::move(conn));
+        }
+    }
+
+    void receive(Connection& conn, uint32_t now_ms) {
+        char buffer[4096];
+        for (;;) {
+            ssize_t n = ::recv(conn.fd, buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                conn.input.append(buffer, static_cast<size_t>(n));
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) break;
+            disconnect(conn);  // 0 なら相手が閉じた
+            return;
+        }
+        size_t begin = 0;
+        for (size_t end; conn.fd >= 0 && (end = conn.input.find('\n', begin)) != std::string::npos; begin = end + 1) {
+            std::string line = conn.input.substr(begin, end - begin);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            handle(conn, line, now_ms);
+        }
+        if (conn.fd < 0) return;
+        conn.input.erase(0, begin);
+        if (conn.input.size() > MAX_LINE_BYTES) {
+            PQ_LOG_WARN(LogCategory::GAME, "session " << conn.id << ": line too long, disconnecting");
+            disconnect(conn);
+        }
+    }
+
+    void handle(Connection& conn, const std::string& line, uint32_t now_ms) {
+        const size_t tab = line.find('\t');
+        const std::string command = line.substr(0, tab);
+        const std::string arg = tab == std::string::npos ? "" : line.substr(tab + 1);
+        SessionInput input;
+        if (command == "QUIT") {
+            disconnect(conn);
+            return;
+        } else if (command == "START") {
+            input.kind = SessionInputKind::START;
+        } else if (command == "SAY") {
+            input.kind = SessionInputKind::TEXT;
+            input.text = arg;
+        } else if (command == "DEPART") {
+            input.kind = SessionInputKind::DEPART;
+        } else if (command == "EQUIP") {
+            input.kind = SessionInputKind::EQUIP;
+            input.item = std::atoi(arg.c_str());
+        } else {
+            conn.output += "ERROR\tunknown command " + field(command) + "\n";
+            return;
+        }
+        GameSession& session = *conn.session;
+        if (!session.applyInput(input, now_ms)) {
+            conn.output += std::string("ERROR\tnot accepted in ") + GameSession::stateName(session.state()) + "\n";
+            return;
+        }
+        conn.awaitingReady = true;
+        session.update(now_ms);
+        publish(conn);
+    }
+
+    // 前回送ってから変わったものを送る
+    void publish(Connection& conn) {
+        const GameSession& session = *conn.session;
+        auto send_if_changed = [&conn](std::string& sent, std::string current) {
+            if (current == sent) return;
+            conn.output += current + "\n";
+            sent = std::move(current);
+        };
+
+        // 行は足した数で数える（出発で画面のログが消えても、届いていない行だけを送る）
+        const std::vector<std::string>& log = session.log();
+        const uint64_t fresh = std::min<uint64_t>(session.logCount() - conn.sentLines, log.size());
+        for (size_t i = log.size() - static_cast<size_t>(fresh); i < log.size(); ++i) conn.output += "LOG\t" + field(log[i]) + "\n";
+        conn.sentLines = session.logCount();
+
+        send_if_changed(conn.sentState, std::string("STATE\t") + GameSession::stateName(session.state()));
+        send_if_changed(conn.sentDeparture, session.departureAvailable() ? "DEPART\t1" : "DEPART\t0");
+        const Stats& stats = session.playerStats();
+        std::string status = "STATUS";
+        for (int value : {stats.hp, stats.mp, stats.atk, stats.def, stats.mat, stats.mdf, stats.spd}) status += "\t" + std::to_string(value);
+        send_if_changed(conn.sentStatus, std::move(status));
+        if (session.enemy()) {
+            send_if_changed(conn.sentEnemy, "ENEMY\t" + field(session.enemy()->name) + "\t" + std::to_string(session.enemyStats().hp));
+        }
+        std::string items = "ITEMS";
+        for (const Item& item : session.inventory()) items += "\t" + field(item.name) + (item.is_equipped ? "*" : "");
+        send_if_changed(conn.sentItems, std::move(items));
+
+        if (conn.awaitingReady && session.acceptsInput()) {
+            conn.output += std::string("READY\t") + GameSession::stateName(session.state()) + "\n";
+            conn.awaitingReady = false;
+        }
+    }
+
+    void flush(Connection& conn) {
+        while (conn.fd >= 0 && !conn.output.empty()) {
+            ssize_t n = ::send(conn.fd, conn.output.data(), conn.output.size(), MSG_NOSIGNAL);
+            if (n > 0) {
+                conn.output.erase(0, static_cast<size_t>(n));
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) break;
+            disconnect(conn);
+            return;
+        }
+        if (conn.output.size() > MAX_PENDING_BYTES) {
+            PQ_LOG_WARN(LogCategory::GAME, "session " << conn.id << ": client is not reading, disconnecting");
+            disconnect(conn);
+        }
+    }
+
+    void disconnect(Connection& conn) {
+        if (conn.fd < 0) return;
+        close(conn.fd);
+        conn.fd = -1;
+        conn.backend->cancelPending();  // このセッションの生成だけを打ち切る
+        PQ_LOG_INFO(LogCategory::GAME, "session " << conn.id << " disconnected");
+    }
+
+    // 切断したセッションは、生成中の応答が届いてから解放する（ループを止めて待たない）
+    void sweep() {
+        for (auto it = connections.begin(); it != connections.end();) {
+            if ((*it)->fd >= 0) {
+                ++it;
+                continue;
+            }
+            closing.push_back(std::move(*it));
+            it = connections.erase(it);
+        }
+        for (auto it = closing.begin(); it != closing.end();) {
+            if ((*it)->session->inFlight()) {
+                ++it;
+                continue;
+            }
+            it = closing.erase(it);
+        }
+    }
+};
+
+} // namespace
+
+int main(int argc, char** argv) {
+    GameServer::Options options;
+    std::string root;
+    std::string model = "llama.cpp/models/Llama-3.1-8B-EZO-1.1-it.i1-Q4_K_M.gguf";
+    std::string mockScript;
+    int parallel = 8;
+    size_t kv_budget_mb = LlmManager::DEFAULT_BATCH_KV_BYTES >> 20;
+    bool usage = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--port" && i + 1 < argc) options.port = std::atoi(argv[++i]);
+        else if (arg == "--host" && i + 1 < argc) options.host = argv[++i];
+        else if (arg == "--max-sessions" && i + 1 < argc) options.maxSessions = static_cast<size_t>(std::max(1, std::atoi(argv[++i])));
+        else if (arg == "--parallel" && i + 1 < argc) parallel = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--kv-budget-mb" && i + 1 < argc) kv_budget_mb = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--root" && i + 1 < argc) root = argv[++i];
+        else if (arg == "--model" && i + 1 < argc) model = argv[++i];
+        else if (arg == "--mock" && i + 1 < argc) mockScript = argv[++i];
+        else if (arg == "--story-ms" && i + 1 < argc) options.storyLineMs = static_cast<uint32_t>(std::max(0, std::atoi(argv[++i])));
+        else if (arg == "--seed" && i + 1 < argc) options.seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        else usage = true;
+    }
+    if (usage) {
+        std::cerr << "Usage: game_server [--port N] [--host <addr>] [--max-sessions N] [--parallel N] [--kv-budget-mb N] [--root <dir>]"
+                     " [--model <gguf>] [--mock <script>] [--story-ms N] [--seed S]" << std::endl;
+        return 1;
+    }
+    if (!root.empty() && root.back() != '/') root += '/';
+
+    LogConfig log_config;
+    log_config.path = "logs/game_server.log";
+    Log::start(log_config);
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    int exit_code = 0;
+    try {
+        ContentDatabase content;
+        if (!content.loadFromFile(root + "data/content.txt")) {
+            std::cerr << "Failed to load content database." << std::endl;
+            Log::stop();
+            return 1;
+        }
+
+        std::unique_ptr<InferenceBackend> llm;
+        LlmManager* manager = nullptr;
+        if (!mockScript.empty()) {
+            auto mock = std::make_unique<MockBackend>();
+            if (!mock->loadScript(root + mockScript)) {
+                std::cerr << "Failed to load mock script " << root + mockScript << std::endl;
+                Log::stop();
+                return 1;
+            }
+            // 台本の遅延はセッションごとに並行して流す（--parallel 1 なら実際のモデルのように1件ずつ）
+            mock->setSerialized(parallel <= 1);
+            llm = std::move(mock);
+        } else {
+            // ゲームの main.cpp と同じ役割の構成
+            std::map<std::string, LlmRoleConfig> role_configs = {
+                {"GM", {root + model}},
+                {"NPC", {root + model}},
+                {"BATTLE", {root + model}}
+            };
+            const LlmContextConfig context = LlmContextConfig::fromEnvironment();
+            for (auto& pair : role_configs) pair.second.context = context;
+
+            auto llama = std::make_unique<LlmManager>(role_configs, LlmThreadConfig::fromEnvironment());
+            // スロットの分のKVはコンテキストを作るときに確保するので、モデルを読み込む前に設定する
+            llama->setParallelSequences(parallel, kv_budget_mb << 20);
+            llama->setModelBudget(size_t(10) * 1024 * 1024 * 1024);
+            llama->prefetch("GM");
+            llama->prefetch("NPC");
+            manager = llama.get();
+            llm = std::move(llama);
+        }
+        llm->setSeed(options.seed);
+        GameSession::addLore(content, *llm);
+
+        GameServer server(content, *llm, manager, options);
+        if (!server.listen()) {
+            exit_code = 1;
+        } else {
+            server.run();
+        }
+    } catch (const std::exception& e) {
+        PQ_LOG_ERROR(LogCategory::GAME, "game server failed: " << e.what());
+        exit_code = 1;
+    }
+
+    Log::stop();
+    return exit_code;
+}
@@ -0,0 +1,451 @@
+// inference_worker.cpp - Prompt Quest: ゲームとは別のプロセスで推論を受け持つワーカー（Linux のみ）
+//
+// 使い方（リポジトリ直下で実行）: inference_worker [--name pq] [--root <dir>] [--model [<役割>=]<gguf>]...
+//                                   [--lora <役割>=<gguf>[:<scale>]]... [--compact-prompt <役割>]... [--semantic-cache]
+//   ゲームは PQ_LLM_WORKER=<name> を付けて起動すると、このワーカーに推論を頼む（つながらなければ自分で推論する）。
+//
+// モデル・KVキャッシュ・プレフィックスキャッシュはワーカーが持ち続けるので、ゲームを起動し直しても読み込みを待たない。
+// ゲームはつなぐときに役割ごとの設定を送ってくる。モデル・LoRA・短いプロンプト・コンテキストのどれかが
+// ワーカーの設定と違うゲームは断る（ゲームは自分で推論する）。PQ_LLM_CTX などはゲームと同じ環境変数で指定する。
+// 同時に ipc::MAX_CLIENTS 個までのゲームをつなげる。要求はワーカーの1つの LlmManager に入るので、
+// 実際の生成は役割ごとの順番待ちになる。長老の記憶とシードはゲームごとに持てないので、2つ以上つないでいる間は
+// 記憶を空にして、記憶とシードの指示を捨てる（1つに戻ってからの分は覚える）。Ctrl+C で止める。
+
+#include "InferenceIpc.h"
+#include "LlmManager.h"
+#include "Log.h"
+#include <array>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+
+namespace {
+
+const int RESPONSE_TIMEOUT_MS = 2000;  // 応答のリングが空くのを待つ時間（読まないゲームは切り捨てる）
+const int DOORBELL_POLL_MS = 200;      // 要求が無いときにゲームの生存を確かめる間隔
+const int CLAIM_TIMEOUT_MS = 5000;     // pid を書く前に終了したゲームの CLAIMING の枠を空けるまでの時間
+
+volatile std::sig_atomic_t stopRequested = 0;
+
+void onSignal(int) { stopRequested = 1; }
+
+// ワーカー側の枠ごとの状態
+struct Client {
+    std::mutex writeMutex;   // 応答のリングへの書き込みを直列化する（生成は枠ごとに並行する）
+    uint32_t generation = 0; // 書き込むときに枠が同じ接続のままか確かめる
+    bool connected = false;
+    bool accepted = false;   // 役割の設定が一致した（それまでは要求を受けない）
+    bool idle = true;
+    std::chrono::steady_clock::time_point claimingSince;  // CLAIMING を最初に見た時刻（それ以外なら既定値）
+};
+
+class InferenceWorker {
+public:
+    // role_configs は役割 → LlmRoleConfig::summary()（つないできたゲームの設定と比べる）
+    InferenceWorker(LlmManager& llm, ipc::SharedRegion& region, std::map<std::string, std::string> role_configs)
+        : llm(llm), region(region), roleConfigs(std::move(role_configs)) {}
+
+    void run() {
+        PQ_LOG_INFO(LogCategory::LLM, "inference worker ready (" << ipc::MAX_CLIENTS << " client slots)");
+        std::string message;
+        while (!stopRequested) {
+            uint32_t seen = region.doorbell.load(std::memory_order_acquire);
+            bool handled = false;
+            for (size_t i = 0; i < ipc::MAX_CLIENTS; ++i) {
+                ipc::ClientSlot& slot = region.slots[i];
+                if (!checkSlot(i)) continue;
+                ipc::Ring requests(slot.requests, slot.requestData);
+                while (requests.read(message, 0)) {
+                    handle(i, message);
+                    handled = true;
+                }
+            }
+            pruneTasks();
+            if (!handled) ipc::wait(region.doorbell, seen, DOORBELL_POLL_MS);
+        }
+
+        PQ_LOG_INFO(LogCategory::LLM, "stopping inference worker");
+        llm.cancelPending();
+        for (auto& task : tasks) task.wait();
+    }
+
+private:
+    LlmManager& llm;
+    ipc::SharedRegion& region;
+    const std::map<std::string, std::string> roleConfigs;
+    std::array<Client, ipc::MAX_CLIENTS> clients;
+    std::list<std::future<void>> tasks;
+    std::set<std::string> lore;  // どのゲームも起動時に同じものを送ってくるので、1度だけ入れる
+
+    // 切断・終了したゲームの枠を空ける。CONNECTED なら true
+    bool checkSlot(size_t index) {
+        ipc::ClientSlot& slot = region.slots[index];
+        auto state = static_cast<ipc::SlotState>(slot.state.load(std::memory_order_acquire));
+        if (state == ipc::SlotState::CLAIMING) {
+            releaseAbandonedClaim(index);
+            return false;
+        }
+        clients[index].claimingSince = {};
+        if (state == ipc::SlotState::CONNECTED) {
+            Client& client = clients[index];
+            if (!client.connected) {
+                // つながったばかり
+                std::lock_guard<std::mutex> lock(client.writeMutex);
+                client.generation = slot.generation.load(std::memory_order_relaxed);
+                client.connected = true;
+                client.accepted = false;
+                client.idle = true;
+                PQ_LOG_INFO(LogCategory::LLM, "client " << index << " connected (pid " << slot.pid.load() << ")");
+                const size_t count = connectedClients();
+                if (count > 1) {
+                    // 先にいたゲームの会話を、このゲームの長老が思い出さないように
+                    llm.forgetEpisodes();
+                    PQ_LOG_INFO(LogCategory::LLM, count << " clients connected; episodic memory and seeds are not shared between them");
+                }
+            }
+            if (ipc::processAlive(slot.pid.load(std::memory_order_relaxed))) return true;
+            state = ipc::SlotState::CLOSED;
+        }
+        if (state != ipc::SlotState::CLOSED) return false;
+
+        Client& client = clients[index];
+        {
+            std::lock_guard<std::mutex> lock(client.writeMutex);
+            // 世代を進めると、生成中の要求の応答は書かれずに捨てられる
+            slot.generation.fetch_add(1, std::memory_order_acq_rel);
+            client.connected = false;
+            client.accepted = false;
+            client.idle = true;
+            slot.pid.store(0, std::memory_order_relaxed);
+            slot.state.store(static_cast<uint32_t>(ipc::SlotState::FREE), std::memory_order_release);
+        }
+        PQ_LOG_INFO(LogCategory::LLM, "client " << index << " disconnected");
+        updateIdle();
+        return false;
+    }
+
+    // 枠を取ってから CONNECTED にするまでの間に終了したゲームの枠を空ける（放っておくと枠が尽きる）
+    void releaseAbandonedClaim(size_t index) {
+        ipc::ClientSlot& slot = region.slots[index];
+        Client& client = clients[index];
+        const auto now = std::chrono::steady_clock::now();
+        if (client.claimingSince == std::chrono::steady_clock::time_point()) client.claimingSince = now;
+        const int32_t pid = slot.pid.load(std::memory_order_acquire);
+        // pid があればその生死で、まだ無ければ（CAS の直後に終了した）時間で決める
+        const bool abandoned = pid != 0 ? !ipc::processAlive(pid) : now - client.claimingSince >= std::chrono::milliseconds(CLAIM_TIMEOUT_MS);
+        if (!abandoned) return;
+
+        // 取ったゲームはもういないので、CAS の前に pid を消しても他の誰も書き換えない
+        uint32_t expected = static_cast<uint32_t>(ipc::SlotState::CLAIMING);
+        slot.pid.store(0, std::memory_order_relaxed);
+        if (slot.state.compare_exchange_strong(expected, static_cast<uint32_t>(ipc::SlotState::FREE), std::memory_order_acq_rel)) {
+            PQ_LOG_WARN(LogCategory::LLM, "client " << index << " exited while connecting (pid " << pid << "); slot released");
+        }
+        client.claimingSince = {};
+    }
+
+    void respond(size_t index, uint32_t generation, const ipc::MessageWriter& message) {
+        ipc::ClientSlot& slot = region.slots[index];
+        Client& client = clients[index];
+        std::lock_guard<std::mutex> lock(client.writeMutex);
+        if (!client.connected || client.generation != generation) {
+            return;  // 要求を出したゲームはもういない
+        }
+        if (!ipc::Ring(slot.responses, slot.responseData).write(message.data(), RESPONSE_TIMEOUT_MS)) {
+            PQ_LOG_WARN(LogCategory::LLM, "client " << index << " is not reading responses; dropped " << message.data().size() << " bytes");
+        }
+    }
+
+    // 生成は std::async に任せて、次の要求（取り消しなど）をすぐ読めるようにする
+    template <typename F>
+    void spawn(size_t index, uint64_t id, F work) {
+        const uint32_t generation = clients[index].generation;
+        tasks.push_back(std::async(std::launch::async, [this, index, id, generation, work]() {
+            try {
+                work(generation);
+            } catch (const std::exception& e) {
+                respond(index, generation, ipc::MessageWriter(ipc::MessageType::ERROR_RESULT, id).str(e.what()));
+            }
+        }));
+    }
+
+    void pruneTasks() {
+        for (auto it = tasks.begin(); it != tasks.end();) {
+            if (it->wait_for(std::chrono::seconds(0)) == std::future_status::ready) it = tasks.erase(it);
+            else ++it;
+        }
+    }
+
+    size_t connectedClients() const {
+        size_t count = 0;
+        for (const auto& slot : region.slots) {
+            if (slot.state.load(std::memory_order_acquire) == static_cast<uint32_t>(ipc::SlotState::CONNECTED)) count++;
+        }
+        return count;
+    }
+
+    // 記憶とシードは1つの LlmManager にしか無いので、つないでいるゲームが1つのときだけ変えてよい
+    bool ownsMemory() const { return connectedClients() == 1; }
+
+    // 役割ごとの設定がこちらと同じなら空、違えば理由
+    std::string compareRoleConfigs(ipc::MessageReader& in) const {
+        std::map<std::string, std::string> theirs;
+        const uint32_t count = in.u32();
+        for (uint32_t i = 0; i < count && in.ok(); ++i) {
+            std::string role = in.str();
+            theirs[role] = in.str();
+        }
+        if (!in.ok()) return "malformed role configs";
+        for (const auto& pair : roleConfigs) {
+            auto it = theirs.find(pair.first);
+            if (it == theirs.end()) return "role " + pair.first + " is missing (worker: " + pair.second + ")";
+            if (it->second != pair.second) return "role " + pair.first + " differs (worker: " + pair.second + ", game: " + it->second + ")";
+        }
+        for (const auto& pair : theirs) {
+            if (!roleConfigs.count(pair.first)) return "role " + pair.first + " is not served by the worker";
+        }
+        return "";
+    }
+
+    // 推論スレッドを眠らせるのは、つないでいるゲームがすべて入力待ちのときだけ
+    void updateIdle() {
+        bool idle = true;
+        for (size_t i = 0; i < ipc::MAX_CLIENTS; ++i) {
+            if (region.slots[i].state.load(std::memory_order_acquire) != static_cast<uint32_t>(ipc::SlotState::CONNECTED)) continue;
+            if (!clients[i].idle) idle = false;
+        }
+        llm.setThreadsIdle(idle);
+    }
+
+    void handle(size_t index, const std::string& data) {
+        ipc::MessageReader in(data);
+        const uint64_t id = in.id();
+        if (in.type() == ipc::MessageType::ROLE_CONFIGS) {
+            std::string mismatch = compareRoleConfigs(in);
+            if (!mismatch.empty()) {
+                PQ_LOG_WARN(LogCategory::LLM, "client " << index << " refused: " << mismatch);
+                respond(index, clients[index].generation, ipc::MessageWriter(ipc::MessageType::ERROR_RESULT, id).str(mismatch));
+                return;
+            }
+            clients[index].accepted = true;
+            respond(index, clients[index].generation, ipc::MessageWriter(ipc::MessageType::TEXT_RESULT, id).str(""));
+            return;
+        }
+        if (!clients[index].accepted) {
+            // 設定を確かめる前の要求（断ったゲームが送ってきたもの）は受けない
+            if (id != 0) respond(index, clients[index].generation, ipc::MessageWriter(ipc::MessageType::ERROR_RESULT, id).str("role configs not accepted"));
+            return;
+        }
+        switch (in.type()) {
+            case ipc::MessageType::GM_RESPONSE:
+            case ipc::MessageType::GM_DECISION: {
+                auto history = std::make_shared<ConversationState>();
+                if (!ipc::readHistory(in, *history)) break;
+                const bool decision_only = in.type() == ipc::MessageType::GM_DECISION;
+                spawn(index, id, [this, index, id, history, decision_only](uint32_t generation) {
+                    auto on_decision = [&](const GmResponse& decision) {
+                        ipc::MessageWriter out(ipc::MessageType::GM_DECISION_READY, id);
+                        ipc::writeGm(out, decision);
+                        respond(index, generation, out);
+                        return true;
+                    };
+                    GmResponse res = decision_only ? llm.generateGmDecision(history->snapshot(), on_decision)
+                                                   : llm.generateGmResponse(history->snapshot(), on_decision);
+                    ipc::MessageWriter out(ipc::MessageType::GM_RESULT, id);
+                    ipc::writeGm(out, res);
+                    respond(index, generation, out);
+                });
+                return;
+            }
+            case ipc::MessageType::NPC_DIALOGUE: {
+                auto history = std::make_shared<ConversationState>();
+                if (!ipc::readHistory(in, *history)) break;
+                std::string scene_context = in.str();
+                spawn(index, id, [this, index, id, history, scene_context](uint32_t generation) {
+                    std::string text = llm.generateNpcDialogue(history->snapshot(), scene_context);
+                    respond(index, generation, ipc::MessageWriter(ipc::MessageType::TEXT_RESULT, id).str(text));
+                });
+                return;
+            }
+            case ipc::MessageType::BATTLE_RESPONSE: {
+                std::string player_stats = in.str();
+                std::string enemy_stats = in.str();
+                std::string player_action = in.str();
+                std::string enemy_info = in.str();
+                if (!in.ok()) break;
+                spawn(index, id, [=](uint32_t generation) {
+                    auto on_decision = [&](const BattleResponse& decision) {
+                        ipc::MessageWriter out(ipc::MessageType::BATTLE_DECISION_READY, id);
+                        ipc::writeBattle(out, decision);
+                        respond(index, generation, out);
+                        return true;
+                    };
+                    BattleResponse res = llm.generateBattleResponse(player_stats, enemy_stats, player_action, enemy_info, on_decision);
+                    ipc::MessageWriter out(ipc::MessageType::BATTLE_RESULT, id);
+                    ipc::writeBattle(out, res);
+                    respond(index, generation, out);
+                });
+                return;
+            }
+            case ipc::MessageType::BATTLE_NARRATION: {
+                std::string player_action = in.str();
+                std::string enemy_info = in.str();
+                std::string outcome = in.str();
+                if (!in.ok()) break;
+                spawn(index, id, [=](uint32_t generation) {
+                    std::string text = llm.generateBattleNarration(player_action, enemy_info, outcome);
+                    respond(index, generation, ipc::MessageWriter(ipc::MessageType::TEXT_RESULT, id).str(text));
+                });
+                return;
+            }
+            case ipc::MessageType::CANCEL:
+                // ゲーム側はもう待っていない。生成を打ち切ると他のゲームの要求も切り上がるので、1つだけのときに限る
+                if (connectedClients() == 1) llm.cancelPending();
+                return;
+            case ipc::MessageType::SET_SEED:
+                if (ownsMemory()) llm.setSeed(in.u32());
+                return;
+            case ipc::MessageType::PREFETCH:
+                llm.prefetch(in.str());
+                return;
+            case ipc::MessageType::THREADS_IDLE:
+                clients[index].idle = in.u8() != 0;
+                updateIdle();
+                return;
+            case ipc::MessageType::ADD_LORE: {
+                std::string text = in.str();
+                if (in.ok() && lore.insert(text).second) llm.addLore(text);
+                return;
+            }
+            case ipc::MessageType::REMEMBER_TURN: {
+                ChatTurn turn;
+                turn.role = in.u8() == static_cast<uint8_t>(ChatRole::ASSISTANT) ? ChatRole::ASSISTANT : ChatRole::USER;
+                turn.serial = in.u64();
+                turn.text = in.str();
+                if (in.ok() && ownsMemory()) llm.rememberTurn(turn);
+                return;
+            }
+            case ipc::MessageType::REMEMBER_EVENT: {
+                std::string text = in.str();
+                if (in.ok() && ownsMemory()) llm.rememberEvent(text);
+                return;
+            }
+            case ipc::MessageType::FORGET_EPISODES:
+                if (ownsMemory()) llm.forgetEpisodes();
+                return;
+            default:
+                break;
+        }
+        PQ_LOG_WARN(LogCategory::LLM, "client " << index << " sent a malformed message (type " << static_cast<int>(in.type()) << ")");
+        if (id != 0) respond(index, clients[index].generation, ipc::MessageWriter(ipc::MessageType::ERROR_RESULT, id).str("malformed request"));
+    }
+};
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string name = "pq";
+    std::string root;
+    // ゲームの main.cpp と同じ役割の構成（違う構成のゲームは断るので、ゲームに合わせてオプションで変える）
+    const std::string base_model = "llama.cpp/models/Llama-3.1-8B-EZO-1.1-it.i1-Q4_K_M.gguf";
+    std::map<std::string, LlmRoleConfig> role_configs = {
+        {"GM", {base_model}},
+        {"NPC", {base_model}},
+        {"BATTLE", {base_model}}
+    };
+    // "<役割>=<値>" を分ける。役割が無い・知らない役割なら false
+    auto split_role = [&](const std::string& value, std::string& role, std::string& rest) {
+        size_t eq = value.find('=');
+        if (eq == std::string::npos) return false;
+        role = value.substr(0, eq);
+        rest = value.substr(eq + 1);
+        return role_configs.count(role) > 0 && !rest.empty();
+    };
+    bool semantic_cache = false;
+    bool valid = true;
+    for (int i = 1; i < argc && valid; ++i) {
+        std::string arg = argv[i];
+        std::string role, rest;
+        if (arg == "--name" && i + 1 < argc) name = argv[++i];
+        else if (arg == "--root" && i + 1 < argc) root = argv[++i];
+        else if (arg == "--model" && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (split_role(value, role, rest)) role_configs[role].model_path = rest;
+            else for (auto& pair : role_configs) pair.second.model_path = value;
+        } else if (arg == "--lora" && i + 1 < argc) {
+            valid = split_role(argv[++i], role, rest);
+            if (!valid) break;
+            LlmRoleConfig& config = role_configs[role];
+            size_t colon = rest.rfind(':');
+            char* end = nullptr;
+            float scale = colon == std::string::npos ? 0.0f : std::strtof(rest.c_str() + colon + 1, &end);
+            if (end && *end == '\0' && end != rest.c_str() + colon + 1) {
+                config.lora_path = rest.substr(0, colon);
+                config.lora_scale = scale;
+            } else {
+                config.lora_path = rest;
+            }
+        } else if (arg == "--compact-prompt" && i + 1 < argc) {
+            role = argv[++i];
+            valid = role_configs.count(role) > 0;
+            if (valid) role_configs[role].compact_prompt = true;
+        } else if (arg == "--semantic-cache") semantic_cache = true;
+        else valid = false;
+    }
+    if (!valid) {
+        std::cerr << "Usage: inference_worker [--name <name>] [--root <dir>] [--model [<role>=]<gguf>]... [--lora <role>=<gguf>[:<scale>]]...\n"
+                     "                        [--compact-prompt <role>]... [--semantic-cache]" << std::endl;
+        return 1;
+    }
+    if (!root.empty() && root.back() != '/') root += '/';
+    const LlmContextConfig context = LlmContextConfig::fromEnvironment();
+    std::map<std::string, std::string> summaries;
+    for (auto& pair : role_configs) {
+        pair.second.model_path = root + pair.second.model_path;
+        if (!pair.second.lora_path.empty()) pair.second.lora_path = root + pair.second.lora_path;
+        pair.second.context = context;
+        summaries[pair.first] = pair.second.summary();
+    }
+
+    LogConfig log_config;
+    log_config.path = "logs/inference_worker.log";
+    Log::start(log_config);
+    for (const auto& pair : summaries) PQ_LOG_INFO(LogCategory::LLM, "role " << pair.first << ": " << pair.second);
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    int exit_code = 0;
+    try {
+        LlmManager llm(role_configs, LlmThreadConfig::fromEnvironment());
+        llm.setModelBudget(size_t(10) * 1024 * 1024 * 1024);
+        if (semantic_cache && !llm.enableSemanticCache()) {
+            std::cerr << "Semantic cache disabled." << std::endl;
+        }
+        // 最初のゲームがつなぐ前に会話の役割を読み込んでおく
+        llm.prefetch("GM");
+        llm.prefetch("NPC");
+
+        ipc::SharedMemory shm;
+        if (!shm.create(name)) {
+            exit_code = 1;
+        } else {
+            InferenceWorker worker(llm, *shm.region(), summaries);
+            worker.run();
+        }
+    } catch (const std::exception& e) {
+        PQ_LOG_ERROR(LogCategory::LLM, "inference worker failed: " << e.what());
+        exit_code = 1;
+    }
+
+    Log::stop();
+    return exit_code;
+}